@@ -230,6 +230,7 @@ arprequest(struct ifnet *ifp, struct sockaddr *sa)
 int arpresolve(struct ifnet *ifp, struct rte_mbuf *m,
 	       in_addr_t addr, struct rte_ether_addr *desten)
 {
+	struct lltable *llt = ifp->if_lltable;
 	struct llentry *la;
 
 lookup:
@@ -243,8 +244,14 @@ resolved:
 		return 0;
 	}
 
-	/* Create if necessary */
+	/* Create if necessary, unless resolution is being throttled */
 	if (la == NULL) {
+		if (unlikely(rte_atomic16_read(&llt->lle_restoken) <= 0)) {
+			ARPSTAT_INC(if_vrfid(ifp), resthrot);
+			rte_pktmbuf_free(m);
+			return -ENOMEM;
+		}
+
 		la = in_lltable_lookup(ifp, LLE_CREATE|LLE_LOCAL, addr);
 
 		/* out of memory */
@@ -255,6 +262,8 @@ resolved:
 			return -ENOMEM;
 		}
 
+		rte_atomic16_dec(&llt->lle_restoken);
+
 		char b1[INET_ADDRSTRLEN];
 		ARP_DEBUG("new entry created for %s\n",
 			  inet_ntop(AF_INET, &addr, b1, sizeof(b1)));
@@ -282,16 +291,20 @@ resolved:
 	 * There is an arptab entry, but no ethernet address
 	 * response yet.  Add the mbuf to the list, dropping
 	 * the oldest packet if we have exceeded the system
-	 * setting.
+	 * setting, or this packet if no more can be held.
 	 */
-	if (la->la_numheld >= ARP_MAXHOLD) {
+	if (la->la_numheld < ARP_MAXHOLD && lltable_hold_get(llt))
+		la->la_held[la->la_numheld++] = m;
+	else if (la->la_numheld) {
 		ARPSTAT_INC(if_vrfid(ifp), dropped);
 		rte_pktmbuf_free(la->la_held[0]);
 		memmove(&la->la_held[0], &la->la_held[1],
-			(ARP_MAXHOLD-1) * sizeof(la->la_held[0]));
-		la->la_held[ARP_MAXHOLD-1] = m;
-	} else
-		la->la_held[la->la_numheld++] = m;
+			(la->la_numheld - 1) * sizeof(la->la_held[0]));
+		la->la_held[la->la_numheld - 1] = m;
+	} else {
+		ARPSTAT_INC(if_vrfid(ifp), dropped);
+		rte_pktmbuf_free(m);
+	}
 
 	/*
 	 * Only send first request here, others handled by timer.
@@ -312,15 +325,29 @@ resolved:
 	return -EWOULDBLOCK;
 }
 
-/* Optimized inline version of arpresolve. */
+/*
+ * Optimized inline version of arpresolve, trying the per-lcore
+ * neighbour cache before the lltable.
+ */
 ALWAYS_INLINE int
 arpresolve_fast(struct ifnet *ifp, struct rte_mbuf *m,
 		in_addr_t addr, struct rte_ether_addr *desten)
 {
-	struct llentry *la = in_lltable_find(ifp, addr);
+	struct lle_cache_entry *lc = lle_cache_slot(ifp, addr);
+	uint32_t gen = CMM_LOAD_SHARED(lle_cache_gen);
+	struct llentry *la;
 
-	if (llentry_copy_mac(la, desten))
+	if (likely(lle_cache_match(lc, ifp, addr, gen))) {
+		lle_cache_copy_mac(lc, desten);
 		return 0;
+	}
+
+	la = in_lltable_find(ifp, addr);
+	if (llentry_copy_mac(la, desten)) {
+		lc->lc_in = addr;
+		lle_cache_fill(lc, ifp, la, desten, gen);
+		return 0;
+	}
 
 	return arpresolve(ifp, m, addr, desten);
 }
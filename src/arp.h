@@ -42,6 +42,7 @@ struct arp_stats {
 	uint64_t garp_reqs_dropped; /* # of GARP requests dropped */
 	uint64_t garp_reps_dropped; /* # of GARP replies dropped */
 	uint64_t mpoolfail;	/* Memory pool limit hit */
+	uint64_t resthrot;	/* Resolutions throttled */
 };
 
 #define ARPSTAT_ADD(vrf_id, name, val)			\
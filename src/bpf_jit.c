@@ -0,0 +1,581 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Classic BPF to x86-64 compiler.
+ *
+ * Each BPF instruction is translated into a fixed sequence of machine
+ * instructions, using 32 bit relative offsets for all jumps, so the size
+ * of the code for an instruction never depends on where its jump targets
+ * end up.  That lets a first pass over the program work out where every
+ * instruction will be placed, and a second pass emit the code.
+ *
+ * The generated function follows the SysV calling convention:
+ *
+ *   rdi	packet data
+ *   esi	wirelen
+ *   edx	buflen, moved to r8d as div clobbers edx
+ *   eax	accumulator (A), and return value
+ *   r9d	index register (X)
+ *   r10, r11	scratch for bounds checks and constants
+ *   ecx	shift count
+ *
+ * All of these are caller-saved, and the function never calls anything,
+ * so the scratch memory words live in the red zone below the stack
+ * pointer rather than needing a frame.
+ *
+ * Loads from the packet are bounds checked against buflen exactly as
+ * bpf_filter() checks them, returning 0 when out of range.
+ */
+
+#include <errno.h>
+#include <rte_common.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bpf_jit.h"
+
+#if defined(__x86_64__)
+
+/* Offset of scratch memory word k from rsp, within the red zone */
+#define JIT_MEM_OFF(k)	((uint8_t)(-(int)(BPF_MEMWORDS * 4) + 4 * (k)))
+
+/* Condition codes, for jcc rel32 (0x0f 0x80 + cc) */
+#define JIT_CC_JB	0x2
+#define JIT_CC_JAE	0x3
+#define JIT_CC_JE	0x4
+#define JIT_CC_JNE	0x5
+#define JIT_CC_JBE	0x6
+#define JIT_CC_JA	0x7
+#define JIT_CC_INV(cc)	((cc) ^ 1)
+
+struct jit_ctx {
+	uint8_t *image;		/* NULL on the sizing pass */
+	unsigned int pos;	/* current offset into the image */
+	unsigned int *addrs;	/* image offset of each instruction */
+	unsigned int ret0;	/* image offset of the "return 0" exit */
+};
+
+static void jit_emit(struct jit_ctx *ctx, const uint8_t *bytes,
+		     unsigned int n)
+{
+	if (ctx->image)
+		memcpy(ctx->image + ctx->pos, bytes, n);
+	ctx->pos += n;
+}
+
+#define EMIT(ctx, ...)							\
+	jit_emit(ctx, (const uint8_t[]){ __VA_ARGS__ },		\
+		 sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+static void jit_emit_u32(struct jit_ctx *ctx, uint32_t v)
+{
+	EMIT(ctx, v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24);
+}
+
+/* jmp rel32 */
+static void jit_jmp(struct jit_ctx *ctx, unsigned int target)
+{
+	EMIT(ctx, 0xe9);
+	jit_emit_u32(ctx, target - (ctx->pos + 4));
+}
+
+/* jcc rel32 */
+static void jit_jcc(struct jit_ctx *ctx, uint8_t cc, unsigned int target)
+{
+	EMIT(ctx, 0x0f, 0x80 | cc);
+	jit_emit_u32(ctx, target - (ctx->pos + 4));
+}
+
+/*
+ * Load size bytes at rdi + r10 into eax, in host byte order, or for the
+ * MSH case load the byte into r9d.
+ */
+static void jit_ld_r10(struct jit_ctx *ctx, unsigned int size, bool msh)
+{
+	switch (size) {
+	case 4:
+		EMIT(ctx, 0x42, 0x8b, 0x04, 0x17);		/* mov eax,[rdi+r10] */
+		EMIT(ctx, 0x0f, 0xc8);				/* bswap eax */
+		break;
+	case 2:
+		EMIT(ctx, 0x42, 0x0f, 0xb7, 0x04, 0x17);	/* movzx eax,w[rdi+r10] */
+		EMIT(ctx, 0x66, 0xc1, 0xc0, 0x08);		/* rol ax,8 */
+		break;
+	default:
+		if (msh)
+			EMIT(ctx, 0x46, 0x0f, 0xb6, 0x0c, 0x17); /* movzx r9d,b[rdi+r10] */
+		else
+			EMIT(ctx, 0x42, 0x0f, 0xb6, 0x04, 0x17); /* movzx eax,b[rdi+r10] */
+		break;
+	}
+}
+
+/* As jit_ld_r10(), for rdi + k where k fits in a signed disp32 */
+static void jit_ld_disp(struct jit_ctx *ctx, unsigned int size, uint32_t k,
+			bool msh)
+{
+	switch (size) {
+	case 4:
+		EMIT(ctx, 0x8b, 0x87);				/* mov eax,[rdi+k] */
+		jit_emit_u32(ctx, k);
+		EMIT(ctx, 0x0f, 0xc8);				/* bswap eax */
+		break;
+	case 2:
+		EMIT(ctx, 0x0f, 0xb7, 0x87);			/* movzx eax,w[rdi+k] */
+		jit_emit_u32(ctx, k);
+		EMIT(ctx, 0x66, 0xc1, 0xc0, 0x08);		/* rol ax,8 */
+		break;
+	default:
+		if (msh)
+			EMIT(ctx, 0x44, 0x0f, 0xb6, 0x8f);	/* movzx r9d,b[rdi+k] */
+		else
+			EMIT(ctx, 0x0f, 0xb6, 0x87);		/* movzx eax,b[rdi+k] */
+		jit_emit_u32(ctx, k);
+		break;
+	}
+}
+
+/* Load from the constant offset k, returning 0 unless k + size <= buflen */
+static void jit_ld_abs(struct jit_ctx *ctx, unsigned int size, uint32_t k,
+		       bool msh)
+{
+	uint64_t end = (uint64_t)k + size;
+
+	if (end > UINT32_MAX) {
+		jit_jmp(ctx, ctx->ret0);
+		return;
+	}
+
+	EMIT(ctx, 0x41, 0x81, 0xf8);			/* cmp r8d,end */
+	jit_emit_u32(ctx, end);
+	jit_jcc(ctx, JIT_CC_JB, ctx->ret0);
+
+	if (k <= INT32_MAX) {
+		jit_ld_disp(ctx, size, k, msh);
+	} else {
+		EMIT(ctx, 0x41, 0xba);			/* mov r10d,k */
+		jit_emit_u32(ctx, k);
+		jit_ld_r10(ctx, size, msh);
+	}
+}
+
+/*
+ * Load from X + k, returning 0 unless X + k + size <= buflen.  The sum
+ * is done in 64 bits so it can't wrap.
+ */
+static void jit_ld_ind(struct jit_ctx *ctx, unsigned int size, uint32_t k)
+{
+	EMIT(ctx, 0x45, 0x89, 0xca);			/* mov r10d,r9d */
+	EMIT(ctx, 0x41, 0xbb);				/* mov r11d,k */
+	jit_emit_u32(ctx, k);
+	EMIT(ctx, 0x4d, 0x01, 0xda);			/* add r10,r11 */
+	EMIT(ctx, 0x4d, 0x8d, 0x5a, size);		/* lea r11,[r10+size] */
+	EMIT(ctx, 0x4d, 0x39, 0xc3);			/* cmp r11,r8 */
+	jit_jcc(ctx, JIT_CC_JA, ctx->ret0);
+	jit_ld_r10(ctx, size, false);
+}
+
+/* Conditional jump on the flags set by the preceding cmp or test */
+static void jit_jmp_cond(struct jit_ctx *ctx, unsigned int i,
+			 const struct bpf_insn *pc, uint8_t cc)
+{
+	unsigned int t_true = ctx->addrs[i + 1 + pc->jt];
+	unsigned int t_false = ctx->addrs[i + 1 + pc->jf];
+
+	if (pc->jt == 0) {
+		jit_jcc(ctx, JIT_CC_INV(cc), t_false);
+	} else {
+		jit_jcc(ctx, cc, t_true);
+		if (pc->jf != 0)
+			jit_jmp(ctx, t_false);
+	}
+}
+
+/* ALU ops with an eax,r9d or eax,imm32 form, indexed by BPF_OP() >> 4 */
+static const uint8_t jit_alu_x[16] = {
+	[BPF_ADD >> 4] = 0x01, [BPF_SUB >> 4] = 0x29,
+	[BPF_AND >> 4] = 0x21, [BPF_OR >> 4] = 0x09,
+	[BPF_XOR >> 4] = 0x31,
+};
+
+static const uint8_t jit_alu_k[16] = {
+	[BPF_ADD >> 4] = 0x05, [BPF_SUB >> 4] = 0x2d,
+	[BPF_AND >> 4] = 0x25, [BPF_OR >> 4] = 0x0d,
+	[BPF_XOR >> 4] = 0x35,
+};
+
+static int jit_insn(struct jit_ctx *ctx, const struct bpf_insn *insns,
+		    unsigned int i)
+{
+	const struct bpf_insn *pc = &insns[i];
+	uint32_t k = pc->k;
+
+	switch (pc->code) {
+	case BPF_RET|BPF_K:
+		EMIT(ctx, 0xb8);				/* mov eax,k */
+		jit_emit_u32(ctx, k);
+		EMIT(ctx, 0xc3);				/* ret */
+		break;
+
+	case BPF_RET|BPF_A:
+		EMIT(ctx, 0xc3);				/* ret */
+		break;
+
+	case BPF_LD|BPF_W|BPF_ABS:
+		jit_ld_abs(ctx, 4, k, false);
+		break;
+
+	case BPF_LD|BPF_H|BPF_ABS:
+		jit_ld_abs(ctx, 2, k, false);
+		break;
+
+	case BPF_LD|BPF_B|BPF_ABS:
+		jit_ld_abs(ctx, 1, k, false);
+		break;
+
+	case BPF_LD|BPF_W|BPF_IND:
+		jit_ld_ind(ctx, 4, k);
+		break;
+
+	case BPF_LD|BPF_H|BPF_IND:
+		jit_ld_ind(ctx, 2, k);
+		break;
+
+	case BPF_LD|BPF_B|BPF_IND:
+		jit_ld_ind(ctx, 1, k);
+		break;
+
+	case BPF_LDX|BPF_MSH|BPF_B:
+		jit_ld_abs(ctx, 1, k, true);
+		EMIT(ctx, 0x41, 0x83, 0xe1, 0x0f);		/* and r9d,0xf */
+		EMIT(ctx, 0x41, 0xc1, 0xe1, 0x02);		/* shl r9d,2 */
+		break;
+
+	case BPF_LD|BPF_W|BPF_LEN:
+		EMIT(ctx, 0x89, 0xf0);				/* mov eax,esi */
+		break;
+
+	case BPF_LDX|BPF_W|BPF_LEN:
+		EMIT(ctx, 0x41, 0x89, 0xf1);			/* mov r9d,esi */
+		break;
+
+	case BPF_LD|BPF_IMM:
+		EMIT(ctx, 0xb8);				/* mov eax,k */
+		jit_emit_u32(ctx, k);
+		break;
+
+	case BPF_LDX|BPF_IMM:
+		EMIT(ctx, 0x41, 0xb9);				/* mov r9d,k */
+		jit_emit_u32(ctx, k);
+		break;
+
+	case BPF_LD|BPF_MEM:
+		if (k >= BPF_MEMWORDS)
+			return -EINVAL;
+		EMIT(ctx, 0x8b, 0x44, 0x24, JIT_MEM_OFF(k));	/* mov eax,[rsp-] */
+		break;
+
+	case BPF_LDX|BPF_MEM:
+		if (k >= BPF_MEMWORDS)
+			return -EINVAL;
+		EMIT(ctx, 0x44, 0x8b, 0x4c, 0x24, JIT_MEM_OFF(k)); /* mov r9d,[rsp-] */
+		break;
+
+	case BPF_ST:
+		if (k >= BPF_MEMWORDS)
+			return -EINVAL;
+		EMIT(ctx, 0x89, 0x44, 0x24, JIT_MEM_OFF(k));	/* mov [rsp-],eax */
+		break;
+
+	case BPF_STX:
+		if (k >= BPF_MEMWORDS)
+			return -EINVAL;
+		EMIT(ctx, 0x44, 0x89, 0x4c, 0x24, JIT_MEM_OFF(k)); /* mov [rsp-],r9d */
+		break;
+
+	case BPF_JMP|BPF_JA:
+		if (k != 0)
+			jit_jmp(ctx, ctx->addrs[i + 1 + k]);
+		break;
+
+	case BPF_JMP|BPF_JGT|BPF_K:
+	case BPF_JMP|BPF_JGE|BPF_K:
+	case BPF_JMP|BPF_JEQ|BPF_K:
+	case BPF_JMP|BPF_JSET|BPF_K:
+	case BPF_JMP|BPF_JGT|BPF_X:
+	case BPF_JMP|BPF_JGE|BPF_X:
+	case BPF_JMP|BPF_JEQ|BPF_X:
+	case BPF_JMP|BPF_JSET|BPF_X: {
+		uint8_t cc;
+
+		if (pc->jt == pc->jf) {
+			if (pc->jt != 0)
+				jit_jmp(ctx, ctx->addrs[i + 1 + pc->jt]);
+			break;
+		}
+
+		if (BPF_OP(pc->code) == BPF_JSET) {
+			if (BPF_SRC(pc->code) == BPF_X) {
+				EMIT(ctx, 0x44, 0x85, 0xc8);	/* test eax,r9d */
+			} else {
+				EMIT(ctx, 0xa9);		/* test eax,k */
+				jit_emit_u32(ctx, k);
+			}
+			cc = JIT_CC_JNE;
+		} else {
+			if (BPF_SRC(pc->code) == BPF_X) {
+				EMIT(ctx, 0x44, 0x39, 0xc8);	/* cmp eax,r9d */
+			} else {
+				EMIT(ctx, 0x3d);		/* cmp eax,k */
+				jit_emit_u32(ctx, k);
+			}
+			if (BPF_OP(pc->code) == BPF_JGT)
+				cc = JIT_CC_JA;
+			else if (BPF_OP(pc->code) == BPF_JGE)
+				cc = JIT_CC_JAE;
+			else
+				cc = JIT_CC_JE;
+		}
+		jit_jmp_cond(ctx, i, pc, cc);
+		break;
+	}
+
+	case BPF_ALU|BPF_ADD|BPF_X:
+	case BPF_ALU|BPF_SUB|BPF_X:
+	case BPF_ALU|BPF_AND|BPF_X:
+	case BPF_ALU|BPF_OR|BPF_X:
+	case BPF_ALU|BPF_XOR|BPF_X:
+		/* op eax,r9d */
+		EMIT(ctx, 0x44, jit_alu_x[BPF_OP(pc->code) >> 4], 0xc8);
+		break;
+
+	case BPF_ALU|BPF_ADD|BPF_K:
+	case BPF_ALU|BPF_SUB|BPF_K:
+	case BPF_ALU|BPF_AND|BPF_K:
+	case BPF_ALU|BPF_OR|BPF_K:
+	case BPF_ALU|BPF_XOR|BPF_K:
+		/* op eax,k */
+		EMIT(ctx, jit_alu_k[BPF_OP(pc->code) >> 4]);
+		jit_emit_u32(ctx, k);
+		break;
+
+	case BPF_ALU|BPF_MUL|BPF_X:
+		EMIT(ctx, 0x41, 0x0f, 0xaf, 0xc1);		/* imul eax,r9d */
+		break;
+
+	case BPF_ALU|BPF_MUL|BPF_K:
+		EMIT(ctx, 0x69, 0xc0);				/* imul eax,eax,k */
+		jit_emit_u32(ctx, k);
+		break;
+
+	case BPF_ALU|BPF_DIV|BPF_X:
+	case BPF_ALU|BPF_MOD|BPF_X:
+		EMIT(ctx, 0x45, 0x85, 0xc9);			/* test r9d,r9d */
+		jit_jcc(ctx, JIT_CC_JE, ctx->ret0);
+		EMIT(ctx, 0x31, 0xd2);				/* xor edx,edx */
+		EMIT(ctx, 0x41, 0xf7, 0xf1);			/* div r9d */
+		if (BPF_OP(pc->code) == BPF_MOD)
+			EMIT(ctx, 0x89, 0xd0);			/* mov eax,edx */
+		break;
+
+	case BPF_ALU|BPF_DIV|BPF_K:
+	case BPF_ALU|BPF_MOD|BPF_K:
+		if (k == 0)
+			return -EINVAL;
+		EMIT(ctx, 0x41, 0xba);				/* mov r10d,k */
+		jit_emit_u32(ctx, k);
+		EMIT(ctx, 0x31, 0xd2);				/* xor edx,edx */
+		EMIT(ctx, 0x41, 0xf7, 0xf2);			/* div r10d */
+		if (BPF_OP(pc->code) == BPF_MOD)
+			EMIT(ctx, 0x89, 0xd0);			/* mov eax,edx */
+		break;
+
+	/*
+	 * The interpreter shifts by a variable count, which x86 masks to
+	 * 5 bits, so do the same for constant counts.
+	 */
+	case BPF_ALU|BPF_LSH|BPF_K:
+		EMIT(ctx, 0xc1, 0xe0, k & 0x1f);		/* shl eax,k */
+		break;
+
+	case BPF_ALU|BPF_RSH|BPF_K:
+		EMIT(ctx, 0xc1, 0xe8, k & 0x1f);		/* shr eax,k */
+		break;
+
+	case BPF_ALU|BPF_LSH|BPF_X:
+		EMIT(ctx, 0x44, 0x89, 0xc9);			/* mov ecx,r9d */
+		EMIT(ctx, 0xd3, 0xe0);				/* shl eax,cl */
+		break;
+
+	case BPF_ALU|BPF_RSH|BPF_X:
+		EMIT(ctx, 0x44, 0x89, 0xc9);			/* mov ecx,r9d */
+		EMIT(ctx, 0xd3, 0xe8);				/* shr eax,cl */
+		break;
+
+	case BPF_ALU|BPF_NEG:
+		EMIT(ctx, 0xf7, 0xd8);				/* neg eax */
+		break;
+
+	case BPF_MISC|BPF_TAX:
+		EMIT(ctx, 0x41, 0x89, 0xc1);			/* mov r9d,eax */
+		break;
+
+	case BPF_MISC|BPF_TXA:
+		EMIT(ctx, 0x44, 0x89, 0xc8);			/* mov eax,r9d */
+		break;
+
+	default:
+		return -ENOTSUP;
+	}
+
+	return 0;
+}
+
+static bool jit_uses_mem(const struct bpf_insn *insns, u_int len)
+{
+	u_int i;
+
+	for (i = 0; i < len; i++)
+		if (insns[i].code == BPF_ST || insns[i].code == BPF_STX ||
+		    insns[i].code == (BPF_LD|BPF_MEM) ||
+		    insns[i].code == (BPF_LDX|BPF_MEM))
+			return true;
+	return false;
+}
+
+static int jit_pass(struct jit_ctx *ctx, const struct bpf_insn *insns,
+		    u_int len, bool zero_mem)
+{
+	unsigned int i;
+	int rc;
+
+	ctx->pos = 0;
+
+	EMIT(ctx, 0x31, 0xc0);					/* xor eax,eax */
+	EMIT(ctx, 0x45, 0x31, 0xc9);				/* xor r9d,r9d */
+	EMIT(ctx, 0x41, 0x89, 0xd0);				/* mov r8d,edx */
+
+	/* The interpreter starts with all memory words zeroed */
+	if (zero_mem)
+		for (i = 0; i < BPF_MEMWORDS; i += 2) {
+			/* mov qword [rsp-],0 */
+			EMIT(ctx, 0x48, 0xc7, 0x44, 0x24, JIT_MEM_OFF(i));
+			jit_emit_u32(ctx, 0);
+		}
+
+	for (i = 0; i < len; i++) {
+		if (ctx->image && ctx->addrs[i] != ctx->pos)
+			return -EFAULT;
+		ctx->addrs[i] = ctx->pos;
+
+		rc = jit_insn(ctx, insns, i);
+		if (rc < 0)
+			return rc;
+	}
+
+	ctx->ret0 = ctx->pos;
+	EMIT(ctx, 0x31, 0xc0);					/* xor eax,eax */
+	EMIT(ctx, 0xc3);					/* ret */
+
+	return 0;
+}
+
+/* Jumps must stay within the program, and it must end in a return */
+static bool jit_check(const struct bpf_insn *insns, u_int len)
+{
+	u_int i;
+
+	for (i = 0; i < len; i++) {
+		const struct bpf_insn *pc = &insns[i];
+
+		if (BPF_CLASS(pc->code) != BPF_JMP)
+			continue;
+		if (pc->code == (BPF_JMP|BPF_JA)) {
+			if (pc->k >= len - i - 1)
+				return false;
+		} else if (pc->jt >= len - i - 1 || pc->jf >= len - i - 1) {
+			return false;
+		}
+	}
+	return BPF_CLASS(insns[len - 1].code) == BPF_RET;
+}
+
+int bpf_jit_compile(const struct bpf_insn *insns, u_int len,
+		    struct bpf_jit *jit)
+{
+	struct jit_ctx ctx = { .image = NULL };
+	long page_sz = sysconf(_SC_PAGESIZE);
+	bool zero_mem;
+	size_t size;
+	void *image;
+	int rc;
+
+	jit->func = NULL;
+	jit->size = 0;
+
+	if (len == 0 || !jit_check(insns, len))
+		return -EINVAL;
+
+	ctx.addrs = calloc(len, sizeof(*ctx.addrs));
+	if (!ctx.addrs)
+		return -ENOMEM;
+
+	/* Sizing pass, to find where each instruction goes */
+	zero_mem = jit_uses_mem(insns, len);
+	rc = jit_pass(&ctx, insns, len, zero_mem);
+	if (rc < 0)
+		goto out;
+
+	size = (ctx.pos + page_sz - 1) & ~(page_sz - 1);
+	image = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (image == MAP_FAILED) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	ctx.image = image;
+	rc = jit_pass(&ctx, insns, len, zero_mem);
+	if (rc == 0 && mprotect(image, size, PROT_READ | PROT_EXEC) < 0)
+		rc = -errno;
+	if (rc < 0) {
+		munmap(image, size);
+		goto out;
+	}
+
+	jit->func = (bpf_jit_func_t)image;
+	jit->size = size;
+ out:
+	free(ctx.addrs);
+	return rc;
+}
+
+void bpf_jit_free(struct bpf_jit *jit)
+{
+	if (jit->func)
+		munmap((void *)jit->func, jit->size);
+	jit->func = NULL;
+	jit->size = 0;
+}
+
+#else /* !__x86_64__ */
+
+int bpf_jit_compile(const struct bpf_insn *insns __unused, u_int len __unused,
+		    struct bpf_jit *jit)
+{
+	jit->func = NULL;
+	jit->size = 0;
+	return -ENOTSUP;
+}
+
+void bpf_jit_free(struct bpf_jit *jit __unused)
+{
+}
+
+#endif /* __x86_64__ */
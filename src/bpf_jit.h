@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Compile classic BPF filter programs into native code.
+ */
+
+#ifndef BPF_JIT_H
+#define BPF_JIT_H
+
+#include <pcap/bpf.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * A compiled filter takes the same arguments, and returns the same
+ * result, as bpf_filter() does for the program it was compiled from.
+ */
+typedef u_int (*bpf_jit_func_t)(const u_char *p, u_int wirelen,
+				u_int buflen);
+
+struct bpf_jit {
+	bpf_jit_func_t func;	/* NULL if not compiled */
+	size_t size;		/* size of the executable mapping */
+};
+
+/*
+ * Compile a program that has already passed bpf_validate().  Returns 0
+ * on success, or a negative errno if the program can't be compiled on
+ * this architecture, in which case the caller should use bpf_filter().
+ */
+int bpf_jit_compile(const struct bpf_insn *insns, u_int len,
+		    struct bpf_jit *jit);
+void bpf_jit_free(struct bpf_jit *jit);
+
+/* Run the compiled program if there is one, otherwise interpret it */
+static inline u_int bpf_jit_filter(const struct bpf_jit *jit,
+				   const struct bpf_insn *insns,
+				   const u_char *p, u_int wirelen,
+				   u_int buflen)
+{
+	if (jit->func)
+		return jit->func(p, wirelen, buflen);
+
+	return bpf_filter(insns, p, wirelen, buflen);
+}
+
+#endif /* BPF_JIT_H */
@@ -34,6 +34,7 @@
 #include <zmq.h>
 
 #include "capture.h"
+#include "capture_chunk.h"
 #include "config_internal.h"
 #include "event.h"
 #include "fal.h"
@@ -51,8 +52,8 @@
 /* Assume that only some ports are doing capture at once. */
 #define CAPTURE_MAX_PORTS	8
 #define CAP_PKT_BURST		4
+#define CAP_DEQ_BURST		32
 #define CAPTURE_RING_SZ		256
-#define CAP_MAX_PER_PORT        4 /* max simultaneous captures on a port */
 #define CAPTURE_TIME_RESYNC_USECS (60 * USEC_PER_SEC)
 
 static struct rte_mempool *capture_pool;
@@ -69,6 +70,8 @@ static pthread_mutex_t capture_sock_lock = PTHREAD_MUTEX_INITIALIZER;
 typedef int (*fal_func_t)(void *arg);
 
 static int capture_master_send(fal_func_t func, void *arg);
+static struct capture_chunk *
+capture_chunk_cur(struct capture_info *cap_info, unsigned int slot);
 
 static void capture_time_resync(struct timeval *tod, uint64_t *base,
 				uint64_t *hz)
@@ -111,6 +114,15 @@ static bool capture_stop(struct ifnet *ifp,
 	if (cap_info->capture_mask == 0)
 		return true;
 
+	/* Don't give what is left to whoever next uses the slot */
+	if (cap_info->is_pcapng) {
+		struct capture_chunk *chunk =
+			capture_chunk_cur(cap_info, rte_bsf32(slot));
+
+		chunk->cc_len = 0;
+		chunk->cc_pkts = 0;
+	}
+
 	TAILQ_FOREACH(cap_filter, &cap_info->filters, next) {
 		if (!(cap_filter->mask & slot))
 			continue;
@@ -120,6 +132,7 @@ static bool capture_stop(struct ifnet *ifp,
 			continue;
 
 		TAILQ_REMOVE(&cap_info->filters, cap_filter, next);
+		bpf_jit_free(&cap_filter->jit);
 		rte_free(cap_filter->filter.bf_insns);
 		rte_free(cap_filter);
 		break;
@@ -170,6 +183,12 @@ static int cap_filter_install(struct ifnet *ifp, uint8_t slotmask,
 		cap_filter->filter.bf_len = len;
 		cap_filter->mask = slotmask;
 
+		/* Fall back to the interpreter if the filter can't be compiled */
+		if (bpf_jit_compile(bf_insns, len, &cap_filter->jit) < 0)
+			RTE_LOG(DEBUG, DATAPLANE,
+				"capture filter on %s not compiled\n",
+				ifp->if_name);
+
 		TAILQ_INSERT_TAIL(&cap_info->filters, cap_filter, next);
 	}
 	return 0;
@@ -342,16 +361,16 @@ static void capture_wakeup(struct capture_info *cap_info)
 			strerror(errno));
 }
 
-/* Make a copy of the packet mbufs */
+/* Make a snaplen copy of the packet mbufs */
 static int capture_mbuf_copy(struct rte_mbuf *mbi[], struct rte_mbuf *mbo[],
-			     unsigned int n)
+			     unsigned int n, unsigned int snaplen)
 {
 	uint64_t ts = rte_get_timer_cycles();
 	struct rte_mbuf *m;
 	unsigned int i, j;
 
 	for (i = 0; i < n; i++) {
-		m = pktmbuf_copy(mbi[i], capture_pool);
+		m = capture_snap_copy(capture_pool, mbi[i], snaplen);
 		if (!m)
 			goto nomem;
 
@@ -377,6 +396,8 @@ static int capture_enqueue(struct capture_info *cap_info,
 				       (void **)pkts, n, NULL);
 	if (likely(ret > 0))
 		capture_wakeup(cap_info);
+	else
+		capture_drop(cap_info, n);
 
 	return ret;
 }
@@ -388,6 +409,7 @@ static int capture_enqueue(struct capture_info *cap_info,
 void capture_hardware(const struct ifnet *ifp, struct rte_mbuf *mbuf)
 {
 	mbuf->udata64 = rte_get_timer_cycles();
+	CAPTURE_WIRE_LEN(mbuf) = rte_pktmbuf_pkt_len(mbuf);
 
 	if (unlikely(!ifp->hw_capturing) ||
 	    (unlikely(capture_enqueue(ifp->cap_info, &mbuf, 1) == 0)))
@@ -398,13 +420,23 @@ void capture_hardware(const struct ifnet *ifp, struct rte_mbuf *mbuf)
 void capture_burst(const struct ifnet *ifp,
 		   struct rte_mbuf *pkts[], unsigned int n)
 {
+	struct capture_info *cap_info = ifp->cap_info;
 	struct rte_mbuf *snap[n];
 
 	/* may be called with no packets on transmit with bonding interfaces */
-	if (n == 0 || capture_mbuf_copy(pkts, snap, n) < 0)
+	if (n == 0)
+		return;
+
+	/* No point in copying packets that can't be queued */
+	if (unlikely(rte_ring_free_count(cap_info->cap_ring) < n)) {
+		capture_drop(cap_info, n);
+		return;
+	}
+
+	if (capture_mbuf_copy(pkts, snap, n, cap_info->snaplen) < 0)
 		return;
 
-	if (unlikely(capture_enqueue(ifp->cap_info, snap, n) == 0))
+	if (unlikely(capture_enqueue(cap_info, snap, n) == 0))
 		pktmbuf_free_bulk(snap, n);
 }
 
@@ -419,6 +451,156 @@ static int addmsg_if_space(zmsg_t *msg, const void *ptr,
 	return space - addlen;
 }
 
+/*
+ * Chunked captures.  Each slot has a ring of CAPTURE_CHUNKS pcapng chunks.
+ * The capture thread fills the current chunk of each slot the packet
+ * passed the filters for, and sends a chunk as a whole when it is full or
+ * the capture ring has been drained.  The chunk is handed to zmq without
+ * copying, and is reused once zmq frees it, so the capture thread can
+ * fill the next chunks while the earlier ones are being sent.  A packet
+ * for a slot whose chunks are all still being sent is counted as a drop.
+ *
+ * Each message is the slot mask, as for per-packet captures, and then the
+ * chunk.
+ */
+static struct capture_chunk *
+capture_chunk_cur(struct capture_info *cap_info, unsigned int slot)
+{
+	return &cap_info->chunks[slot * CAPTURE_CHUNKS +
+				 cap_info->chunk_cur[slot]];
+}
+
+/* The chunk to add packets to, or NULL if all are still being sent */
+static struct capture_chunk *
+capture_chunk_get(struct capture_info *cap_info, unsigned int slot)
+{
+	struct capture_chunk *chunk = capture_chunk_cur(cap_info, slot);
+
+	if (rte_atomic32_read(&chunk->cc_busy))
+		return NULL;
+
+	if (!chunk->cc_len)
+		capture_chunk_start(chunk, cap_info->snaplen);
+	return chunk;
+}
+
+/* Called by zmq once it has finished with a chunk */
+static void capture_chunk_free(void *data __unused, void *hint)
+{
+	struct capture_chunk *chunk = hint;
+
+	rte_atomic32_clear(&chunk->cc_busy);
+}
+
+/* Send the current chunk of a slot, if it has packets, and move on */
+static int capture_chunk_send(struct capture_info *cap_info,
+			      unsigned int slot)
+{
+	struct capture_chunk *chunk = capture_chunk_cur(cap_info, slot);
+	void *pub = zsock_resolve(cap_info->cap_pub);
+	uint8_t mask = 1 << slot;
+	zmq_msg_t msg;
+
+	if (rte_atomic32_read(&chunk->cc_busy) || !chunk->cc_pkts)
+		return 0;
+
+	rte_atomic32_set(&chunk->cc_busy, 1);
+	if (zmq_msg_init_data(&msg, chunk->cc_buf, chunk->cc_len,
+			      capture_chunk_free, chunk) < 0) {
+		rte_atomic32_clear(&chunk->cc_busy);
+		return -1;
+	}
+
+	chunk->cc_len = 0;
+	chunk->cc_pkts = 0;
+	cap_info->chunk_cur[slot] = (cap_info->chunk_cur[slot] + 1) %
+		CAPTURE_CHUNKS;
+
+	if (zmq_send(pub, &mask, sizeof(mask), ZMQ_SNDMORE) < 0 ||
+	    zmq_msg_send(&msg, pub, 0) < 0) {
+		zmq_msg_close(&msg);
+		return -1;
+	}
+	return 0;
+}
+
+/* Send whatever each active slot has, e.g. once the ring is empty */
+static int capture_chunks_flush(struct capture_info *cap_info)
+{
+	unsigned int i;
+
+	for (i = 0; i < CAP_MAX_PER_PORT; i++)
+		if (cap_info->capture_mask & (1 << i) &&
+		    capture_chunk_send(cap_info, i) < 0)
+			return -1;
+	return 0;
+}
+
+/*
+ * Wait for zmq to give back the chunks that are still being sent, once the
+ * pub socket has been destroyed.  Leak them rather than free memory that
+ * zmq may yet read.
+ */
+static void capture_chunks_free(struct capture_info *cap_info)
+{
+	unsigned int i, tries = 0;
+
+	if (!cap_info->chunks)
+		return;
+
+	for (i = 0; i < CAP_MAX_PER_PORT * CAPTURE_CHUNKS; i++) {
+		while (rte_atomic32_read(&cap_info->chunks[i].cc_busy)) {
+			if (++tries > 1000) {
+				RTE_LOG(ERR, DATAPLANE,
+					"capture chunks still being sent\n");
+				cap_info->chunks = NULL;
+				return;
+			}
+			usleep(1000);
+		}
+	}
+
+	rte_free(cap_info->chunks);
+	cap_info->chunks = NULL;
+}
+
+static int capture_write_chunks(struct capture_info *cap_info,
+				const struct ifnet *ifp,
+				const struct rte_mbuf *m,
+				const struct timeval *ts, uint8_t mask)
+{
+	struct capture_chunk *chunk;
+	uint16_t tpid = 0;
+	unsigned int i;
+
+	if (m->ol_flags & (PKT_TX_VLAN_PKT|PKT_RX_VLAN))
+		tpid = if_tpid(ifp);
+
+	for (i = 0; i < CAP_MAX_PER_PORT; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+
+		chunk = capture_chunk_get(cap_info, i);
+		if (chunk && !capture_chunk_add(chunk, m, ts,
+						CAPTURE_WIRE_LEN(m),
+						cap_info->snaplen, tpid)) {
+			if (capture_chunk_send(cap_info, i) < 0)
+				return -1;
+
+			chunk = capture_chunk_get(cap_info, i);
+			if (chunk && !capture_chunk_add(chunk, m, ts,
+							CAPTURE_WIRE_LEN(m),
+							cap_info->snaplen,
+							tpid))
+				chunk = NULL;
+		}
+
+		if (!chunk)
+			rte_atomic64_inc(&cap_info->drops[i]);
+	}
+	return 0;
+}
+
 /* Filter packets and send to captures via zmq */
 static int capture_write(struct rte_mbuf *m, struct ifnet *ifp)
 {
@@ -430,22 +612,25 @@ static int capture_write(struct rte_mbuf *m, struct ifnet *ifp)
 	unsigned int space = cap_info->snaplen;
 
 	capture_get_timestamp(m, &pcap.ts);
-	pcap.len = rte_pktmbuf_pkt_len(m);
-	if (pcap.len < cap_info->snaplen)
-		pcap.caplen = pcap.len;
-	else
-		pcap.caplen = cap_info->snaplen;
+	pcap.len = CAPTURE_WIRE_LEN(m);
+	pcap.caplen = RTE_MIN(rte_pktmbuf_pkt_len(m), cap_info->snaplen);
 
+	/* The filter can only look at the contiguous first segment */
 	TAILQ_FOREACH(cap_filter, &cap_info->filters, next) {
-		if (!bpf_filter(cap_filter->filter.bf_insns,
-			       (const u_char *) rte_pktmbuf_mtod(m, char *),
-			       pcap.len, pcap.caplen))
+		if (!bpf_jit_filter(&cap_filter->jit,
+				    cap_filter->filter.bf_insns,
+				    rte_pktmbuf_mtod(m, const u_char *),
+				    pcap.len, rte_pktmbuf_data_len(m)))
 			filtered_mask &= ~cap_filter->mask;
 	}
 
 	if (!filtered_mask)
 		return 0;
 
+	if (cap_info->is_pcapng)
+		return capture_write_chunks(cap_info, ifp, m, &pcap.ts,
+					    filtered_mask);
+
 	msg = zmsg_new();
 
 	if (!msg)
@@ -585,6 +770,7 @@ static void capture_cleanup(void *arg)
 	close(cap_info->cap_wake);
 	zsock_destroy(&cap_info->cap_pub);
 	zsock_destroy(&cap_info->cap_pcapin);
+	capture_chunks_free(cap_info);
 
 	for (cap_filter = TAILQ_FIRST(&cap_info->filters);
 	     cap_filter;
@@ -592,6 +778,7 @@ static void capture_cleanup(void *arg)
 
 		next_filter = TAILQ_NEXT(cap_filter, next);
 		TAILQ_REMOVE(&cap_info->filters, cap_filter, next);
+		bpf_jit_free(&cap_filter->jit);
 		rte_free(cap_filter->filter.bf_insns);
 		rte_free(cap_filter);
 	}
@@ -615,8 +802,9 @@ static void capture_cleanup(void *arg)
 static void capture_loop(struct ifnet *ifp)
 {
 	struct capture_info *cap_info = ifp->cap_info;
-	struct rte_mbuf *m;
+	struct rte_mbuf *pkts[CAP_DEQ_BURST];
 	struct timespec now;
+	unsigned int i, n;
 	uint loops;
 	zmq_pollitem_t items[] = {
 		{ .fd = cap_info->cap_wake,
@@ -639,13 +827,16 @@ static void capture_loop(struct ifnet *ifp)
 			return;
 
 		loops = 0;
-		while (rte_ring_sc_dequeue(cap_info->cap_ring,
-					   (void **) &m) == 0) {
-			int ret;
+		while ((n = rte_ring_sc_dequeue_burst(cap_info->cap_ring,
+						      (void **)pkts,
+						      CAP_DEQ_BURST,
+						      NULL)) != 0) {
+			int ret = 0;
 
-			ret = capture_write(m, ifp);
+			for (i = 0; i < n && ret >= 0; i++)
+				ret = capture_write(pkts[i], ifp);
 
-			rte_pktmbuf_free(m);
+			pktmbuf_free_bulk(pkts, n);
 
 			if (ret < 0)
 				return;
@@ -656,6 +847,9 @@ static void capture_loop(struct ifnet *ifp)
 			}
 		}
 
+		if (cap_info->is_pcapng && capture_chunks_flush(cap_info) < 0)
+			return;
+
 		/*
 		 * Ring is empty or we looped MAX times, wait for new packets.
 		 * Timeout at 10s to make sure we check for heartbeats.
@@ -820,7 +1014,8 @@ static bool capture_hw_start(FILE *f, const struct ifnet *ifp,
 static struct capture_info *capture_new(FILE *f, const char *addrstr,
 					struct ifnet *ifp,
 					bool is_promisc, unsigned int snaplen,
-					bool swonly, unsigned int bandwidth)
+					bool swonly, unsigned int bandwidth,
+					bool pcapng)
 {
 	struct capture_info *cap_info;
 	int cap_pub_port, cap_pcapin_port;
@@ -837,6 +1032,22 @@ static struct capture_info *capture_new(FILE *f, const char *addrstr,
 	cap_info->snaplen = snaplen;
 	cap_info->is_swonly = swonly;
 	cap_info->bandwidth = bandwidth;
+	cap_info->is_pcapng = pcapng;
+
+	if (pcapng) {
+		cap_info->snaplen = RTE_MIN(snaplen,
+					    CAPTURE_CHUNK_SNAPLEN_MAX);
+		cap_info->chunks = rte_zmalloc_socket("capture chunks",
+						      CAP_MAX_PER_PORT *
+						      CAPTURE_CHUNKS *
+						      sizeof(struct capture_chunk),
+						      RTE_CACHE_LINE_SIZE,
+						      ifp->if_socket);
+		if (!cap_info->chunks) {
+			fprintf(f, "capture_start: chunks create failed");
+			goto cleanup_fail;
+		}
+	}
 
 	snprintf(rname, RTE_RING_NAMESIZE, "capture_%s", ifp->if_name);
 	cap_info->cap_ring = rte_ring_create(rname, CAPTURE_RING_SZ,
@@ -903,6 +1114,7 @@ static struct capture_info *capture_new(FILE *f, const char *addrstr,
  cleanup_ring_fail:
 	rte_ring_free(cap_info->cap_ring);
  cleanup_fail:
+	rte_free(cap_info->chunks);
 	rte_free(cap_info);
  fail:
 	return NULL;
@@ -913,7 +1125,7 @@ static struct capture_info *capture_new(FILE *f, const char *addrstr,
  */
 static int capture_start(FILE *f, struct ifnet *ifp,
 			 bool is_promisc, unsigned int snaplen,
-			 bool swonly, unsigned int bandwidth)
+			 bool swonly, unsigned int bandwidth, bool pcapng)
 {
 	struct capture_info *cap_info = ifp->cap_info;
 	char addrstr[INET6_ADDRSTRLEN];
@@ -929,7 +1141,7 @@ static int capture_start(FILE *f, struct ifnet *ifp,
 	if (cap_info == NULL) {
 		cap_info = capture_new(f, addrstr,
 				       ifp, is_promisc, snaplen,
-				       swonly, bandwidth);
+				       swonly, bandwidth, pcapng);
 		if (cap_info == NULL)
 			return -1;
 
@@ -943,10 +1155,16 @@ static int capture_start(FILE *f, struct ifnet *ifp,
 			capture_hw_stop(ifp, cap_info);
 			ifp->cap_info = NULL;
 			rte_ring_free(cap_info->cap_ring);
+			rte_free(cap_info->chunks);
 			rte_free(cap_info);
 			return -1;
 		}
 		pthread_setname_np(cap_info->cap_thread, "dataplane/cap");
+	} else if (cap_info->is_pcapng != pcapng) {
+		/* The capture thread sends one format for every slot */
+		fprintf(f, "capture_start: %s capture already running",
+			cap_info->is_pcapng ? "pcapng" : "pcap");
+		return -1;
 	}
 
 	/* Find a free slot */
@@ -955,6 +1173,7 @@ static int capture_start(FILE *f, struct ifnet *ifp,
 
 		if (cap_info->capture_mask & slot)
 			continue;
+		rte_atomic64_clear(&cap_info->drops[i]);
 		cap_info->capture_mask |= slot;
 		cap_slot = slot;
 		break;
@@ -996,6 +1215,8 @@ capture_show(FILE *f, const struct ifnet *ifp)
 		jsonw_bool_field(wr, "hw-capture", ifp->hw_capturing);
 		jsonw_bool_field(wr, "software-only", cap_info->is_swonly);
 		jsonw_uint_field(wr, "bandwidth", cap_info->bandwidth);
+		jsonw_bool_field(wr, "pcapng", cap_info->is_pcapng);
+		capture_drops_jsonw(wr, cap_info);
 	}
 	jsonw_end_object(wr);
 	jsonw_destroy(&wr);
@@ -1006,7 +1227,11 @@ capture_show(FILE *f, const struct ifnet *ifp)
  * Handler for capture command.
  *
  * capture start <interface> <is_promisc> <snaplen> <swonly> <bandwidth>
+ *               [pcapng]
  * capture show  <interface>
+ *
+ * With pcapng, packets are batched into pcapng chunks rather than sent
+ * one zmq message each.
  */
 int cmd_capture(FILE *f, int argc, char **argv)
 {
@@ -1016,6 +1241,7 @@ int cmd_capture(FILE *f, int argc, char **argv)
 	unsigned int snaplen;
 	bool swonly = false;
 	unsigned int bandwidth = 0;
+	bool pcapng = false;
 
 	if (argc < 3) {
 		fprintf(f, "capture: invalid arguments (%d)", argc);
@@ -1069,7 +1295,16 @@ int cmd_capture(FILE *f, int argc, char **argv)
 		bandwidth = value;
 	}
 
-	return capture_start(f, ifp, is_promisc, snaplen, swonly, bandwidth);
+	if (argc > 7) {
+		if (!streq(argv[7], "pcapng")) {
+			fprintf(f, "capture: unknown format %s\n", argv[7]);
+			return -1;
+		}
+		pcapng = true;
+	}
+
+	return capture_start(f, ifp, is_promisc, snaplen, swonly, bandwidth,
+			     pcapng);
 }
 
 /*
@@ -12,6 +12,7 @@
 #include <czmq.h>
 #include <pcap/bpf.h>
 #include <pthread.h>
+#include <rte_atomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -19,10 +20,13 @@
 #include <sys/types.h>
 #include <time.h>
 
+#include "bpf_jit.h"
 #include "if_var.h"
 
 struct rte_mbuf;
 
+#define CAP_MAX_PER_PORT	4 /* max simultaneous captures on a port */
+
 /*
  * Info used by capture thread.
  */
@@ -31,6 +35,7 @@ TAILQ_HEAD(capture_filter_list, capture_filter);
 struct capture_filter {
 	TAILQ_ENTRY(capture_filter) next;
 	struct bpf_program filter; /* BPF filter to apply */
+	struct bpf_jit jit; /* filter compiled to native code, if possible */
 	uint8_t mask; /* bitmask of capture slots applying this filter */
 };
 
@@ -51,6 +56,10 @@ struct capture_info {
 	unsigned int snaplen;
 	unsigned int bandwidth;
 	fal_object_t falobj;
+	rte_atomic64_t drops[CAP_MAX_PER_PORT]; /* ring full, per slot */
+	bool is_pcapng;			/* send pcapng chunks */
+	struct capture_chunk *chunks;	/* CAPTURE_CHUNKS per slot */
+	uint8_t chunk_cur[CAP_MAX_PER_PORT];
 };
 
 /* This should be expanded to all vplane interface types */
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#include <arpa/inet.h>
+#include <pcap/pcap.h>
+#include <rte_common.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+#include <string.h>
+
+#include "capture.h"
+#include "capture_chunk.h"
+#include "pktmbuf_internal.h"
+#include "util.h"
+
+/*
+ * Copy at most snaplen bytes of the packet.  Everything beyond the
+ * snaplen would be thrown away by the capture thread anyway, so don't
+ * spend time on the forwarding core copying it.
+ */
+struct rte_mbuf *capture_snap_copy(struct rte_mempool *pool,
+				   const struct rte_mbuf *ms,
+				   unsigned int snaplen)
+{
+	uint32_t len = RTE_MIN(rte_pktmbuf_pkt_len(ms), snaplen);
+	struct rte_mbuf *md, *seg;
+	uint32_t off = 0;
+
+	md = seg = pktmbuf_alloc(pool, pktmbuf_get_vrf(ms));
+	if (unlikely(!md))
+		return NULL;
+
+	pktmbuf_copy_meta(md, ms);
+	CAPTURE_WIRE_LEN(md) = rte_pktmbuf_pkt_len(ms);
+
+	for (;;) {
+		uint16_t n = RTE_MIN(len - off, rte_pktmbuf_tailroom(seg));
+		char *dst = rte_pktmbuf_mtod(seg, char *);
+		const void *src;
+
+		src = rte_pktmbuf_read(ms, off, n, dst);
+		if (src != dst)
+			rte_memcpy(dst, src, n);
+		seg->data_len = n;
+		md->pkt_len += n;
+		off += n;
+
+		if (off == len)
+			return md;
+
+		seg = pktmbuf_alloc(pool, pktmbuf_get_vrf(ms));
+		if (unlikely(!seg) || rte_pktmbuf_chain(md, seg) < 0) {
+			rte_pktmbuf_free(seg);
+			rte_pktmbuf_free(md);
+			return NULL;
+		}
+	}
+}
+
+/*
+ * Account for packets that none of the active captures will see, as
+ * the capture thread isn't keeping up.
+ */
+void capture_drop(struct capture_info *cap_info, unsigned int n)
+{
+	uint8_t mask = cap_info->capture_mask;
+	int i;
+
+	for (i = 0; i < CAP_MAX_PER_PORT; i++)
+		if (mask & (1 << i))
+			rte_atomic64_add(&cap_info->drops[i], n);
+}
+
+void capture_drops_jsonw(json_writer_t *wr,
+			 const struct capture_info *cap_info)
+{
+	int i;
+
+	jsonw_name(wr, "drops");
+	jsonw_start_array(wr);
+	for (i = 0; i < CAP_MAX_PER_PORT; i++) {
+		if (!(cap_info->capture_mask & (1 << i)))
+			continue;
+		jsonw_start_object(wr);
+		jsonw_uint_field(wr, "slot", 1 << i);
+		jsonw_uint_field(wr, "ring-full",
+				 rte_atomic64_read(&cap_info->drops[i]));
+		jsonw_end_object(wr);
+	}
+	jsonw_end_array(wr);
+}
+
+struct pcapng_block_hdr {
+	uint32_t	type;
+	uint32_t	len;
+};
+
+struct pcapng_shb {
+	struct pcapng_block_hdr	hdr;
+	uint32_t		magic;
+	uint16_t		major;
+	uint16_t		minor;
+	int64_t			section_len;
+};
+
+struct pcapng_idb {
+	struct pcapng_block_hdr	hdr;
+	uint16_t		linktype;
+	uint16_t		reserved;
+	uint32_t		snaplen;
+};
+
+struct pcapng_epb {
+	struct pcapng_block_hdr	hdr;
+	uint32_t		ifid;
+	uint32_t		ts_high;
+	uint32_t		ts_low;
+	uint32_t		caplen;
+	uint32_t		origlen;
+};
+
+/* Copy a block header and its trailing length into the chunk */
+static void capture_chunk_put(struct capture_chunk *chunk, const void *hdr,
+			      uint32_t hdr_len, uint32_t block_len)
+{
+	memcpy(&chunk->cc_buf[chunk->cc_len], hdr, hdr_len);
+	memcpy(&chunk->cc_buf[chunk->cc_len + block_len - sizeof(block_len)],
+	       &block_len, sizeof(block_len));
+}
+
+/*
+ * Empty the chunk and start it with a section header and the description
+ * of interface 0.  Timestamps use the default resolution of microseconds.
+ */
+void capture_chunk_start(struct capture_chunk *chunk, unsigned int snaplen)
+{
+	struct pcapng_shb shb = {
+		.hdr.type = PCAPNG_SHB_TYPE,
+		.hdr.len = sizeof(shb) + sizeof(uint32_t),
+		.magic = PCAPNG_BYTE_ORDER_MAGIC,
+		.major = 1,
+		.minor = 0,
+		.section_len = -1,
+	};
+	struct pcapng_idb idb = {
+		.hdr.type = PCAPNG_IDB_TYPE,
+		.hdr.len = sizeof(idb) + sizeof(uint32_t),
+		.linktype = DLT_EN10MB,
+		.snaplen = snaplen,
+	};
+
+	chunk->cc_len = 0;
+	chunk->cc_pkts = 0;
+
+	capture_chunk_put(chunk, &shb, sizeof(shb), shb.hdr.len);
+	chunk->cc_len += shb.hdr.len;
+	capture_chunk_put(chunk, &idb, sizeof(idb), idb.hdr.len);
+	chunk->cc_len += idb.hdr.len;
+}
+
+/* Copy len bytes of the packet from off, which may span segments */
+static void capture_chunk_copy(const struct rte_mbuf *m, uint32_t off,
+			       uint32_t len, uint8_t *dst)
+{
+	const void *src;
+
+	if (!len)
+		return;
+
+	src = rte_pktmbuf_read(m, off, len, dst);
+	if (src != dst)
+		memcpy(dst, src, len);
+}
+
+/*
+ * Add the first snaplen bytes of the packet to the chunk as an enhanced
+ * packet block.  If vlan_tpid is non-zero the tag the packet was sent or
+ * received with is put back after the MAC addresses.  Returns false,
+ * leaving the chunk unchanged, if there isn't room.
+ */
+bool capture_chunk_add(struct capture_chunk *chunk, const struct rte_mbuf *m,
+		       const struct timeval *ts, uint32_t wire_len,
+		       unsigned int snaplen, uint16_t vlan_tpid)
+{
+	uint32_t tag_len = vlan_tpid ? sizeof(struct rte_vlan_hdr) : 0;
+	uint32_t pkt_len = rte_pktmbuf_pkt_len(m);
+	uint64_t usecs = (uint64_t)ts->tv_sec * USEC_PER_SEC + ts->tv_usec;
+	struct pcapng_epb epb = {
+		.hdr.type = PCAPNG_EPB_TYPE,
+		.caplen = RTE_MIN(pkt_len + tag_len, snaplen),
+		.origlen = wire_len + tag_len,
+		.ts_high = usecs >> 32,
+		.ts_low = usecs,
+	};
+	uint32_t pad, n, left;
+	uint8_t *data;
+
+	pad = RTE_ALIGN_CEIL(epb.caplen, 4) - epb.caplen;
+	epb.hdr.len = sizeof(epb) + epb.caplen + pad + sizeof(uint32_t);
+	if (epb.hdr.len > CAPTURE_CHUNK_SZ - chunk->cc_len)
+		return false;
+
+	capture_chunk_put(chunk, &epb, sizeof(epb), epb.hdr.len);
+	data = &chunk->cc_buf[chunk->cc_len + sizeof(epb)];
+
+	/* up to the tag, if there is one */
+	n = RTE_MIN(epb.caplen, tag_len ? 2 * RTE_ETHER_ADDR_LEN : pkt_len);
+	capture_chunk_copy(m, 0, n, data);
+	left = epb.caplen - n;
+
+	if (tag_len && left) {
+		uint16_t tag[2] = { htons(vlan_tpid), htons(m->vlan_tci) };
+		uint32_t t = RTE_MIN(tag_len, left);
+
+		memcpy(data + n, tag, t);
+		left -= t;
+		capture_chunk_copy(m, n, left, data + n + t);
+	}
+
+	/* zero the padding so that stale bytes don't leak out */
+	memset(data + epb.caplen, 0, pad);
+
+	chunk->cc_len += epb.hdr.len;
+	chunk->cc_pkts++;
+	return true;
+}
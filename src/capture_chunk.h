@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Packet capture work that is independent of the capture thread: the
+ * snaplen copy made on the forwarding core, accounting for packets the
+ * capture ring had no room for, and the pcapng chunks sent by chunked
+ * captures.
+ */
+
+#ifndef CAPTURE_CHUNK_H
+#define CAPTURE_CHUNK_H
+
+#include <rte_atomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "json_writer.h"
+
+struct capture_info;
+struct rte_mbuf;
+struct rte_mempool;
+
+/*
+ * The capture copy only holds the first snaplen bytes, so the length of
+ * the packet on the wire is carried alongside it in the user hash tag.
+ */
+#define CAPTURE_WIRE_LEN(m)	((m)->hash.usr)
+
+struct rte_mbuf *capture_snap_copy(struct rte_mempool *pool,
+				   const struct rte_mbuf *ms,
+				   unsigned int snaplen);
+
+void capture_drop(struct capture_info *cap_info, unsigned int n);
+void capture_drops_jsonw(json_writer_t *wr,
+			 const struct capture_info *cap_info);
+
+/*
+ * A chunk is a self-contained pcapng section: a section header and an
+ * interface description, followed by an enhanced packet block for each
+ * packet.  It is big enough for at least one packet of the largest
+ * snaplen a chunked capture allows.
+ */
+#define CAPTURE_CHUNK_SZ	(128 * 1024)
+#define CAPTURE_CHUNK_SNAPLEN_MAX	65535
+#define CAPTURE_CHUNKS		4	/* ring of chunks for each slot */
+
+#define PCAPNG_SHB_TYPE		0x0A0D0D0A
+#define PCAPNG_IDB_TYPE		0x00000001
+#define PCAPNG_EPB_TYPE		0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC	0x1A2B3C4D
+
+struct capture_chunk {
+	uint8_t		cc_buf[CAPTURE_CHUNK_SZ];
+	uint32_t	cc_len;		/* bytes written */
+	uint32_t	cc_pkts;
+	rte_atomic32_t	cc_busy;	/* being sent */
+};
+
+void capture_chunk_start(struct capture_chunk *chunk, unsigned int snaplen);
+bool capture_chunk_add(struct capture_chunk *chunk, const struct rte_mbuf *m,
+		       const struct timeval *ts, uint32_t wire_len,
+		       unsigned int snaplen, uint16_t vlan_tpid);
+
+#endif /* CAPTURE_CHUNK_H */
@@ -68,6 +68,7 @@
 #include "netinet6/nd6_nbr.h"
 #include "netinet6/route_v6.h"
 #include "netinet6/ip6_funcs.h"
+#include "npf/fragment/ipv4_rsmbl.h"
 #include "pipeline/nodes/pl_nodes_common.h"
 #include "pktmbuf_internal.h"
 #include "pd_show.h"
@@ -322,7 +323,7 @@ static const char *arpstat_names[] = {
 	"duplicate_ip",	"dropped",
 	"timeout",	"proxy",
 	"garp_reqs_dropped", "garp_reps_dropped",
-	"mpool_fail"
+	"mpool_fail",	"res_throttle"
 };
 
 static void show_arpstat(json_writer_t *wr, struct vrf *vrf)
@@ -454,6 +455,7 @@ static int cmd_netstat(FILE *f, int argc, char **argv)
 	show_icmp6stat(wr, vrf);
 	show_nd6stat(wr, vrf);
 	show_udpstat(wr, vrf);
+	fragment_stats_show(wr);
 	jsonw_destroy(&wr);
 
 	return 0;
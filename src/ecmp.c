@@ -40,7 +40,7 @@
 #include "vplane_log.h"
 
 /* Global ECMP mode */
-static uint8_t ecmp_mode = ECMP_HRW;
+uint8_t ecmp_mode = ECMP_HRW;
 
 /* Global ECMP max path param */
 uint16_t ecmp_max_path = UINT16_MAX;
@@ -51,6 +51,7 @@ static const char *ecmp_modes[ECMP_MAX] = {
 	[ECMP_HASH_THRESHOLD]	= "hash-threshold",
 	[ECMP_HRW]		= "hrw",
 	[ECMP_MODULO_N]		= "modulo-n",
+	[ECMP_RESILIENT]	= "resilient",
 };
 
 /*
@@ -171,6 +172,8 @@ static unsigned int
 ecmp_lookup_alg(enum ecmp_modes ecmp_alg, uint32_t size, uint32_t key)
 {
 	switch (ecmp_alg) {
+	/* resilient lists without a bucket map, built before the mode was set */
+	case ECMP_RESILIENT:
 	case ECMP_HASH_THRESHOLD:
 		return key / (UINT32_MAX / size);
 
@@ -223,7 +226,7 @@ static int ecmp_set_max_path(int val)
 }
 
 #define ECMP_MODES \
-	"hash-threshold|hrw|modulo-n|disable"
+	"hash-threshold|hrw|modulo-n|resilient|disable"
 
 #define CMD_ECMP_USAGE                     \
 	"Usage: ecmp show\n"               \
@@ -21,12 +21,16 @@ struct nlattr;
 /* Global ECMP max path param */
 extern uint16_t ecmp_max_path;
 
+/* Global ECMP mode */
+extern uint8_t ecmp_mode;
+
 /* ECMP modes */
 enum ecmp_modes {
 	ECMP_DISABLED,
 	ECMP_HASH_THRESHOLD,
 	ECMP_HRW,
 	ECMP_MODULO_N,
+	ECMP_RESILIENT,
 	ECMP_MAX
 };
 
@@ -27,6 +27,7 @@
 #include <rte_ether.h>
 #include <rte_lcore.h>
 #include <rte_log.h>
+#include <rte_malloc.h>
 #include <rte_mbuf.h>
 #include <rte_memory.h>
 #include <rte_timer.h>
@@ -84,6 +85,10 @@ struct bridge_vlan_set;
 
 #define	BRIDGE_RTABLE_PRUNE_PERIOD 2 /* secs between each expire tick */
 #define	BRIDGE_RTABLE_EXPIRE	(300 / BRIDGE_RTABLE_PRUNE_PERIOD)
+#define	BRIDGE_AGE_SLICE_MS	100  /* msecs between each ageing slice */
+#define	BRIDGE_AGE_SLICES	(BRIDGE_RTABLE_PRUNE_PERIOD * 1000 / \
+				 BRIDGE_AGE_SLICE_MS)
+#define	BRIDGE_AGE_BATCH_MIN	256
 #define BRIDGE_AGEING_TIME_MIN	10
 #define BRIDGE_AGEING_TIME_MAX	1000000
 
@@ -122,6 +127,7 @@ static bool bridge_pvst_flood_local;
 static void bridge_newneigh(int ifindex, const struct rte_ether_addr *dst,
 			    uint16_t state, uint16_t vlan);
 static void bridge_timer(struct rte_timer *, void *);
+static void bridge_flood_lists_free(struct bridge_softc *sc);
 
 static bool bridge_intf_is_virt(struct ifnet *ifp)
 {
@@ -451,34 +457,18 @@ bridge_rtnode_insert(struct bridge_softc *sc, struct bridge_rtnode *brt)
 }
 
 /*
- * Update existing forwarding table entry
+ * Add, or move, a dynamic forwarding table entry.  Called either directly
+ * from the forwarding path, or by the learning updater.
  */
 static void
-bridge_rtupdate(struct ifnet *ifp,
-	const struct rte_ether_addr *dst,
-	uint16_t vlan)
+bridge_rtupdate_apply(struct bridge_softc *sc, struct ifnet *ifp,
+		      const struct rte_ether_addr *dst, uint16_t vlan)
 {
-	struct bridge_softc *sc =
-		bridge_port_get_bridge(ifp->if_brport)->if_softc;
 	struct bridge_rtnode *brt;
 	/* set attr.state to dynamic ie !NUD_PERMANENT and !NUD_NOARP */
 	struct fal_attribute_t attr = {
 		FAL_BRIDGE_NEIGH_ATTR_STATE, .value.u16 = 0};
 
-	if (ifp->if_type == IFT_TUNNEL_GRE) {
-		/* We shouldn't get in here for tunnels but JIC.
-		 *
-		 * We rely on the GRE tunnel code to update bridging entries as
-		 * it knows about the src IP address of the transport layer.
-		 * This is crucial in case of MP GRE tunnels where the spoke is
-		 * identified by its transport IP address
-		 */
-		DP_DEBUG(BRIDGE, ERR, BRIDGE,
-			 "bridge_rtupdate: Bridge rt notif for tunnel interface %s\n",
-			 ifp->if_name);
-		return;
-	}
-
 	/*
 	 * A route for this destination might already exist.  If so,
 	 * update it.
@@ -511,6 +501,290 @@ bridge_rtupdate(struct ifnet *ifp,
 	rte_atomic32_clear(&brt->brt_unused);
 }
 
+/*
+ * Mark an entry as used.  Only written when the ageing walk has marked it
+ * unused, so that hot entries are not written on every frame.
+ */
+static inline void
+bridge_rtnode_touch(struct bridge_rtnode *brt)
+{
+	if (unlikely(rte_atomic32_read(&brt->brt_unused)))
+		rte_atomic32_clear(&brt->brt_unused);
+}
+
+/*
+ * MAC learning
+ *
+ * Each forwarding lcore may apply a few new or moved addresses directly
+ * in each learning period, so that a new station is normally learnt from
+ * its first frame.  Beyond that, e.g. during a flood of new source
+ * addresses, learning events are deferred to a single producer, single
+ * consumer ring per lcore.  The rings are drained in batches by a single
+ * updater on the master thread, so the forwarding threads never contend on
+ * the forwarding table or program the FAL during a storm.
+ *
+ * A small per-lcore filter suppresses repeats of the same event within a
+ * learning period.  Events that do not fit in the ring are dropped, and
+ * the address is learnt from a later frame.
+ */
+#define BRIDGE_LEARN_PERIOD_MS	10	/* updater period */
+#define BRIDGE_LEARN_SYNC_MAX	16	/* direct updates per period */
+#define BRIDGE_LEARN_RING_SZ	1024	/* must be a power of two */
+#define BRIDGE_LEARN_FILTER_SZ	256	/* must be a power of two */
+
+struct bridge_learn_event {
+	struct bridge_key	ble_key;
+	uint32_t		ble_ifindex;
+};
+
+struct bridge_learn_filter {
+	struct bridge_learn_event blf_ev;
+	uint32_t		blf_period;
+};
+
+struct bridge_learn_ring {
+	/* Written by the forwarding thread */
+	uint32_t		blr_head;
+	uint32_t		blr_period;	/* period of blr_sync */
+	uint32_t		blr_sync;	/* direct updates this period */
+	uint64_t		blr_deferred;
+	uint64_t		blr_dropped;
+
+	/* Written by the updater */
+	uint32_t		blr_tail __rte_cache_aligned;
+
+	struct bridge_learn_event blr_ev[BRIDGE_LEARN_RING_SZ]
+						__rte_cache_aligned;
+	struct bridge_learn_filter blr_filter[BRIDGE_LEARN_FILTER_SZ];
+};
+
+static struct bridge_learn_ring *bridge_learn_rings[RTE_MAX_LCORE];
+static struct rte_timer bridge_learn_timer;
+
+/* Incremented by the updater at the end of each learning period */
+static uint32_t bridge_learn_period;
+
+static void bridge_learn_update(struct rte_timer *, void *);
+
+/*
+ * Rings are only used by the forwarding lcores.  The master thread, and
+ * threads that are not EAL lcores, always update the table directly.
+ */
+static void
+bridge_learn_init(void)
+{
+	static bool initialised;
+	unsigned int lcore;
+
+	if (initialised)
+		return;
+	initialised = true;
+
+	RTE_LCORE_FOREACH_SLAVE(lcore) {
+		bridge_learn_rings[lcore] = rte_zmalloc_socket(
+			"bridge_learn", sizeof(struct bridge_learn_ring),
+			RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore));
+		if (!bridge_learn_rings[lcore])
+			RTE_LOG(ERR, BRIDGE,
+				"No learning ring for lcore %u\n", lcore);
+	}
+
+	rte_timer_init(&bridge_learn_timer);
+	rte_timer_reset(&bridge_learn_timer,
+			rte_get_timer_hz() * BRIDGE_LEARN_PERIOD_MS / 1000,
+			PERIODICAL, rte_get_master_lcore(),
+			bridge_learn_update, NULL);
+}
+
+static inline struct bridge_learn_ring *
+bridge_learn_ring_get(void)
+{
+	unsigned int lcore = rte_lcore_id();
+
+	if (unlikely(lcore >= RTE_MAX_LCORE))
+		return NULL;
+	return bridge_learn_rings[lcore];
+}
+
+/*
+ * Returns true if this lcore may still update the table directly in the
+ * current learning period.
+ */
+static inline bool
+bridge_learn_sync_ok(struct bridge_learn_ring *lr)
+{
+	uint32_t period = CMM_LOAD_SHARED(bridge_learn_period);
+
+	if (lr->blr_period != period) {
+		lr->blr_period = period;
+		lr->blr_sync = 0;
+	}
+	return lr->blr_sync++ < BRIDGE_LEARN_SYNC_MAX;
+}
+
+static void
+bridge_learn_defer(struct bridge_learn_ring *lr, struct ifnet *ifp,
+		   const struct rte_ether_addr *dst, uint16_t vlan)
+{
+	struct bridge_learn_filter *filter;
+	struct bridge_learn_event *ev;
+	struct bridge_key key = { .addr = *dst, .vlan = vlan };
+	uint32_t head = lr->blr_head;
+
+	filter = &lr->blr_filter[bridge_key_hash(&key) &
+				 (BRIDGE_LEARN_FILTER_SZ - 1)];
+	if (filter->blf_period == lr->blr_period &&
+	    filter->blf_ev.ble_ifindex == ifp->if_index &&
+	    bridge_key_equal(&filter->blf_ev.ble_key, &key))
+		return;
+
+	if (head - CMM_LOAD_SHARED(lr->blr_tail) >= BRIDGE_LEARN_RING_SZ) {
+		lr->blr_dropped++;
+		return;
+	}
+
+	ev = &lr->blr_ev[head & (BRIDGE_LEARN_RING_SZ - 1)];
+	ev->ble_key = key;
+	ev->ble_ifindex = ifp->if_index;
+
+	filter->blf_ev = *ev;
+	filter->blf_period = lr->blr_period;
+	lr->blr_deferred++;
+
+	/* Event must be visible before the head moves */
+	cmm_smp_wmb();
+	CMM_STORE_SHARED(lr->blr_head, head + 1);
+}
+
+/*
+ * Learn the source address of a frame.
+ *
+ * The common case of a known address on the same port is a read-only
+ * lookup.
+ */
+static void
+bridge_rtupdate(struct ifnet *ifp,
+	const struct rte_ether_addr *dst,
+	uint16_t vlan)
+{
+	struct bridge_softc *sc =
+		bridge_port_get_bridge(ifp->if_brport)->if_softc;
+	struct bridge_learn_ring *lr;
+	struct bridge_rtnode *brt;
+
+	if (ifp->if_type == IFT_TUNNEL_GRE) {
+		/* We shouldn't get in here for tunnels but JIC.
+		 *
+		 * We rely on the GRE tunnel code to update bridging entries as
+		 * it knows about the src IP address of the transport layer.
+		 * This is crucial in case of MP GRE tunnels where the spoke is
+		 * identified by its transport IP address
+		 */
+		DP_DEBUG(BRIDGE, ERR, BRIDGE,
+			 "bridge_rtupdate: Bridge rt notif for tunnel interface %s\n",
+			 ifp->if_name);
+		return;
+	}
+
+	brt = bridge_rtnode_lookup(sc, dst, vlan);
+	if (likely(brt != NULL) &&
+	    (likely(brt->brt_difp == ifp) || !bridge_mac_is_dynamic(brt))) {
+		bridge_rtnode_touch(brt);
+		return;
+	}
+
+	/* New address, or it has moved to this port */
+	lr = bridge_learn_ring_get();
+	if (!lr || bridge_learn_sync_ok(lr)) {
+		bridge_rtupdate_apply(sc, ifp, dst, vlan);
+		return;
+	}
+
+	bridge_learn_defer(lr, ifp, dst, vlan);
+}
+
+static void
+bridge_learn_event_apply(const struct bridge_learn_event *ev)
+{
+	struct bridge_port *port;
+	struct ifnet *ifp;
+	uint8_t state;
+
+	/* The port may have been removed, or changed state, since */
+	ifp = dp_ifnet_byifindex(ev->ble_ifindex);
+	if (!ifp || ifp->if_type == IFT_TUNNEL_GRE)
+		return;
+
+	port = rcu_dereference(ifp->if_brport);
+	if (!port)
+		return;
+
+	state = bridge_port_get_state_vlan(port, ev->ble_key.vlan);
+	if (state != STP_IFSTATE_LEARNING && state != STP_IFSTATE_FORWARDING)
+		return;
+
+	bridge_rtupdate_apply(bridge_port_get_bridge(port)->if_softc, ifp,
+			      &ev->ble_key.addr, ev->ble_key.vlan);
+}
+
+static void
+bridge_learn_jsonw(json_writer_t *wr)
+{
+	struct bridge_learn_ring *lr;
+	uint64_t deferred = 0, dropped = 0;
+	unsigned int lcore;
+
+	RTE_LCORE_FOREACH_SLAVE(lcore) {
+		lr = bridge_learn_rings[lcore];
+		if (lr) {
+			deferred += CMM_LOAD_SHARED(lr->blr_deferred);
+			dropped += CMM_LOAD_SHARED(lr->blr_dropped);
+		}
+	}
+
+	jsonw_name(wr, "learning");
+	jsonw_start_object(wr);
+	jsonw_uint_field(wr, "deferred", deferred);
+	jsonw_uint_field(wr, "dropped", dropped);
+	jsonw_end_object(wr);
+}
+
+/* Drain the learning rings of all the forwarding lcores */
+static void bridge_learn_update(struct rte_timer *timer __rte_unused,
+				void *arg __rte_unused)
+{
+	struct bridge_learn_ring *lr;
+	uint32_t head, tail;
+	unsigned int lcore;
+
+	rcu_read_lock();
+	RTE_LCORE_FOREACH_SLAVE(lcore) {
+		lr = bridge_learn_rings[lcore];
+		if (!lr)
+			continue;
+
+		tail = lr->blr_tail;
+		head = CMM_LOAD_SHARED(lr->blr_head);
+		if (head == tail)
+			continue;
+
+		/* Read the events after the head */
+		cmm_smp_rmb();
+		while (tail != head) {
+			bridge_learn_event_apply(
+				&lr->blr_ev[tail & (BRIDGE_LEARN_RING_SZ - 1)]);
+			tail++;
+		}
+
+		/* Events must be read before the slots are reused */
+		cmm_smp_mb();
+		CMM_STORE_SHARED(lr->blr_tail, tail);
+	}
+	rcu_read_unlock();
+
+	CMM_STORE_SHARED(bridge_learn_period, bridge_learn_period + 1);
+}
+
 static void
 bridge_rtnode_free(struct rcu_head *head)
 {
@@ -724,8 +998,10 @@ void bridge_update(const char *ifname, struct nl_bridge_info *br_info)
 		 br_info->br_vlan_default_pvid);
 
 
-	if (br_info->br_vlan_filter)
+	if (br_info->br_vlan_filter && !sc->scbr_vlan_filter) {
 		sc->scbr_vlan_filter = true;
+		bridge_flood_invalidate(ifp);
+	}
 	if (br_info->br_vlan_default_pvid)
 		sc->scbr_vlan_default_pvid = br_info->br_vlan_default_pvid;
 }
@@ -742,12 +1018,16 @@ static int bridge_if_init(struct ifnet *ifp)
 	CDS_INIT_LIST_HEAD(&sc->scbr_porthead);
 	bridge_rtable_init(sc);
 
+	sc->scbr_ageing_ticks = BRIDGE_RTABLE_EXPIRE;
+	sc->scbr_age_start = rte_get_timer_cycles();
+
 	rte_timer_init(&sc->scbr_timer);
 	rte_timer_reset(&sc->scbr_timer,
-			rte_get_timer_hz() * BRIDGE_RTABLE_PRUNE_PERIOD,
+			rte_get_timer_hz() * BRIDGE_AGE_SLICE_MS / 1000,
 			PERIODICAL, rte_get_master_lcore(),
 			bridge_timer, sc);
-	sc->scbr_ageing_ticks = BRIDGE_RTABLE_EXPIRE;
+
+	bridge_learn_init();
 
 	ifp->if_softc = sc;
 
@@ -767,6 +1047,7 @@ static void bridge_if_uninit(struct ifnet *ifp)
 
 	rte_timer_stop(&sc->scbr_timer);
 	cds_lfht_destroy(sc->scbr_rthash, NULL);
+	bridge_flood_lists_free(sc);
 
 	/* make sure all vlan stats storage is cleaned up */
 	for (i = 0; i < VLAN_N_VID; i++) {
@@ -1150,6 +1431,174 @@ drop:
 	return BRIDGE_CONSUMED;
 }
 
+/*
+ * Flood lists
+ *
+ * The ports to flood a vlan to are precomputed, so that flooding does not
+ * need to look up the STP state, allowed vlans and untag vlans of every
+ * port for every frame.  A list is built on the master thread, and is
+ * stamped with the generation it was built in.  Any change to the ports,
+ * or to their vlans or STP state, bumps the generation.  A frame that finds
+ * no list for its vlan, or a stale one, is flooded by walking the ports as
+ * before, and requests that the list is rebuilt.
+ */
+struct bridge_flood_port {
+	struct ifnet		*bfp_ifp;
+	bool			bfp_untag;
+};
+
+struct bridge_flood_list {
+	struct rcu_head		bfl_rcu;
+	uint32_t		bfl_gen;
+	bool			bfl_vlan_filter;
+	uint16_t		bfl_count;
+	struct bridge_flood_port bfl_port[];
+};
+
+void bridge_flood_invalidate(struct ifnet *bridge_ifp)
+{
+	struct bridge_softc *sc;
+
+	if (!bridge_ifp)
+		return;
+
+	sc = bridge_ifp->if_softc;
+	if (sc)
+		CMM_STORE_SHARED(sc->scbr_flood_gen, sc->scbr_flood_gen + 1);
+}
+
+static void
+bridge_flood_list_free(struct rcu_head *head)
+{
+	free(caa_container_of(head, struct bridge_flood_list, bfl_rcu));
+}
+
+static struct bridge_flood_list *
+bridge_flood_list_build(struct bridge_softc *sc, uint16_t vlan)
+{
+	struct bridge_flood_list *fl;
+	struct cds_list_head *entry;
+	struct bridge_port *port;
+	unsigned int count = 0;
+
+	bridge_for_each_brport(port, entry, sc)
+		count++;
+
+	fl = zmalloc_aligned(sizeof(*fl) + count * sizeof(fl->bfl_port[0]));
+	if (!fl)
+		return NULL;
+
+	fl->bfl_gen = sc->scbr_flood_gen;
+	fl->bfl_vlan_filter = sc->scbr_vlan_filter;
+
+	bridge_for_each_brport(port, entry, sc) {
+		if (fl->bfl_count == count)
+			break;
+
+		if (bridge_port_get_state_vlan(port, vlan)
+		    != STP_IFSTATE_FORWARDING)
+			continue;
+
+		if (fl->bfl_vlan_filter && !bridge_port_lookup_vlan(port, vlan))
+			continue;
+
+		fl->bfl_port[fl->bfl_count].bfp_ifp =
+			bridge_port_get_interface(port);
+		fl->bfl_port[fl->bfl_count].bfp_untag = fl->bfl_vlan_filter &&
+			bridge_port_lookup_untag_vlan(port, vlan);
+		fl->bfl_count++;
+	}
+
+	return fl;
+}
+
+/* Rebuild the flood lists that have been requested by the forwarding path */
+static void
+bridge_flood_rebuild(struct bridge_softc *sc)
+{
+	struct bridge_flood_list *fl, *old;
+	unsigned int i, vlan;
+	uint64_t want;
+
+	for (i = 0; i < ARRAY_SIZE(sc->scbr_flood_want); i++) {
+		if (!CMM_LOAD_SHARED(sc->scbr_flood_want[i]))
+			continue;
+
+		want = uatomic_xchg(&sc->scbr_flood_want[i], 0);
+		while (want) {
+			vlan = i * 64 + __builtin_ctzll(want);
+			want &= want - 1;
+
+			fl = bridge_flood_list_build(sc, vlan);
+			if (!fl)
+				continue;
+
+			old = rcu_xchg_pointer(&sc->scbr_flood[vlan], fl);
+			if (old)
+				call_rcu(&old->bfl_rcu, bridge_flood_list_free);
+		}
+	}
+}
+
+static void
+bridge_flood_lists_free(struct bridge_softc *sc)
+{
+	struct bridge_flood_list *old;
+	unsigned int vlan;
+
+	for (vlan = 0; vlan < VLAN_N_VID; vlan++) {
+		if (!sc->scbr_flood[vlan])
+			continue;
+
+		old = rcu_xchg_pointer(&sc->scbr_flood[vlan], NULL);
+		if (old)
+			call_rcu(&old->bfl_rcu, bridge_flood_list_free);
+	}
+}
+
+/*
+ * Get the flood list for a vlan, or NULL if there is no current list.
+ */
+static inline const struct bridge_flood_list *
+bridge_flood_list_get(struct bridge_softc *sc, uint16_t vlan)
+{
+	const struct bridge_flood_list *fl;
+	uint64_t *want;
+	uint64_t bit;
+
+	vlan &= VLAN_VID_MASK;
+	fl = rcu_dereference(sc->scbr_flood[vlan]);
+	if (likely(fl != NULL) &&
+	    likely(fl->bfl_gen == CMM_LOAD_SHARED(sc->scbr_flood_gen)))
+		return fl;
+
+	want = &sc->scbr_flood_want[vlan / 64];
+	bit = 1ull << (vlan % 64);
+	if (!(CMM_LOAD_SHARED(*want) & bit))
+		uatomic_or(want, bit);
+
+	return NULL;
+}
+
+/*
+ * Send a frame to a port on the flood list.  The port is known to be
+ * forwarding, and to allow the vlan.
+ */
+static void
+bridge_flood_tx(struct bridge_softc *sc, const struct bridge_flood_list *fl,
+		const struct bridge_flood_port *fp, struct ifnet *in_ifp,
+		uint16_t vlan, struct rte_mbuf *m)
+{
+	if (fl->bfl_vlan_filter) {
+		bridge_frame_rx_vlan_to_tx_vlan(m);
+		if (fp->bfp_untag)
+			bridge_frame_remove_tx_vlan(m);
+		if_vlan_out_stats_incr(sc, vlan, m);
+	}
+
+	if_output(fp->bfp_ifp, m, in_ifp, ETH_P_TEB);
+}
+
 static void
 bridge_gre_clone_and_send(struct ifnet *ifp,
 			  struct mgre_rt_info *remote, void *arg)
@@ -1173,30 +1622,18 @@ static void bridge_flood_on_gre_tunnel(struct ifnet *out_if,
 	gre_tunnel_peer_walk(out_if, bridge_gre_clone_and_send, m);
 }
 
-/* Flood packets on locally hosted interfaces belonging to bridge. */
-static void bridge_flood_local(struct bridge_softc *sc, struct ifnet *in_ifp,
-			       struct rte_mbuf *m, struct ifnet *br_ifp,
-			       bool is_pvst)
+/*
+ * Flood packets on locally hosted interfaces belonging to bridge, by
+ * walking the bridge ports.  Used until there is a current flood list for
+ * the vlan.
+ */
+static void bridge_flood_walk(struct bridge_softc *sc, struct ifnet *in_ifp,
+			      struct rte_mbuf *m, struct ifnet *br_ifp,
+			      uint16_t vlan, bool input_hw_fwded)
 {
 	struct ifnet *dif, *lastif = NULL;
 	struct cds_list_head *entry;
 	struct bridge_port *port;
-	bool input_hw_fwded;
-
-	if (in_ifp)
-		input_hw_fwded = in_ifp->hw_forwarding;
-	else
-		input_hw_fwded = false;
-
-	/*
-	 * The hardware platforms process PVST BPDUs differently. Some
-	 * process (flood) the frames others always punt forcing us to
-	 * perform the flooding.
-	 */
-	if (input_hw_fwded && is_pvst && bridge_pvst_flood_local)
-		input_hw_fwded = false;
-
-	uint16_t vlan = bridge_frame_get_vlan(m);
 
 	bridge_for_each_brport(port, entry, sc) {
 		dif = bridge_port_get_interface(port);
@@ -1253,6 +1690,79 @@ drop:
 	rte_pktmbuf_free(m);
 }
 
+/* Flood packets on locally hosted interfaces belonging to bridge. */
+static void bridge_flood_local(struct bridge_softc *sc, struct ifnet *in_ifp,
+			       struct rte_mbuf *m, struct ifnet *br_ifp,
+			       bool is_pvst)
+{
+	const struct bridge_flood_port *fp, *lastfp = NULL;
+	const struct bridge_flood_list *fl;
+	bool input_hw_fwded;
+	struct ifnet *dif;
+	unsigned int i;
+
+	if (in_ifp)
+		input_hw_fwded = in_ifp->hw_forwarding;
+	else
+		input_hw_fwded = false;
+
+	/*
+	 * The hardware platforms process PVST BPDUs differently. Some
+	 * process (flood) the frames others always punt forcing us to
+	 * perform the flooding.
+	 */
+	if (input_hw_fwded && is_pvst && bridge_pvst_flood_local)
+		input_hw_fwded = false;
+
+	uint16_t vlan = bridge_frame_get_vlan(m);
+
+	fl = bridge_flood_list_get(sc, vlan);
+	if (unlikely(fl == NULL)) {
+		bridge_flood_walk(sc, in_ifp, m, br_ifp, vlan, input_hw_fwded);
+		return;
+	}
+
+	for (i = 0; i < fl->bfl_count; i++) {
+		fp = &fl->bfl_port[i];
+		dif = fp->bfp_ifp;
+
+		if (dif == in_ifp)
+			continue;
+
+		if (input_hw_fwded && dif->hw_forwarding)
+			continue;
+
+		if (bridge_pkt_exceeds_mtu(m, dif))
+			continue;
+
+		if (lastfp) {
+			if (lastfp->bfp_ifp->if_type == IFT_TUNNEL_GRE) {
+				/* The tunnel makes its own copies */
+				bridge_flood_on_gre_tunnel(lastfp->bfp_ifp, m);
+			} else {
+				struct rte_mbuf *n
+					 = pktmbuf_clone(m, m->pool);
+
+				if (likely(n != NULL))
+					bridge_flood_tx(sc, fl, lastfp, in_ifp,
+							vlan, n);
+			}
+		}
+
+		lastfp = fp;
+	}
+
+	/* original goes to the last port */
+	if (unlikely(lastfp == NULL))
+		rte_pktmbuf_free(m);
+	else if (lastfp->bfp_ifp->if_type == IFT_TUNNEL_GRE) {
+		bridge_flood_on_gre_tunnel(lastfp->bfp_ifp, m);
+		/* bridge flood over tunnel always sends a copy */
+		rte_pktmbuf_free(m);
+	} else
+		bridge_flood_tx(sc, fl, lastfp, in_ifp, vlan, m);
+}
+
 /*
  * Destination is unknown unicast, flood to all ports in bridge.
  *
@@ -1574,20 +2084,119 @@ bridge_rtexpired(struct bridge_rtnode *brt, uint32_t ageing_ticks)
 	return 0;
 }
 
-/* walk bridge forwarding database and timeout old entries */
+/*
+ * Number of entries to age in each slice, so that a pass over the whole
+ * table takes about one prune period.
+ */
+static uint32_t bridge_age_batch(struct bridge_softc *sc)
+{
+	unsigned long count;
+	long split_before, split_after;
+
+	cds_lfht_count_nodes(sc->scbr_rthash, &split_before, &count,
+			     &split_after);
+
+	return RTE_MAX(count / BRIDGE_AGE_SLICES + 1,
+		       (unsigned long)BRIDGE_AGE_BATCH_MIN);
+}
+
+/*
+ * Position of a key in the walk order.  The split-ordered hash table
+ * keeps its entries sorted by bit-reversed hash.
+ */
+static unsigned long bridge_key_order(const struct bridge_key *key)
+{
+	unsigned long hash = bridge_key_hash(key);
+	unsigned long order = 0;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(hash) * 8; i++) {
+		order = (order << 1) | (hash & 1);
+		hash >>= 1;
+	}
+
+	return order;
+}
+
+/*
+ * Walk the bridge forwarding database and timeout old entries.
+ *
+ * The walk starts once per prune period, and is done in slices of
+ * scbr_age_batch entries so that a large table does not stall the master
+ * thread.  Each slice resumes after the last entry kept by the previous
+ * slice.  The hash table is split-ordered, so the walk order is not
+ * changed by a resize.  If the cursor entry has since been deleted then
+ * the slice resumes at the first entry beyond the cursor's position.
+ */
 static void bridge_timer(struct rte_timer *timer __rte_unused,
 			 void *arg __rte_unused)
 {
 	struct bridge_softc *sc = arg;
+	uint64_t now = rte_get_timer_cycles();
 	struct cds_lfht_iter iter;
+	struct cds_lfht_node *node;
 	struct bridge_rtnode *brt;
+	uint32_t n;
+
+	bridge_flood_rebuild(sc);
+
+	if (!sc->scbr_age_active) {
+		if (now - sc->scbr_age_start <
+		    rte_get_timer_hz() * BRIDGE_RTABLE_PRUNE_PERIOD)
+			return;
+
+		sc->scbr_age_start = now;
+		sc->scbr_age_active = true;
+		sc->scbr_age_cursor_valid = false;
+		sc->scbr_age_batch = bridge_age_batch(sc);
+	}
 
 	rcu_read_lock();
-	cds_lfht_for_each_entry(sc->scbr_rthash, &iter, brt, brt_node) {
+
+	if (sc->scbr_age_cursor_valid) {
+		cds_lfht_lookup(sc->scbr_rthash,
+				bridge_key_hash(&sc->scbr_age_cursor),
+				bridge_rtnode_match, &sc->scbr_age_cursor,
+				&iter);
+		if (cds_lfht_iter_get_node(&iter))
+			cds_lfht_next(sc->scbr_rthash, &iter);
+		else {
+			unsigned long pos =
+				bridge_key_order(&sc->scbr_age_cursor);
+
+			cds_lfht_first(sc->scbr_rthash, &iter);
+			while ((node = cds_lfht_iter_get_node(&iter))) {
+				brt = caa_container_of(node,
+						       struct bridge_rtnode,
+						       brt_node);
+				if (bridge_key_order(&brt->brt_key) > pos)
+					break;
+				cds_lfht_next(sc->scbr_rthash, &iter);
+			}
+		}
+	} else
+		cds_lfht_first(sc->scbr_rthash, &iter);
+
+	node = cds_lfht_iter_get_node(&iter);
+
+	for (n = 0; node && n < sc->scbr_age_batch; n++) {
+		brt = caa_container_of(node, struct bridge_rtnode, brt_node);
+		cds_lfht_next(sc->scbr_rthash, &iter);
+
 		if (bridge_rtexpired(brt, sc->scbr_ageing_ticks))
 			bridge_rtnode_destroy(sc->scbr_rthash, brt);
+		else {
+			sc->scbr_age_cursor = brt->brt_key;
+			sc->scbr_age_cursor_valid = true;
+		}
+		node = cds_lfht_iter_get_node(&iter);
 	}
+
 	rcu_read_unlock();
+
+	/* End of the pass */
+	if (!node)
+		sc->scbr_age_active = false;
 }
 
 /*
@@ -2451,6 +3060,7 @@ bridge_frag_status(FILE *f, int argc, char **argv __rte_unused)
 	jsonw_name(wr, "global_config");
 	jsonw_start_object(wr);
 	jsonw_bool_field(wr, "bridge_frag_enable", bridge_frag_enable);
+	bridge_learn_jsonw(wr);
 	jsonw_end_object(wr);
 	jsonw_destroy(&wr);
 	return 0;
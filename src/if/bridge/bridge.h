@@ -85,6 +85,7 @@ struct bridge_rtnode {
 };
 
 struct mstp_bridge;
+struct bridge_flood_list;
 
 struct bridge_softc {
 	struct rte_timer	scbr_timer;
@@ -94,6 +95,13 @@ struct bridge_softc {
 	/* ageing time divided by seconds per tick.  0 == don't age */
 	uint32_t		scbr_ageing_ticks;
 
+	/* incremental ageing walk, resumed after scbr_age_cursor */
+	bool			scbr_age_active;
+	bool			scbr_age_cursor_valid;
+	uint32_t		scbr_age_batch;
+	uint64_t		scbr_age_start;	/* cycles at start of pass */
+	struct bridge_key	scbr_age_cursor;
+
 	/* fields for VLAN aware mode */
 	bool			scbr_vlan_filter;
 	uint16_t		scbr_vlan_default_pvid;
@@ -107,6 +115,15 @@ struct bridge_softc {
 
 	/* Stats per vlan for switches */
 	struct bridge_vlan_stat_block *vlan_stats[VLAN_N_VID];
+
+	/*
+	 * Flood lists per vlan.  A list is only used if it was built in
+	 * the current generation.  Stale lists are requested in
+	 * scbr_flood_want, and rebuilt by the timer.
+	 */
+	uint32_t		scbr_flood_gen;
+	uint64_t		scbr_flood_want[VLAN_N_VID / 64];
+	struct bridge_flood_list *scbr_flood[VLAN_N_VID];
 };
 
 /*
@@ -147,6 +164,12 @@ void bridge_output(struct ifnet *ifp, struct rte_mbuf *m, struct ifnet *in_ifp);
 
 fal_object_t bridge_fal_stp_object(const struct ifnet *ifp);
 
+/*
+ * Port membership, vlan or STP state of the bridge has changed, so the
+ * flood lists must be rebuilt.
+ */
+void bridge_flood_invalidate(struct ifnet *bridge_ifp);
+
 struct ifnet *bridge_create(int ifindex, const char *ifname,
 			    unsigned int mtu,
 			    const struct rte_ether_addr *eth_addr);
@@ -11,6 +11,7 @@
 #include <string.h>
 #include <urcu/list.h>
 
+#include "bridge.h"
 #include "bridge_vlan_set.h"
 #include "mstp.h"
 #include "urcu.h"
@@ -126,6 +127,7 @@ void
 bridge_port_destroy(struct bridge_port *port)
 {
 	cds_list_del_rcu(&port->brlink);
+	bridge_flood_invalidate(port->bridge_ifp);
 
 	call_rcu(&port->rcu, bridge_port_rcu_free);
 }
@@ -135,6 +137,7 @@ bridge_port_set_state_msti(struct bridge_port *port, int mstiindex,
 			   uint8_t state)
 {
 	CMM_STORE_SHARED(port->state[mstiindex], state);
+	bridge_flood_invalidate(port->bridge_ifp);
 
 	const struct fal_attribute_t attr_list[2] = {
 		{FAL_STP_PORT_ATTR_INSTANCE,
@@ -159,6 +162,7 @@ void
 bridge_port_set_state(struct bridge_port *port, uint8_t state)
 {
 	CMM_STORE_SHARED(port->state[MSTP_MSTI_IST], state);
+	bridge_flood_invalidate(port->bridge_ifp);
 
 	const struct fal_attribute_t attr_list[2] = {
 		{FAL_STP_PORT_ATTR_INSTANCE,
@@ -179,6 +183,7 @@ void
 bridge_port_flush_vlans(struct bridge_port *port)
 {
 	bridge_vlan_set_clear(port->vlans);
+	bridge_flood_invalidate(port->bridge_ifp);
 }
 
 bool
@@ -191,7 +196,11 @@ bool
 bridge_port_synchronize_vlans(struct bridge_port *port,
 	struct bridge_vlan_set *new_vlans)
 {
-	return bridge_port_set_synchronize(port->vlans, new_vlans);
+	bool changed = bridge_port_set_synchronize(port->vlans, new_vlans);
+
+	if (changed)
+		bridge_flood_invalidate(port->bridge_ifp);
+	return changed;
 }
 
 bool
@@ -217,18 +226,21 @@ void
 bridge_port_add_untag_vlan(struct bridge_port *port, uint16_t vlan)
 {
 	bridge_vlan_set_add(port->untag_vlans, vlan);
+	bridge_flood_invalidate(port->bridge_ifp);
 }
 
 void
 bridge_port_remove_untag_vlan(struct bridge_port *port, uint16_t vlan)
 {
 	bridge_vlan_set_remove(port->untag_vlans, vlan);
+	bridge_flood_invalidate(port->bridge_ifp);
 }
 
 void
 bridge_port_flush_untag_vlans(struct bridge_port *port)
 {
 	bridge_vlan_set_clear(port->untag_vlans);
+	bridge_flood_invalidate(port->bridge_ifp);
 }
 
 bool
@@ -241,7 +253,12 @@ bool
 bridge_port_synchronize_untag_vlans(struct bridge_port *port,
 	struct bridge_vlan_set *new_untagged)
 {
-	return bridge_port_set_synchronize(port->untag_vlans, new_untagged);
+	bool changed = bridge_port_set_synchronize(port->untag_vlans,
+						   new_untagged);
+
+	if (changed)
+		bridge_flood_invalidate(port->bridge_ifp);
+	return changed;
 }
 
 bool
@@ -278,6 +295,7 @@ void bridge_port_add_to_list(struct bridge_port *port,
 			     struct cds_list_head *list)
 {
 	cds_list_add_tail_rcu(&port->brlink, list);
+	bridge_flood_invalidate(port->bridge_ifp);
 }
 
 bool bridge_port_is_vlan_member(struct bridge_port *port,
@@ -10,18 +10,24 @@
 #include <libmnl/libmnl.h>
 #include <netinet/in.h>
 #include <linux/if.h>
+#include <linux/if_ether.h>
 #include <linux/if_link.h>
 #include <rte_branch_prediction.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
 #include <rte_eth_bond.h>
 #include <rte_eth_bond_8023ad.h>
 #include <rte_ethdev.h>
 #include <rte_ether.h>
+#include <rte_jhash.h>
 #include <rte_lcore.h>
 #include <rte_log.h>
 #include <rte_mbuf.h>
+#include <rte_per_lcore.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <urcu/uatomic.h>
 #include <rte_eth_bond_8023ad.h>
@@ -30,6 +36,7 @@
 #include "capture.h"
 #include "compat.h"
 #include "dpdk_eth_if.h"
+#include "ecmp.h"
 #include "ether.h"
 #include "if_var.h"
 #include "json_writer.h"
@@ -172,6 +179,334 @@ dpdk_lag_create(const struct ifinfomsg *ifi, struct nlattr *tb[])
 	return ifp;
 }
 
+/*
+ * Software distributor for 802.3ad bonds.
+ *
+ * Rather than have the bonding PMD hash every packet, the flow hash is
+ * computed on a per-lcore flow cache miss and the member chosen for the
+ * flow is cached.  When a flow has been idle for longer than the flowlet
+ * gap it can be moved without reordering, so it is then moved to the
+ * member that this lcore has recently sent the fewest bytes on.
+ *
+ * The distributing members are snapshotted into an RCU protected
+ * lag_dist whenever the selection changes.  A flow whose member is still
+ * distributing keeps it across a change, so only the flows on a removed
+ * member are moved.
+ */
+#define LAG_FLOW_CACHE_SZ	512	/* must be a power of two */
+#define LAG_DIST_BURST		64
+#define LAG_FLOWLET_GAP_US	500
+#define LAG_LOAD_DECAY_US	1000
+
+struct lag_dist {
+	uint32_t	ld_gen;
+	uint16_t	ld_count;
+	portid_t	ld_members[LAG_MAX_SLAVES];
+	struct rcu_head	ld_rcu;
+};
+
+struct lag_flow_entry {
+	uint32_t	fe_hash;
+	uint32_t	fe_gen;
+	portid_t	fe_bond;
+	portid_t	fe_member;
+	uint64_t	fe_last;
+};
+
+struct lag_flow_cache {
+	struct lag_flow_entry	fc_flows[LAG_FLOW_CACHE_SZ];
+	uint64_t		fc_load[LAG_MAX_SLAVES];
+	uint64_t		fc_decay;
+};
+
+struct lag_member_stats {
+	uint64_t	tx_packets;
+	uint64_t	tx_bytes;
+	uint64_t	moves;
+};
+
+static struct lag_dist *lag_dist_tbl[DATAPLANE_MAX_PORTS];
+static uint32_t lag_dist_gen;
+static RTE_DEFINE_PER_LCORE(struct lag_flow_cache, lag_flow_cache);
+
+/* per-lcore, per-member port stats, indexed by lcore * LAG_MAX_SLAVES */
+static struct lag_member_stats *lag_member_stats;
+
+static uint64_t lag_flowlet_gap;
+static uint64_t lag_load_decay;
+
+static struct lag_member_stats *
+lag_member_stats_get(unsigned int lcore, portid_t port)
+{
+	return &lag_member_stats[lcore * LAG_MAX_SLAVES + port];
+}
+
+static int lag_dist_init(void)
+{
+	if (lag_member_stats)
+		return 0;
+
+	lag_member_stats = zmalloc_aligned((get_lcore_max() + 1) *
+					   LAG_MAX_SLAVES *
+					   sizeof(*lag_member_stats));
+	if (!lag_member_stats)
+		return -ENOMEM;
+
+	lag_flowlet_gap = rte_get_timer_hz() * LAG_FLOWLET_GAP_US / 1000000;
+	lag_load_decay = rte_get_timer_hz() * LAG_LOAD_DECAY_US / 1000000;
+	return 0;
+}
+
+static void lag_member_stats_clear(portid_t port)
+{
+	unsigned int lcore;
+
+	if (!lag_member_stats)
+		return;
+
+	FOREACH_DP_LCORE(lcore)
+		memset(lag_member_stats_get(lcore, port), 0,
+		       sizeof(*lag_member_stats));
+}
+
+static void lag_dist_free(struct rcu_head *head)
+{
+	free(caa_container_of(head, struct lag_dist, ld_rcu));
+}
+
+static void lag_dist_set(portid_t port, struct lag_dist *dist)
+{
+	struct lag_dist *old = lag_dist_tbl[port];
+
+	rcu_assign_pointer(lag_dist_tbl[port], dist);
+	if (old)
+		call_rcu(&old->ld_rcu, lag_dist_free);
+}
+
+/*
+ * Rebuild the distributing member list of a bond.  If the bond is not in
+ * 802.3ad mode, or there is no memory, the bonding PMD is left to
+ * distribute.
+ */
+static void lag_dist_update(struct ifnet *master)
+{
+	portid_t slaves[LAG_MAX_SLAVES];
+	struct lag_dist *dist = NULL;
+	int count, i;
+
+	if (rte_eth_bond_mode_get(master->if_port) == BONDING_MODE_8023AD &&
+	    lag_dist_init() == 0)
+		dist = zmalloc_aligned(sizeof(*dist));
+
+	if (dist) {
+		count = rte_eth_bond_slaves_get(master->if_port, slaves,
+						LAG_MAX_SLAVES);
+		for (i = 0; i < count; i++)
+			if (rte_eth_bond_8023ad_ext_distrib_get(
+				    master->if_port, slaves[i]) > 0)
+				dist->ld_members[dist->ld_count++] = slaves[i];
+		dist->ld_gen = uatomic_add_return(&lag_dist_gen, 1);
+	}
+
+	lag_dist_set(master->if_port, dist);
+}
+
+static uint32_t lag_dist_hash(const struct rte_mbuf *m)
+{
+	const struct rte_ether_hdr *eh =
+		rte_pktmbuf_mtod(m, const struct rte_ether_hdr *);
+	uint16_t ether_type = ntohs(eh->ether_type);
+
+	if (dp_pktmbuf_l2_len(m) == RTE_ETHER_HDR_LEN &&
+	    (ether_type == RTE_ETHER_TYPE_IPV4 ||
+	     ether_type == RTE_ETHER_TYPE_IPV6 ||
+	     ether_type == ETH_P_MPLS_UC))
+		return ecmp_mbuf_hash(m, ether_type);
+
+	/* non-IP, or tagged in software: hash the addresses */
+	return rte_jhash(eh, 2 * RTE_ETHER_ADDR_LEN, ether_type);
+}
+
+static bool lag_dist_is_member(const struct lag_dist *dist, portid_t port)
+{
+	unsigned int i;
+
+	for (i = 0; i < dist->ld_count; i++)
+		if (dist->ld_members[i] == port)
+			return true;
+	return false;
+}
+
+static portid_t lag_dist_least_loaded(const struct lag_dist *dist,
+				      const struct lag_flow_cache *fc)
+{
+	portid_t best = dist->ld_members[0];
+	unsigned int i;
+
+	for (i = 1; i < dist->ld_count; i++)
+		if (fc->fc_load[dist->ld_members[i]] < fc->fc_load[best])
+			best = dist->ld_members[i];
+	return best;
+}
+
+/* Return the member to send a packet on, assigning its flow if need be */
+static portid_t lag_dist_member(const struct lag_dist *dist, portid_t bond,
+				struct lag_flow_cache *fc,
+				const struct rte_mbuf *m, uint64_t now,
+				unsigned int lcore)
+{
+	uint32_t hash = lag_dist_hash(m);
+	struct lag_flow_entry *fe =
+		&fc->fc_flows[(hash ^ bond) & (LAG_FLOW_CACHE_SZ - 1)];
+	portid_t member;
+
+	if (likely(fe->fe_hash == hash && fe->fe_bond == bond)) {
+		if (likely(fe->fe_gen == dist->ld_gen) ||
+		    lag_dist_is_member(dist, fe->fe_member)) {
+			fe->fe_gen = dist->ld_gen;
+			member = fe->fe_member;
+
+			/* flowlet boundary, so can move without reordering */
+			if (unlikely(now - fe->fe_last > lag_flowlet_gap)) {
+				portid_t least = lag_dist_least_loaded(dist,
+								       fc);
+
+				if (fc->fc_load[least] < fc->fc_load[member]) {
+					member = least;
+					lag_member_stats_get(lcore,
+							     member)->moves++;
+				}
+			}
+			goto out;
+		}
+	}
+
+	/* scale the hash onto the members, whatever the ecmp mode */
+	member = dist->ld_members[((uint64_t)hash * dist->ld_count) >> 32];
+	fe->fe_hash = hash;
+	fe->fe_bond = bond;
+	fe->fe_gen = dist->ld_gen;
+out:
+	fe->fe_member = member;
+	fe->fe_last = now;
+	return member;
+}
+
+static uint16_t
+lag_dist_tx_chunk(const struct lag_dist *dist, portid_t bond,
+		  uint16_t queue_id, struct rte_mbuf **tx_pkts,
+		  uint16_t nb_pkts)
+{
+	struct lag_flow_cache *fc = &RTE_PER_LCORE(lag_flow_cache);
+	struct rte_mbuf *bufs[LAG_DIST_BURST];
+	struct rte_mbuf *unsent[LAG_DIST_BURST];
+	portid_t member[LAG_DIST_BURST];
+	unsigned int lcore = dp_lcore_id();
+	uint16_t nb_sent = 0, nb_unsent = 0;
+	uint64_t now = rte_get_timer_cycles();
+	unsigned int i, j;
+
+	if (unlikely(now - fc->fc_decay > lag_load_decay)) {
+		for (i = 0; i < dist->ld_count; i++)
+			fc->fc_load[dist->ld_members[i]] >>= 1;
+		fc->fc_decay = now;
+	}
+
+	for (i = 0; i < nb_pkts; i++)
+		member[i] = lag_dist_member(dist, bond, fc, tx_pkts[i], now,
+					    lcore);
+
+	for (i = 0; i < dist->ld_count; i++) {
+		portid_t port = dist->ld_members[i];
+		struct lag_member_stats *stats;
+		uint16_t cnt = 0, sent;
+		uint64_t bytes = 0;
+
+		for (j = 0; j < nb_pkts; j++)
+			if (member[j] == port)
+				bufs[cnt++] = tx_pkts[j];
+		if (!cnt)
+			continue;
+
+		sent = rte_eth_tx_burst(port, queue_id, bufs, cnt);
+		for (j = 0; j < sent; j++)
+			bytes += rte_pktmbuf_pkt_len(bufs[j]);
+		for (j = sent; j < cnt; j++)
+			unsent[nb_unsent++] = bufs[j];
+
+		stats = lag_member_stats_get(lcore, port);
+		stats->tx_packets += sent;
+		stats->tx_bytes += bytes;
+		fc->fc_load[port] += bytes;
+		nb_sent += sent;
+	}
+
+	/* callers expect whatever was not sent at the end of the burst */
+	memcpy(&tx_pkts[nb_sent], unsent, nb_unsent * sizeof(unsent[0]));
+	return nb_sent;
+}
+
+/*
+ * Transmit a burst on a bond, returning the number sent.  As with
+ * rte_eth_tx_burst, the packets not sent are left at the end of tx_pkts.
+ */
+uint16_t dpdk_lag_tx_burst(struct ifnet *ifp, uint16_t queue_id,
+			   struct rte_mbuf **tx_pkts, uint16_t nb_pkts)
+{
+	struct lag_dist *dist = rcu_dereference(lag_dist_tbl[ifp->if_port]);
+	uint16_t sent = 0, n, done;
+
+	if (!dist || !dist->ld_count)
+		return rte_eth_tx_burst(ifp->if_port, queue_id,
+					tx_pkts, nb_pkts);
+
+	/* let the bonding PMD send any queued LACPDUs */
+	rte_eth_tx_burst(ifp->if_port, queue_id, NULL, 0);
+
+	while (sent < nb_pkts) {
+		n = RTE_MIN(nb_pkts - sent, LAG_DIST_BURST);
+		done = lag_dist_tx_chunk(dist, ifp->if_port, queue_id,
+					 &tx_pkts[sent], n);
+		sent += done;
+		if (done < n)
+			break;
+	}
+	return sent;
+}
+
+/*
+ * Distribute over the given members when transmitting on port, which need
+ * not be a bond, for the unit tests.  A count of 0 removes the distributor.
+ */
+int dpdk_lag_dist_set_ut(portid_t port, const portid_t *members,
+			 uint16_t count)
+{
+	struct lag_dist *dist = NULL;
+	uint16_t i;
+
+	if (count > LAG_MAX_SLAVES)
+		return -EINVAL;
+
+	if (count) {
+		if (lag_dist_init() < 0)
+			return -ENOMEM;
+
+		dist = zmalloc_aligned(sizeof(*dist));
+		if (!dist)
+			return -ENOMEM;
+
+		for (i = 0; i < count; i++) {
+			dist->ld_members[i] = members[i];
+			lag_member_stats_clear(members[i]);
+		}
+		dist->ld_count = count;
+		dist->ld_gen = uatomic_add_return(&lag_dist_gen, 1);
+	}
+
+	lag_dist_set(port, dist);
+	return 0;
+}
+
 static int slave_add(struct ifnet *master, struct ifnet *ifp)
 {
 	int rv;
@@ -237,6 +572,7 @@ static int slave_add(struct ifnet *master, struct ifnet *ifp)
 	rte_smp_mb();
 
 	rcu_assign_pointer(ifp->aggregator, master);
+	lag_member_stats_clear(ifp->if_port);
 
 	return 0;
 }
@@ -265,6 +601,7 @@ static int slave_remove(struct ifnet *master, struct ifnet *ifp)
 
 	/* clear RCU protected aggregator pointer */
 	ifp->aggregator = NULL;
+	lag_dist_update(master);
 
 	/*
 	 * Force the port to be stopped since it will have been
@@ -324,6 +661,7 @@ static int dpdk_lag_mode_set_balance(struct ifnet *ifp)
 
 
 	rte_eth_bond_xmit_policy_set(ifp->if_port, BALANCE_XMIT_POLICY_LAYER34);
+	lag_dist_update(ifp);
 
 	return 0;
 }
@@ -340,6 +678,7 @@ static int dpdk_lag_mode_set_activebackup(struct ifnet *ifp)
 	rv = rte_eth_bond_mode_set(ifp->if_port, BONDING_MODE_ACTIVE_BACKUP);
 	if (rv < 0)
 		return rv;
+	lag_dist_update(ifp);
 
 	if (dev_started)
 		rte_eth_dev_start(ifp->if_port);
@@ -376,6 +715,7 @@ static int dpdk_lag_select(struct ifnet *ifp, bool sel)
 		DP_DEBUG(LAG, ERR, DATAPLANE, "cannot set distributing flag\n");
 		return -1;
 	}
+	lag_dist_update(ifp->aggregator);
 
 	return 0;
 }
@@ -429,6 +769,7 @@ static void dpdk_lag_delete(struct ifnet *master_ifp)
 			}
 		}
 	}
+	lag_dist_set(port_id, NULL);
 	remove_port(port_id);
 	if_free(master_ifp);
 
@@ -572,6 +913,47 @@ static bool lag_slave_is_active(portid_t active[], int len, uint16_t portid)
 	return false;
 }
 
+static void lag_member_stats_sum(portid_t port, struct lag_member_stats *sum)
+{
+	const struct lag_member_stats *stats;
+	unsigned int lcore;
+
+	memset(sum, 0, sizeof(*sum));
+	if (!lag_member_stats)
+		return;
+
+	FOREACH_DP_LCORE(lcore) {
+		stats = lag_member_stats_get(lcore, port);
+		sum->tx_packets += CMM_LOAD_SHARED(stats->tx_packets);
+		sum->tx_bytes += CMM_LOAD_SHARED(stats->tx_bytes);
+		sum->moves += CMM_LOAD_SHARED(stats->moves);
+	}
+}
+
+void dpdk_lag_member_stats_ut(portid_t port, uint64_t *tx_packets,
+			      uint64_t *moves)
+{
+	struct lag_member_stats sum;
+
+	lag_member_stats_sum(port, &sum);
+	*tx_packets = sum.tx_packets;
+	*moves = sum.moves;
+}
+
+static void lag_member_stats_show(portid_t port, json_writer_t *wr)
+{
+	struct lag_member_stats sum;
+
+	if (!lag_member_stats)
+		return;
+
+	lag_member_stats_sum(port, &sum);
+
+	jsonw_uint_field(wr, "tx-packets", sum.tx_packets);
+	jsonw_uint_field(wr, "tx-bytes", sum.tx_bytes);
+	jsonw_uint_field(wr, "flowlet-moves", sum.moves);
+}
+
 static void dpdk_lag_show_detail(struct ifnet *node, json_writer_t *wr)
 {
 	int num_slaves;
@@ -637,6 +1019,7 @@ static void dpdk_lag_show_detail(struct ifnet *node, json_writer_t *wr)
 				jsonw_end_object(wr);
 				jsonw_end_array(wr);
 			}
+			lag_member_stats_show(sl->if_port, wr);
 		}
 
 		jsonw_end_object(wr);
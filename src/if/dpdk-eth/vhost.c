@@ -49,6 +49,7 @@ struct vhost_info {
 	char *qemu_ifname;		/**< QEMU name for guest interface */
 	struct cds_list_head transport_links;
 					/**< Monitored interfaces -- if any */
+	bool zero_copy;			/**< Guest tx dequeued without copy */
 };
 
 /*
@@ -220,6 +221,9 @@ void vhost_devinfo(json_writer_t *wr, const struct ifnet *ifp)
 		if (vi->qemu_ifname)
 			jsonw_string_field(wr, "qemu_ifname",
 					       vi->qemu_ifname);
+		jsonw_bool_field(wr, "zero_copy", vi->zero_copy);
+		jsonw_int_field(wr, "numa_node",
+				rte_eth_dev_socket_id(ifp->if_port));
 		jsonw_name(wr, "transport_links");
 		jsonw_start_array(wr);
 		cds_list_for_each_entry(entry, &vi->transport_links, list)
@@ -323,7 +327,7 @@ static int cmd_vhost_set_qemu_ifname(char *name, char *qemu_ifname)
 }
 
 static int cmd_vhost_enable(char *ifname, char *queues, char *path, char *alias,
-			    bool on_master, bool is_client)
+			    bool zero_copy, bool on_master, bool is_client)
 {
 	int rc;
 	char *devargs_p;
@@ -340,10 +344,19 @@ static int cmd_vhost_enable(char *ifname, char *queues, char *path, char *alias,
 		return -1;
 	}
 
-	/* Construct "eth_vhost1,iface=/run/dataplane/eth_vhost1" with */
-	size = asprintf(&devargs_p, "eth_%s,iface=%s%s%s%s%s",
+	/*
+	 * Construct "eth_vhost1,iface=/run/dataplane/eth_vhost1" with
+	 * options.  With dequeue zero copy the mbufs received from the guest
+	 * point at the guest's buffers, rather than the forwarding core
+	 * copying each packet out of the virtio ring.  The guest cannot
+	 * reuse a buffer until its mbuf is freed, so anything that holds
+	 * packets (ARP hold queues, fragment reassembly, QoS queues) ties
+	 * up guest memory and may stall the guest's tx ring.
+	 */
+	size = asprintf(&devargs_p, "eth_%s,iface=%s%s%s%s%s%s",
 			p, dev_basename, p, is_client ? ",client=1" : "",
-			queues ? ",queues=" : "", queues ? queues : "");
+			queues ? ",queues=" : "", queues ? queues : "",
+			zero_copy ? ",dequeue-zero-copy=1" : "");
 	if (size == -1)
 		return -1;
 
@@ -375,6 +388,8 @@ static int cmd_vhost_enable(char *ifname, char *queues, char *path, char *alias,
 		ifp = vhost_byname(ifname);
 		if (ifp) {
 			rc = vhost_info_alloc(ifp);
+			if (!rc)
+				get_vhost_info(ifp)->zero_copy = zero_copy;
 			if (!rc && path)
 				cmd_vhost_set_qmp_path(ifname, path);
 			if (!rc && alias)
@@ -701,6 +716,7 @@ static int __cmd_vhost(const char *cmd,
 	char *queues = NULL;
 	char *path = NULL;
 	char *alias = NULL;
+	bool zero_copy = false;
 	int rc;
 
 	if (argc < 3)
@@ -725,12 +741,15 @@ static int __cmd_vhost(const char *cmd,
 				if (i >= argc)
 					goto bad_command;
 				alias = argv[i++];
+			} else if (strcmp(argv[i], "-z") == 0) {
+				i++;
+				zero_copy = true;
 			} else
 				goto bad_command;
 		}
 
-		rc = cmd_vhost_enable(argv[2],
-				      queues, path, alias, true, is_client);
+		rc = cmd_vhost_enable(argv[2], queues, path, alias,
+				      zero_copy, true, is_client);
 	} else if (strcmp(argv[1], "disable") == 0 && argc == 3)
 		rc = cmd_vhost_disable(argv[2], false);
 	else if (strcmp(argv[1], "set-qmp-path") == 0 && argc == 4)
@@ -744,10 +763,13 @@ static int __cmd_vhost(const char *cmd,
 
 bad_command:
 	fprintf(f, "usage: %s enable <string> "
-		   "[-q queues] [-a alias] [-p path]\n", cmd);
+		   "[-q queues] [-a alias] [-p path] [-z]\n", cmd);
 	fprintf(f, "       %s disable <string>\n", cmd);
 	fprintf(f, "       %s set-qmp-path name path\n", cmd);
 	fprintf(f, "       %s set-qemu-ifname name qemu-ifname\n", cmd);
+	fprintf(f, "  -z: dequeue zero copy; received mbufs hold guest "
+		   "buffers until freed, so packets must not be held long "
+		   "(ARP hold, reassembly, QoS queues)\n");
 	return -1;
 }
 
@@ -767,6 +789,7 @@ static int __cmd_vhost_cfg(const char *cmd,
 	char *queues = NULL;
 	char *path = NULL;
 	char *alias = NULL;
+	bool zero_copy = false;
 	int rc;
 
 	if (argc < 3)
@@ -791,12 +814,15 @@ static int __cmd_vhost_cfg(const char *cmd,
 				if (i >= argc)
 					goto bad_command;
 				alias = argv[i++];
+			} else if (strcmp(argv[i], "-z") == 0) {
+				i++;
+				zero_copy = true;
 			} else
 				goto bad_command;
 		}
 
-		rc = cmd_vhost_enable(argv[2],
-				      queues, path, alias, true, is_client);
+		rc = cmd_vhost_enable(argv[2], queues, path, alias,
+				      zero_copy, true, is_client);
 	} else if (strcmp(argv[1], "disable") == 0 && argc == 3)
 		rc = cmd_vhost_disable(argv[2], true);
 	else if (strcmp(argv[1], "transport-link") == 0 && argc == 5) {
@@ -816,10 +842,14 @@ static int __cmd_vhost_cfg(const char *cmd,
 
 bad_command:
 	if (f) {
-		fprintf(f, "usage: %s enable <string> [-q <queues>]\n", cmd);
+		fprintf(f, "usage: %s enable <string> [-q <queues>] [-z]\n",
+			cmd);
 		fprintf(f, "       %s disable <string>\n", cmd);
 		fprintf(f, "       %s transport-link <vhost_name> "
 			   "<transport_name> add|del\n", cmd);
+		fprintf(f, "  -z: dequeue zero copy; received mbufs hold "
+			   "guest buffers until freed, so packets must not "
+			   "be held long (ARP hold, reassembly, QoS queues)\n");
 	}
 	return -1;
 }
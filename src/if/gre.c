@@ -33,6 +33,7 @@
 #include <rte_log.h>
 #include <rte_mbuf.h>
 #include <rte_memory.h>
+#include <rte_per_lcore.h>
 #include <rte_timer.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -70,6 +71,7 @@
 #include "rt_tracker.h"
 #include "shadow.h"
 #include "snmp_mib.h"
+#include "util.h"
 #include "vplane_log.h"
 #include "vrf_internal.h"
 #include "fal_plugin.h"
@@ -103,6 +105,42 @@ struct gre_softc {
 #define GRE_RTHASH_MIN  32
 #define GRE_RTHASH_MAX  64
 
+/*
+ * Per-lcore direct-mapped caches in front of the gre_info tables, used on
+ * decap, and the mGRE peer tables, used on encap.  A miss falls back to
+ * the tables, and only what is found there is cached.  Adding or removing
+ * a gre_info or mGRE peer bumps the generation, which invalidates every
+ * cache, so a cached pointer is never used once its object is freed.
+ */
+#define GRE_TUN_CACHE_SZ	256	/* must be a power of two */
+
+struct gre_tun_cache_entry {
+	struct gre_info_hash_key tc_key;
+	vrfid_t			tc_vrfid;
+	uint32_t		tc_gen;
+	struct gre_info_st	*tc_greinfo;
+};
+
+struct mgre_peer_cache_entry {
+	const struct gre_softc	*pc_sc;
+	in_addr_t		pc_tun_addr;
+	uint32_t		pc_gen;
+	struct mgre_rt_info	*pc_rt_info;
+};
+
+struct gre_tun_cache {
+	struct gre_tun_cache_entry	tc_tun[GRE_TUN_CACHE_SZ];
+	struct mgre_peer_cache_entry	tc_peer[GRE_TUN_CACHE_SZ];
+};
+
+static RTE_DEFINE_PER_LCORE(struct gre_tun_cache, gre_tun_cache);
+static uint32_t gre_tun_gen;
+
+static void gre_tun_cache_invalidate(void)
+{
+	uatomic_inc(&gre_tun_gen);
+}
+
 static void gre_tunnel_delete(struct ifnet *ifp);
 static void gre_tunnel_update_tep(void *ctx);
 
@@ -169,6 +207,7 @@ gre_info_free(struct rcu_head *head)
 static void
 gre_info_destroy(struct gre_info_st *greinfo)
 {
+	gre_tun_cache_invalidate();
 	call_rcu(&greinfo->gre_rcu, gre_info_free);
 }
 
@@ -234,8 +273,12 @@ gre_info_insert(struct gre_infotbl_st *gre_infos, struct gre_info_st *greinfo,
 	ret_node = cds_lfht_add_unique(gre_infos->gi_grehash, hash,
 				       gre_info_match, greinfo,
 				       &greinfo->gre_node);
+	if (ret_node != &greinfo->gre_node)
+		return EEXIST;
 
-	return (ret_node != &greinfo->gre_node) ? EEXIST : 0;
+	/* May be more specific than a cached wildcard remote match */
+	gre_tun_cache_invalidate();
+	return 0;
 }
 
 static struct gre_info_st *
@@ -256,6 +299,83 @@ gre_info_lookup(struct gre_infotbl_st *gre_infos,
 		return NULL;
 }
 
+static inline bool
+gre_tun_cache_key_eq(const struct gre_info_hash_key *a,
+		     const struct gre_info_hash_key *b)
+{
+	if (a->family != b->family || a->key != b->key ||
+	    ((a->flags ^ b->flags) & GRE_KEY))
+		return false;
+
+	if (a->family == AF_INET)
+		return a->local == b->local && a->remote == b->remote;
+
+	return IN6_ARE_ADDR_EQUAL(&a->local6, &b->local6) &&
+		IN6_ARE_ADDR_EQUAL(&a->remote6, &b->remote6);
+}
+
+/*
+ * Find the gre_info for a received packet, first in the per-lcore cache.
+ * An IPv4 packet that matches no tunnel may match one with any remote.
+ */
+static struct gre_info_st *
+gre_info_cache_lookup(struct vrf *vrf, struct gre_info_hash_key *h_key)
+{
+	struct gre_tun_cache_entry *tc;
+	struct gre_info_hash_key orig;
+	struct gre_info_st *greinfo;
+	uint32_t gen = CMM_LOAD_SHARED(gre_tun_gen);
+
+	tc = &RTE_PER_LCORE(gre_tun_cache).tc_tun[
+		gre_info_hash(h_key, vrf->v_id) & (GRE_TUN_CACHE_SZ - 1)];
+	if (likely(tc->tc_greinfo && tc->tc_gen == gen &&
+		   tc->tc_vrfid == vrf->v_id &&
+		   gre_tun_cache_key_eq(&tc->tc_key, h_key)))
+		return tc->tc_greinfo;
+
+	orig = *h_key;
+	greinfo = gre_info_lookup(vrf->v_gre_infos, h_key);
+	if (!greinfo && h_key->family == AF_INET) {
+		h_key->remote = INADDR_ANY;
+		greinfo = gre_info_lookup(vrf->v_gre_infos, h_key);
+	}
+
+	if (greinfo) {
+		tc->tc_key = orig;
+		tc->tc_vrfid = vrf->v_id;
+		tc->tc_gen = gen;
+		tc->tc_greinfo = greinfo;
+	}
+	return greinfo;
+}
+
+/*
+ * The outer IPv4 header templates carry their own checksum, taken with a
+ * zero length and id.  Each packet then only folds in the words that it
+ * changes, rather than summing the whole header.
+ */
+static void
+gre_iph_tmpl_cksum(struct iphdr *iph)
+{
+	iph->check = 0;
+	iph->check = dp_in_cksum_hdr(iph);
+}
+
+static inline uint16_t
+gre_iph_tmpl_cksum_fixup(const struct iphdr *tmpl, const struct iphdr *ip)
+{
+	const uint16_t *o = (const uint16_t *)tmpl;
+	const uint16_t *n = (const uint16_t *)ip;
+	uint16_t check = tmpl->check;
+	unsigned int i;
+
+	/* tos, tot_len, id, frag_off and ttl are in the first five words */
+	for (i = 0; i < 5; i++)
+		if (o[i] != n[i])
+			check = ip_fixup16_cksum(check, o[i], n[i]);
+	return check;
+}
+
 static struct gre_info_st *
 gre_info_init(struct vrf *vrf, const struct gre_info_hash_key *h_key)
 {
@@ -279,6 +399,7 @@ gre_info_init(struct vrf *vrf, const struct gre_info_hash_key *h_key)
 		greinfo->iph.version = IPVERSION;
 		greinfo->iph.frag_off = htons(IP_DF);
 		greinfo->iph.tos = 0;
+		gre_iph_tmpl_cksum(&greinfo->iph);
 		greinfo->family = AF_INET;
 	} else {
 		greinfo->iph6.ip6_src = h_key->local6;
@@ -314,16 +435,39 @@ gre_info_init(struct vrf *vrf, const struct gre_info_hash_key *h_key)
 	return greinfo;
 }
 
+static uint64_t
+mgre_rtinfo_tx_packets(const struct mgre_rt_info *rtinfo)
+{
+	uint64_t tx_packets = 0;
+	unsigned int i;
+
+	FOREACH_DP_LCORE(i)
+		tx_packets += CMM_LOAD_SHARED(rtinfo->rt_stats[i].tx_packets);
+	return tx_packets;
+}
+
 static void
 mgre_timer(struct rte_timer *tim __rte_unused, void *arg)
 {
 	struct gre_softc *sc = arg;
 	struct mgre_rt_info *rtinfo;
 	struct cds_lfht_iter iter;
+	uint64_t tx_packets;
 
 	rcu_read_lock();
 	cds_lfht_for_each_entry(sc->scg_rtinfo_hash_nbma, &iter,
 				rtinfo, rtinfo_node_nbma) {
+		/*
+		 * The forwarding threads only count packets sent to the
+		 * peer, so it has been used if the count has moved on.
+		 */
+		tx_packets = mgre_rtinfo_tx_packets(rtinfo);
+		if (tx_packets != rtinfo->rt_tx_seen) {
+			rtinfo->rt_tx_seen = tx_packets;
+			CMM_ACCESS_ONCE(rtinfo->rt_info_bits) |=
+						RT_INFO_BIT_IS_USED;
+		}
+
 		/*
 		 * Use two bits to determine if the rt_info has not be used for
 		 * at least the period of the timer.
@@ -382,9 +526,18 @@ mgre_rtinfo_free(struct rcu_head *head)
 static void
 mgre_rtinfo_destroy(struct mgre_rt_info *rtinfo)
 {
+	gre_tun_cache_invalidate();
 	call_rcu(&rtinfo->rtinfo_rcu, mgre_rtinfo_free);
 }
 
+static struct mgre_rt_info *
+mgre_rtinfo_alloc(void)
+{
+	return zmalloc_aligned(sizeof(struct mgre_rt_info) +
+			       (get_lcore_max() + 1) *
+			       sizeof(struct mgre_rt_info_stats));
+}
+
 static inline unsigned long
 mgre_rtinfo_hash(const struct in_addr *tun_addr, unsigned long seed)
 {
@@ -459,6 +612,31 @@ mgre_rtinfo_lookup(struct gre_softc *sc, const struct in_addr *addr)
 	return NULL;
 }
 
+/* Find the mGRE peer to send to, first in the per-lcore cache */
+static struct mgre_rt_info *
+mgre_rtinfo_cache_lookup(struct gre_softc *sc, const struct in_addr *addr)
+{
+	struct mgre_peer_cache_entry *pc;
+	struct mgre_rt_info *rt_info;
+	uint32_t gen = CMM_LOAD_SHARED(gre_tun_gen);
+
+	pc = &RTE_PER_LCORE(gre_tun_cache).tc_peer[
+		mgre_rtinfo_hash(addr, sc->scg_rtinfo_seed) &
+		(GRE_TUN_CACHE_SZ - 1)];
+	if (likely(pc->pc_rt_info && pc->pc_gen == gen && pc->pc_sc == sc &&
+		   pc->pc_tun_addr == addr->s_addr))
+		return pc->pc_rt_info;
+
+	rt_info = mgre_rtinfo_lookup(sc, addr);
+	if (rt_info) {
+		pc->pc_sc = sc;
+		pc->pc_tun_addr = addr->s_addr;
+		pc->pc_gen = gen;
+		pc->pc_rt_info = rt_info;
+	}
+	return rt_info;
+}
+
 /*
  * Return values:
  *  0 - Success
@@ -515,6 +693,7 @@ mgre_rtinfo_insert(struct gre_softc *sc, struct mgre_rt_info *rt_info,
 		return -1;
 	}
 
+	gre_tun_cache_invalidate();
 	return 0;
 }
 
@@ -578,6 +757,7 @@ gre_tunnel_set_params(struct gre_info_st *greinfo,
 		if (gre_attr[IFLA_GRE_IGNORE_DF])
 			greinfo->ignore_df =
 				!!mnl_attr_get_u8(gre_attr[IFLA_GRE_IGNORE_DF]);
+		gre_iph_tmpl_cksum(&greinfo->iph);
 	} else {
 		uint8_t tos;
 
@@ -1248,7 +1428,7 @@ mgre_newneigh(struct ifnet *ifp,
 	if (!greinfo)
 		return MNL_CB_ERROR;
 
-	rt_info = zmalloc_aligned(sizeof(*rt_info));
+	rt_info = mgre_rtinfo_alloc();
 	if (!rt_info) {
 		RTE_LOG(ERR, GRE,
 			"out of memory for mGRE routing info entry\n");
@@ -1264,6 +1444,7 @@ mgre_newneigh(struct ifnet *ifp,
 	rt_info->iph.frag_off = htons(IP_DF);
 	rt_info->iph.saddr = greinfo->iph.saddr;
 	rt_info->iph.daddr = nbma_addr->s_addr;
+	gre_iph_tmpl_cksum(&rt_info->iph);
 	rt_info->tun_addr.s_addr = tun_addr->s_addr;
 	rt_info->nbma_vrfid = nbma_vrfid;
 	rt_info->rt_info_bits = 0;
@@ -1326,6 +1507,7 @@ mgre_newneigh(struct ifnet *ifp,
 	sub_greinfo->iph.ttl = greinfo->iph.ttl;
 	sub_greinfo->ifp = ifp;
 	rt_info->greinfo = sub_greinfo;
+	rcu_assign_pointer(sub_greinfo->rtinfo, rt_info);
 	return MNL_CB_OK;
 }
 
@@ -1469,6 +1651,7 @@ gre_parse(const struct rte_mbuf *m, struct gre_info_hash_key *h_key,
 	uint16_t gre_hdr_len;
 	uint32_t i_seqno;
 	bool i_seq_flag;
+	struct mgre_rt_info *rt_info;
 	struct ifnet *tun_ifp;
 
 	struct vrf *vrf;
@@ -1502,14 +1685,7 @@ gre_parse(const struct rte_mbuf *m, struct gre_info_hash_key *h_key,
 
 	h_key->flags = gre->flags;
 	*next_prot = ntohs(gre->ptype);
-	greinfo = gre_info_lookup(vrf->v_gre_infos, h_key);
-	if (!greinfo) {
-		if (h_key->family == AF_INET) {
-			h_key->remote = INADDR_ANY;
-			greinfo = gre_info_lookup(vrf->v_gre_infos, h_key);
-		}
-	}
-
+	greinfo = gre_info_cache_lookup(vrf, h_key);
 	if (!greinfo)
 		return NULL;
 
@@ -1526,6 +1702,10 @@ gre_parse(const struct rte_mbuf *m, struct gre_info_hash_key *h_key,
 	if (!tun_ifp || !(tun_ifp->if_flags & IFF_UP))
 		return NULL;
 
+	rt_info = rcu_dereference(greinfo->rtinfo);
+	if (rt_info)
+		rt_info->rt_stats[dp_lcore_id()].rx_packets++;
+
 	return tun_ifp;
 }
 
@@ -1810,8 +1990,7 @@ gre_tunnel_add_encap(struct ifnet *tunnel_ifp, struct rte_mbuf *m,
 	if (proto == ETH_P_NHRP)
 		ip->tos |= IPTOS_PREC_INTERNETCONTROL;
 	ip->id = dp_ip_randomid(0);
-	ip->check = 0;
-	ip->check = dp_in_cksum_hdr(ip);
+	ip->check = gre_iph_tmpl_cksum_fixup(outer_ip, ip);
 
 	eth_hdr = (struct rte_ether_hdr *)hdr;
 	eth_hdr->ether_type = htons(ETH_P_IP);
@@ -2056,13 +2235,12 @@ gre_tunnel_encap(struct ifnet *input_ifp, struct ifnet *tunnel_ifp,
 		struct in_addr tun_addr;
 
 		tun_addr.s_addr = *nxt_ip;
-		rt_info = mgre_rtinfo_lookup(sc, &tun_addr);
+		rt_info = mgre_rtinfo_cache_lookup(sc, &tun_addr);
 		if (rt_info) {
 			outer_ip = &rt_info->iph;
 			t_vrfid = rt_info->nbma_vrfid;
-			/* Set rt_info to used since the last timer reset */
-			CMM_ACCESS_ONCE(rt_info->rt_info_bits) |=
-							RT_INFO_BIT_IS_USED;
+			/* Picked up as a use by the next mgre_timer */
+			rt_info->rt_stats[dp_lcore_id()].tx_packets++;
 		} else {
 			goto slow_path;
 		}
@@ -2470,10 +2648,16 @@ static void neighbor_dump(struct ifnet *ifp,
 	json_writer_t *json = arg;
 	char b1[INET_ADDRSTRLEN];
 	char b2[INET_ADDRSTRLEN];
+	uint64_t rx_packets = 0, tx_packets;
+	unsigned int i;
 
 	if (!peer) /* not mgre */
 		return;
 
+	FOREACH_DP_LCORE(i)
+		rx_packets += CMM_LOAD_SHARED(peer->rt_stats[i].rx_packets);
+	tx_packets = mgre_rtinfo_tx_packets(peer);
+
 	jsonw_start_object(json);
 	jsonw_string_field(json, "ifname", ifp->if_name);
 	jsonw_string_field(json, "ip", inet_ntop(AF_INET, &peer->tun_addr,
@@ -2481,8 +2665,11 @@ static void neighbor_dump(struct ifnet *ifp,
 	jsonw_string_field(json, "nbma", inet_ntop(AF_INET, &peer->iph.daddr,
 						   b2, sizeof(b2)));
 	jsonw_bool_field(json, "used",
-			 (CMM_ACCESS_ONCE(peer->rt_info_bits) &
-			 (RT_INFO_BIT_IS_USED|RT_INFO_BIT_WAS_USED)) ? 1 : 0);
+			 (tx_packets != peer->rt_tx_seen ||
+			  (CMM_ACCESS_ONCE(peer->rt_info_bits) &
+			   (RT_INFO_BIT_IS_USED|RT_INFO_BIT_WAS_USED))) ? 1 : 0);
+	jsonw_uint_field(json, "rx_packets", rx_packets);
+	jsonw_uint_field(json, "tx_packets", tx_packets);
 	jsonw_end_object(json);
 }
 
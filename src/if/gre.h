@@ -22,6 +22,7 @@
 #include <linux/rtnetlink.h>
 #include <linux/if_ether.h>
 #include <netinet/ip.h>
+#include <rte_memory.h>
 #include <rte_timer.h>
 
 #include "json_writer.h"
@@ -72,6 +73,15 @@ struct gre_info_st {
 	struct rt_tracker_info *ti_info;
 };
 
+/*
+ * Per-lcore packet counts for an mGRE peer.  Each lcore has its own cache
+ * line so that the counts are not shared between forwarding threads.
+ */
+struct mgre_rt_info_stats {
+	uint64_t             rx_packets;
+	uint64_t             tx_packets;
+} __rte_cache_aligned;
+
 struct mgre_rt_info {
 	struct cds_lfht_node rtinfo_node_tun;
 	struct cds_lfht_node rtinfo_node_nbma;
@@ -81,6 +91,8 @@ struct mgre_rt_info {
 	uint32_t             rt_info_bits;
 	struct rcu_head      rtinfo_rcu;
 	struct gre_info_st   *greinfo;
+	uint64_t             rt_tx_seen; /* tx_packets at the last mgre_timer */
+	struct mgre_rt_info_stats rt_stats[]; /* indexed by dp_lcore_id() */
 };
 
 /*
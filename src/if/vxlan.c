@@ -39,6 +39,7 @@
 #include <rte_log.h>
 #include <rte_mbuf.h>
 #include <rte_memory.h>
+#include <rte_per_lcore.h>
 #include <rte_timer.h>
 #include <rte_udp.h>
 
@@ -68,6 +69,7 @@
 #include "pl_fused.h"
 #include "route.h"
 #include "route_flags.h"
+#include "rt_tracker.h"
 #include "shadow.h"
 #include "snmp_mib.h"
 #include "udp_handler.h"
@@ -191,6 +193,45 @@ vxlan_vni_lookup(uint32_t vni)
 		return NULL;
 }
 
+/*
+ * Per-lcore direct-mapped cache of VNI nodes, in front of the VNI table.
+ * Only VNIs that are found are cached.  Deleting a VNI bumps the
+ * generation, which invalidates every cache.  A node found in the cache
+ * is freed via rcu, so remains valid until the lcore next goes quiescent.
+ */
+#define VXLAN_VNI_CACHE_SZ	64	/* must be a power of two */
+
+struct vxlan_vni_cache_entry {
+	uint32_t		vc_vni;
+	uint32_t		vc_gen;
+	struct vxlan_vninode	*vc_vnode;
+};
+
+struct vxlan_vni_cache {
+	struct vxlan_vni_cache_entry vc_entry[VXLAN_VNI_CACHE_SZ];
+};
+
+static RTE_DEFINE_PER_LCORE(struct vxlan_vni_cache, vxlan_vni_cache);
+static uint32_t vxlan_vni_gen;
+
+static struct vxlan_vninode *
+vxlan_vni_cache_lookup(uint32_t vni)
+{
+	struct vxlan_vni_cache_entry *vc;
+	uint32_t gen = CMM_LOAD_SHARED(vxlan_vni_gen);
+
+	vc = &RTE_PER_LCORE(vxlan_vni_cache).vc_entry[
+		vni & (VXLAN_VNI_CACHE_SZ - 1)];
+	if (likely(vc->vc_vnode && vc->vc_vni == vni && vc->vc_gen == gen))
+		return vc->vc_vnode;
+
+	vc->vc_vnode = vxlan_vni_lookup(vni);
+	vc->vc_vni = vni;
+	vc->vc_gen = gen;
+
+	return vc->vc_vnode;
+}
+
 /* Insert the specified vxlan node into the VNI table. */
 static int
 vxlan_vni_insert(struct vxlan_vninode *vni)
@@ -613,6 +654,324 @@ int vxlan_select_src(struct vxlan_vninode *vnode,
 	return err;
 }
 
+/*
+ * Outer header templates
+ *
+ * Each lcore caches the complete outer IP, UDP and VXLAN header per VNI
+ * and remote VTEP, with the output interface and nexthop that source
+ * selection chose.  A hit is applied with a single prepend and copy,
+ * after which only the lengths, UDP source port and any inherited tos are
+ * written.
+ *
+ * A template is only cached for a remote whose route is tracked, and has
+ * a single path, as otherwise the path depends on the packet.  The route
+ * trackers, address and link events, and config changes all bump the
+ * generation, which invalidates every template.  The master thread tracks
+ * remotes as they are added to, or found in, the forwarding tables, so
+ * a newly learnt remote takes the slow path until the next vxlan_timer.
+ */
+#define VXLAN_REMOTES_MAX	1024
+#define VXLAN_ENCAP_CACHE_SZ	64	/* must be a power of two */
+
+struct vxlan_remote {
+	struct cds_lfht_node	vr_node;
+	struct ip_addr		vr_addr;
+	vrfid_t			vr_vrfid;
+	struct rt_tracker_info	*vr_ti;
+	struct rcu_head		vr_rcu;
+};
+
+struct vxlan_remote_key {
+	const struct ip_addr	*addr;
+	vrfid_t			vrfid;
+};
+
+struct vxlan_encap_tmpl {
+	struct vxlan_vninode	*et_vnode;
+	struct ifnet		*et_dif;
+	uint32_t		et_gen;
+	uint8_t			et_type;
+	bool			et_inherit_tos;
+	struct ip_addr		et_dip;
+	struct ip_addr		et_nhip;
+	union {
+		struct vxlan_ipv4_encap	v4;
+		struct vxlan_ipv6_encap	v6;
+	} et_hdr;
+};
+
+struct vxlan_encap_cache {
+	struct vxlan_encap_tmpl	ec_tmpl[VXLAN_ENCAP_CACHE_SZ];
+};
+
+static struct cds_lfht *vxlan_remotes;
+static unsigned int vxlan_remote_count;
+static uint32_t vxlan_encap_gen;
+static RTE_DEFINE_PER_LCORE(struct vxlan_encap_cache, vxlan_encap_cache);
+
+static void vxlan_encap_invalidate(void)
+{
+	uatomic_inc(&vxlan_encap_gen);
+}
+
+/* Route tracker callback, for a change in the route to a remote */
+static void vxlan_remote_update(void *ctx __unused)
+{
+	vxlan_encap_invalidate();
+}
+
+static inline unsigned long
+vxlan_remote_hash(const struct ip_addr *addr, vrfid_t vrfid)
+{
+	if (addr->type == AF_INET)
+		return rte_jhash_1word(addr->address.ip_v4.s_addr, vrfid);
+	return rte_jhash_32b(addr->address.ip_v6.s6_addr32, 4, vrfid);
+}
+
+static int vxlan_remote_match(struct cds_lfht_node *node, const void *key)
+{
+	const struct vxlan_remote_key *rk = key;
+	const struct vxlan_remote *vr
+		= caa_container_of(node, const struct vxlan_remote, vr_node);
+
+	return vr->vr_vrfid == rk->vrfid && dp_addr_eq(&vr->vr_addr, rk->addr);
+}
+
+static struct vxlan_remote *
+vxlan_remote_lookup(vrfid_t vrfid, const struct ip_addr *addr)
+{
+	struct vxlan_remote_key rk = { .addr = addr, .vrfid = vrfid };
+	struct cds_lfht_iter iter;
+	struct cds_lfht_node *node;
+
+	cds_lfht_lookup(vxlan_remotes, vxlan_remote_hash(addr, vrfid),
+			vxlan_remote_match, &rk, &iter);
+	node = cds_lfht_iter_get_node(&iter);
+	if (node)
+		return caa_container_of(node, struct vxlan_remote, vr_node);
+	return NULL;
+}
+
+/* Start tracking the route to a remote VTEP.  Master thread only. */
+static void vxlan_remote_track(vrfid_t vrfid, const struct ip_addr *addr)
+{
+	struct vxlan_remote *vr;
+	struct vrf *vrf;
+
+	if (vrfid == VRF_INVALID_ID ||
+	    vxlan_remote_count >= VXLAN_REMOTES_MAX ||
+	    vxlan_remote_lookup(vrfid, addr))
+		return;
+
+	vr = zmalloc_aligned(sizeof(*vr));
+	if (!vr)
+		return;
+
+	vr->vr_addr = *addr;
+	vr->vr_vrfid = vrfid;
+
+	/* Hold the transport VRF for as long as the route is tracked */
+	vrf = vrf_find_or_create(vrfid);
+	if (!vrf) {
+		free(vr);
+		return;
+	}
+
+	vr->vr_ti = dp_rt_tracker_add(vrf, &vr->vr_addr, vr,
+				      vxlan_remote_update);
+	if (!vr->vr_ti) {
+		vrf_delete(vrfid);
+		free(vr);
+		return;
+	}
+
+	cds_lfht_node_init(&vr->vr_node);
+	cds_lfht_add(vxlan_remotes, vxlan_remote_hash(addr, vrfid),
+		     &vr->vr_node);
+	vxlan_remote_count++;
+}
+
+static void vxlan_remote_free(struct rcu_head *head)
+{
+	free(caa_container_of(head, struct vxlan_remote, vr_rcu));
+}
+
+/*
+ * Stop tracking the remotes in a transport VRF, or every remote if the
+ * VRF is VRF_INVALID_ID, e.g. when a VXLAN interface goes or moves, so
+ * that the VRF is not held.  The remotes still in use are tracked again
+ * by the next vxlan_timer.  Master thread only.
+ */
+static void vxlan_remotes_flush(vrfid_t vrfid)
+{
+	struct cds_lfht_iter iter;
+	struct vxlan_remote *vr;
+	struct vrf *vrf;
+
+	cds_lfht_for_each_entry(vxlan_remotes, &iter, vr, vr_node) {
+		if (vrfid != VRF_INVALID_ID && vr->vr_vrfid != vrfid)
+			continue;
+		cds_lfht_del(vxlan_remotes, &vr->vr_node);
+		vrf = vrf_get_rcu(vr->vr_vrfid);
+		if (vrf) {
+			dp_rt_tracker_delete(vrf, &vr->vr_addr, vr);
+			vrf_delete_by_ptr(vrf);
+		}
+		call_rcu(&vr->vr_rcu, vxlan_remote_free);
+		vxlan_remote_count--;
+	}
+	vxlan_encap_invalidate();
+}
+
+/* Is the route to the remote tracked, with a single path? */
+static bool
+vxlan_remote_cacheable(vrfid_t vrfid, const struct ip_addr *dip)
+{
+	struct vxlan_remote *vr = vxlan_remote_lookup(vrfid, dip);
+	struct next_hop_list *nextl;
+
+	if (!vr || !CMM_LOAD_SHARED(vr->vr_ti->tracking))
+		return false;
+
+	nextl = next_hop_list_get(dip->type,
+				  CMM_LOAD_SHARED(vr->vr_ti->nhindex));
+	return nextl && nextl->nsiblings == 1;
+}
+
+static inline struct vxlan_encap_tmpl *
+vxlan_encap_tmpl_slot(const struct vxlan_vninode *vnode,
+		      const struct ip_addr *dip)
+{
+	uint32_t hash;
+
+	if (dip->type == AF_INET)
+		hash = rte_jhash_1word(dip->address.ip_v4.s_addr, vnode->vni);
+	else
+		hash = rte_jhash_32b(dip->address.ip_v6.s6_addr32, 4,
+				     vnode->vni);
+
+	return &RTE_PER_LCORE(vxlan_encap_cache).ec_tmpl[
+		hash & (VXLAN_ENCAP_CACHE_SZ - 1)];
+}
+
+/*
+ * Take a template from a packet that the slow path has just encapsulated,
+ * clearing the fields that are written per packet.
+ */
+static void
+vxlan_encap_tmpl_fill(struct vxlan_encap_tmpl *et,
+		      struct vxlan_vninode *vnode, const struct rte_mbuf *m,
+		      enum vxlan_type vxl_type, const struct ip_addr *dip,
+		      const struct ip_addr *nhip, struct ifnet *dif,
+		      uint32_t gen)
+{
+	et->et_inherit_tos = (vnode->tos == 0);
+
+	if (dip->type == AF_INET) {
+		struct vxlan_ipv4_encap *v4 = &et->et_hdr.v4;
+
+		memcpy(v4, rte_pktmbuf_mtod(m, void *), sizeof(*v4));
+		v4->ip_header.tot_len = 0;
+		if (et->et_inherit_tos)
+			v4->ip_header.tos = 0;
+		v4->ip_header.check = 0;
+		v4->ip_header.check = dp_in_cksum_hdr(&v4->ip_header);
+		v4->udp_header.src_port = 0;
+		v4->udp_header.dgram_len = 0;
+	} else {
+		struct vxlan_ipv6_encap *v6 = &et->et_hdr.v6;
+
+		memcpy(v6, rte_pktmbuf_mtod(m, void *), sizeof(*v6));
+		v6->ip6_header.ip6_plen = 0;
+		v6->udp_header.src_port = 0;
+		v6->udp_header.dgram_len = 0;
+	}
+
+	et->et_vnode = vnode;
+	et->et_dif = dif;
+	et->et_type = vxl_type;
+	et->et_dip = *dip;
+	et->et_nhip = *nhip;
+	et->et_gen = gen;
+}
+
+static ALWAYS_INLINE
+bool vxlan_encap_tmpl_valid(const struct vxlan_encap_tmpl *et,
+			    const struct vxlan_vninode *vnode,
+			    const struct ip_addr *dip,
+			    enum vxlan_type vxl_type, uint32_t gen)
+{
+	return et->et_gen == gen && et->et_vnode == vnode &&
+		et->et_type == vxl_type && dp_addr_eq(&et->et_dip, dip) &&
+		(et->et_dif->if_flags & IFF_UP);
+}
+
+/* Encapsulate the packet by copying in the template */
+static ALWAYS_INLINE
+int vxlan_encap_tmpl_apply(const struct vxlan_encap_tmpl *et,
+			   struct rte_mbuf *m, uint8_t *entropy,
+			   uint32_t entropy_len, uint8_t tos_tc,
+			   enum vgpe_nxt_proto nxtproto, bool oam)
+{
+	uint16_t udp_len = sizeof(struct rte_udp_hdr) +
+		sizeof(struct rte_vxlan_hdr) + rte_pktmbuf_pkt_len(m);
+	struct rte_udp_hdr *udp;
+	struct rte_vxlan_hdr *vxh;
+
+	if (et->et_dip.type == AF_INET) {
+		struct vxlan_ipv4_encap *v4;
+		struct iphdr *iph;
+		uint16_t old;
+
+		v4 = (struct vxlan_ipv4_encap *)
+			rte_pktmbuf_prepend(m, (uint16_t)sizeof(*v4));
+		if (unlikely(v4 == NULL))
+			return -ENOMEM;
+		memcpy(v4, &et->et_hdr.v4, sizeof(*v4));
+
+		iph = &v4->ip_header;
+		iph->tot_len = htons(sizeof(*iph) + udp_len);
+		iph->check = ip_fixup16_cksum(iph->check, 0, iph->tot_len);
+		if (et->et_inherit_tos && tos_tc) {
+			/* tos shares the first word with version and ihl */
+			old = *(uint16_t *)iph;
+			iph->tos = tos_tc;
+			iph->check = ip_fixup16_cksum(iph->check, old,
+						      *(uint16_t *)iph);
+		}
+		udp = &v4->udp_header;
+		vxh = &v4->vxlan_header;
+	} else {
+		struct vxlan_ipv6_encap *v6;
+
+		v6 = (struct vxlan_ipv6_encap *)
+			rte_pktmbuf_prepend(m, (uint16_t)sizeof(*v6));
+		if (unlikely(v6 == NULL))
+			return -ENOMEM;
+		memcpy(v6, &et->et_hdr.v6, sizeof(*v6));
+
+		v6->ip6_header.ip6_plen = htons(udp_len);
+		if (et->et_inherit_tos)
+			v6->ip6_header.ip6_flow =
+				htonl((IPV6_VERSION << 4 | tos_tc) << 20);
+		udp = &v6->udp_header;
+		vxh = &v6->vxlan_header;
+	}
+
+	/* Update L2 length in packet as the encap includes ether_hdr */
+	dp_pktmbuf_l2_len(m) = RTE_ETHER_HDR_LEN;
+
+	udp->src_port = htons(vxlan_get_src_port(et->et_vnode, entropy,
+						 entropy_len, m));
+	udp->dgram_len = htons(udp_len);
+
+	if (et->et_type == VXLAN_GPE)
+		vxh->vx_flags =
+			htonl(VXLAN_VALIDFLAG | VXLAN_NXTPROTO_FLAG |
+			      nxtproto | (oam ? VXLAN_OAM_FLAG : 0));
+	return 0;
+}
+
 static
 void vxlan_query_payload_mpls(uint32_t *hdr, uint8_t *tc,
 			      uint8_t **entropy, uint32_t *entropy_len)
@@ -797,11 +1156,13 @@ vxlan_send_packet(struct ifnet *ifp, uint32_t vni, struct ip_addr *dip,
 {
 	struct ifnet *dif = NULL;
 	struct vxlan_vninode *vnode;
+	struct vxlan_encap_tmpl *et;
 	struct ip_addr sip, nhip;
 	int err;
 	uint8_t tos_tc = 0;
 	uint8_t *entropy;
 	uint32_t entropy_len;
+	uint32_t gen;
 
 	vnode = vxlan_vni_lookup(vni);
 	if (unlikely(vnode == NULL))
@@ -828,6 +1189,19 @@ vxlan_send_packet(struct ifnet *ifp, uint32_t vni, struct ip_addr *dip,
 	pktmbuf_set_vrf(m, vnode->t_vrfid);
 	pktmbuf_prepare_encap_out(m);
 
+	gen = CMM_LOAD_SHARED(vxlan_encap_gen);
+	et = vxlan_encap_tmpl_slot(vnode, dip);
+	if (likely(vxlan_encap_tmpl_valid(et, vnode, dip, vxl_type, gen))) {
+		err = vxlan_encap_tmpl_apply(et, m, entropy, entropy_len,
+					     tos_tc, nxtproto, oam);
+		if (unlikely(err != 0)) {
+			VXLAN_STAT_INC(VXLAN_STATS_OUTDISCARDS_ENCAP_FAILED);
+			goto drop;
+		}
+		return vxlan_resolve_send_pak(m, &et->et_nhip, dip, ifp,
+					      et->et_dif);
+	}
+
 	err = vxlan_select_src(vnode, dip, m, &dif, &sip, &nhip);
 	if (unlikely(err != 0)) {
 		VXLAN_STAT_INC(VXLAN_STATS_OUTDISCARDS_NO_VTEP_SRC);
@@ -841,6 +1215,11 @@ vxlan_send_packet(struct ifnet *ifp, uint32_t vni, struct ip_addr *dip,
 		VXLAN_STAT_INC(VXLAN_STATS_OUTDISCARDS_ENCAP_FAILED);
 		goto drop;
 	}
+
+	if (vxlan_remote_cacheable(vnode->t_vrfid, dip))
+		vxlan_encap_tmpl_fill(et, vnode, m, vxl_type, dip, &nhip, dif,
+				      gen);
+
 	return vxlan_resolve_send_pak(m, &nhip, dip, ifp, dif);
 
  drop:
@@ -893,46 +1272,58 @@ void vxlan_send_encapped(struct rte_mbuf *m, struct ifnet *ifp, uint8_t af)
 	if_incr_dropped(ifp);
 }
 
-static void
-vxlan_snoop(enum vgpe_nxt_proto nxtproto, struct ifnet *ifp,
-	    struct rte_mbuf *m __unused,
-	    uint16_t ether_type, void *l3hdr, struct rte_vxlan_hdr *vxlan)
+/*
+ * Find the inner ether header that follows the vxlan header, or NULL if
+ * there isn't one.
+ */
+static struct rte_ether_hdr *
+vxlan_inner_eh(enum vgpe_nxt_proto nxtproto, struct rte_vxlan_hdr *vxlan)
 {
 	void *vxlan_end = vxlan + 1;
-	struct ip_addr ipaddr;
-
-	if (ether_type == htons(RTE_ETHER_TYPE_IPV4)) {
-		const struct iphdr *oip = l3hdr;
-
-		ipaddr.type = AF_INET;
-		ipaddr.address.ip_v4.s_addr = oip->saddr;
-	} else if (ether_type == htons(RTE_ETHER_TYPE_IPV6)) {
-		const struct ip6_hdr *oip6 = l3hdr;
-
-		ipaddr.type = AF_INET6;
-		ipaddr.address.ip_v6 = oip6->ip6_src;
-	} else
-		return;
-
-	/* where is the inner ether header? */
-	struct rte_ether_hdr *eh;
 
 	if (nxtproto == VGPE_NXT_NONE || nxtproto == VGPE_NXT_ETHER)
 		/* trivial for vxlan, or vxlan-gpe followed by ether */
-		eh = vxlan_end;
-	else if (nxtproto == VGPE_NXT_NSH) {
+		return vxlan_end;
+
+	if (nxtproto == VGPE_NXT_NSH) {
 		/* can also use NSH, if followed by ether */
 		void *nsh_payload;
 		enum nsh_np nsh_proto;
 
 		if (nsh_get_payload(vxlan_end, &nsh_proto, &nsh_payload) != 0 ||
 		    nsh_proto != NSH_NP_ETHER)
-			return;
+			return NULL;
 
-		eh = nsh_payload;
+		return nsh_payload;
+	}
+
+	return NULL;
+}
+
+static bool
+vxlan_outer_src(uint16_t ether_type, const void *l3hdr,
+		struct ip_addr *ipaddr)
+{
+	if (ether_type == htons(RTE_ETHER_TYPE_IPV4)) {
+		const struct iphdr *oip = l3hdr;
+
+		ipaddr->type = AF_INET;
+		ipaddr->address.ip_v4.s_addr = oip->saddr;
+	} else if (ether_type == htons(RTE_ETHER_TYPE_IPV6)) {
+		const struct ip6_hdr *oip6 = l3hdr;
+
+		ipaddr->type = AF_INET6;
+		ipaddr->address.ip_v6 = oip6->ip6_src;
 	} else
-		return;
+		return false;
 
+	return true;
+}
+
+static void
+vxlan_snoop(struct ifnet *ifp, struct ip_addr *ipaddr,
+	    const struct rte_ether_hdr *eh)
+{
 	/* Don't learn my own address,
 	 *  other side might be setup the same way
 	 */
@@ -947,74 +1338,62 @@ vxlan_snoop(enum vgpe_nxt_proto nxtproto, struct ifnet *ifp,
 			     &bridge_port_get_bridge(brport)->eth_addr)))
 		return;
 
-	vxlan_rtupdate(ifp, &ipaddr, &eh->s_addr);
+	vxlan_rtupdate(ifp, ipaddr, &eh->s_addr);
 }
 
-static void
-vxlan_recv_encap(struct rte_mbuf *m, uint16_t ether_type,
-		 void *l3hdr, struct udphdr *udp)
+/*
+ * Validate the vxlan header.  Returns VXLAN_STATS_INPKTS if it is valid,
+ * or the counter for the reason it is not.
+ */
+static int
+vxlan_decap_parse(struct rte_mbuf *m, struct udphdr *udp, uint16_t *hdr_len,
+		  uint32_t *vnip, enum vxlan_type *vxl_type, uint8_t *nxtproto)
 {
-	struct ifnet *ifp;
-	struct vxlan_vninode *vnode;
-	uint32_t vni;
-	int cntr = VXLAN_STATS_INPKTS;
 	unsigned int udp_encap_len;
 	struct rte_vxlan_hdr *vxhdr;
 	uint32_t vx_flags;
-	uint16_t hdr_len;
+	uint32_t vni;
 
 	udp_encap_len = (char *)(udp + 1) - rte_pktmbuf_mtod(m, char *);
-	hdr_len = udp_encap_len + sizeof(struct rte_vxlan_hdr);
-	if (rte_pktmbuf_data_len(m) < hdr_len) {
-		cntr = VXLAN_STATS_INDISCARDS_BADHEADER;
-		goto drop;
-	}
+	*hdr_len = udp_encap_len + sizeof(struct rte_vxlan_hdr);
+	if (rte_pktmbuf_data_len(m) < *hdr_len)
+		return VXLAN_STATS_INDISCARDS_BADHEADER;
+
 	vxhdr = (struct rte_vxlan_hdr *)(udp + 1);
 
 	vni = ntohl(vxhdr->vx_vni);
-	if (vni & 0xff) {
-		cntr = VXLAN_STATS_INDISCARDS_BADHEADER;
-		goto drop;
-	}
+	if (vni & 0xff)
+		return VXLAN_STATS_INDISCARDS_BADHEADER;
 
-	enum vxlan_type vxl_type;
-	uint8_t nxtproto = VGPE_NXT_NONE;
+	*nxtproto = VGPE_NXT_NONE;
 
 	vx_flags = ntohl(vxhdr->vx_flags);
 	if (udp->uh_dport == htons(VXLAN_PORT)) {
-		if (vx_flags != VXLAN_VALIDFLAG) {
-			cntr = VXLAN_STATS_INDISCARDS_BADHEADER;
-			goto drop;
-		}
-		vxl_type = VXLAN_L2;
+		if (vx_flags != VXLAN_VALIDFLAG)
+			return VXLAN_STATS_INDISCARDS_BADHEADER;
+		*vxl_type = VXLAN_L2;
 	} else if (udp->uh_dport == htons(VXLAN_GPE_PORT)) {
-		if (!(vx_flags & (VXLAN_VALIDFLAG | VXLAN_NXTPROTO_FLAG))) {
-			cntr = VXLAN_STATS_INDISCARDS_BADHEADER;
-			goto drop;
-		}
-		nxtproto = vx_flags & VXLAN_NXTPROTO_MASK;
+		if (!(vx_flags & (VXLAN_VALIDFLAG | VXLAN_NXTPROTO_FLAG)))
+			return VXLAN_STATS_INDISCARDS_BADHEADER;
 
-		if (nxtproto == VGPE_NXT_NONE || nxtproto >= VGPE_NXT_MAX) {
-			cntr = VXLAN_STATS_INDISCARDS_BADHEADER;
-			goto drop;
-		}
-		vxl_type = VXLAN_GPE;
-	} else {
-		cntr = VXLAN_STATS_INDISCARDS_BADHEADER;
-		goto drop;
-	}
+		*nxtproto = vx_flags & VXLAN_NXTPROTO_MASK;
 
-	vni >>= 8;
-	vnode = vxlan_vni_lookup(vni);
+		if (*nxtproto == VGPE_NXT_NONE || *nxtproto >= VGPE_NXT_MAX)
+			return VXLAN_STATS_INDISCARDS_BADHEADER;
+		*vxl_type = VXLAN_GPE;
+	} else
+		return VXLAN_STATS_INDISCARDS_BADHEADER;
 
-	if (unlikely(vnode == NULL)) {
-		cntr = VXLAN_STATS_INDISCARDS_VNINOTFOUND;
-		goto drop;
-	}
+	*vnip = vni >> 8;
+	return VXLAN_STATS_INPKTS;
+}
 
-	ifp = vnode->ifp;
-	if (vnode->learning)
-		vxlan_snoop(nxtproto, ifp, m, ether_type, l3hdr, vxhdr);
+/* Strip the outer headers, and pass the payload on */
+static void
+vxlan_decap_deliver(struct ifnet *ifp, struct rte_mbuf *m, uint16_t hdr_len,
+		    enum vxlan_type vxl_type, uint8_t nxtproto)
+{
+	int cntr = VXLAN_STATS_INPKTS;
 
 	rte_pktmbuf_adj(m, hdr_len);
 	VXLAN_STAT_INC(cntr);
@@ -1094,6 +1473,219 @@ drop:
 	rte_pktmbuf_free(m);
 }
 
+static void
+vxlan_recv_encap(struct rte_mbuf *m, uint16_t ether_type,
+		 void *l3hdr, struct udphdr *udp)
+{
+	struct vxlan_vninode *vnode;
+	enum vxlan_type vxl_type;
+	struct rte_ether_hdr *eh;
+	struct ip_addr ipaddr;
+	uint8_t nxtproto;
+	uint16_t hdr_len;
+	uint32_t vni;
+	int cntr;
+
+	cntr = vxlan_decap_parse(m, udp, &hdr_len, &vni, &vxl_type, &nxtproto);
+	if (unlikely(cntr != VXLAN_STATS_INPKTS))
+		goto drop;
+
+	vnode = vxlan_vni_cache_lookup(vni);
+	if (unlikely(vnode == NULL)) {
+		cntr = VXLAN_STATS_INDISCARDS_VNINOTFOUND;
+		goto drop;
+	}
+
+	if (vnode->learning &&
+	    vxlan_outer_src(ether_type, l3hdr, &ipaddr)) {
+		eh = vxlan_inner_eh(nxtproto, (struct rte_vxlan_hdr *)(udp + 1));
+		if (eh)
+			vxlan_snoop(vnode->ifp, &ipaddr, eh);
+	}
+
+	vxlan_decap_deliver(vnode->ifp, m, hdr_len, vxl_type, nxtproto);
+	return;
+
+drop:
+	VXLAN_STAT_INC(cntr);
+	rte_pktmbuf_free(m);
+}
+
+/*
+ * Encapsulated packets received while an rx burst is being processed are
+ * held, and decapsulated together at the end of the burst, see
+ * vxlan_burst_begin().
+ */
+#define VXLAN_BURST_MAX		32
+#define VXLAN_BURST_GROUPS	8
+
+struct vxlan_burst_pkt {
+	struct rte_mbuf		*vp_m;
+	void			*vp_l3hdr;
+	struct udphdr		*vp_udp;
+	uint16_t		vp_ether_type;
+};
+
+struct vxlan_burst {
+	bool			vb_active;
+	uint16_t		vb_count;
+	struct vxlan_burst_pkt	vb_pkt[VXLAN_BURST_MAX];
+};
+
+static RTE_DEFINE_PER_LCORE(struct vxlan_burst, vxlan_burst);
+
+struct vxlan_burst_group {
+	uint32_t		bg_vni;
+	struct ip_addr		bg_src;
+	struct vxlan_vninode	*bg_vnode;
+	bool			bg_learnt;
+	struct rte_ether_addr	bg_learnt_addr;
+};
+
+static inline bool
+vxlan_burst_src_equal(const struct ip_addr *a, const struct ip_addr *b)
+{
+	if (a->type != b->type)
+		return false;
+	if (a->type == AF_INET)
+		return a->address.ip_v4.s_addr == b->address.ip_v4.s_addr;
+	return IN6_ARE_ADDR_EQUAL(&a->address.ip_v6, &b->address.ip_v6);
+}
+
+/*
+ * Decapsulate a burst of vxlan packets.
+ *
+ * Packets are grouped by VNI and outer source address.  The VNI is resolved
+ * once per group, and an inner source address is learnt once for each run
+ * of packets from it in the group.  Packets are delivered in the order
+ * they were received.  Packets that don't fit in the group table are
+ * decapsulated individually.
+ */
+static void
+vxlan_recv_encap_burst(struct vxlan_burst_pkt *pkts, unsigned int count)
+{
+	struct vxlan_burst_group grp[VXLAN_BURST_GROUPS];
+	unsigned int i, j, ngrp = 0;
+	struct vxlan_burst_group *bg;
+
+	for (i = 0; i < count; i++) {
+		struct vxlan_burst_pkt *vp = &pkts[i];
+		struct rte_mbuf *m = vp->vp_m;
+		enum vxlan_type vxl_type;
+		struct rte_ether_hdr *eh;
+		struct ip_addr src;
+		uint8_t nxtproto;
+		uint16_t hdr_len;
+		uint32_t vni;
+		int cntr;
+
+		cntr = vxlan_decap_parse(m, vp->vp_udp, &hdr_len, &vni,
+					 &vxl_type, &nxtproto);
+		if (unlikely(cntr != VXLAN_STATS_INPKTS)) {
+			VXLAN_STAT_INC(cntr);
+			rte_pktmbuf_free(m);
+			continue;
+		}
+
+		if (unlikely(!vxlan_outer_src(vp->vp_ether_type, vp->vp_l3hdr,
+					      &src))) {
+			vxlan_recv_encap(m, vp->vp_ether_type, vp->vp_l3hdr,
+					 vp->vp_udp);
+			continue;
+		}
+
+		for (j = 0; j < ngrp; j++)
+			if (grp[j].bg_vni == vni &&
+			    vxlan_burst_src_equal(&grp[j].bg_src, &src))
+				break;
+
+		if (j == ngrp) {
+			if (unlikely(ngrp == VXLAN_BURST_GROUPS)) {
+				vxlan_recv_encap(m, vp->vp_ether_type,
+						 vp->vp_l3hdr, vp->vp_udp);
+				continue;
+			}
+			bg = &grp[ngrp++];
+			bg->bg_vni = vni;
+			bg->bg_src = src;
+			bg->bg_vnode = vxlan_vni_cache_lookup(vni);
+			bg->bg_learnt = false;
+		}
+		bg = &grp[j];
+
+		if (unlikely(bg->bg_vnode == NULL)) {
+			VXLAN_STAT_INC(VXLAN_STATS_INDISCARDS_VNINOTFOUND);
+			rte_pktmbuf_free(m);
+			continue;
+		}
+
+		if (bg->bg_vnode->learning) {
+			eh = vxlan_inner_eh(
+				nxtproto, (struct rte_vxlan_hdr *)(vp->vp_udp + 1));
+			if (eh && (!bg->bg_learnt ||
+				   !rte_ether_addr_equal(&eh->s_addr,
+							 &bg->bg_learnt_addr))) {
+				vxlan_snoop(bg->bg_vnode->ifp, &src, eh);
+				bg->bg_learnt = true;
+				bg->bg_learnt_addr = eh->s_addr;
+			}
+		}
+
+		vxlan_decap_deliver(bg->bg_vnode->ifp, m, hdr_len, vxl_type,
+				    nxtproto);
+	}
+}
+
+static void vxlan_burst_flush(struct vxlan_burst *vb)
+{
+	bool active = vb->vb_active;
+	unsigned int count = vb->vb_count;
+
+	/*
+	 * Packets that loop back into vxlan while the burst is being
+	 * decapsulated, e.g. vxlan in vxlan, are decapsulated immediately.
+	 */
+	vb->vb_active = false;
+	vb->vb_count = 0;
+	vxlan_recv_encap_burst(vb->vb_pkt, count);
+	vb->vb_active = active;
+}
+
+void vxlan_burst_begin(void)
+{
+	RTE_PER_LCORE(vxlan_burst).vb_active = true;
+}
+
+void vxlan_burst_end(void)
+{
+	struct vxlan_burst *vb = &RTE_PER_LCORE(vxlan_burst);
+
+	vb->vb_active = false;
+	if (vb->vb_count)
+		vxlan_burst_flush(vb);
+}
+
+static void
+vxlan_recv_encap_hold(struct rte_mbuf *m, uint16_t ether_type,
+		      void *l3hdr, struct udphdr *udp)
+{
+	struct vxlan_burst *vb = &RTE_PER_LCORE(vxlan_burst);
+	struct vxlan_burst_pkt *vp;
+
+	if (unlikely(!vb->vb_active)) {
+		vxlan_recv_encap(m, ether_type, l3hdr, udp);
+		return;
+	}
+
+	vp = &vb->vb_pkt[vb->vb_count];
+	vp->vp_m = m;
+	vp->vp_l3hdr = l3hdr;
+	vp->vp_udp = udp;
+	vp->vp_ether_type = ether_type;
+	if (++vb->vb_count == VXLAN_BURST_MAX)
+		vxlan_burst_flush(vb);
+}
+
 static int vxlan_recv_encap_ipv4(struct rte_mbuf *m,
 				 void *l3hdr,
 				 struct udphdr *udp,
@@ -1108,7 +1700,7 @@ static int vxlan_recv_encap_ipv4(struct rte_mbuf *m,
 		return 0;
 	}
 
-	vxlan_recv_encap(m, htons(RTE_ETHER_TYPE_IPV4), ip, udp);
+	vxlan_recv_encap_hold(m, htons(RTE_ETHER_TYPE_IPV4), ip, udp);
 	return 0;
 }
 
@@ -1119,7 +1711,7 @@ static int vxlan_recv_encap_ipv6(struct rte_mbuf *m,
 {
 	struct ip6_hdr *ip6 = l3hdr;
 
-	vxlan_recv_encap(m, htons(RTE_ETHER_TYPE_IPV6), ip6, udp);
+	vxlan_recv_encap_hold(m, htons(RTE_ETHER_TYPE_IPV6), ip6, udp);
 	return 0;
 }
 
@@ -1286,17 +1878,44 @@ vxlan_rtupdate(struct ifnet *ifp,
 			return;
 		}
 	} else if ((vxlrt->vxlrt_flags & IFBAF_TYPEMASK) == IFBAF_DYNAMIC) {
+		/* Only write the entry if the remote VTEP has changed */
 		if (addr->type == AF_INET) {
-			vxlrt->vxlrt_dst = addr->address.ip_v4;
-			vxlrt->vxlrt_flags |= IFBAF_ADDR_V4;
+			if (unlikely(!(vxlrt->vxlrt_flags & IFBAF_ADDR_V4) ||
+				     vxlrt->vxlrt_dst.s_addr !=
+				     addr->address.ip_v4.s_addr)) {
+				vxlrt->vxlrt_dst = addr->address.ip_v4;
+				vxlrt->vxlrt_flags |= IFBAF_ADDR_V4;
+			}
 		} else {
-			vxlrt->vxlrt_dst_v6 = addr->address.ip_v6;
-			vxlrt->vxlrt_flags |= IFBAF_ADDR_V6;
+			if (unlikely(!(vxlrt->vxlrt_flags & IFBAF_ADDR_V6) ||
+				     !IN6_ARE_ADDR_EQUAL(&vxlrt->vxlrt_dst_v6,
+						&addr->address.ip_v6))) {
+				vxlrt->vxlrt_dst_v6 = addr->address.ip_v6;
+				vxlrt->vxlrt_flags |= IFBAF_ADDR_V6;
+			}
 		}
 	}
 
 	/* Entry is marked used */
-	rte_atomic32_clear(&vxlrt->vxlrt_unused);
+	if (unlikely(rte_atomic32_read(&vxlrt->vxlrt_unused)))
+		rte_atomic32_clear(&vxlrt->vxlrt_unused);
+}
+
+/* Track the route to the remote VTEP of a forwarding entry */
+static void
+vxlan_rtnode_track(struct vxlan_vninode *vnode, struct vxlan_rtnode *vxlrt)
+{
+	struct ip_addr addr;
+
+	if (vxlrt->vxlrt_flags & IFBAF_ADDR_V4) {
+		addr.type = AF_INET;
+		addr.address.ip_v4 = vxlrt->vxlrt_dst;
+	} else if (vxlrt->vxlrt_flags & IFBAF_ADDR_V6) {
+		addr.type = AF_INET6;
+		addr.address.ip_v6 = vxlrt->vxlrt_dst_v6;
+	} else
+		return;
+	vxlan_remote_track(vnode->t_vrfid, &addr);
 }
 
 static void
@@ -1347,19 +1966,43 @@ static int vxlan_rtexpired(struct vxlan_rtnode *vxlrt)
 static void vxlan_timer(struct rte_timer *timer __rte_unused, void *arg)
 {
 	struct vxlan_softc *sc = arg;
+	struct vxlan_vninode *vnode;
 	struct cds_lfht_iter iter;
 	struct vxlan_rtnode *vxlrt;
 
 	rcu_read_lock();
+	vnode = vxlan_vni_lookup(sc->scvx_vni);
 	cds_lfht_for_each_entry(sc->scvx_rthash, &iter, vxlrt, vxlrt_node) {
 		if (vxlan_rtexpired(vxlrt)) {
 			cds_lfht_del(sc->scvx_rthash, &vxlrt->vxlrt_node);
 			vxlan_rtnode_destroy(vxlrt);
+		} else if (vnode) {
+			vxlan_rtnode_track(vnode, vxlrt);
 		}
 	}
 	rcu_read_unlock();
 }
 
+static void vxlan_walker_track(struct vxlan_vninode *vnode,
+			       void *ctx __unused)
+{
+	struct vxlan_softc *sc = vnode->ifp->if_softc;
+	struct cds_lfht_iter iter;
+	struct vxlan_rtnode *vxlrt;
+
+	cds_lfht_for_each_entry(sc->scvx_rthash, &iter, vxlrt, vxlrt_node)
+		vxlan_rtnode_track(vnode, vxlrt);
+}
+
+unsigned int vxlan_remotes_track_ut(void)
+{
+	rcu_read_lock();
+	vxlan_tbl_walk(vxlan_walker_track, NULL);
+	rcu_read_unlock();
+
+	return vxlan_remote_count;
+}
+
 
 /*
  * Interface management functions
@@ -1483,6 +2126,8 @@ static void set_vxlan_params(struct ifnet *ifp,
 			ifp->if_mtu = pifp->if_mtu - VXLAN_OVERHEAD;
 
 		if (vninode->t_vrfid != pifp->if_vrfid) {
+			if (vninode->t_vrfid != VRF_INVALID_ID)
+				vxlan_remotes_flush(vninode->t_vrfid);
 			vrf_delete(vninode->t_vrfid);
 			if (vrf_find_or_create(pifp->if_vrfid) == NULL) {
 				vninode->t_vrfid = VRF_INVALID_ID;
@@ -1517,6 +2162,16 @@ static void set_vxlan_params(struct ifnet *ifp,
 	/* TODO: dynamically allocate source port range */
 	vninode->port_low = VXLAN_PORT_LOW;
 	vninode->port_high = VXLAN_PORT_HIGH;
+
+	if (vninode->g_addr) {
+		struct ip_addr group = {
+			.type = AF_INET,
+			.address.ip_v4.s_addr = vninode->g_addr,
+		};
+
+		vxlan_remote_track(vninode->t_vrfid, &group);
+	}
+	vxlan_encap_invalidate();
 }
 
 /* Handle RTM_NEWLINK netlink on existing vxlan interface */
@@ -1731,6 +2386,9 @@ static void vxlan_if_uninit(struct ifnet *ifp)
 
 	if (vni) {
 		cds_lfht_del(vxlans->vtbl_vnihash, &vni->vni_node);
+		CMM_STORE_SHARED(vxlan_vni_gen, vxlan_vni_gen + 1);
+		if (vni->t_vrfid != VRF_INVALID_ID)
+			vxlan_remotes_flush(vni->t_vrfid);
 
 		vrf_delete(vni->t_vrfid);
 		vxlan_vni_destroy(vni);
@@ -1908,6 +2566,12 @@ vxlan_init(void)
 	memset(vxlans, 0, sizeof(struct vxlan_vnitbl));
 	vxlan_vniable_init();
 
+	vxlan_remotes = cds_lfht_new(VXLAN_RTHASH_MIN, VXLAN_RTHASH_MIN,
+				     VXLAN_REMOTES_MAX, CDS_LFHT_AUTO_RESIZE,
+				     NULL);
+	if (!vxlan_remotes)
+		rte_panic("Can't allocate vxlan remotes table\n");
+
 	if (udp_handler_register(AF_INET, htons(VXLAN_PORT),
 				 vxlan_recv_encap_ipv4) != 0)
 		rte_panic("cannot initialise vxlan ipv4 handler\n");
@@ -1930,6 +2594,10 @@ static void vxlan_destroy(void)
 	udp_handler_unregister(AF_INET, htons(VXLAN_GPE_PORT));
 	udp_handler_unregister(AF_INET6, htons(VXLAN_PORT));
 	udp_handler_unregister(AF_INET6, htons(VXLAN_GPE_PORT));
+
+	vxlan_remotes_flush(VRF_INVALID_ID);
+	cds_lfht_destroy(vxlan_remotes, NULL);
+	vxlan_remotes = NULL;
 }
 
 /*
@@ -1991,6 +2659,8 @@ void vxlan_set_t_vrfid(struct ifnet *ifp, vrfid_t t_vrfid)
 		return;
 	if (t_vrfid == VRF_INVALID_ID)
 		return;
+	if (vnode->t_vrfid != VRF_INVALID_ID)
+		vxlan_remotes_flush(vnode->t_vrfid);
 	vrf_delete(vnode->t_vrfid);
 
 	if (vrf_find_or_create(t_vrfid) == NULL) {
@@ -2253,7 +2923,35 @@ static void vxlan_type_init(void)
 		rte_panic("Failed to register VXLAN type: %s", strerror(-ret));
 }
 
+/*
+ * Events that may change the source, or output interface, chosen for a
+ * remote VTEP.
+ */
+static void vxlan_encap_if_event(struct ifnet *ifp __unused)
+{
+	vxlan_encap_invalidate();
+}
+
+static void vxlan_encap_addr_event(enum cont_src_en cont_src __unused,
+				   struct ifnet *ifp __unused,
+				   uint32_t ifindex __unused, int af __unused,
+				   const void *addr __unused)
+{
+	vxlan_encap_invalidate();
+}
+
+static void vxlan_encap_link_event(struct ifnet *ifp __unused,
+				   bool up __unused, uint32_t speed __unused)
+{
+	vxlan_encap_invalidate();
+}
+
 static const struct dp_event_ops vxlan_events = {
+	.if_delete = vxlan_encap_if_event,
+	.if_vrf_set = vxlan_encap_if_event,
+	.if_addr_add = vxlan_encap_addr_event,
+	.if_addr_delete = vxlan_encap_addr_event,
+	.if_link_change = vxlan_encap_link_event,
 	.init = vxlan_type_init,
 	.uninit = vxlan_destroy,
 };
@@ -132,6 +132,14 @@ struct vxlan_ipv6_encap {
 
 /* VXLAN Functions */
 void vxlan_output(struct ifnet *ifp, struct rte_mbuf *m, uint16_t proto);
+
+/*
+ * Encapsulated packets received between vxlan_burst_begin() and
+ * vxlan_burst_end() on the same lcore are held, and decapsulated as a
+ * burst.  Outside of a burst they are decapsulated immediately.
+ */
+void vxlan_burst_begin(void);
+void vxlan_burst_end(void);
 struct ifnet *vxlan_create(const struct ifinfomsg *ifi, const char *ifname,
 			   const struct rte_ether_addr *eth_addr,
 			   struct nlattr *tb[], struct nlattr *data,
@@ -167,4 +175,10 @@ uint32_t vxlan_get_vni(struct ifnet *ifp);
 
 int cmd_vxlan(FILE *f, int argc, char **argv);
 
+/*
+ * Test hook.  Track the remotes in the forwarding tables now, rather than
+ * at the next vxlan_timer, and get the number of remotes tracked.
+ */
+unsigned int vxlan_remotes_track_ut(void);
+
 #endif /* VXLAN_H */
@@ -106,6 +106,7 @@ void ll_addr_set(struct llentry *lle, const struct rte_ether_addr *eth)
 	tmp.lu_flags = lle->la_flags;
 	barrier();	/* keep compiler from optimizing aliased */
 	lle->ll_u.lu_addr_flags = tmp.lu_addr_flags;
+	lle_cache_invalidate();
 }
 
 /* Update existing link-layer addr table entry. */
@@ -173,6 +174,7 @@ void lladdr_update(struct ifnet *ifp, struct llentry *la,
 			la->la_held[i] = NULL;
 		}
 		la->la_numheld = 0;
+		lltable_hold_put(ifp->if_lltable, la_numheld);
 	}
 
 	rte_spinlock_unlock(&la->ll_lock);
@@ -262,8 +264,10 @@ lladdr_add(struct ifnet *ifp, struct sockaddr *sock,
 	} else {
 		rte_spinlock_lock(&lle->ll_lock);
 		lle->la_flags &= ~(LLE_VALID | LLE_STATIC);
+		lle_cache_invalidate();
 
 		pktmbuf_free_bulk(lle->la_held, lle->la_numheld);
+		lltable_hold_put(ifp->if_lltable, lle->la_numheld);
 		lle->la_numheld = 0;
 		rte_spinlock_unlock(&lle->ll_lock);
 	}
@@ -396,8 +400,18 @@ static void ll_probe(struct lltable *llt, struct llentry *la)
 	}
 }
 
+/*
+ * Age an entry once its expiry time is reached, rather than checking
+ * its used flags every second.  Checking the flags may mean querying the
+ * hardware, which is too expensive to do for every entry of a large
+ * table on every tick.  An entry used during the last ARPT_KEEP seconds
+ * is kept for another ARPT_KEEP.
+ */
 static void ll_age(struct lltable *llt, struct llentry *lle, uint64_t cur_time)
 {
+	if ((int64_t)(cur_time - lle->ll_expire) < 0)
+		return;
+
 	if (llentry_has_been_used_and_clear(lle)) {
 		lle->ll_expire = cur_time + rte_get_timer_hz() * ARPT_KEEP;
 
@@ -405,7 +419,7 @@ static void ll_age(struct lltable *llt, struct llentry *lle, uint64_t cur_time)
 		if (lle->la_flags & (LLE_LOCAL | LLE_PROXY))
 			lle->ll_expire += rte_get_timer_hz() * ARPT_KEEP;
 
-	} else if ((int64_t)(cur_time - lle->ll_expire) >= 0) {
+	} else {
 		LLADDR_DEBUG("expire entry for %s, flags %#x\n",
 			     lladdr_ntop(lle), lle->la_flags);
 		rte_spinlock_lock(&lle->ll_lock);
@@ -445,6 +459,9 @@ void lladdr_timer(struct rte_timer *tim __rte_unused, void *arg)
 	if (llt->lle_refresh_expire < cur_time) {
 		refresh_timer_expired = true;
 
+		/* Refresh resolution tokens */
+		rte_atomic16_set(&llt->lle_restoken, ARP_RES_TOKEN);
+
 		/* one second later */
 		llt->lle_refresh_expire = cur_time + rte_get_timer_hz();
 	}
@@ -56,13 +56,25 @@
 #include "util.h"
 #include "vplane_log.h"
 
-/* Bounds for auto resizing hash table */
+/*
+ * Bounds for auto resizing hash table.  Large L2 domains can put up to
+ * a million neighbours behind one interface.  Tables start small rather
+ * than being pre-sized, as most interfaces have few neighbours and a
+ * million buckets on each would cost 8MB per interface.  The resize is
+ * done by the urcu call_rcu thread, not the forwarding threads.
+ */
 #define	LL_HASHTBL_MIN  32
-#define LL_HASHTBL_BITS 13
+#define LL_HASHTBL_BITS 20
 #define LL_HASHTBL_MAX	(1u << LL_HASHTBL_BITS)
 
 static bool lltable_probe_timer_enabled = true;
 
+/* Packets held by entries awaiting resolution, across all tables */
+static rte_atomic32_t lltable_held;
+
+RTE_DEFINE_PER_LCORE(struct lle_cache, lle_cache);
+uint32_t lle_cache_gen;
+
 bool lltable_probe_timer_is_enabled(void)
 {
 	return lltable_probe_timer_enabled;
@@ -155,6 +167,7 @@ llentry_fal_destroy(struct lltable *llt, struct llentry *lle)
 void
 __llentry_destroy(struct lltable *llt, struct llentry *lle)
 {
+	lle_cache_invalidate();
 	llentry_routing_uninstall(lle);
 
 	llentry_fal_destroy(llt, lle);
@@ -173,9 +186,11 @@ llentry_destroy(struct lltable *llt, struct llentry *lle)
 	unsigned int dropped = lle->la_numheld;
 
 	lle->la_flags |= LLE_DELETED;
+	lle_cache_invalidate();
 
 	pktmbuf_free_bulk(lle->la_held, dropped);
 	lle->la_numheld = 0;
+	lltable_hold_put(llt, dropped);
 
 	if (is_master_thread())
 		__llentry_destroy(llt, lle);
@@ -238,10 +253,11 @@ lltable_free_rcu(struct lltable *llt)
 }
 
 /*
- * Create a new lltable.
+ * Create a new lltable, with res_token new resolutions allowed until
+ * the protocol's timer first refills the budget.
  */
 struct lltable *
-lltable_new(struct ifnet *ifp)
+lltable_new(struct ifnet *ifp, int16_t res_token)
 {
 	struct lltable *llt;
 
@@ -259,12 +275,44 @@ lltable_new(struct ifnet *ifp)
 
 	rte_timer_init(&llt->lle_timer);
 	llt->lle_unrtoken = 0;
-	rte_atomic16_set(&llt->lle_restoken, ND6_RES_TOKEN);
+	rte_atomic16_set(&llt->lle_restoken, res_token);
+	rte_atomic16_clear(&llt->lle_held);
 	rte_atomic32_clear(&llt->lle_size);
 
 	return llt;
 }
 
+/*
+ * Account for a packet to be held by an entry of the table while it is
+ * resolved.  Returns false if either the table or the global limit on
+ * held packets has been reached, in which case the caller must drop a
+ * packet instead.
+ */
+bool lltable_hold_get(struct lltable *llt)
+{
+	if (rte_atomic16_add_return(&llt->lle_held, 1) > LL_HOLD_TBL_MAX) {
+		rte_atomic16_dec(&llt->lle_held);
+		return false;
+	}
+
+	if (rte_atomic32_add_return(&lltable_held, 1) > LL_HOLD_MAX) {
+		rte_atomic32_dec(&lltable_held);
+		rte_atomic16_dec(&llt->lle_held);
+		return false;
+	}
+
+	return true;
+}
+
+/* Release held packets once they are sent or freed */
+void lltable_hold_put(struct lltable *llt, unsigned int count)
+{
+	if (count) {
+		rte_atomic16_sub(&llt->lle_held, count);
+		rte_atomic32_sub(&lltable_held, count);
+	}
+}
+
 static unsigned
 lltable_fal_l3_enable_cb(struct lltable *llt __unused, struct llentry *lle,
 			 void *arg)
@@ -34,6 +34,7 @@
 #include <netinet/in.h>
 #include <rte_atomic.h>
 #include <rte_ether.h>
+#include <rte_per_lcore.h>
 #include <rte_spinlock.h>
 #include <rte_timer.h>
 #include <stdbool.h>
@@ -42,13 +43,24 @@
 #include <sys/queue.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <urcu/uatomic.h>
 
 #include "compiler.h"
 #include "if_var.h"
 #include "urcu.h"
+#include "util.h"
 
 #define ARP_MAXHOLD	8	/* packets held until entry resolved */
 #define ARP_MAXPROBES	5	/* send at most 5 requests  */
+#define ARP_RES_TOKEN	100	/* new resolutions per second per table */
+
+/*
+ * Packets held across all entries awaiting resolution, and the share of
+ * those any one table may hold, so that a scan of one interface cannot
+ * starve resolution on the others of mbufs.
+ */
+#define LL_HOLD_MAX	4096
+#define LL_HOLD_TBL_MAX	512
 
 /* timer values */
 #define ARPT_KEEP	(20*60)	/* once resolved, good for 20 * minutes */
@@ -109,6 +121,7 @@ struct lltable {
 	struct rte_timer	lle_timer;
 	uint16_t		lle_unrtoken;
 	rte_atomic16_t		lle_restoken;
+	rte_atomic16_t		lle_held;	/* packets held by entries */
 	rte_atomic32_t		lle_size;
 	uint64_t		lle_refresh_expire;
 };
@@ -143,7 +156,7 @@ struct lltable {
 #define LLE_INTERNAL_MASK (LLE_FWDING | LLE_CREATED_IN_HW |	\
 			   LLE_HW_UPD_PENDING)
 
-struct lltable *lltable_new(struct ifnet *ifp);
+struct lltable *lltable_new(struct ifnet *ifp, int16_t res_token);
 void lltable_stop_timer(struct lltable *);
 void lltable_free_rcu(struct lltable *);
 
@@ -165,6 +178,9 @@ struct llentry *in_lltable_lookup(struct ifnet *ifp, u_int flags,
 
 struct llentry *llentry_new(const void *c, size_t len, struct ifnet *ifp);
 
+bool lltable_hold_get(struct lltable *llt);
+void lltable_hold_put(struct lltable *llt, unsigned int count);
+
 unsigned long lla_hash(const struct lltable *llt, in_addr_t key);
 int lla_match(struct cds_lfht_node *node, const void *key)
 	__hot_func;
@@ -216,6 +232,102 @@ llentry_copy_mac(struct llentry *la,  struct rte_ether_addr *desten)
 	return false;
 }
 
+/*
+ * Per-lcore direct-mapped cache of resolved neighbours, keyed by the
+ * interface index and address, in front of the lltable hashes.  Only
+ * valid entries are cached, along with a copy of their MAC address, so a
+ * hit reads nothing shared but the idle flag.  Any change to the address
+ * or validity of an llentry, or its deletion, bumps the generation, which
+ * invalidates every cache, so a cached llentry is never used once freed.
+ */
+#define LLE_CACHE_BITS	8
+#define LLE_CACHE_SZ	(1u << LLE_CACHE_BITS)
+
+struct lle_cache_entry {
+	struct llentry		*lc_lle;
+	uint32_t		lc_gen;
+	uint32_t		lc_ifindex;
+	struct rte_ether_addr	lc_addr;
+	union {
+		in_addr_t	lc_in;
+		struct in6_addr	lc_in6;
+	};
+};
+
+struct lle_cache {
+	struct lle_cache_entry	lc_v4[LLE_CACHE_SZ];
+	struct lle_cache_entry	lc_v6[LLE_CACHE_SZ];
+};
+
+RTE_DECLARE_PER_LCORE(struct lle_cache, lle_cache);
+extern uint32_t lle_cache_gen;
+
+static inline void lle_cache_invalidate(void)
+{
+	uatomic_inc(&lle_cache_gen);
+}
+
+static ALWAYS_INLINE struct lle_cache_entry *
+lle_cache_slot(const struct ifnet *ifp, in_addr_t addr)
+{
+	return &RTE_PER_LCORE(lle_cache).lc_v4[
+		hash32(addr ^ ifp->if_index, LLE_CACHE_BITS)];
+}
+
+static ALWAYS_INLINE struct lle_cache_entry *
+lle_cache_slot6(const struct ifnet *ifp, const struct in6_addr *addr)
+{
+	return &RTE_PER_LCORE(lle_cache).lc_v6[
+		hash32(addr->s6_addr32[2] ^ addr->s6_addr32[3] ^
+		       ifp->if_index, LLE_CACHE_BITS)];
+}
+
+static ALWAYS_INLINE bool
+lle_cache_match(const struct lle_cache_entry *lc, const struct ifnet *ifp,
+		in_addr_t addr, uint32_t gen)
+{
+	return lc->lc_lle && lc->lc_gen == gen &&
+		lc->lc_in == addr && lc->lc_ifindex == ifp->if_index;
+}
+
+static ALWAYS_INLINE bool
+lle_cache_match6(const struct lle_cache_entry *lc, const struct ifnet *ifp,
+		 const struct in6_addr *addr, uint32_t gen)
+{
+	return lc->lc_lle && lc->lc_gen == gen &&
+		IN6_ARE_ADDR_EQUAL(&lc->lc_in6, addr) &&
+		lc->lc_ifindex == ifp->if_index;
+}
+
+/*
+ * Copy the MAC address from a cache hit.  The idle flag is only written
+ * when set, so the llentry cache line stays shared between the lcores.
+ */
+static ALWAYS_INLINE void
+lle_cache_copy_mac(const struct lle_cache_entry *lc,
+		   struct rte_ether_addr *desten)
+{
+	if (unlikely(rte_atomic16_read(&lc->lc_lle->ll_idle)))
+		rte_atomic16_clear(&lc->lc_lle->ll_idle);
+	rte_ether_addr_copy(&lc->lc_addr, desten);
+}
+
+/*
+ * Cache a valid entry, once the caller has set the address.  The
+ * generation must be read before the lltable lookup, so that a change
+ * made since then invalidates the new entry.
+ */
+static ALWAYS_INLINE void
+lle_cache_fill(struct lle_cache_entry *lc, const struct ifnet *ifp,
+	       struct llentry *lle, const struct rte_ether_addr *mac,
+	       uint32_t gen)
+{
+	lc->lc_lle = lle;
+	lc->lc_gen = gen;
+	lc->lc_ifindex = ifp->if_index;
+	rte_ether_addr_copy(mac, &lc->lc_addr);
+}
+
 /* Check if an lle has been used in HW or SW and reset the used bit */
 bool
 llentry_has_been_used_and_clear(struct llentry *lle);
@@ -152,7 +152,7 @@ in_domifattach(struct ifnet *ifp)
 {
 	struct lltable *llt;
 
-	llt = lltable_new(ifp);
+	llt = lltable_new(ifp, ARP_RES_TOKEN);
 
 	llt->lle_refresh_expire = rte_get_timer_cycles() + rte_get_timer_hz();
 	rte_timer_reset(&llt->lle_timer, rte_get_timer_hz(),
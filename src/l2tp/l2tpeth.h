@@ -13,6 +13,7 @@
 #include <netinet/udp.h>
 #include <linux/l2tp.h>
 #include <rte_atomic.h>
+#include <rte_common.h>
 #include <rte_ether.h>
 #include <urcu/list.h>
 
@@ -24,6 +25,8 @@ struct ifnet;
 #define IPPROTO_L2TPV3	0x73
 #define L2TP_UDP_SESSION_HEADER_SIZE	8
 #define L2TP_IP_SESSION_HEADER_SIZE	4
+/* IPv6, UDP, the session header, an 8 byte cookie and a sequence number */
+#define L2TP_HDR_LEN_MAX	(40 + 8 + L2TP_UDP_SESSION_HEADER_SIZE + 8 + 4)
 
 
 struct l2tp_softc {
@@ -92,6 +95,13 @@ struct l2tp_session {
 	uint32_t peer_seq;
 	uint8_t  ttl;
 
+	/*
+	 * The hdr_len bytes of outer IP, UDP and L2TPv3 headers that are
+	 * sent, with the per-packet fields zero.  The IPv4 checksum is for
+	 * the template, see l2tp_encap_tmpl_init().
+	 */
+	uint8_t  encap_tmpl[L2TP_HDR_LEN_MAX] __rte_aligned(8);
+
 	/* stats must be last */
 	struct l2tp_stats stats[1] __rte_cache_aligned;
 };
@@ -163,6 +173,7 @@ void l2tp_output(struct ifnet *ifp, struct rte_mbuf *m, uint16_t rx_vlan);
 void l2tp_stats(const struct l2tp_session *session,
 		       struct l2tp_stats *stats);
 int l2tp_set_xconnect(char *cmd, char *, char*, char *);
+void l2tp_encap_tmpl_init(struct l2tp_session *session);
 
 int l2tp_udpv4_recv_encap(struct rte_mbuf *m, const struct iphdr *ip,
 			  const struct udphdr *udp);
@@ -172,6 +183,14 @@ int l2tp_udpv6_recv_encap(struct rte_mbuf *m, const struct ip6_hdr *ip6,
 
 int l2tp_ipv6_recv_encap(struct rte_mbuf *m, const struct ip6_hdr *ip6,
 			const unsigned char *l2tp);
+/*
+ * Packets received between l2tp_burst_begin() and l2tp_burst_end() on the
+ * same lcore are held once their session has been checked, and delivered
+ * as a burst.  Outside of a burst they are delivered immediately.
+ */
+void l2tp_burst_begin(void);
+void l2tp_burst_end(void);
+
 int l2tp_undo_decap(const struct ifnet *ifp, struct rte_mbuf *m);
 int l2tp_undo_decap_br(const struct ifnet *brif, struct rte_mbuf *m);
 #endif /* L2TPETH_H */
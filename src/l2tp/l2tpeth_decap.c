@@ -15,6 +15,7 @@
 #include <rte_branch_prediction.h>
 #include <rte_ether.h>
 #include <rte_mbuf.h>
+#include <rte_per_lcore.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -102,6 +103,135 @@ static void l2tp_decap(struct rte_mbuf *m, uint32_t offset)
 }
 
 
+/* Cookies are 4 or 8 bytes, so compare them as words */
+static inline bool l2tp_cookie_match(const struct l2tp_session *s,
+				     const unsigned char *l2tp)
+{
+	uint64_t c64, p64;
+	uint32_t c32, p32;
+
+	switch (s->peer_cookie_len) {
+	case 0:
+		return true;
+	case 4:
+		memcpy(&c32, l2tp, sizeof(c32));
+		memcpy(&p32, s->peer_cookie, sizeof(p32));
+		return c32 == p32;
+	case 8:
+		memcpy(&c64, l2tp, sizeof(c64));
+		memcpy(&p64, s->peer_cookie, sizeof(p64));
+		return c64 == p64;
+	default:
+		return !memcmp(l2tp, s->peer_cookie, s->peer_cookie_len);
+	}
+}
+
+/*
+ * Frames received while an rx burst is being processed are held, and
+ * delivered together at the end of the burst, see l2tp_burst_begin().
+ * The session, cookie and sequence number are checked as each packet
+ * arrives, so packets that aren't for a session, or are to be dropped,
+ * are still returned to the IP input path.
+ */
+#define L2TP_BURST_MAX	32
+
+struct l2tp_burst_pkt {
+	struct rte_mbuf	*lp_m;
+	struct ifnet	*lp_ifp;
+	uint16_t	lp_offset;
+};
+
+struct l2tp_burst {
+	bool			lb_active;
+	uint16_t		lb_count;
+	struct l2tp_burst_pkt	lb_pkt[L2TP_BURST_MAX];
+};
+
+static RTE_DEFINE_PER_LCORE(struct l2tp_burst, l2tp_burst);
+
+/*
+ * Deliver a burst of frames to their sessions' interfaces.  All of the
+ * headers are stripped first, and then the frames are passed on in the
+ * order they were received.
+ */
+static void
+l2tp_deliver_burst(struct l2tp_burst_pkt *pkts, unsigned int count)
+{
+	struct l2tp_burst_pkt *lp;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		lp = &pkts[i];
+		l2tp_decap(lp->lp_m, lp->lp_offset);
+		if_incr_in(lp->lp_ifp, lp->lp_m);
+		pktmbuf_prepare_decap_reswitch(lp->lp_m);
+	}
+
+	for (i = 0; i < count; i++) {
+		lp = &pkts[i];
+
+		if (unlikely(rte_pktmbuf_data_len(lp->lp_m) <
+			     sizeof(struct rte_ether_hdr))) {
+			if_incr_error(lp->lp_ifp);
+			rte_pktmbuf_free(lp->lp_m);
+			continue;
+		}
+		ether_input(lp->lp_ifp, lp->lp_m);
+	}
+}
+
+static void l2tp_burst_flush(struct l2tp_burst *lb)
+{
+	bool active = lb->lb_active;
+	unsigned int count = lb->lb_count;
+
+	/*
+	 * Frames that loop back into l2tp while the burst is being
+	 * delivered are delivered immediately.
+	 */
+	lb->lb_active = false;
+	lb->lb_count = 0;
+	l2tp_deliver_burst(lb->lb_pkt, count);
+	lb->lb_active = active;
+}
+
+void l2tp_burst_begin(void)
+{
+	RTE_PER_LCORE(l2tp_burst).lb_active = true;
+}
+
+void l2tp_burst_end(void)
+{
+	struct l2tp_burst *lb = &RTE_PER_LCORE(l2tp_burst);
+
+	lb->lb_active = false;
+	if (lb->lb_count)
+		l2tp_burst_flush(lb);
+}
+
+static void l2tp_deliver_hold(struct ifnet *ifp, struct rte_mbuf *m,
+			      unsigned int offset)
+{
+	struct l2tp_burst *lb = &RTE_PER_LCORE(l2tp_burst);
+	struct l2tp_burst_pkt *lp;
+
+	if (unlikely(!lb->lb_active)) {
+		struct l2tp_burst_pkt one = {
+			.lp_m = m, .lp_ifp = ifp, .lp_offset = offset,
+		};
+
+		l2tp_deliver_burst(&one, 1);
+		return;
+	}
+
+	lp = &lb->lb_pkt[lb->lb_count];
+	lp->lp_m = m;
+	lp->lp_ifp = ifp;
+	lp->lp_offset = offset;
+	if (++lb->lb_count == L2TP_BURST_MAX)
+		l2tp_burst_flush(lb);
+}
+
 /*
  * Receive encapsulated packets from a l2tpv3 peer
  *
@@ -139,8 +269,7 @@ static int l2tp_recv_encap(struct rte_mbuf *m,
 	if (unlikely((rte_pktmbuf_data_len(m) <= offset)))
 		return 1;
 
-	if (s->peer_cookie_len != 0
-		&& memcmp(l2tp, s->peer_cookie, s->peer_cookie_len)) {
+	if (!l2tp_cookie_match(s, l2tp)) {
 		++stats->rx_cookie_discards;
 		return -1; /* discard - bad cookie */
 	}
@@ -163,17 +292,7 @@ static int l2tp_recv_encap(struct rte_mbuf *m,
 	if (unlikely(ifp == NULL))
 		return -1;
 
-	l2tp_decap(m, offset);
-	if_incr_in(ifp, m);
-	pktmbuf_prepare_decap_reswitch(m);
-
-	if (rte_pktmbuf_data_len(m) < sizeof(struct rte_ether_hdr)) {
-		if_incr_error(ifp);
-		rte_pktmbuf_free(m);
-		return 0;
-	}
-
-	ether_input(ifp, m);
+	l2tp_deliver_hold(ifp, m, offset);
 	return 0;
 }
 
@@ -103,6 +103,77 @@ static int l2tp_add_vlan(struct rte_mbuf *m, uint8_t offset)
 	return 0;
 }
 
+/*
+ * Build the session's outer header template, which l2tp_output() copies in
+ * front of each frame before filling in the tos, ttl, lengths, sequence
+ * number and checksums.
+ */
+void l2tp_encap_tmpl_init(struct l2tp_session *session)
+{
+	uint8_t *hdr = session->encap_tmpl;
+	uint8_t flags = session->flags;
+	uint8_t proto = (flags & L2TP_ENCAP_UDP) ? IPPROTO_UDP : IPPROTO_L2TP;
+	uint8_t ip_hdr_len;
+
+	memset(hdr, 0, sizeof(session->encap_tmpl));
+
+	if (flags & L2TP_ENCAP_IPV4) {
+		struct iphdr *ip_header = (struct iphdr *)hdr;
+
+		ip_header->ihl = sizeof(struct iphdr) >> 2;
+		ip_header->version = IPVERSION;
+		ip_header->protocol = proto;
+		memcpy(&ip_header->saddr, &session->s_addr, sizeof(uint32_t));
+		memcpy(&ip_header->daddr, &session->d_addr, sizeof(uint32_t));
+		ip_header->check = dp_in_cksum_hdr(ip_header);
+		ip_hdr_len = sizeof(struct iphdr);
+	} else {
+		struct ip6_hdr *ip_header = (struct ip6_hdr *)hdr;
+
+		ip6_ver_tc_flow_hdr(ip_header, 0, 0);
+		ip_header->ip6_nxt = proto;
+		memcpy(&ip_header->ip6_src, &session->s_addr,
+		       sizeof(struct in6_addr));
+		memcpy(&ip_header->ip6_dst, &session->d_addr,
+		       sizeof(struct in6_addr));
+		ip_hdr_len = sizeof(struct ip6_hdr);
+	}
+	hdr += ip_hdr_len;
+
+	if (flags & L2TP_ENCAP_UDP) {
+		struct rte_udp_hdr *udp_header = (struct rte_udp_hdr *)hdr;
+		struct l2tpv3_udp_hdr *v3udp_hdr = (struct l2tpv3_udp_hdr *)
+			(udp_header + 1);
+
+		udp_header->src_port = htons(session->sport);
+		udp_header->dst_port = htons(session->dport);
+		v3udp_hdr->ver = htons(L2TP_HDR_VER_3);
+		hdr = (uint8_t *)&v3udp_hdr->session_id;
+	}
+
+	*((uint32_t *)hdr) = htonl(session->peer_session_id);
+	hdr += 4;
+
+	/* The sequence number, if any, follows the cookie */
+	memcpy(hdr, session->cookie, session->cookie_len);
+}
+
+/*
+ * Fold the words of the IPv4 header that differ from the template into the
+ * template's checksum.  Only tos, tot_len and ttl are written per packet.
+ */
+static inline uint16_t
+l2tp_ip_tmpl_cksum_fixup(const struct iphdr *tmpl, const struct iphdr *ip)
+{
+	const uint16_t *o = (const uint16_t *)tmpl;
+	const uint16_t *n = (const uint16_t *)ip;
+	uint16_t check = tmpl->check;
+
+	check = ip_fixup16_cksum(check, o[0], n[0]);
+	check = ip_fixup16_cksum(check, o[1], n[1]);
+	return ip_fixup16_cksum(check, o[4], n[4]);
+}
+
 /* Send a packet out. */
 void
 l2tp_output(struct ifnet *ifp, struct rte_mbuf *m, uint16_t rx_vlan)
@@ -175,24 +246,18 @@ l2tp_output(struct ifnet *ifp, struct rte_mbuf *m, uint16_t rx_vlan)
 	if (session->ttl)
 		ttl = session->ttl;
 
+	memcpy(encap->iphdr, session->encap_tmpl, session->hdr_len);
+
 	if (flags & L2TP_ENCAP_IPV4) {
 		struct iphdr *ip_header = (struct iphdr *)encap->iphdr;
 
 		encap->ether_header.ether_type = htons(RTE_ETHER_TYPE_IPV4);
 
-		ip_header->ihl = sizeof(struct iphdr) >> 2;
-		ip_header->version = IPVERSION;
 		ip_header->tos = tos;
 		ip_header->tot_len = htons(session->hdr_len + orig_pkt_len);
-		ip_header->frag_off = 0;
-		ip_header->id = 0;
 		ip_header->ttl = ttl;
-		ip_header->protocol = (flags & L2TP_ENCAP_UDP) ?
-			IPPROTO_UDP : IPPROTO_L2TP;
-		memcpy(&ip_header->saddr, &session->s_addr, sizeof(uint32_t));
-		memcpy(&ip_header->daddr, &session->d_addr, sizeof(uint32_t));
-
-		dp_set_cksum_hdr(ip_header);
+		ip_header->check = l2tp_ip_tmpl_cksum_fixup(
+			(const struct iphdr *)session->encap_tmpl, ip_header);
 		dp_pktmbuf_l3_len(m) = ip_header->ihl << 2;
 	} else {
 		struct ip6_hdr *ip_header = (struct ip6_hdr *)encap->iphdr;
@@ -203,13 +268,7 @@ l2tp_output(struct ifnet *ifp, struct rte_mbuf *m, uint16_t rx_vlan)
 		ip6_ver_tc_flow_hdr(ip_header, tos, 0);
 		ip_header->ip6_plen = htons(session->hdr_len +
 					    orig_pkt_len - sizeof(struct ip6_hdr));
-		ip_header->ip6_nxt = (flags & L2TP_ENCAP_UDP) ?
-			IPPROTO_UDP : IPPROTO_L2TP;
 		ip_header->ip6_hlim = ttl;
-		memcpy(&ip_header->ip6_src, &session->s_addr,
-		       sizeof(struct in6_addr));
-		memcpy(&ip_header->ip6_dst, &session->d_addr,
-		       sizeof(struct in6_addr));
 	}
 
 	/* udp hdr */
@@ -221,12 +280,8 @@ l2tp_output(struct ifnet *ifp, struct rte_mbuf *m, uint16_t rx_vlan)
 	if (unlikely(flags & L2TP_ENCAP_UDP)) {
 		uint16_t pkt_len = session->hdr_len - ip_hdr_len + orig_pkt_len;
 
-		udp_header->src_port = htons(session->sport);
-		udp_header->dst_port = htons(session->dport);
 		udp_header->dgram_len = htons(pkt_len);
-		if (flags & L2TP_ENCAP_IPV4)
-			udp_header->dgram_cksum = 0;
-		else {
+		if (!(flags & L2TP_ENCAP_IPV4)) {
 			if (proto == IPPROTO_TCP)
 				orig_cksum = ((struct rte_tcp_hdr *)
 					   ((char *)orig_ip + offset))->cksum;
@@ -240,27 +295,9 @@ l2tp_output(struct ifnet *ifp, struct rte_mbuf *m, uint16_t rx_vlan)
 		}
 	}
 
-	/* l2tp header */
-	if (flags & L2TP_ENCAP_UDP) {
-		struct l2tpv3_udp_hdr *v3udp_hdr = (struct l2tpv3_udp_hdr *)
-				  ((char *)encap->iphdr +
-				   ip_hdr_len + sizeof(struct rte_udp_hdr));
-		v3udp_hdr->ver = htons(L2TP_HDR_VER_3);
-		v3udp_hdr->zero = 0;
-		l2tp_hdr = (char *)&v3udp_hdr->session_id;
-	} else
-		l2tp_hdr = (char *)encap->iphdr + ip_hdr_len;
-
-	*((uint32_t *)l2tp_hdr) = htonl(session->peer_session_id);
-	l2tp_hdr += 4;
-
-	if (session->cookie_len) {
-		memcpy(l2tp_hdr, (char *)&session->cookie[0],
-		       session->cookie_len);
-		l2tp_hdr += session->cookie_len;
-	}
-
+	/* l2tp sequence number, the last word of the header */
 	if (unlikely(flags & L2TP_ENCAP_SEQ)) {
+		l2tp_hdr = (char *)encap->iphdr + session->hdr_len - 4;
 		*((uint32_t *)l2tp_hdr) = htonl(0x40000000 |
 						session->local_seq);
 		session->local_seq = (session->local_seq + 1) & 0xffffff;
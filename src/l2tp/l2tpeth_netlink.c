@@ -52,6 +52,13 @@ struct l2tp_session_hash_tbl {
 };
 static struct l2tp_session_hash_tbl *l2tp_sessions;
 
+/*
+ * Sessions with small IDs, which is most of them, are also indexed by ID
+ * so that the forwarding threads don't need to probe the hash table.
+ */
+#define L2TP_SESSION_IDX_SZ 4096
+static struct l2tp_session *l2tp_session_idx[L2TP_SESSION_IDX_SZ];
+
 /* List to iterate over all tunnels. */
 static CDS_LIST_HEAD(l2tp_tunnel_list);
 
@@ -94,6 +101,9 @@ l2tp_session_byid(uint32_t session_id)
 {
 	struct cds_lfht_iter iter;
 
+	if (likely(session_id < L2TP_SESSION_IDX_SZ))
+		return rcu_dereference(l2tp_session_idx[session_id]);
+
 	cds_lfht_lookup(l2tp_sessions->sess_hash,
 			l2tp_session_hash(session_id,
 					  l2tp_sessions->sess_seed),
@@ -170,8 +180,12 @@ l2tp_session_insert(struct l2tp_session *sess, uint32_t s_id)
 	ret_node = cds_lfht_add_unique(l2tp_sessions->sess_hash, hash,
 				       l2tp_session_match, &s_id,
 				       &sess->session_node);
+	if (ret_node != &sess->session_node)
+		return EEXIST;
 
-	return (ret_node != &sess->session_node) ? EEXIST : 0;
+	if (s_id < L2TP_SESSION_IDX_SZ)
+		rcu_assign_pointer(l2tp_session_idx[s_id], sess);
+	return 0;
 }
 
 static void
@@ -195,6 +209,10 @@ static void
 l2tp_session_delete(struct l2tp_session *session)
 {
 	if (likely(session != NULL)) {
+		if (session->session_id < L2TP_SESSION_IDX_SZ &&
+		    l2tp_session_idx[session->session_id] == session)
+			rcu_assign_pointer(l2tp_session_idx[session->session_id],
+					   NULL);
 		cds_lfht_del(l2tp_sessions->sess_hash, &session->session_node);
 		l2tp_session_dec_refcnt(session);
 	}
@@ -284,6 +302,7 @@ l2tp_session_set_info(struct l2tp_session *session, uint32_t session_id,
 	}
 
 	session->hdr_len = hdr_len;
+	l2tp_encap_tmpl_init(session);
 
 	session->ifp = l2tpeth_attach_session(ifname, session, mtu);
 	if (!session->ifp)
@@ -70,5 +70,11 @@ bool lag_can_start(const struct ifnet *ifp);
 bool lag_is_team(struct ifnet *ifp);
 int lag_can_startstop_member(struct ifnet *ifp);
 int lag_set_l2_address(struct ifnet *ifp, struct rte_ether_addr *macaddr);
+uint16_t dpdk_lag_tx_burst(struct ifnet *ifp, uint16_t queue_id,
+			   struct rte_mbuf **tx_pkts, uint16_t nb_pkts);
+int dpdk_lag_dist_set_ut(portid_t port, const portid_t *members,
+			 uint16_t count);
+void dpdk_lag_member_stats_ut(portid_t port, uint64_t *tx_packets,
+			      uint64_t *moves);
 
 #endif
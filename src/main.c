@@ -105,6 +105,7 @@
 #include "if/dpdk-eth/dpdk_eth_if.h"
 #include "if/dpdk-eth/dpdk_eth_linkwatch.h"
 #include "if/dpdk-eth/vhost.h"
+#include "if/vxlan.h"
 #include "if_llatbl.h"
 #include "if_var.h"
 #include "ip_funcs.h"
@@ -116,6 +117,7 @@
 #include "lag.h"
 #include "main.h"
 #include "master.h"
+#include "mpls/mpls_forward.h"
 #include "mpls/mpls_label_table.h"
 #include "netinet6/ip6_funcs.h"
 #include "npf/fragment/ipv4_rsmbl.h"
@@ -415,6 +417,8 @@ eth_tx_burst(struct ifnet *ifp, uint16_t queue_id,
 	     struct rte_mbuf **tx_pkts, uint16_t nb_pkts)
 {
 	eth_tx_run_post_qos_features(ifp, tx_pkts, nb_pkts);
+	if (unlikely(ifp->if_team))
+		return dpdk_lag_tx_burst(ifp, queue_id, tx_pkts, nb_pkts);
 	return rte_eth_tx_burst(ifp->if_port, queue_id, tx_pkts, nb_pkts);
 }
 
@@ -430,7 +434,10 @@ master_eth_tx(struct ifnet *ifp, struct rte_mbuf **tx_pkts, uint16_t nb_pkts)
 	eth_tx_run_post_qos_features(ifp, tx_pkts, nb_pkts);
 
 	pthread_mutex_lock(&master_tx_lock);
-	ret = rte_eth_tx_burst(ifp->if_port, 0, tx_pkts, nb_pkts);
+	if (unlikely(ifp->if_team))
+		ret = dpdk_lag_tx_burst(ifp, 0, tx_pkts, nb_pkts);
+	else
+		ret = rte_eth_tx_burst(ifp->if_port, 0, tx_pkts, nb_pkts);
 	pthread_mutex_unlock(&master_tx_lock);
 
 	return ret;
@@ -716,6 +723,10 @@ process_burst(portid_t portid, struct rte_mbuf *pkts[], uint16_t nb)
 	if (unlikely(ifp->portmonitor))
 		portmonitor_src_phy_rx_output(ifp, pkts, nb);
 
+	mpls_burst_begin();
+	vxlan_burst_begin();
+	l2tp_burst_begin();
+
 	/* Process already prefetched packets */
 	for (i = 0; i + PREFETCH_OFFSET < nb; i++) {
 		rte_prefetch0(pkts[i + PREFETCH_OFFSET]->cacheline1);
@@ -730,6 +741,15 @@ process_burst(portid_t portid, struct rte_mbuf *pkts[], uint16_t nb)
 		pktmbuf_mdata_clear_all(pkts[i]);
 		input_func(ifp, pkts[i]);
 	}
+
+	/*
+	 * Deliver any l2tp frames held back from the burst, decapsulate any
+	 * vxlan packets, including those from l2tp, and then switch any
+	 * labelled packets, including those from vxlan.
+	 */
+	l2tp_burst_end();
+	vxlan_burst_end();
+	mpls_burst_end();
 }
 
 /*
@@ -1595,6 +1615,57 @@ static unsigned int lcore_score(unsigned int lcore, int socket_id, bool is_txq)
 	return score;
 }
 
+static bool port_is_vhost(portid_t portid)
+{
+	const struct rte_eth_dev *dev = &rte_eth_devices[portid];
+
+	return !strncmp(dev->data->name, "eth_vhost", 9);
+}
+
+/*
+ * The vhost PMD moves a port to the NUMA node holding the guest's memory
+ * once the guest connects, so pick that up before placing its queues.
+ */
+static void port_update_socket(portid_t portid)
+{
+	struct port_conf *port_conf = &port_config[portid];
+	int socketid;
+
+	if (!port_is_vhost(portid))
+		return;
+
+	socketid = rte_eth_dev_socket_id(portid);
+	if (socketid < 0 || socketid == port_conf->socketid)
+		return;
+
+	DP_DEBUG(INIT, INFO, DATAPLANE,
+		 "Port %u moved from node %d to node %d\n",
+		 portid, port_conf->socketid, socketid);
+	port_conf->socketid = socketid;
+}
+
+/* Which allowed lcore, if any, polls the given rx queue of a port */
+static int rx_queue_lcore(portid_t portid, uint16_t queue_id,
+			  const bitmask_t *allowed)
+{
+	unsigned int lcore;
+
+	FOREACH_FORWARD_LCORE(lcore) {
+		const struct lcore_conf *conf = lcore_conf[lcore];
+		unsigned int i;
+
+		if (!bitmask_isset(allowed, lcore))
+			continue;
+
+		for (i = 0; i < conf->high_rxq; i++)
+			if (conf->rx_poll[i].portid == portid &&
+			    conf->rx_poll[i].queueid == queue_id)
+				return lcore;
+	}
+
+	return -1;
+}
+
 /* Compute least loaded lcore in round-robin fashion */
 static int next_available_lcore(int socket_id,
 				const bitmask_t *allowed, bool is_txq)
@@ -1722,6 +1793,32 @@ found:
 	return 0;
 }
 
+/*
+ * Pick the lcore for a transmit queue. With pair_rxq set, keep the
+ * queue pair on the lcore polling the matching rx queue, which the
+ * rx queue placement has already made NUMA local.
+ */
+static int tx_queue_lcore(portid_t portid, uint16_t queue_id,
+			  const bitmask_t *allowed, bool pair_rxq)
+{
+	int lcore = -1;
+
+	if (pair_rxq)
+		lcore = rx_queue_lcore(portid, queue_id, allowed);
+	if (lcore < 0)
+		lcore = next_available_lcore(port_config[portid].socketid,
+					     allowed, true);
+	return lcore;
+}
+
+int tx_queue_lcore_ut(portid_t portid, uint16_t queue_id)
+{
+	bitmask_t allowed =
+		cpu_affinity_online(&port_config[portid].tx_cpu_affinity);
+
+	return tx_queue_lcore(portid, queue_id, &allowed, true);
+}
+
 /* Assign lcores that will handle transmit queues (bottom half) */
 static int assign_port_transmit_queues(portid_t portid)
 {
@@ -1744,9 +1841,8 @@ static int assign_port_transmit_queues(portid_t portid)
 		if (!bitmask_isset(&port_conf->tx_enabled_queues, q))
 			continue;
 
-		lcore = next_available_lcore(port_conf->socketid,
-					     &allowed,
-					     true);
+		lcore = tx_queue_lcore(portid, q, &allowed,
+				       port_is_vhost(portid));
 		if (lcore < 0) {
 			RTE_LOG(ERR, DATAPLANE,
 				"no available lcore for tx port %u\n", portid);
@@ -1879,6 +1975,8 @@ int assign_queues(portid_t portid)
 {
 	int rc;
 
+	port_update_socket(portid);
+
 	rc = assign_port_receive_queues(portid);
 	if (rc != 0)
 		goto exit;
@@ -1949,14 +2047,13 @@ void disable_transmit_thread(portid_t portid)
 bool port_uses_queue_state(uint16_t portid)
 {
 	struct port_conf *port_conf = &port_config[portid];
-	struct rte_eth_dev *dev = &rte_eth_devices[portid];
 
 	/*
 	 * Only multiqueue-capable vhost interfaces generate
 	 * RTE_ETH_EVENT_QUEUE_STATE events.
 	 */
 
-	return !strncmp(dev->data->name, "eth_vhost", 9) &&
+	return port_is_vhost(portid) &&
 		port_conf->tx_queues > 1 && port_conf->rx_queues > 1;
 }
 
@@ -54,6 +54,12 @@ extern const char *console_endpoint;
 void console_setup(void);
 void console_destroy(void);
 
+/*
+ * Test hook. The lcore a transmit queue would be placed on when paired
+ * with its rx queue, as is done for vhost ports.
+ */
+int tx_queue_lcore_ut(portid_t portid, uint16_t queue_id);
+
 int portid_to_ifindex(portid_t port);
 int8_t ifindex_to_portid(int index);
 
@@ -25,6 +25,7 @@
 #include <rte_branch_prediction.h>
 #include <rte_ether.h>
 #include <rte_mbuf.h>
+#include <rte_per_lcore.h>
 
 #include "compiler.h"
 #include "compat.h"
@@ -119,6 +120,22 @@ struct mpls_label_cache {
 	struct mplshdr label[MAX_LABEL_CACHE_DEPTH];
 };
 
+/*
+ * Labelled packets received while an rx burst is being processed are held
+ * and switched together at the end of the burst, see mpls_burst_begin().
+ */
+#define MPLS_BURST_MAX		32
+#define MPLS_BURST_GROUPS	8
+
+struct mpls_burst {
+	bool			mb_active;
+	uint16_t		mb_count;
+	struct ifnet		*mb_ifp[MPLS_BURST_MAX];
+	struct rte_mbuf		*mb_pkt[MPLS_BURST_MAX];
+};
+
+static RTE_DEFINE_PER_LCORE(struct mpls_burst, mpls_burst);
+
 static void mpls_output(struct rte_mbuf *m);
 
 bool mpls_global_get_ipttlpropagate(void)
@@ -1506,87 +1523,61 @@ static bool mpls_reswitch_as_ipv6(struct ifnet *input_ifp,
 	return true;
 }
 
+static inline void
+mpls_labeled_drop(struct ifnet *input_ifp, bool local, struct rte_mbuf *m)
+{
+	if (!local) {
+		DBG_MPLS_PKTERR(input_ifp, m,
+				"Dropping mpls pkt\n");
+		mpls_if_incr_in_errors(input_ifp);
+	}
+	rte_pktmbuf_free(m);
+}
+
+/*
+ * Switch a labelled packet whose ttl has been checked and decremented.  nh
+ * is the nexthop for the top label if it has already been looked up,
+ * otherwise NULL.
+ */
 static ALWAYS_INLINE void
-mpls_labeled_forward(struct ifnet *input_ifp, bool local,
-		     struct rte_mbuf *m)
+mpls_labeled_switch(struct ifnet *input_ifp, bool local,
+		    struct rte_mbuf *m, uint8_t ttl, struct next_hop *nh,
+		    enum nh_type nht, enum mpls_payload_type payload_type)
 {
-	enum mpls_payload_type payload_type;
 	struct mpls_label_cache cache;
 	struct cds_lfht *label_table;
 	struct mplshdr *hdr;
 	enum nh_fwd_ret ret;
 	uint32_t in_label;
-	enum nh_type nht;
-	uint8_t ttl;
-	struct next_hop *nh;
 	bool pop;
 
 	mpls_label_cache_init(&cache);
-
-	if (!local)
-		mpls_if_incr_in_ucastpkts(
-			input_ifp, rte_pktmbuf_pkt_len(m));
-
-	hdr = mplshdr_safe(m);
-	if (unlikely(!hdr)) {
-		DBG_MPLS_PKTERR(input_ifp, m,
-				"mpls_labeled_input truncated packet %u if %s(%d)\n",
-				rte_pktmbuf_data_len(m) - dp_pktmbuf_l2_len(m),
-				local ? "(local)" : input_ifp->if_name,
-				local ? 0 : input_ifp->if_index);
-		goto drop;
-	}
-	ttl = mpls_ls_get_ttl(hdr->ls);
-
-	if (unlikely(ttl <= 1) && !local) {
-		struct rte_mbuf *icmp;
-
-		if (is_mpls_oam(input_ifp, m)) {
-			/*
-			 * CPP input firewall. Enables RFC-6192.
-			 *
-			 * Run the local firewall, and discard if so instructed.
-			 */
-			if (npf_local_fw(input_ifp, &m, htons(ETH_P_MPLS_UC)))
-				goto drop;
-			local_packet(input_ifp, m);
-			return;
-		}
-
-		icmp = mpls_icmp_ttl(input_ifp, m, &cache);
-		if (!icmp)
-			goto drop;
-		rte_pktmbuf_free(m);
-		mpls_output(icmp);
-		return;
-	}
-
-	/*
-	 * Decrement ttl unless this is a locally generated packet
-	 */
-	if (!local)
-		ttl--;
+	hdr = mplshdr(m);
 
 	do {
-		in_label = mpls_ls_get_label(hdr->ls);
+		if (!nh) {
+			in_label = mpls_ls_get_label(hdr->ls);
 
-		if (local)
-			label_table = rcu_dereference(global_label_table);
-		else
-			label_table = rcu_dereference(
-				input_ifp->mpls_label_table);
-		nh = mpls_label_table_lookup(label_table, in_label, m,
-					     ETH_P_MPLS_UC, &nht,
-					     &payload_type);
-		if (unlikely(!nh)) {
-			if (!local && label_table) {
-				DBG_MPLS_PKTERR(input_ifp, m,
-						"label table entry not found\n");
-				mpls_if_incr_lbl_lookup_failures(input_ifp);
-			} else
-				DBG_MPLS_PKTERR(input_ifp, m,
-						"dropping as forwarding not enabled on interface\n");
-			break;
+			if (local)
+				label_table =
+					rcu_dereference(global_label_table);
+			else
+				label_table = rcu_dereference(
+					input_ifp->mpls_label_table);
+			nh = mpls_label_table_lookup(label_table, in_label, m,
+						     ETH_P_MPLS_UC, &nht,
+						     &payload_type);
+			if (unlikely(!nh)) {
+				if (!local && label_table) {
+					DBG_MPLS_PKTERR(input_ifp, m,
+							"label table entry not found\n");
+					mpls_if_incr_lbl_lookup_failures(
+						input_ifp);
+				} else
+					DBG_MPLS_PKTERR(input_ifp, m,
+							"dropping as forwarding not enabled on interface\n");
+				break;
+			}
 		}
 
 		ret = nh_fwd_mpls(nh, m, true, payload_type, &cache, &pop);
@@ -1607,14 +1598,14 @@ mpls_labeled_forward(struct ifnet *input_ifp, bool local,
 				    input_ifp, m, dp_nh_get_ifp(nh) ?
 				    if_vrfid(dp_nh_get_ifp(nh)) :
 				    VRF_DEFAULT_ID, ttl))
-				goto drop;
+				break;
 			return;
 		} else if (unlikely(ret == NH_FWD_RESWITCH_IPv6)) {
 			if (!mpls_reswitch_as_ipv6(
 				    input_ifp, m, dp_nh_get_ifp(nh) ?
 				    if_vrfid(dp_nh_get_ifp(nh)) :
 				    VRF_DEFAULT_ID, ttl))
-				goto drop;
+				break;
 			return;
 		} else if (unlikely(ret == NH_FWD_SLOWPATH)) {
 			/*
@@ -1648,18 +1639,272 @@ mpls_labeled_forward(struct ifnet *input_ifp, bool local,
 		hdr = mplshdr_safe(m);
 		if (unlikely(!hdr))
 			break;
+		nh = NULL;
 	} while (unlikely(ret == NH_FWD_RESWITCH_MPLS));
-drop:
-	if (!local) {
+
+	mpls_labeled_drop(input_ifp, local, m);
+}
+
+static ALWAYS_INLINE void
+mpls_labeled_forward(struct ifnet *input_ifp, bool local,
+		     struct rte_mbuf *m)
+{
+	struct mpls_label_cache cache;
+	struct mplshdr *hdr;
+	uint8_t ttl;
+
+	mpls_label_cache_init(&cache);
+
+	if (!local)
+		mpls_if_incr_in_ucastpkts(
+			input_ifp, rte_pktmbuf_pkt_len(m));
+
+	hdr = mplshdr_safe(m);
+	if (unlikely(!hdr)) {
 		DBG_MPLS_PKTERR(input_ifp, m,
-				"Dropping mpls pkt\n");
-		mpls_if_incr_in_errors(input_ifp);
+				"mpls_labeled_input truncated packet %u if %s(%d)\n",
+				rte_pktmbuf_data_len(m) - dp_pktmbuf_l2_len(m),
+				local ? "(local)" : input_ifp->if_name,
+				local ? 0 : input_ifp->if_index);
+		goto drop;
 	}
-	rte_pktmbuf_free(m);
+	ttl = mpls_ls_get_ttl(hdr->ls);
+
+	if (unlikely(ttl <= 1) && !local) {
+		struct rte_mbuf *icmp;
+
+		if (is_mpls_oam(input_ifp, m)) {
+			/*
+			 * CPP input firewall. Enables RFC-6192.
+			 *
+			 * Run the local firewall, and discard if so instructed.
+			 */
+			if (npf_local_fw(input_ifp, &m, htons(ETH_P_MPLS_UC)))
+				goto drop;
+			local_packet(input_ifp, m);
+			return;
+		}
+
+		icmp = mpls_icmp_ttl(input_ifp, m, &cache);
+		if (!icmp)
+			goto drop;
+		rte_pktmbuf_free(m);
+		mpls_output(icmp);
+		return;
+	}
+
+	/*
+	 * Decrement ttl unless this is a locally generated packet
+	 */
+	if (!local)
+		ttl--;
+
+	mpls_labeled_switch(input_ifp, local, m, ttl, NULL, NH_TYPE_V4GW,
+			    MPT_UNSPEC);
+	return;
+drop:
+	mpls_labeled_drop(input_ifp, local, m);
+}
+
+/*
+ * Is the nexthop a simple swap of the top label for one or more labels?
+ */
+static ALWAYS_INLINE bool
+nh_is_mpls_swap(const struct next_hop *nh)
+{
+	const union next_hop_outlabels *labels = nh_get_labels(nh);
+
+	return !(nh_get_flags(nh) & RTF_SLOWPATH) &&
+		nh_outlabels_get_cnt(labels) &&
+		nh_outlabels_get_value(labels, 0) != MPLS_IMPLICITNULL;
+}
+
+struct mpls_burst_group {
+	struct cds_lfht		*bg_table;
+	uint32_t		bg_label;
+	enum nh_type		bg_nht;
+	enum mpls_payload_type	bg_payload_type;
+	struct next_hop_list	*bg_nhl;
+};
+
+/*
+ * Switch a burst of labelled packets received on forwarding interfaces.
+ *
+ * Packets are grouped by top label and label table, and each label is
+ * looked up once per group.  The ECMP hashes for packets with multipath
+ * labels are computed together, and the output label stack is built once
+ * for consecutive swaps to the same nexthop and copied into each packet.
+ *
+ * Packets that need the exception paths (truncated, ttl expiry, forwarding
+ * not enabled) and packets whose label does not fit in the group table are
+ * switched individually first.  Packets with the same top label are always
+ * handled by the same path, so are not reordered.
+ */
+static void
+mpls_labeled_forward_burst(struct ifnet **ifps, struct rte_mbuf **pkts,
+			   unsigned int count)
+{
+	struct mpls_burst_group *pkt_grp[MPLS_BURST_MAX];
+	struct mpls_burst_group grp[MPLS_BURST_GROUPS];
+	struct mpls_label_cache cache, last_cache;
+	struct ifnet *fast_ifp[MPLS_BURST_MAX];
+	struct rte_mbuf *fast[MPLS_BURST_MAX];
+	const struct next_hop *last_nh = NULL;
+	uint32_t hash[MPLS_BURST_MAX];
+	unsigned int i, j, n = 0, ngrp = 0;
+	struct mpls_burst_group *bg;
+	uint8_t last_bos = 0;
+
+	for (i = 0; i < count; i++) {
+		struct rte_mbuf *m = pkts[i];
+		struct ifnet *ifp = ifps[i];
+		struct cds_lfht *label_table;
+		struct mplshdr *hdr;
+		uint32_t in_label;
+
+		hdr = mplshdr_safe(m);
+		label_table = rcu_dereference(ifp->mpls_label_table);
+		if (unlikely(!hdr || !label_table ||
+			     mpls_ls_get_ttl(hdr->ls) <= 1)) {
+			mpls_labeled_forward(ifp, false, m);
+			continue;
+		}
+
+		in_label = mpls_ls_get_label(hdr->ls);
+		for (j = 0; j < ngrp; j++)
+			if (grp[j].bg_label == in_label &&
+			    grp[j].bg_table == label_table)
+				break;
+
+		if (j == ngrp) {
+			if (unlikely(ngrp == MPLS_BURST_GROUPS)) {
+				mpls_labeled_forward(ifp, false, m);
+				continue;
+			}
+			bg = &grp[ngrp++];
+			bg->bg_table = label_table;
+			bg->bg_label = in_label;
+			bg->bg_nhl = mpls_label_table_lookup_nhl(
+				label_table, in_label, &bg->bg_nht,
+				&bg->bg_payload_type);
+		}
+
+		fast[n] = m;
+		fast_ifp[n] = ifp;
+		pkt_grp[n] = &grp[j];
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		const struct next_hop_list *nhl = pkt_grp[i]->bg_nhl;
+
+		if (nhl && nhl->nsiblings > 1)
+			hash[i] = mpls_ecmp_hash(fast[i]);
+	}
+
+	for (i = 0; i < n; i++) {
+		struct rte_mbuf *m = fast[i];
+		struct ifnet *ifp = fast_ifp[i];
+		struct mplshdr *hdr = mplshdr(m);
+		struct next_hop_list *nhl;
+		struct next_hop *nh;
+		uint8_t ttl, bos;
+
+		bg = pkt_grp[i];
+		nhl = bg->bg_nhl;
+
+		mpls_if_incr_in_ucastpkts(ifp, rte_pktmbuf_pkt_len(m));
+		ttl = mpls_ls_get_ttl(hdr->ls) - 1;
+
+		if (unlikely(!nhl))
+			nh = NULL;
+		else if (likely(nhl->nsiblings == 1))
+			nh = nhl->siblings;
+		else
+			nh = nexthop_mp_select(nhl, nhl->siblings,
+					       nhl->nsiblings, hash[i]);
+
+		if (unlikely(!nh)) {
+			DBG_MPLS_PKTERR(ifp, m,
+					"label table entry not found\n");
+			mpls_if_incr_lbl_lookup_failures(ifp);
+			mpls_labeled_drop(ifp, false, m);
+			continue;
+		}
+
+		if (unlikely(!nh_is_mpls_swap(nh))) {
+			mpls_labeled_switch(ifp, false, m, ttl, nh,
+					    bg->bg_nht, bg->bg_payload_type);
+			continue;
+		}
+
+		bos = mpls_ls_get_bos(hdr->ls);
+		if (nh == last_nh && bos == last_bos) {
+			cache = last_cache;
+		} else {
+			mpls_label_cache_init(&cache);
+			if (unlikely(!push_labels(nh_get_labels(nh), bos,
+						  &cache))) {
+				mpls_labeled_drop(ifp, false, m);
+				continue;
+			}
+			last_nh = nh;
+			last_bos = bos;
+			last_cache = cache;
+		}
+
+		/*
+		 * Make swapped label part of l2_len as we don't care about it
+		 * anymore
+		 */
+		dp_pktmbuf_l2_len(m) += sizeof(struct mplshdr);
+		nh_mpls_forward(bg->bg_payload_type, bg->bg_nht, nh, true,
+				ttl, m, &cache, ifp);
+	}
+}
+
+static void mpls_burst_flush(struct mpls_burst *mb)
+{
+	bool active = mb->mb_active;
+	unsigned int count = mb->mb_count;
+
+	/*
+	 * Packets that loop back into mpls_labeled_input while the burst
+	 * is being switched, e.g. after a pop and IP reswitch to a tunnel,
+	 * are switched immediately.
+	 */
+	mb->mb_active = false;
+	mb->mb_count = 0;
+	mpls_labeled_forward_burst(mb->mb_ifp, mb->mb_pkt, count);
+	mb->mb_active = active;
+}
+
+void mpls_burst_begin(void)
+{
+	RTE_PER_LCORE(mpls_burst).mb_active = true;
+}
+
+void mpls_burst_end(void)
+{
+	struct mpls_burst *mb = &RTE_PER_LCORE(mpls_burst);
+
+	mb->mb_active = false;
+	if (mb->mb_count)
+		mpls_burst_flush(mb);
 }
 
 void mpls_labeled_input(struct ifnet *input_ifp, struct rte_mbuf *m)
 {
+	struct mpls_burst *mb = &RTE_PER_LCORE(mpls_burst);
+
+	if (likely(mb->mb_active)) {
+		mb->mb_ifp[mb->mb_count] = input_ifp;
+		mb->mb_pkt[mb->mb_count] = m;
+		if (++mb->mb_count == MPLS_BURST_MAX)
+			mpls_burst_flush(mb);
+		return;
+	}
+
 	mpls_labeled_forward(input_ifp, false /* non-local */, m);
 }
 
@@ -32,6 +32,14 @@ void mpls_global_set_defaultttl(int ttl);
 
 uint32_t mpls_ecmp_hash(const struct rte_mbuf *m);
 
+/*
+ * Labelled packets input between mpls_burst_begin() and mpls_burst_end()
+ * on the same lcore are held, and switched as a burst.  Outside of a burst
+ * they are switched immediately.
+ */
+void mpls_burst_begin(void);
+void mpls_burst_end(void);
+
 void mpls_labeled_input(struct ifnet *ifp, struct rte_mbuf *m)
 	__attribute__((hot));
 void mpls_unlabeled_input(struct ifnet *ifp, struct rte_mbuf *m,
@@ -49,6 +49,14 @@ struct cds_lfht;
 /* Max is full label value range */
 #define LABEL_TABLE_LFHT_MAX	(1 << 20)
 
+/*
+ * Size of the direct index before the label table size is configured, and
+ * the largest it can be.  Labels at or above the index size are only in the
+ * hash table.
+ */
+#define LABEL_TABLE_INDEX_INIT	(1 << 16)
+#define LABEL_TABLE_INDEX_MAX	(1 << 18)
+
 struct label_table_node {
 	uint32_t in_label; /* Incoming label */
 	uint32_t next_hop; /* idx of output info */
@@ -58,6 +66,18 @@ struct label_table_node {
 	struct rcu_head rcu_head;
 } __rte_cache_aligned;
 
+/*
+ * Direct index of label table nodes by incoming label, for labels below
+ * li_size.  It is kept in step with the hash table by the master thread, so
+ * a NULL entry is a miss without needing to search the hash table.
+ */
+struct label_table_index {
+	struct cds_lfht *li_table;
+	uint32_t li_size;
+	struct rcu_head li_rcu;
+	struct label_table_node *li_node[];
+};
+
 /*
  * Currently we only support a single label space.  but we preserve
  * the underlying infra in case we ever have more.
@@ -65,6 +85,9 @@ struct label_table_node {
 int global_label_space_id;
 struct cds_lfht *global_label_table;
 
+/* Direct index for global_label_table */
+static struct label_table_index *global_label_index;
+
 /* set of labelspaces, for each labelspaces there is label table */
 static struct cds_list_head label_table_set;
 
@@ -75,6 +98,7 @@ struct label_table_set_entry {
 	int labelspace; /* labelspace indentificator  */
 	int refcount;
 	struct cds_lfht *label_table;
+	struct label_table_index *label_index;
 	struct rcu_head rcu_head;
 };
 
@@ -157,6 +181,40 @@ static void free_label_table_node(struct label_table_node *label_table_entry)
 		 free_label_table_node_rcu);
 }
 
+static struct label_table_index *
+mpls_label_index_create(struct cds_lfht *label_table, uint32_t size)
+{
+	struct label_table_index *index;
+
+	index = zmalloc_aligned(sizeof(*index) +
+				size * sizeof(index->li_node[0]));
+	if (!index)
+		return NULL;
+
+	index->li_table = label_table;
+	index->li_size = size;
+	return index;
+}
+
+static void
+free_label_index_rcu(struct rcu_head *head)
+{
+	free(caa_container_of(head, struct label_table_index, li_rcu));
+}
+
+/*
+ * Point the index entry for a label at a new node, or NULL.  Readers see
+ * either the old or the new node, and the old node is freed after a grace
+ * period.
+ */
+static void
+mpls_label_index_set(struct label_table_index *index, uint32_t in_label,
+		     struct label_table_node *label_table_node)
+{
+	if (index && in_label < index->li_size)
+		rcu_assign_pointer(index->li_node[in_label], label_table_node);
+}
+
 static void
 free_label_table_set_entry_rcu(struct rcu_head *head)
 {
@@ -173,22 +231,25 @@ free_label_table_set_entry_rcu(struct rcu_head *head)
 	assert(!mpls_label_table_count(ls_entry->label_table));
 
 	dp_ht_destroy_deferred(ls_entry->label_table);
+	free(ls_entry->label_index);
 	free(ls_entry);
 }
 
 static bool
-mpls_label_table_ins_lbl_internal(struct cds_lfht *label_table,
+mpls_label_table_ins_lbl_internal(struct label_table_set_entry *ls_entry,
 				  uint32_t in_label, enum nh_type nh_type,
 				  enum mpls_payload_type payload_type,
 				  struct next_hop *hops,
 				  size_t size)
 {
 	struct label_table_node *label_table_node;
+	struct cds_lfht *label_table;
 	struct cds_lfht_node *node;
 	uint32_t nextu_idx;
 	int rc;
 	bool added_new = false;
 
+	label_table = ls_entry ? ls_entry->label_table : NULL;
 	if (!label_table) {
 		RTE_LOG(ERR, MPLS,
 			"There is no label table for this insertion\n");
@@ -250,6 +311,8 @@ mpls_label_table_ins_lbl_internal(struct cds_lfht *label_table,
 					    label_table_node),
 				    mpls_label_table_node_match,
 				    label_table_node, &label_table_node->node);
+	mpls_label_index_set(ls_entry->label_index, in_label,
+			     label_table_node);
 	if (node) {
 		DP_DEBUG(MPLS_CTRL, DEBUG, MPLS,
 			 "Free the old label table entry for label %d\n",
@@ -269,9 +332,10 @@ mpls_label_table_ins_lbl_internal(struct cds_lfht *label_table,
 }
 
 static int
-mpls_label_table_rem_lbl_internal(struct cds_lfht *label_table,
+mpls_label_table_rem_lbl_internal(struct label_table_set_entry *ls_entry,
 				  uint32_t in_label)
 {
+	struct cds_lfht *label_table = ls_entry->label_table;
 	struct label_table_node *out, in;
 	struct cds_lfht_iter iter;
 	struct cds_lfht_node *node;
@@ -285,8 +349,11 @@ mpls_label_table_rem_lbl_internal(struct cds_lfht *label_table,
 	node = cds_lfht_iter_get_node(&iter);
 	if (node) {
 		out = caa_container_of(node, struct label_table_node, node);
-		if (!cds_lfht_del(label_table, &out->node))
+		if (!cds_lfht_del(label_table, &out->node)) {
+			mpls_label_index_set(ls_entry->label_index, in_label,
+					     NULL);
 			free_label_table_node(out);
+		}
 		rc = 0;
 	} else {
 		rc = -ENOENT;
@@ -302,18 +369,18 @@ mpls_label_table_rem_lbl_internal(struct cds_lfht *label_table,
  * Delete entries for the various mpls reserved label values.
  */
 static void
-mpls_label_table_del_reserved_labels(struct cds_lfht *table)
+mpls_label_table_del_reserved_labels(struct label_table_set_entry *ls_entry)
 {
-	mpls_label_table_rem_lbl_internal(table, MPLS_IPV4EXPLICITNULL);
-	mpls_label_table_rem_lbl_internal(table, MPLS_IPV6EXPLICITNULL);
-	mpls_label_table_rem_lbl_internal(table, MPLS_ROUTERALERT);
+	mpls_label_table_rem_lbl_internal(ls_entry, MPLS_IPV4EXPLICITNULL);
+	mpls_label_table_rem_lbl_internal(ls_entry, MPLS_IPV6EXPLICITNULL);
+	mpls_label_table_rem_lbl_internal(ls_entry, MPLS_ROUTERALERT);
 }
 
 /*
  * Add entries for the various mpls reserved label values.
  */
 static bool
-mpls_label_table_add_reserved_labels(struct cds_lfht *table)
+mpls_label_table_add_reserved_labels(struct label_table_set_entry *ls_entry)
 {
 	struct next_hop *nhop;
 	struct ip_addr addr_any = {
@@ -331,10 +398,10 @@ mpls_label_table_add_reserved_labels(struct cds_lfht *table)
 	nhop = nexthop_create(NULL, &addr_any, 0, 1, outlabels);
 	if (!nhop)
 		goto error;
-	mpls_label_table_ins_lbl_internal(table, MPLS_IPV4EXPLICITNULL,
+	mpls_label_table_ins_lbl_internal(ls_entry, MPLS_IPV4EXPLICITNULL,
 					  NH_TYPE_V4GW, MPT_IPV4,
 					  nhop, 1);
-	mpls_label_table_ins_lbl_internal(table, MPLS_IPV6EXPLICITNULL,
+	mpls_label_table_ins_lbl_internal(ls_entry, MPLS_IPV6EXPLICITNULL,
 					  NH_TYPE_V4GW, MPT_IPV6,
 					  nhop, 1);
 	free(nhop);
@@ -342,7 +409,7 @@ mpls_label_table_add_reserved_labels(struct cds_lfht *table)
 	nhop = nexthop_create(NULL, &addr_any, RTF_SLOWPATH, 1, outlabels);
 	if (!nhop)
 		goto error;
-	mpls_label_table_ins_lbl_internal(table, MPLS_ROUTERALERT,
+	mpls_label_table_ins_lbl_internal(ls_entry, MPLS_ROUTERALERT,
 					  NH_TYPE_V4GW, 0, nhop, 1);
 	free(nhop);
 
@@ -351,7 +418,7 @@ mpls_label_table_add_reserved_labels(struct cds_lfht *table)
 error:
 	RTE_LOG(ERR, MPLS,
 		"Out of memory allocating nexthops for reserved labels\n");
-	mpls_label_table_del_reserved_labels(table);
+	mpls_label_table_del_reserved_labels(ls_entry);
 	return false;
 }
 
@@ -439,8 +506,18 @@ mpls_label_table_get_and_lock(int labelspace)
 		free(ls_entry);
 		return NULL;
 	}
+	ls_entry->label_index = mpls_label_index_create(ls_entry->label_table,
+							LABEL_TABLE_INDEX_INIT);
+	if (!ls_entry->label_index) {
+		RTE_LOG(ERR, MPLS,
+			"Unable to create label table index for labelspace %d\n",
+			labelspace);
+		dp_ht_destroy_deferred(ls_entry->label_table);
+		free(ls_entry);
+		return NULL;
+	}
 	ls_entry->refcount = 1;
-	if (!mpls_label_table_add_reserved_labels(ls_entry->label_table)) {
+	if (!mpls_label_table_add_reserved_labels(ls_entry)) {
 		free_label_table_set_entry_rcu(&ls_entry->rcu_head);
 		return NULL;
 	}
@@ -454,6 +531,8 @@ mpls_label_table_get_and_lock(int labelspace)
 	if (labelspace == global_label_space_id) {
 		assert(!global_label_table);
 		rcu_read_lock();
+		rcu_assign_pointer(global_label_index,
+				   ls_entry->label_index);
 		rcu_assign_pointer(global_label_table,
 				   ls_entry->label_table);
 		rcu_read_unlock();
@@ -492,12 +571,13 @@ mpls_label_table_unlock_internal(struct label_table_set_entry *ls_entry)
 		if (ls_entry->labelspace == global_label_space_id) {
 			assert(global_label_table);
 			rcu_assign_pointer(global_label_table, NULL);
+			rcu_assign_pointer(global_label_index, NULL);
 		}
 
 		DP_DEBUG(MPLS_CTRL, DEBUG, MPLS,
 			 "label table for labelspace %d is being deleted\n",
 			 ls_entry->labelspace);
-		mpls_label_table_del_reserved_labels(ls_entry->label_table);
+		mpls_label_table_del_reserved_labels(ls_entry);
 		cds_list_del_rcu(&ls_entry->entry);
 
 		call_rcu(&ls_entry->rcu_head, free_label_table_set_entry_rcu);
@@ -521,14 +601,16 @@ void mpls_label_table_insert_label(int labelspace, uint32_t in_label,
 			     struct next_hop *hops,
 			     size_t size)
 {
-	struct cds_lfht *label_table =
-		mpls_label_table_get_and_lock(labelspace);
+	struct label_table_set_entry *ls_entry = NULL;
+
+	if (mpls_label_table_get_and_lock(labelspace))
+		ls_entry = mpls_label_space_entry_get(labelspace);
 
 	/*
 	 * if we inserted a new entry then keep lock on table for
 	 * it - otherwise release the refcount we took above.
 	 */
-	if (!mpls_label_table_ins_lbl_internal(label_table, in_label,
+	if (!mpls_label_table_ins_lbl_internal(ls_entry, in_label,
 					       nh_type, payload_type,
 					       hops, size))
 		mpls_label_table_unlock(labelspace);
@@ -538,12 +620,19 @@ static inline struct label_table_node *
 mpls_label_table_lookup_internal(struct cds_lfht *label_table,
 				 uint32_t in_label)
 {
+	struct label_table_index *index;
 	struct label_table_node in;
 	struct cds_lfht_iter iter;
 	struct cds_lfht_node *node;
 
 	if (unlikely(!label_table))
 		return NULL;
+
+	index = rcu_dereference(global_label_index);
+	if (likely(index && index->li_table == label_table &&
+		   in_label < index->li_size))
+		return rcu_dereference(index->li_node[in_label]);
+
 	in.in_label = in_label;
 	cds_lfht_lookup(label_table, mpls_label_table_node_hash(&in),
 			mpls_label_table_node_match, &in, &iter);
@@ -582,6 +671,28 @@ mpls_label_table_lookup(struct cds_lfht *label_table, uint32_t in_label,
 	return nh;
 }
 
+/*
+ * Lookup a label returning the next hop list, rather than a path selected
+ * for one packet, so that the result can be shared by a burst of packets
+ * with the same label.
+ */
+struct next_hop_list *
+mpls_label_table_lookup_nhl(struct cds_lfht *label_table, uint32_t in_label,
+			    enum nh_type *nht,
+			    enum mpls_payload_type *payload_type)
+{
+	struct label_table_node *out;
+
+	out = mpls_label_table_lookup_internal(label_table, in_label);
+	if (unlikely(!out))
+		return NULL;
+
+	*nht = out->nh_type;
+	*payload_type = out->payload_type;
+	return next_hop_list_get(nh_type_to_address_family(*nht),
+				 out->next_hop);
+}
+
 void mpls_label_table_remove_label(int labelspace, uint32_t in_label)
 {
 	struct label_table_set_entry *ls_entry;
@@ -590,13 +701,51 @@ void mpls_label_table_remove_label(int labelspace, uint32_t in_label)
 	if (!ls_entry)
 		return;
 
-	if (!mpls_label_table_rem_lbl_internal(ls_entry->label_table, in_label))
+	if (!mpls_label_table_rem_lbl_internal(ls_entry, in_label))
 		/*
 		 * Deleted an entry so lose its lock on the table
 		 */
 		mpls_label_table_unlock_internal(ls_entry);
 }
 
+/*
+ * Replace the direct index with one sized for the new label space, and
+ * populate it from the hash table.  If the allocation fails the existing
+ * index is kept, and any labels beyond it are found via the hash table.
+ */
+static void
+mpls_label_index_resize(struct label_table_set_entry *ls_entry,
+			uint32_t max_label)
+{
+	struct label_table_node *label_table_entry;
+	struct label_table_index *index, *old;
+	struct cds_lfht_iter iter;
+
+	index = mpls_label_index_create(ls_entry->label_table,
+					RTE_MIN(max_label,
+						LABEL_TABLE_INDEX_MAX));
+	if (!index) {
+		RTE_LOG(ERR, MPLS,
+			"Unable to resize label table index for labelspace %d\n",
+			ls_entry->labelspace);
+		return;
+	}
+
+	cds_lfht_for_each_entry(ls_entry->label_table, &iter,
+				label_table_entry, node) {
+		if (label_table_entry->in_label < index->li_size)
+			index->li_node[label_table_entry->in_label] =
+				label_table_entry;
+	}
+
+	old = ls_entry->label_index;
+	rcu_assign_pointer(ls_entry->label_index, index);
+	if (ls_entry->labelspace == global_label_space_id)
+		rcu_assign_pointer(global_label_index, index);
+
+	call_rcu(&old->li_rcu, free_label_index_rcu);
+}
+
 void mpls_label_table_resize(int labelspace, uint32_t max_label)
 {
 	struct label_table_node *label_table_entry;
@@ -622,12 +771,19 @@ void mpls_label_table_resize(int labelspace, uint32_t max_label)
 			DP_DEBUG(MPLS_CTRL, DEBUG, MPLS,
 				 "purging label %u due to resize\n",
 				 label_table_entry->in_label);
+			mpls_label_index_set(ls_entry->label_index,
+					     label_table_entry->in_label,
+					     NULL);
 			free_label_table_node(label_table_entry);
 			/* release lock on table for presence of route */
 			mpls_label_table_unlock_internal(ls_entry);
 		}
 	}
 
+	/* The table is being freed if the last route was purged */
+	if (ls_entry->refcount)
+		mpls_label_index_resize(ls_entry, max_label);
+
 	rcu_read_unlock();
 }
 
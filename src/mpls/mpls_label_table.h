@@ -61,6 +61,11 @@ mpls_label_table_lookup(struct cds_lfht *label_table, uint32_t in_label,
 			enum nh_type *nht,
 			enum mpls_payload_type *payload_type)
 	__attribute__((hot));
+struct next_hop_list *
+mpls_label_table_lookup_nhl(struct cds_lfht *label_table, uint32_t in_label,
+			    enum nh_type *nht,
+			    enum mpls_payload_type *payload_type)
+	__attribute__((hot));
 
 void mpls_label_table_resize(int labelspace, uint32_t max_label);
 void mpls_label_table_set_dump(FILE *fp, const int labelspace);
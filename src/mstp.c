@@ -249,6 +249,7 @@ mstp_msti_delete(struct ifnet *bridge, uint16_t mstid)
 		rcu_xchg_pointer(&sc->scbr_vlan2mstiindex, v2minew);
 
 	call_rcu(&v2miold->rcu, mstp_vlan2mstiindex_free);
+	bridge_flood_invalidate(bridge);
 	mstp_mstid2index_release(bridge, mstid);
 
 	/*
@@ -342,6 +343,7 @@ mstp_msti_update(struct ifnet *bridge, uint16_t mstid,
 
 	if (v2miold != NULL)
 		call_rcu(&v2miold->rcu, mstp_vlan2mstiindex_free);
+	bridge_flood_invalidate(bridge);
 
 	DP_DEBUG(BRIDGE, INFO, BRIDGE,
 		 "MSTP MSTI %s:%d(%d): %s\n",
@@ -386,6 +388,7 @@ mstp_bridge_delete(struct ifnet *bridge)
 	if (v2mi != NULL) {
 		rcu_assign_pointer(sc->scbr_vlan2mstiindex, NULL);
 		call_rcu(&v2mi->rcu, mstp_vlan2mstiindex_free);
+		bridge_flood_invalidate(bridge);
 	}
 
 	sc->scbr_mstp = NULL;
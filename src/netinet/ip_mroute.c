@@ -260,9 +260,17 @@ static int mfc_match(struct cds_lfht_node *node, const void *_key)
 	       (key->mfc_mcastgrp.s_addr == rt->mfc_mcastgrp.s_addr));
 }
 
+static void mfc_olist_free(struct rcu_head *head)
+{
+	struct mfc_olist *olist = caa_container_of(head, struct mfc_olist,
+						   mo_rcu);
+	free(olist);
+}
+
 static void mfc_free(struct rcu_head *head)
 {
 	struct mfc *rt = caa_container_of(head, struct mfc, rcu_head);
+	free(rt->mfc_olist);
 	free(rt);
 }
 
@@ -279,6 +287,58 @@ static void vif_free(struct rcu_head *head)
 	free(vifp);
 }
 
+/*
+ * Compile the outgoing vifs of an mfc entry into an array, along with the
+ * group's L2 destination address, and publish it in place of the previous
+ * one.  Must be redone whenever the ifset or the vif table changes, before
+ * any vif removed from the table is freed.
+ *
+ * If the allocation fails the entry is left without an output vector and
+ * its packets are punted.
+ */
+static void mfc_olist_update(struct vrf *vrf, struct mfc *rt)
+{
+	struct cds_lfht *viftable = vrf->v_mvrf4.viftable;
+	struct mfc_olist *olist, *old;
+	struct cds_lfht_iter iter;
+	struct vif *vifp;
+	unsigned int count = 0;
+	mcast_dst_eth_addr_t eth_daddr;
+
+	cds_lfht_for_each_entry(viftable, &iter, vifp, node)
+		if (IF_ISSET(vifp->v_vif_index, &rt->mfc_ifset))
+			count++;
+
+	olist = malloc(sizeof(*olist) + count * sizeof(olist->mo_vifs[0]));
+	if (olist) {
+		eth_daddr = mcast_dst_eth_addr(rt->mfc_mcastgrp.s_addr);
+		rte_ether_addr_copy(&eth_daddr.as_addr, &olist->mo_eth_daddr);
+		olist->mo_count = 0;
+
+		cds_lfht_for_each_entry(viftable, &iter, vifp, node)
+			if (IF_ISSET(vifp->v_vif_index, &rt->mfc_ifset))
+				olist->mo_vifs[olist->mo_count++] = vifp;
+	} else {
+		mfc_debug(vrf->v_id, &rt->mfc_origin, &rt->mfc_mcastgrp,
+			  "Failed to allocate olist; punting all packets.");
+	}
+
+	old = rt->mfc_olist;
+	rcu_assign_pointer(rt->mfc_olist, olist);
+	if (old)
+		call_rcu(&old->mo_rcu, mfc_olist_free);
+}
+
+/* Recompile the output vectors of all mfc entries in a vrf */
+static void mfc_olists_update(struct vrf *vrf)
+{
+	struct cds_lfht_iter iter;
+	struct mfc *rt;
+
+	cds_lfht_for_each_entry(vrf->v_mvrf4.mfchashtbl, &iter, rt, node)
+		mfc_olist_update(vrf, rt);
+}
+
 /*
  * Find a route for a given origin IP address and multicast group address.
  * Statistics must be updated by the caller.
@@ -447,7 +507,10 @@ int add_vif(int ifindex)
 	if (retnode) {
 		vifp = caa_container_of(retnode, struct vif, node);
 		IF_CLR(vifp->v_vif_index, &vrf->v_mvrf4.mfc_ifset);
+		mfc_olists_update(vrf);
 		call_rcu(&vifp->rcu_head, vif_free);
+	} else {
+		mfc_olists_update(vrf);
 	}
 
 	ip_mcast_fal_int_enable(vifp, viftable);
@@ -490,6 +553,7 @@ int del_vif(vifi_t vifi)
 	IF_CLR(vifp->v_vif_index, &vrf->v_mvrf4.mfc_ifset);
 	if (!cds_lfht_del(vrf->v_mvrf4.viftable, &vifp->node)) {
 		ip_mcast_fal_int_disable(vifp, vrf->v_mvrf4.viftable);
+		mfc_olists_update(vrf);
 		call_rcu(&vifp->rcu_head, vif_free);
 	}
 	return 0;
@@ -608,6 +672,8 @@ static void update_mfc_params(vrfid_t vrf_id, struct mfc *rt,
 			  &rt->mfc_mcastgrp,
 			  "Cannot forward on this mroute in data plane; punting all packets.");
 	}
+
+	mfc_olist_update(vrf, rt);
 }
 
 static inline void init_mfc_counters(struct mfc *rt)
@@ -1041,6 +1107,7 @@ static void expire_upcalls(__attribute__((unused)) struct rte_timer *rtetm,
 
 static int mcast_ethernet_send(struct ifnet *in_ifp,
 			       struct vif *out_vifp,
+			       const struct rte_ether_addr *eth_daddr,
 			       struct rte_mbuf *m, int plen)
 {
 	struct iphdr *ip;
@@ -1049,9 +1116,8 @@ static int mcast_ethernet_send(struct ifnet *in_ifp,
 	ip = iphdr(m);
 	decrement_ttl(ip);
 
-	mcast_dst_eth_addr_t eth_daddr = mcast_dst_eth_addr(ip->daddr);
 	eth_hdr = rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
-	rte_ether_addr_copy(&eth_daddr.as_addr, &eth_hdr->d_addr);
+	rte_ether_addr_copy(eth_daddr, &eth_hdr->d_addr);
 
 	mc_ip_output(in_ifp, m, out_vifp->v_ifp, ip);
 	out_vifp->v_pkt_out++;
@@ -1126,6 +1192,7 @@ static void mcast_tunnel_send(struct ifnet *in_ifp,  struct vif *out_vifp,
  * function based on underlying interface type.
  */
 static void vif_send(struct ifnet *in_ifp, struct vif *out_vifp,
+		     const struct rte_ether_addr *eth_daddr,
 		     struct rte_mbuf *m, int plen)
 {
 	if (unlikely(out_vifp->v_flags & VIFF_TUNNEL)) {
@@ -1134,7 +1201,7 @@ static void vif_send(struct ifnet *in_ifp, struct vif *out_vifp,
 		return;
 	}
 
-	mcast_ethernet_send(in_ifp, out_vifp, m, plen);
+	mcast_ethernet_send(in_ifp, out_vifp, eth_daddr, m, plen);
 }
 
 /*
@@ -1145,8 +1212,9 @@ static int ip_mdq(struct mcast_vrf *mvrf, struct rte_mbuf *m, struct ip *ip,
 {
 	struct vif *vifp;
 	int plen = ntohs(ip->ip_len);
-	struct cds_lfht_iter iter;
+	struct mfc_olist *olist;
 	struct rte_mbuf *md, *mh;
+	unsigned int i;
 
 	/* Don't forward if it didn't arrive on parent vif for its origin. */
 	vifp = get_vif_by_ifindex(rt->mfc_parent);
@@ -1165,7 +1233,8 @@ static int ip_mdq(struct mcast_vrf *mvrf, struct rte_mbuf *m, struct ip *ip,
 	}
 
 	/* Rate limit this punted packet */
-	if (rt->mfc_controller) {
+	olist = rcu_dereference(rt->mfc_olist);
+	if (rt->mfc_controller || unlikely(!olist)) {
 		rt->mfc_ctrl_pkts++;
 		if (ip_punt_rate_limit(rt)) {
 			MRTSTAT_INC(mvrf, mrts_upq_ovflw);
@@ -1189,24 +1258,20 @@ static int ip_mdq(struct mcast_vrf *mvrf, struct rte_mbuf *m, struct ip *ip,
 
 	rte_pktmbuf_adj(md, dp_pktmbuf_l2_len(md) + sizeof(struct iphdr));
 
-	/* For each dataplane vif, forward if:
-	 *	- the ifset bit is set for this interface.
-	 *	- there are group members downstream on interface */
-	cds_lfht_for_each_entry(mvrf->viftable, &iter, vifp, node) {
-		if (IF_ISSET(vifp->v_vif_index, &rt->mfc_ifset) &&
-		    ip->ip_ttl > vifp->v_threshold) {
-			if (!vifp->v_ifp)
-				continue;
+	/* For each vif in the compiled olist, forward if there are group
+	 * members downstream on the interface */
+	for (i = 0; i < olist->mo_count; i++) {
+		vifp = olist->mo_vifs[i];
+		if (ip->ip_ttl <= vifp->v_threshold || !vifp->v_ifp)
+			continue;
 
-			mh = mcast_create_l2l3_header(m, md,
-						      sizeof(struct iphdr));
-			if (mh) {
-				/* send the newly created packet chain */
-				vif_send(ifp, vifp, mh, plen);
-			} else {
-				rte_pktmbuf_free(md);
-				return -ENOBUFS;
-			}
+		mh = mcast_create_l2l3_header(m, md, sizeof(struct iphdr));
+		if (mh) {
+			/* send the newly created packet chain */
+			vif_send(ifp, vifp, &olist->mo_eth_daddr, mh, plen);
+		} else {
+			rte_pktmbuf_free(md);
+			return -ENOBUFS;
 		}
 	}
 	/* We still hold a lock on the newly created initial data segment and
@@ -1457,6 +1522,50 @@ void mvif_dump(FILE *f, __attribute__((unused)) struct vrf *vrf)
 	jsonw_destroy(&wr);
 }
 
+/*
+ * Test hook.  Get the interfaces in the output vector of an (S,G) in the
+ * default vrf, in forwarding order.  Returns the number of entries, or
+ * -ESTALE if any entry is not a vif currently in the vif table.
+ */
+int mfc_olist_ut(struct in_addr origin, struct in_addr grp,
+		 unsigned int *ifindex, unsigned int max)
+{
+	struct mfc_olist *olist;
+	struct cds_lfht_iter iter;
+	struct vif *vifp;
+	struct vrf *vrf;
+	struct mfc *rt;
+	unsigned int i;
+	int rc;
+
+	rcu_read_lock();
+	vrf = vrf_get_rcu(VRF_DEFAULT_ID);
+	rt = vrf ? mfc_find(&vrf->v_mvrf4, &origin, &grp) : NULL;
+	olist = rt ? rcu_dereference(rt->mfc_olist) : NULL;
+	if (!olist) {
+		rcu_read_unlock();
+		return -ENOENT;
+	}
+
+	rc = olist->mo_count;
+	for (i = 0; i < olist->mo_count; i++) {
+		bool found = false;
+
+		cds_lfht_for_each_entry(vrf->v_mvrf4.viftable, &iter,
+					vifp, node)
+			if (vifp == olist->mo_vifs[i])
+				found = true;
+		if (!found) {
+			rc = -ESTALE;
+			break;
+		}
+		if (i < max)
+			ifindex[i] = olist->mo_vifs[i]->v_if_index;
+	}
+	rcu_read_unlock();
+	return rc;
+}
+
 /*
  * Multicast Fastpath
  */
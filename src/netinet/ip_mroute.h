@@ -47,6 +47,7 @@
 #include <linux/mroute.h>
 #include <linux/mroute6.h>
 #include <netinet/in.h>
+#include <rte_ether.h>
 #include <rte_meter.h>
 #include <stdint.h>
 #include <time.h>
@@ -151,6 +152,18 @@ struct mfc_key {
 
 #define MFCKEYLEN (sizeof(struct mfc_key)/4)
 
+/*
+ * Output vector for an mfc entry, compiled from the ifset and the vif table
+ * whenever either changes so that forwarding does not have to walk the vif
+ * table for every packet.  Replaced as a whole under RCU.
+ */
+struct mfc_olist {
+	struct rcu_head	mo_rcu;
+	struct rte_ether_addr mo_eth_daddr;	/* L2 dst for the group     */
+	unsigned int	mo_count;		/* number of vifs           */
+	struct vif	*mo_vifs[];		/* outgoing vifs            */
+};
+
 /*
  * The kernel's multicast forwarding cache entry structure
  */
@@ -163,6 +176,7 @@ struct mfc {
 	vifi_t		mfc_controller;		/* all packets to controller */
 	struct if_set	mfc_ifset;		/* set of outgoing IFs   */
 	unsigned char   mfc_olist_size;         /* number of intfs in olist  */
+	struct mfc_olist *mfc_olist;		/* compiled olist, RCU       */
 	struct rte_meter_srtcm meter;		/* punt rate meter           */
 	uint64_t	mfc_pkt_cnt;		/* pkt count for src-grp     */
 	uint64_t	mfc_byte_cnt;		/* byte count for src-grp    */
@@ -182,4 +196,12 @@ struct mfc {
 	fal_object_t	mfc_fal_ol;		/* fal olist group object    */
 	struct fal_object_list_t *mfc_fal_ol_lst;/* fal olist members object */
 };
+
+/*
+ * Test hook.  Get the ifindexes in the output vector of a default vrf
+ * (S,G), checking they are all still in the vif table.
+ */
+int mfc_olist_ut(struct in_addr origin, struct in_addr grp,
+		 unsigned int *ifindex, unsigned int max);
+
 #endif /* IP_MROUTE_H */
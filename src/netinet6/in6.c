@@ -85,6 +85,7 @@
 #include "in6.h"
 #include "in6_var.h"
 #include "ip6_funcs.h"
+#include "nd6_nbr.h"
 #include "pipeline/nodes/pl_nodes_common.h"
 #include "pktmbuf_internal.h"
 #include "pl_node.h"
@@ -201,7 +202,7 @@ in6_domifattach(struct ifnet *ifp)
 {
 	struct lltable *llt;
 
-	llt = lltable_new(ifp);
+	llt = lltable_new(ifp, ND6_RES_TOKEN);
 
 	llt->lle_refresh_expire = rte_get_timer_cycles() + rte_get_timer_hz();
 	rte_timer_reset(&llt->lle_timer, rte_get_timer_hz(),
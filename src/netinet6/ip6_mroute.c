@@ -285,9 +285,17 @@ static int mf6c_match(struct cds_lfht_node *node, const void *_key)
 		IN6_ARE_ADDR_EQUAL(&key->mf6c_mcastgrp, &rt->mf6c_mcastgrp);
 }
 
+static void mf6c_olist_free(struct rcu_head *head)
+{
+	struct mf6c_olist *olist = caa_container_of(head, struct mf6c_olist,
+						    mo_rcu);
+	free(olist);
+}
+
 static void mf6c_free(struct rcu_head *head)
 {
 	struct mf6c *rt = caa_container_of(head, struct mf6c, rcu_head);
+	free(rt->mf6c_olist);
 	free(rt);
 }
 
@@ -306,6 +314,58 @@ static void mif6_free(struct rcu_head *head)
 	free(mifp);
 }
 
+/*
+ * Compile the outgoing mifs of an mf6c entry into an array, along with the
+ * group's L2 destination address, and publish it in place of the previous
+ * one.  Must be redone whenever the ifset or the mif table changes, before
+ * any mif removed from the table is freed.
+ *
+ * If the allocation fails the entry is left without an output vector and
+ * its packets are punted.
+ */
+static void mf6c_olist_update(struct vrf *vrf, struct mf6c *rt)
+{
+	struct cds_lfht *mif6table = vrf->v_mvrf6.mif6table;
+	struct mf6c_olist *olist, *old;
+	struct cds_lfht_iter iter;
+	struct mif6 *mifp;
+	unsigned int count = 0;
+	mcast_dst_eth_addr_t eth_daddr;
+
+	cds_lfht_for_each_entry(mif6table, &iter, mifp, node)
+		if (IF_ISSET(mifp->m6_mif_index, &rt->mf6c_ifset))
+			count++;
+
+	olist = malloc(sizeof(*olist) + count * sizeof(olist->mo_mifs[0]));
+	if (olist) {
+		eth_daddr = mcast6_dst_eth_addr(&rt->mf6c_mcastgrp);
+		rte_ether_addr_copy(&eth_daddr.as_addr, &olist->mo_eth_daddr);
+		olist->mo_count = 0;
+
+		cds_lfht_for_each_entry(mif6table, &iter, mifp, node)
+			if (IF_ISSET(mifp->m6_mif_index, &rt->mf6c_ifset))
+				olist->mo_mifs[olist->mo_count++] = mifp;
+	} else {
+		mfc6_debug(vrf->v_id, &rt->mf6c_origin, &rt->mf6c_mcastgrp,
+			   "Failed to allocate olist; punting all packets.");
+	}
+
+	old = rt->mf6c_olist;
+	rcu_assign_pointer(rt->mf6c_olist, olist);
+	if (old)
+		call_rcu(&old->mo_rcu, mf6c_olist_free);
+}
+
+/* Recompile the output vectors of all mf6c entries in a vrf */
+static void mf6c_olists_update(struct vrf *vrf)
+{
+	struct cds_lfht_iter iter;
+	struct mf6c *rt;
+
+	cds_lfht_for_each_entry(vrf->v_mvrf6.mf6ctable, &iter, rt, node)
+		mf6c_olist_update(vrf, rt);
+}
+
 /*
  * Find a route for a given origin IPv6 address and Multicast group address.
  */
@@ -463,7 +523,10 @@ int add_m6if(mifi_t ifindex)
 	if (retnode) {
 		mifp = caa_container_of(retnode, struct mif6, node);
 		IF_CLR(mifp->m6_mif_index, &vrf->v_mvrf6.mf6c_ifset);
+		mf6c_olists_update(vrf);
 		call_rcu(&mifp->rcu_head, mif6_free);
+	} else {
+		mf6c_olists_update(vrf);
 	}
 
 	ip6_mcast_fal_int_enable(mifp, mif6table);
@@ -598,6 +661,8 @@ static void update_mfc6_params(vrfid_t vrf_id, struct mf6c *rt,
 		mfc6_debug(vrf_id, &rt->mf6c_origin, &rt->mf6c_mcastgrp,
 			   "Cannot forward on this mroute in data plane; punting all packets.");
 	}
+
+	mf6c_olist_update(vrf, rt);
 }
 
 /*
@@ -630,6 +695,7 @@ int del_m6if(mifi_t mifi)
 	IF_CLR(mifp->m6_mif_index, &vrf->v_mvrf6.mf6c_ifset);
 	if (!cds_lfht_del(vrf->v_mvrf6.mif6table, &mifp->node)) {
 		ip6_mcast_fal_int_disable(mifp, vrf->v_mvrf6.mif6table);
+		mf6c_olists_update(vrf);
 		call_rcu(&mifp->rcu_head, mif6_free);
 	}
 
@@ -993,13 +1059,13 @@ static void expire_upcalls(__attribute__((unused)) struct rte_timer *rtetm,
 }
 #endif
 
-static int mcast6_ethernet_send(struct mif6 *mifp, struct rte_mbuf *m,
-				struct ifnet *in_ifp)
+static int mcast6_ethernet_send(struct mif6 *mifp,
+				const struct rte_ether_addr *eth_daddr,
+				struct rte_mbuf *m, struct ifnet *in_ifp)
 {
 	struct ifnet *ifp = mifp->m6_ifp;
 	struct ip6_hdr *ip6 = ip6hdr(m);
 	struct rte_ether_hdr *eth_hdr;
-	mcast_dst_eth_addr_t eth_daddr;
 
 	if (unlikely(rte_pktmbuf_pkt_len(m) > ifp->if_mtu))
 		return ICMP6_PACKET_TOO_BIG;
@@ -1012,8 +1078,7 @@ static int mcast6_ethernet_send(struct mif6 *mifp, struct rte_mbuf *m,
 	ip6->ip6_hlim--;
 
 	eth_hdr = rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
-	eth_daddr = mcast6_dst_eth_addr(&ip6->ip6_dst);
-	rte_ether_addr_copy(&eth_daddr.as_addr, &eth_hdr->d_addr);
+	rte_ether_addr_copy(eth_daddr, &eth_hdr->d_addr);
 	rte_ether_addr_copy(&ifp->eth_addr, &eth_hdr->s_addr);
 
 	if_output(ifp, m, in_ifp, ETH_P_IPV6);
@@ -1088,6 +1153,7 @@ static void mcast6_tunnel_send(struct ifnet *in_ifp, struct mif6 *out_mifp,
  * function based on underlying interface type.
  */
 static void mif6_send(struct ifnet *in_ifp, struct mif6 *out_mifp,
+		      const struct rte_ether_addr *eth_daddr,
 		      struct rte_mbuf *m, int plen)
 {
 	struct vrf *vrf;
@@ -1097,7 +1163,8 @@ static void mif6_send(struct ifnet *in_ifp, struct mif6 *out_mifp,
 		return;
 	}
 
-	if (mcast6_ethernet_send(out_mifp, m, in_ifp) == ICMP6_PACKET_TOO_BIG) {
+	if (mcast6_ethernet_send(out_mifp, eth_daddr, m, in_ifp) ==
+	    ICMP6_PACKET_TOO_BIG) {
 		vrf = vrf_get_rcu(if_vrfid(in_ifp));
 		if (vrf) {
 			struct mcast6_vrf *mvrf6 = &vrf->v_mvrf6;
@@ -1118,8 +1185,9 @@ static int ip6_mdq(struct mcast6_vrf *mvrf6, struct rte_mbuf *m,
 	struct mif6 *mifp;
 	int plen = rte_pktmbuf_pkt_len(m);
 	u_int32_t iszone, idzone;
-	struct cds_lfht_iter iter;
+	struct mf6c_olist *olist;
 	struct rte_mbuf *md, *mh;
+	unsigned int i;
 
 	/* Don't forward if it didn't arrive on parent mif* for its origin.  */
 	mifp = get_mif_by_ifindex(rt->mf6c_parent);
@@ -1138,7 +1206,8 @@ static int ip6_mdq(struct mcast6_vrf *mvrf6, struct rte_mbuf *m,
 	}
 
 	/* Rate limit this punted packet */
-	if (rt->mf6c_controller) {
+	olist = rcu_dereference(rt->mf6c_olist);
+	if (rt->mf6c_controller || unlikely(!olist)) {
 		if (ip6_punt_rate_limit(rt)) {
 			return RTF_BLACKHOLE;
 		} else {
@@ -1185,22 +1254,20 @@ static int ip6_mdq(struct mcast6_vrf *mvrf6, struct rte_mbuf *m,
 
 	/* For each mif, forward a copy of the packet if there are group
 	 * members downstream on the interface. */
-	cds_lfht_for_each_entry(mvrf6->mif6table, &iter, mifp, node) {
-		if (IF_ISSET(mifp->m6_mif_index, &rt->mf6c_ifset)) {
-			mifp->m6_pkt_out++;
-			mifp->m6_bytes_out += plen;
-			if (!mifp->m6_ifp)
-				continue;
-
-			mh = mcast_create_l2l3_header(m, md,
-						      sizeof(struct ip6_hdr));
-			if (mh) {
-				/* send the newly created packet chain */
-				mif6_send(ifp, mifp, mh, plen);
-			} else {
-				rte_pktmbuf_free(md);
-				return -ENOBUFS;
-			}
+	for (i = 0; i < olist->mo_count; i++) {
+		mifp = olist->mo_mifs[i];
+		mifp->m6_pkt_out++;
+		mifp->m6_bytes_out += plen;
+		if (!mifp->m6_ifp)
+			continue;
+
+		mh = mcast_create_l2l3_header(m, md, sizeof(struct ip6_hdr));
+		if (mh) {
+			/* send the newly created packet chain */
+			mif6_send(ifp, mifp, &olist->mo_eth_daddr, mh, plen);
+		} else {
+			rte_pktmbuf_free(md);
+			return -ENOBUFS;
 		}
 	}
 	rte_pktmbuf_free(md);
@@ -1458,6 +1525,50 @@ void mvif6_dump(FILE *f, __attribute__((unused)) struct vrf *vrf)
 	jsonw_destroy(&wr);
 }
 
+/*
+ * Test hook.  Get the interfaces in the output vector of an (S,G) in the
+ * default vrf, in forwarding order.  Returns the number of entries, or
+ * -ESTALE if any entry is not a mif currently in the mif table.
+ */
+int mf6c_olist_ut(struct in6_addr origin, struct in6_addr grp,
+		  unsigned int *ifindex, unsigned int max)
+{
+	struct mf6c_olist *olist;
+	struct cds_lfht_iter iter;
+	struct mif6 *mifp;
+	struct vrf *vrf;
+	struct mf6c *rt;
+	unsigned int i;
+	int rc;
+
+	rcu_read_lock();
+	vrf = vrf_get_rcu(VRF_DEFAULT_ID);
+	rt = vrf ? mf6c_find(&vrf->v_mvrf6, &origin, &grp) : NULL;
+	olist = rt ? rcu_dereference(rt->mf6c_olist) : NULL;
+	if (!olist) {
+		rcu_read_unlock();
+		return -ENOENT;
+	}
+
+	rc = olist->mo_count;
+	for (i = 0; i < olist->mo_count; i++) {
+		bool found = false;
+
+		cds_lfht_for_each_entry(vrf->v_mvrf6.mif6table, &iter,
+					mifp, node)
+			if (mifp == olist->mo_mifs[i])
+				found = true;
+		if (!found) {
+			rc = -ESTALE;
+			break;
+		}
+		if (i < max)
+			ifindex[i] = olist->mo_mifs[i]->m6_if_index;
+	}
+	rcu_read_unlock();
+	return rc;
+}
+
 int mcast_ip6(struct ip6_hdr *ip6, struct ifnet *ifp, struct rte_mbuf *m)
 {
 	int err = 0;
@@ -56,6 +56,7 @@
 
 #include <linux/mroute6.h>
 #include <netinet/in.h>
+#include <rte_ether.h>
 #include <rte_meter.h>
 #include <stdint.h>
 #include <time.h>
@@ -132,6 +133,17 @@ struct mf6c_key {
 
 #define MF6CKEYLEN (sizeof(struct mf6c_key) / 4)
 
+/*
+ * Output vector for an mf6c entry, compiled from the ifset and the mif table
+ * whenever either changes.  Replaced as a whole under RCU.
+ */
+struct mf6c_olist {
+	struct rcu_head		mo_rcu;
+	struct rte_ether_addr	mo_eth_daddr;	 /* L2 dst for the group     */
+	unsigned int		mo_count;	 /* number of mifs           */
+	struct mif6		*mo_mifs[];	 /* outgoing mifs            */
+};
+
 /*
  * The kernel's multicast forwarding cache entry structure
  */
@@ -143,6 +155,7 @@ struct mf6c {
 	mifi_t			mf6c_parent;	 /* incoming IF              */
 	struct if_set		mf6c_ifset;	 /* set of outgoing IFs      */
 	unsigned char           mf6c_olist_size; /* number of intfs in olist  */
+	struct mf6c_olist	*mf6c_olist;	 /* compiled olist, RCU      */
 	struct rte_meter_srtcm  meter;		 /* punt rate meter          */
 	int			mf6c_controller; /* forward via controller   */
 	uint64_t		mf6c_pkt_cnt;	 /* pkt count for src-grp    */
@@ -163,4 +176,11 @@ struct mf6c {
 	struct fal_object_list_t *mf6c_fal_ol_lst; /* fal olist members object*/
 };
 
+/*
+ * Test hook.  Get the ifindexes in the output vector of a default vrf
+ * (S,G), checking they are all still in the mif table.
+ */
+int mf6c_olist_ut(struct in6_addr origin, struct in6_addr grp,
+		  unsigned int *ifindex, unsigned int max);
+
 #endif /* !IP6_MROUTE_H */
@@ -427,6 +427,7 @@ nd6_entry_amend(struct ifnet *ifp, struct llentry *la, uint8_t state,
 				rte_ether_addr_copy(enaddr, &eh->d_addr);
 				if_output(ifp, m, NULL, ntohs(eh->ether_type));
 			}
+			lltable_hold_put(llt, la->la_numheld);
 			la->la_numheld = 0;
 		}
 	}
@@ -1136,6 +1137,7 @@ int nd6_resolve(struct ifnet *in_ifp, struct ifnet *ifp,
 	struct lltable *llt = ifp->if_lltable6;
 	struct llentry *la;
 	char b[INET6_ADDRSTRLEN];
+	struct in6_addr src;
 	bool send_ns = false;
 
 lookup:
@@ -1192,18 +1194,23 @@ resolved:
 
 	/*
 	 * Incomplete ND cache entry. Queue packet on entry
-	 * Discard oldest if queue limit is exceeded
+	 * Discard oldest if queue limit is exceeded, or this
+	 * packet if no more can be held.
 	 */
+	src = ip6hdr(m)->ip6_src;
 	if (in_ifp)
 		pktmbuf_save_ifp(m, in_ifp);
-	if (la->la_numheld >= nd6_cfg.nd6_maxhold) {
+	if (la->la_numheld < nd6_cfg.nd6_maxhold && lltable_hold_get(llt)) {
+		la->la_held[la->la_numheld++] = m;
+	} else if (la->la_numheld) {
 		ND6NBR_INC(dropped);
 		rte_pktmbuf_free(la->la_held[0]);
 		memmove(&la->la_held[0], &la->la_held[1],
-			(nd6_cfg.nd6_maxhold - 1) * sizeof(la->la_held[0]));
-		la->la_held[nd6_cfg.nd6_maxhold - 1] = m;
+			(la->la_numheld - 1) * sizeof(la->la_held[0]));
+		la->la_held[la->la_numheld - 1] = m;
 	} else {
-		la->la_held[la->la_numheld++] = m;
+		ND6NBR_INC(dropped);
+		rte_pktmbuf_free(m);
 	}
 
 	/*
@@ -1215,11 +1222,8 @@ resolved:
 	}
 	rte_spinlock_unlock(&la->ll_lock);
 
-	if (send_ns) {
-		struct ip6_hdr *ip6 = ip6hdr(m);
-
-		nd6_ns_output(ifp, &ip6->ip6_src, addr, NULL);
-	}
+	if (send_ns)
+		nd6_ns_output(ifp, &src, addr, NULL);
 
 	return -EWOULDBLOCK;
 }
@@ -1614,6 +1618,7 @@ nd6_unreachable(struct ifnet *ifp, struct llentry *lle,
 			pktmbuf_free_bulk(lle->la_held, lle->la_numheld);
 		}
 		ND6NBR_ADD(dropped, lle->la_numheld);
+		lltable_hold_put(llt, lle->la_numheld);
 		lle->la_numheld = 0;
 	}
 	nd6_entry_destroy(llt, lle);
@@ -94,18 +94,26 @@ in6_lltable_find(struct ifnet *ifp, const struct in6_addr *addr)
 }
 
 /*
- * Inline optimized version of neighbor resolution
+ * Inline optimized version of neighbor resolution, trying the per-lcore
+ * neighbour cache before the lltable.
  */
 static inline int
 nd6_resolve_fast(struct ifnet *in_ifp, struct ifnet *ifp, struct rte_mbuf *m,
 		 const struct in6_addr *addr, struct rte_ether_addr *desten)
 {
+	struct lle_cache_entry *lc = lle_cache_slot6(ifp, addr);
+	uint32_t gen = CMM_LOAD_SHARED(lle_cache_gen);
 	struct llentry *la;
 
+	if (likely(lle_cache_match6(lc, ifp, addr, gen))) {
+		lle_cache_copy_mac(lc, desten);
+		return 0;
+	}
+
 	la = in6_lltable_find(ifp, addr);
-	if (likely(la && (la->la_flags & LLE_VALID))) {
-		rte_atomic16_clear(&la->ll_idle);
-		rte_ether_addr_copy(&la->ll_addr, desten);
+	if (likely(llentry_copy_mac(la, desten))) {
+		lc->lc_in6 = *addr;
+		lle_cache_fill(lc, ifp, la, desten, gen);
 		return 0;
 	}
 
@@ -6,6 +6,8 @@
 
 #include <urcu/list.h>
 #include <rte_debug.h>
+#include <rte_jhash.h>
+#include <rte_spinlock.h>
 
 #include "ecmp.h"
 #include "fal.h"
@@ -17,6 +19,9 @@
 
 static struct cds_lfht *next_hop_intf_hash;
 
+/* Serialises updates to the nh_maps of next_hop_lists */
+static rte_spinlock_t nh_map_lock = RTE_SPINLOCK_INITIALIZER;
+
 /*
  * use entry 0 for AF_INET
  * use entry 1 for AF_INET6
@@ -179,7 +184,8 @@ static int next_hop_list_num_primaries_usable(struct next_hop_list *nextl)
 	return 0;
 }
 
-static void next_hop_map_use_backups(struct next_hop_list *nextl)
+static void next_hop_map_use_backups(const struct next_hop_list *nextl,
+				     struct nh_map *map)
 {
 	int i, j;
 	int backups = nextl->nsiblings - nextl->primaries;
@@ -199,8 +205,8 @@ static void next_hop_map_use_backups(struct next_hop_list *nextl)
 	}
 
 	j = 0;
-	for (i = 0; i < nextl->nh_map->count; i++) {
-		CMM_STORE_SHARED(nextl->nh_map->index[i], slots[j]);
+	for (i = 0; i < map->count; i++) {
+		map->index[i] = slots[j];
 		j++;
 		if (j >= backups)
 			j = 0;
@@ -229,31 +235,10 @@ static int next_hop_bitmap_find_next(uint64_t bitmap, int start)
 	return -1;
 }
 
-static void next_hop_map_reinit(struct next_hop_list *nextl,
-				uint64_t usable_nhs)
-{
-	int next_to_write;
-	int i;
-
-	next_to_write = next_hop_bitmap_find_next(usable_nhs, 0);
-	for (i = 0; i < nextl->nh_map->count; i++) {
-
-		CMM_STORE_SHARED(nextl->nh_map->index[i],
-				 next_to_write);
-
-		next_to_write = next_hop_bitmap_find_next(usable_nhs,
-							  ++next_to_write);
-		if (next_to_write < 0)
-			next_to_write = next_hop_bitmap_find_next(usable_nhs,
-								  0);
-	}
-}
-
 static void
-next_hop_list_update_map_usable(struct next_hop_list *nextl,
+next_hop_list_update_map_usable(struct nh_map *map,
 				uint64_t usable_nhs,
-				uint64_t orig_nhs,
-				int loops)
+				uint64_t orig_nhs)
 {
 	int i;
 	int entries_per_path;
@@ -275,31 +260,20 @@ next_hop_list_update_map_usable(struct next_hop_list *nextl,
 	 * enabling 1 this would become: 1, 2, 1, 3, 2, 3, i.e
 	 * we should have 2 entries added, so swap out the first 2, and
 	 * the first 3.
-	 *
-	 * If loops is non 0 then we are coming round again, which
-	 * means we lost  race with another thread, so refill it as
-	 * if it was the initial init
 	 */
-	if (loops) {
-		next_hop_map_reinit(nextl, usable_nhs);
-		return;
-	}
-
 	usable_num = next_hop_bitmap_get_usable_count(usable_nhs);
-	entries_per_path = nextl->nh_map->count / usable_num;
+	entries_per_path = map->count / usable_num;
 	next_to_write = next_hop_bitmap_find_next(added_nhs, 0);
 
 	idx_to_swap = next_hop_bitmap_find_next(orig_nhs, 0);
 
 	do {
-		for (i = 0; i < nextl->nh_map->count; i++) {
+		for (i = 0; i < map->count; i++) {
 			if (idx_to_swap >= 0 &&
-			    !(CMM_ACCESS_ONCE(nextl->nh_map->index[i]) ==
-			      idx_to_swap))
+			    map->index[i] != idx_to_swap)
 				continue;
 
-			CMM_STORE_SHARED(nextl->nh_map->index[i],
-					 next_to_write);
+			map->index[i] = next_to_write;
 
 			next_to_write = next_hop_bitmap_find_next(
 				added_nhs, ++next_to_write);
@@ -328,10 +302,7 @@ next_hop_list_update_map_usable(struct next_hop_list *nextl,
 		 * the distribution is:
 		 * 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0.
 		 * However make sure we don't go round too many times
-		 * as another thread could overwrite the entries we
-		 * are looking for meaning we will never find them.
-		 * In this case it will be fixed up by the thread that
-		 * goes round the outer loop again.
+		 * if the entries we are looking for are not there.
 		 */
 		loop_count++;
 		if (loop_count > added)
@@ -340,9 +311,9 @@ next_hop_list_update_map_usable(struct next_hop_list *nextl,
 }
 
 static void
-next_hop_list_update_map_unusable(struct next_hop_list *nextl,
-				  uint64_t usable_nhs,
-				  int loops)
+next_hop_list_update_map_unusable(const struct next_hop_list *nextl,
+				  struct nh_map *map,
+				  uint64_t usable_nhs)
 {
 	int i, j;
 	int new_index = 0;
@@ -352,18 +323,10 @@ next_hop_list_update_map_unusable(struct next_hop_list *nextl,
 	 * across all entries, and if the map contains the index then
 	 * replace it with the next value.  The next value is based on a
 	 * round robin over the remaining usable primary paths.
-	 *
-	 * If loops is non 0 then we are coming round again, which
-	 * means we lost  race with another thread, so refill it as
-	 * if it was the initial init
 	 */
-	if (loops) {
-		next_hop_map_reinit(nextl, usable_nhs);
-		return;
-	}
 
-	for (i = 0; i < nextl->nh_map->count; i++) {
-		if (!((1ull << nextl->nh_map->index[i]) & usable_nhs)) {
+	for (i = 0; i < map->count; i++) {
+		if (!((1ull << map->index[i]) & usable_nhs)) {
 			/* Was using the now unusable path */
 			for (j = 0; j < nextl->nsiblings; j++) {
 				/*
@@ -377,8 +340,7 @@ next_hop_list_update_map_unusable(struct next_hop_list *nextl,
 						new_index = 0;
 					continue;
 				}
-				CMM_STORE_SHARED(nextl->nh_map->index[i],
-						 new_index);
+				map->index[i] = new_index;
 				new_index++;
 				if (new_index >= nextl->nsiblings)
 					new_index = 0;
@@ -388,53 +350,59 @@ next_hop_list_update_map_unusable(struct next_hop_list *nextl,
 	}
 }
 
+static void nh_map_free(struct rcu_head *head)
+{
+	free(caa_container_of(head, struct nh_map, rcu));
+}
+
 /*
- * Called to update a map when a path has become unusable.
+ * Called to update a map when a path has become usable or unusable.
+ *
+ * The new map is built in a copy and swapped in, so the forwarding
+ * threads see either the old or the new map, and every prefix using the
+ * list switches over with that one pointer store however many there are.
+ * Updates can come from any thread registered with rcu, so are
+ * serialised by nh_map_lock.
  */
 static void next_hop_list_update_map(struct next_hop_list *nextl, int index,
 				     bool usable)
 {
+	struct nh_map *old_map, *new_map;
 	uint64_t usable_nhs;
 	uint64_t orig_nhs;
-	int loops = 0;
 
-	/*
-	 * To update (add or remove) we maintain an atomic bitmask of the
-	 * usable paths, and verify at the end of the changes that we were
-	 * the only writer. If another index has changed then we need to go
-	 * round the loop again as we lost the race to another thread.
-	 * Second and later times round it will refill it as if it was the
-	 * initial init. This is because it is in an unknown state due to
-	 * possible collisions the first time round which can lead to
-	 * unfairness in the allocation if we continue to update based on
-	 * the current state.
-	 */
-	do {
-		usable_nhs = rte_atomic64_read(&nextl->usable_prim_nh_bitmask);
-		orig_nhs = usable_nhs;
-
-		if (usable)
-			usable_nhs |= (1ull << index);
-		else
-			usable_nhs &= ~(1ull << index);
-
-		if (next_hop_bitmap_get_usable_count(usable_nhs) == 0)
-			next_hop_map_use_backups(nextl);
-		else
-			if (usable)
-				next_hop_list_update_map_usable(nextl,
-								usable_nhs,
-								orig_nhs,
-								loops);
-			else
-				next_hop_list_update_map_unusable(nextl,
-								  usable_nhs,
-								  loops);
-		loops++;
-	} while (!rte_atomic64_cmpset((volatile uint64_t *)
-				      &nextl->usable_prim_nh_bitmask,
-				      orig_nhs,
-				      usable_nhs));
+	new_map = malloc_aligned(sizeof(*new_map));
+	if (!new_map) {
+		RTE_LOG(ERR, ROUTE, "Unable to allocate next hop map\n");
+		return;
+	}
+
+	rte_spinlock_lock(&nh_map_lock);
+
+	old_map = nextl->nh_map;
+	*new_map = *old_map;
+
+	usable_nhs = rte_atomic64_read(&nextl->usable_prim_nh_bitmask);
+	orig_nhs = usable_nhs;
+
+	if (usable)
+		usable_nhs |= (1ull << index);
+	else
+		usable_nhs &= ~(1ull << index);
+
+	if (next_hop_bitmap_get_usable_count(usable_nhs) == 0)
+		next_hop_map_use_backups(nextl, new_map);
+	else if (usable)
+		next_hop_list_update_map_usable(new_map, usable_nhs, orig_nhs);
+	else
+		next_hop_list_update_map_unusable(nextl, new_map, usable_nhs);
+
+	rte_atomic64_set(&nextl->usable_prim_nh_bitmask, usable_nhs);
+	rcu_assign_pointer(nextl->nh_map, new_map);
+
+	rte_spinlock_unlock(&nh_map_lock);
+
+	call_rcu(&old_map->rcu, nh_map_free);
 }
 
 static struct next_hop_list *nexthop_lookup(int family,
@@ -1093,7 +1061,70 @@ static void next_hop_fixup_protected_tracking(struct next_hop_list *old,
 	}
 }
 /*
- * Create the nh_map for the list. Only use the map if there are backup paths.
+ * Key for a path in a resilient map, so that the same path gets the same
+ * buckets whichever list it is in.
+ */
+static uint32_t next_hop_resilient_key(const struct next_hop *next)
+{
+	const struct ifnet *ifp = dp_nh_get_ifp(next);
+	uint32_t ifindex = ifp ? ifp->if_index : 0;
+
+	if (next->gateway.type == AF_INET6)
+		return rte_jhash(&next->gateway.address.ip_v6,
+				 sizeof(next->gateway.address.ip_v6), ifindex);
+
+	return rte_jhash_1word(next->gateway.address.ip_v4.s_addr, ifindex);
+}
+
+/*
+ * In resilient mode a multipath list without backup paths gets a map of
+ * NH_MAP_MAX_ENTRIES buckets, so lookup is a single index however many
+ * paths there are.  Each bucket goes to the path with the highest random
+ * weight for it.  A list built when a path is added or removed therefore
+ * differs from the one it replaces only in the buckets that path wins or
+ * held, and the flows in every other bucket stay on their path.
+ */
+static int next_hop_list_init_resilient_map(struct next_hop_list *nextl)
+{
+	int size = nextl->nsiblings;
+	struct next_hop *array = nextl->siblings;
+	uint32_t keys[size];
+	int i, b;
+
+	if (ecmp_mode != ECMP_RESILIENT || size < 2)
+		return 0;
+
+	if (ecmp_max_path && ecmp_max_path < size)
+		size = ecmp_max_path;
+
+	nextl->nh_map = malloc_aligned(sizeof(*nextl->nh_map));
+	if (!nextl->nh_map)
+		return -ENOMEM;
+
+	for (i = 0; i < size; i++)
+		keys[i] = next_hop_resilient_key(array + i);
+
+	nextl->nh_map->count = NH_MAP_MAX_ENTRIES;
+	for (b = 0; b < NH_MAP_MAX_ENTRIES; b++) {
+		uint32_t weight, best_weight = rte_jhash_1word(b, keys[0]);
+		int best = 0;
+
+		for (i = 1; i < size; i++) {
+			weight = rte_jhash_1word(b, keys[i]);
+			if (weight > best_weight) {
+				best_weight = weight;
+				best = i;
+			}
+		}
+		nextl->nh_map->index[b] = best;
+	}
+
+	return 0;
+}
+
+/*
+ * Create the nh_map for the list. Only use the map if there are backup paths,
+ * or for resilient ECMP.
  * We use (#primary_paths * (#primary_paths -1)) as the initial size of the map
  * as this gives us fairness on the first cutover of a path. This is limited
  * to a max of 64 entries to make sure it stays in a cache line.
@@ -1115,7 +1146,7 @@ static int next_hop_list_init_map(struct next_hop_list *nextl)
 	next_hop_list_check_usability(nextl, NULL);
 
 	if (nextl->primaries == 0)
-		return 0;
+		return next_hop_list_init_resilient_map(nextl);
 
 	nextl->nh_map = malloc_aligned(sizeof(*nextl->nh_map));
 	if (!nextl->nh_map)
@@ -1143,7 +1174,7 @@ static int next_hop_list_init_map(struct next_hop_list *nextl)
 
 	nextl->nh_map->count = num_entries;
 	if (usable_prim == 0) {
-		next_hop_map_use_backups(nextl);
+		next_hop_map_use_backups(nextl, nextl->nh_map);
 		return 0;
 	}
 
@@ -1564,12 +1595,21 @@ nexthop_mp_select(const struct next_hop_list *nextl,
 		  uint32_t size,
 		  uint32_t hash)
 {
+	const struct nh_map *map;
 	uint16_t path;
 	int index;
 
-	if (nextl->nh_map) {
-		index = hash % nextl->nh_map->count;
-		return next + (nextl->nh_map->index[index]);
+	map = rcu_dereference(nextl->nh_map);
+	if (map) {
+		index = hash % map->count;
+		path = map->index[index];
+
+		/*
+		 * Backup paths take over through the map, whereas a
+		 * dead path in a resilient map is left to the search below.
+		 */
+		if (likely(!(next[path].flags & RTF_DEAD)) || nextl->primaries)
+			return next + path;
 	}
 
 	if (ecmp_max_path && ecmp_max_path < size)
@@ -1612,6 +1652,14 @@ ALWAYS_INLINE struct next_hop *nexthop_select(int family, uint32_t nh_idx,
 				 ecmp_mbuf_hash(m, ether_type));
 }
 
+ALWAYS_INLINE struct next_hop_list *
+next_hop_list_get(int family, uint32_t nh_idx)
+{
+	struct nexthop_table *nh_table = nh_common_get_nh_table(family);
+
+	return rcu_dereference(nh_table->entry[nh_idx]);
+}
+
 struct next_hop_list *
 next_hop_list_create_copy_start(int family __unused,
 				struct next_hop_list *old)
@@ -1656,8 +1704,11 @@ next_hop_list_create_copy_finish(int family,
 		return rc;
 	}
 
-	if (old->nh_map)
+	if (old->nh_map) {
+		rte_spinlock_lock(&nh_map_lock);
 		memcpy(new->nh_map, old->nh_map, sizeof(*new->nh_map));
+		rte_spinlock_unlock(&nh_map_lock);
+	}
 	/*
 	 * Set the usable nh bitmask. Scan the copies of the NHs
 	 * in case there was a change to the original
@@ -1722,15 +1773,16 @@ dp_nh6_get_addr(const struct next_hop *next_hop)
 void nexthop_map_display(const struct next_hop_list *nextl,
 			 json_writer_t *jsonw)
 {
+	const struct nh_map *map = rcu_dereference(nextl->nh_map);
 	int i;
 
-	if (!nextl->nh_map)
+	if (!map)
 		return;
 
-	jsonw_uint_field(jsonw, "nh_map_count", nextl->nh_map->count);
+	jsonw_uint_field(jsonw, "nh_map_count", map->count);
 	jsonw_name(jsonw, "nh_map");
 	jsonw_start_array(jsonw);
-	for (i = 0; i < nextl->nh_map->count; i++)
-		jsonw_uint(jsonw, nextl->nh_map->index[i]);
+	for (i = 0; i < map->count; i++)
+		jsonw_uint(jsonw, map->index[i]);
 	jsonw_end_array(jsonw);
 }
@@ -24,9 +24,11 @@ struct llentry;
 
 #define NH_MAP_MAX_ENTRIES 64
 
+/* Replaced as a whole under RCU when a path's usability changes */
 struct nh_map {
 	uint8_t index[NH_MAP_MAX_ENTRIES];
 	int count;
+	struct rcu_head rcu;
 };
 
 /* Output information associated with a single nexthop */
@@ -53,7 +55,7 @@ struct next_hop_list {
 	uint8_t              primaries; /* number of primary next hops */
 	uint8_t              padding;
 	uint32_t             index;
-	struct nh_map        *nh_map;
+	struct nh_map        *nh_map;	/* RCU protected */
 	struct next_hop      hop0;      /* optimization for non-ECMP */
 	uint32_t             refcount;	/* # of LPM's referring */
 	enum pd_obj_state    pd_state;
@@ -307,6 +309,13 @@ struct next_hop *nexthop_select(int family, uint32_t nh_idx,
 				const struct rte_mbuf *m,
 				uint16_t ether_type);
 
+/*
+ * Get the next_hop_list for a nexthop index, so that a path can be selected
+ * from it with nexthop_mp_select for several packets.  Must be called with
+ * the rcu read lock held.
+ */
+struct next_hop_list *next_hop_list_get(int family, uint32_t nh_idx);
+
 bool nh_is_connected(const struct next_hop *nh);
 bool nh_is_local(const struct next_hop *nh);
 bool nh_is_gw(const struct next_hop *nh);
@@ -20,6 +20,7 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <linux/if.h>
 #include <dpdk/rte_jhash.h>
@@ -37,7 +38,9 @@
 #include "npf/nat/nat_pool.h"
 
 #include "npf/apm/apm.h"
+#include "npf/cgnat/cgn.h"
 #include "npf/cgnat/cgn_errno.h"
+#include "npf/cgnat/cgn_limits.h"
 #include "npf/cgnat/cgn_log.h"
 #include "npf/cgnat/cgn_map.h"
 
@@ -52,8 +55,6 @@ int npf_parse_ip_addr(char *value, sa_family_t *fam, npf_addr_t *addr,
 /* Number of gc passes before apm is deactivated */
 #define APM_GC_COUNT	2
 
-#define ONE_THOUSAND		(1<<10)
-
 /*
  * Start with 128 buckets, and allow to grow to any size (size will be limited
  * by number of addresses in the CGNAT address pools).
@@ -665,6 +666,12 @@ static int apm_match(struct cds_lfht_node *node, const void *key)
 	return 1; /* match */
 }
 
+/* Match the gc cursor node itself, whatever its state */
+static int apm_match_node(struct cds_lfht_node *node, const void *key)
+{
+	return node == key;
+}
+
 /*
  * Lookup a public address
  */
@@ -1162,26 +1169,116 @@ unlock:
 	rte_spinlock_unlock(&apm->apm_lock);
 }
 
-static void apm_gc(struct rte_timer *timer, void *arg __unused)
+/*
+ * gc walk state.  The apm table is walked CGN_WALK_BATCH entries at a time.
+ * An iterator is not kept between slices, as the table may be resized in the
+ * meantime.  Each slice resumes after the last entry kept by the previous
+ * slice, found by looking it up again.  The hash table is split-ordered, so
+ * the walk order is not changed by a resize.  If the cursor entry has since
+ * been removed then the pass ends early, and the remaining entries are
+ * inspected on the next pass.
+ */
+static struct cds_lfht_node *apm_gc_cursor;
+static ulong apm_gc_cursor_hash;
+static bool apm_gc_in_progress;
+static uint64_t apm_gc_visited;
+static uint64_t apm_gc_passes;
+
+/*
+ * Visit up to 'budget' apm table entries.  Returns true when a full pass of
+ * the table is complete.
+ */
+static bool apm_gc_walk(uint budget)
 {
 	struct cds_lfht_iter iter;
+	struct cds_lfht_node *node;
 	struct apm *apm;
 
+	if (!apm_gc_in_progress) {
+		apm_gc_in_progress = true;
+		apm_gc_visited = 0;
+		apm_gc_cursor = NULL;
+	}
+
+	if (apm_gc_cursor) {
+		cds_lfht_lookup(apm_ht, apm_gc_cursor_hash, apm_match_node,
+				apm_gc_cursor, &iter);
+		if (cds_lfht_iter_get_node(&iter))
+			cds_lfht_next(apm_ht, &iter);
+	} else
+		cds_lfht_first(apm_ht, &iter);
+
+	while ((node = cds_lfht_iter_get_node(&iter)) != NULL) {
+		if (budget-- == 0)
+			return false;
+
+		/* Move on before the entry is possibly destroyed */
+		apm = caa_container_of(node, struct apm, apm_node);
+		cds_lfht_next(apm_ht, &iter);
+
+		apm_gc_inspect(apm);
+		apm_gc_visited++;
+
+		if (!(apm->apm_flags & APM_DEAD)) {
+			apm_gc_cursor = &apm->apm_node;
+			apm_gc_cursor_hash = apm_hash(apm->apm_addr,
+						      apm->apm_vrfid);
+		}
+	}
+
+	apm_gc_in_progress = false;
+	apm_gc_passes++;
+
+	return true;
+}
+
+static void apm_gc(struct rte_timer *timer, void *arg __unused)
+{
+	uint64_t ticks = APM_GC_INTERVAL * rte_get_timer_hz();
+	uint budget = timer ? cgn_walk_batch : UINT_MAX;
+
 	if (!apm_ht)
 		return;
 
-	/* Walk the apm table */
-	cds_lfht_for_each_entry(apm_ht, &iter, apm, apm_node)
-		apm_gc_inspect(apm);
+	/* Continue the pass on the next slice if it did not complete */
+	if (!apm_gc_walk(budget))
+		ticks = CGN_WALK_SLICE_MS * rte_get_timer_hz() / 1000;
 
 	/* Restart timer if dataplane still running */
 	if (running && timer)
-		rte_timer_reset(timer,
-				APM_GC_INTERVAL * rte_get_timer_hz(),
+		rte_timer_reset(timer, ticks,
 				SINGLE, rte_get_master_lcore(), apm_gc,
 				NULL);
 }
 
+/*
+ * Complete a pass that is part way through
+ */
+static void apm_gc_flush(void)
+{
+	if (apm_gc_in_progress)
+		apm_gc_walk(UINT_MAX);
+}
+
+void apm_jsonw_gc(json_writer_t *json)
+{
+	jsonw_name(json, "apm_gc");
+	jsonw_start_object(json);
+	jsonw_bool_field(json, "in_progress", apm_gc_in_progress);
+	jsonw_uint_field(json, "visited", apm_gc_visited);
+	jsonw_uint_field(json, "passes", apm_gc_passes);
+	jsonw_end_object(json);
+}
+
+/*
+ * Called via hidden vplsh command.  Run one slice of a gc pass.
+ */
+void apm_gc_slice(void)
+{
+	if (apm_ht)
+		apm_gc_walk(cgn_walk_batch);
+}
+
 /*
  * Called from unit-test and from apm_uninit.
  */
@@ -1190,6 +1287,7 @@ void apm_cleanup(void)
 	uint i;
 
 	rte_timer_stop(&apm_timer);
+	apm_gc_flush();
 
 	for (i = 0; i <= APM_GC_COUNT; i++)
 		/* Do not restart gc timer */
@@ -1202,7 +1300,14 @@ void apm_cleanup(void)
 void apm_gc_pass(void)
 {
 	rte_timer_stop(&apm_timer);
-	apm_gc(&apm_timer, NULL);
+	apm_gc_flush();
+	apm_gc_walk(UINT_MAX);
+
+	if (running)
+		rte_timer_reset(&apm_timer,
+				APM_GC_INTERVAL * rte_get_timer_hz(),
+				SINGLE, rte_get_master_lcore(), apm_gc,
+				NULL);
 }
 
 /*
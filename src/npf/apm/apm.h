@@ -234,6 +234,8 @@ void apm_show(FILE *f, int argc, char **argv);
 
 void apm_cleanup(void);
 void apm_gc_pass(void);
+void apm_gc_slice(void);
+void apm_jsonw_gc(json_writer_t *json);
 
 void apm_init(void);
 void apm_uninit(void);
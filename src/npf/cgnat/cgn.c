@@ -12,6 +12,8 @@
 #include <time.h>
 #include <netinet/in.h>
 #include <linux/if.h>
+#include <rte_lcore.h>
+#include <rte_mempool.h>
 
 #include "compiler.h"
 #include "if_var.h"
@@ -25,6 +27,7 @@
 #include "npf/cgnat/cgn_cmd_cfg.h"
 #include "npf/cgnat/cgn_errno.h"
 #include "npf/cgnat/cgn_if.h"
+#include "npf/cgnat/cgn_limits.h"
 #include "npf/cgnat/cgn_policy.h"
 #include "npf/cgnat/cgn_session.h"
 #include "npf/cgnat/cgn_source.h"
@@ -51,6 +54,12 @@ bool cgn_snat_alg_bypass_gbl;
 rte_atomic64_t cgn_sess2_ht_created;
 rte_atomic64_t cgn_sess2_ht_destroyed;
 
+/*
+ * Number of entries visited per slice of a large table walk.  May be
+ * lowered by the unit-tests so that walks span several slices.
+ */
+unsigned int cgn_walk_batch = CGN_WALK_BATCH;
+
 /*
  * Time in millisecs since Epoch, relative to soft_ticks==0.  This is
  * calculated once when the dataplane starts.  Its value may then be added to
@@ -172,6 +181,151 @@ char *cgn_addrstr(uint32_t addr, char *str, size_t slen)
 	return str;
 }
 
+/*
+ * Create a mempool on each socket that has an enabled lcore.  count is the
+ * total number of objects, and is divided evenly between the sockets.
+ * Objects that do not fit are allocated from the heap.
+ *
+ * Each pool has a per-lcore cache so that session create and destroy on
+ * the forwarding threads does not go to the shared pool ring every time.
+ * DPDK requires the cache flush threshold (1.5 times the cache size) to
+ * fit within the pool.
+ */
+int cgn_mempools_create(struct cgn_mempools *mps, uint32_t count)
+{
+	uint32_t nsockets = 0, per_socket, cache;
+	bool socket_used[RTE_MAX_NUMA_NODES] = { false };
+	char name[RTE_MEMPOOL_NAMESIZE];
+	unsigned int lcore, socket;
+	int rc = 0;
+
+	if (count == 0)
+		return 0;
+
+	RTE_LCORE_FOREACH(lcore) {
+		socket = rte_lcore_to_socket_id(lcore);
+		if (socket < RTE_MAX_NUMA_NODES && !socket_used[socket]) {
+			socket_used[socket] = true;
+			nsockets++;
+		}
+	}
+
+	if (nsockets == 0)
+		return -ENODEV;
+
+	per_socket = (count + nsockets - 1) / nsockets;
+	cache = RTE_MIN((uint32_t)RTE_MEMPOOL_CACHE_MAX_SIZE,
+			per_socket * 2 / 3);
+
+	for (socket = 0; socket < RTE_MAX_NUMA_NODES; socket++) {
+		if (!socket_used[socket] || mps->mp_pool[socket])
+			continue;
+
+		snprintf(name, sizeof(name), "%s_s%u", mps->mp_name, socket);
+
+		mps->mp_pool[socket] =
+			rte_mempool_create(name, per_socket, mps->mp_elt_size,
+					   cache, 0, NULL, NULL, NULL, NULL,
+					   socket, 0);
+		if (!mps->mp_pool[socket]) {
+			RTE_LOG(ERR, CGNAT,
+				"Failed to create %s with %u objects: %s\n",
+				name, per_socket, rte_strerror(rte_errno));
+			rc = -ENOMEM;
+		}
+	}
+	/* Pool sizes are fixed by the first call */
+	if (mps->mp_count == 0)
+		mps->mp_count = count;
+
+	return rc;
+}
+
+/*
+ * Destroy the per-socket pools.  A pool with objects still in use is left in
+ * place, since those objects will be returned to it when freed.
+ */
+void cgn_mempools_destroy(struct cgn_mempools *mps)
+{
+	unsigned int socket;
+	bool in_use = false;
+
+	for (socket = 0; socket < RTE_MAX_NUMA_NODES; socket++) {
+		struct rte_mempool *mp = mps->mp_pool[socket];
+
+		if (!mp)
+			continue;
+
+		if (rte_mempool_in_use_count(mp) != 0) {
+			in_use = true;
+			continue;
+		}
+
+		mps->mp_pool[socket] = NULL;
+		rte_mempool_free(mp);
+	}
+
+	if (!in_use)
+		mps->mp_count = 0;
+}
+
+/*
+ * Get a zeroed object from the pool local to this lcore.  Returns NULL if
+ * the caller should allocate from the heap instead.
+ */
+void *cgn_mempools_get(struct cgn_mempools *mps)
+{
+	unsigned int socket = rte_socket_id();
+	struct rte_mempool *mp;
+	void *obj;
+
+	if (likely(socket < RTE_MAX_NUMA_NODES)) {
+		mp = CMM_ACCESS_ONCE(mps->mp_pool[socket]);
+
+		if (mp && rte_mempool_get(mp, &obj) == 0) {
+			memset(obj, 0, mps->mp_elt_size);
+			return obj;
+		}
+	}
+
+	rte_atomic64_inc(&mps->mp_heap_allocs);
+	return NULL;
+}
+
+/* Return an object to the pool it was allocated from */
+void cgn_mempools_put(void *obj)
+{
+	rte_mempool_put(rte_mempool_from_obj(obj), obj);
+}
+
+void cgn_mempools_jsonw(json_writer_t *json, struct cgn_mempools *mps)
+{
+	uint64_t in_use = 0, avail = 0;
+	unsigned int socket;
+
+	for (socket = 0; socket < RTE_MAX_NUMA_NODES; socket++) {
+		struct rte_mempool *mp = mps->mp_pool[socket];
+
+		if (!mp)
+			continue;
+
+		in_use += rte_mempool_in_use_count(mp);
+		avail += rte_mempool_avail_count(mp);
+	}
+
+	jsonw_name(json, mps->mp_name);
+	jsonw_start_object(json);
+	jsonw_uint_field(json, "count", mps->mp_count);
+	jsonw_uint_field(json, "elt_size", mps->mp_elt_size);
+	jsonw_uint_field(json, "in_use", in_use);
+	jsonw_uint_field(json, "avail", avail);
+	jsonw_uint_field(json, "mem_bytes",
+			 (in_use + avail) * mps->mp_elt_size);
+	jsonw_uint_field(json, "heap_allocs",
+			 rte_atomic64_read(&mps->mp_heap_allocs));
+	jsonw_end_object(json);
+}
+
 /*
  * NAT pool has been de-activated.  Clear all sessions and mappings that
  * derive from this nat pool.
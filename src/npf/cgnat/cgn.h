@@ -13,10 +13,12 @@
 
 #include <rte_atomic.h>
 #include <rte_log.h>
+#include "json_writer.h"
 #include "vplane_log.h"
 
 struct ifnet;
 struct rte_mbuf;
+struct rte_mempool;
 
 /*
  * Packet direction relative to interface with cgnat policy.  Note that this
@@ -43,6 +45,7 @@ extern bool cgn_hairpinning_gbl;
 extern bool cgn_snat_alg_bypass_gbl;
 extern rte_atomic64_t cgn_sess2_ht_created;
 extern rte_atomic64_t cgn_sess2_ht_destroyed;
+extern unsigned int cgn_walk_batch;
 
 struct rte_mbuf *cgn_copy_or_clone_and_undo(struct rte_mbuf *mbuf,
 					    const struct ifnet *in_ifp,
@@ -67,6 +70,25 @@ int cgn_arg_to_int(const char *arg);
 /* Format host byte order address to string */
 char *cgn_addrstr(uint32_t addr, char *str, size_t slen);
 
+/*
+ * Per-socket object pools.  Used for session state so that objects are
+ * local to the socket of the lcore that created them.  Allocations fall back
+ * to the heap when a pool is exhausted or has not been created.
+ */
+struct cgn_mempools {
+	const char		*mp_name;	/* pool name prefix */
+	uint32_t		mp_elt_size;
+	uint32_t		mp_count;	/* total objects, all sockets */
+	struct rte_mempool	*mp_pool[RTE_MAX_NUMA_NODES];
+	rte_atomic64_t		mp_heap_allocs;	/* pool exhausted or absent */
+};
+
+int cgn_mempools_create(struct cgn_mempools *mps, uint32_t count);
+void cgn_mempools_destroy(struct cgn_mempools *mps);
+void *cgn_mempools_get(struct cgn_mempools *mps);
+void cgn_mempools_put(void *obj);
+void cgn_mempools_jsonw(json_writer_t *json, struct cgn_mempools *mps);
+
 /* For unit-tests */
 void dp_test_npf_clear_cgnat(void);
 bool ipv4_cgnat_test(struct rte_mbuf **mbufp, struct ifnet *ifp,
@@ -36,6 +36,8 @@
  *
  * cgn-cfg hairpinning {on | off}
  * cgn-cfg snat-alg-bypass {on | off}
+ * cgn-cfg session-table-size <num>
+ * cgn-cfg eim-table-size <num>
  */
 
 #include <errno.h>
@@ -743,6 +745,65 @@ usage:
 	return -1;
 }
 
+/*
+ * cgn-cfg session-table-size <num>
+ *
+ * Expected number of sessions.  Used to pre-size the session tables and
+ * session mempools.  0 reverts to the default table size.
+ */
+static int cgn_session_table_size_cfg(FILE *f, int argc, char **argv)
+{
+	int tmp;
+
+	if (argc < 3)
+		goto usage;
+
+	tmp = cgn_arg_to_int(argv[2]);
+	if (tmp < 0 || tmp > CGN_SESSIONS_MAX)
+		return -1;
+
+	if (cgn_session_set_expected(tmp) < 0) {
+		if (f)
+			fprintf(f, "%s: failed to create session mempools",
+				__func__);
+		return -1;
+	}
+
+	return 0;
+usage:
+	if (f)
+		fprintf(f, "%s: cgn-cfg session-table-size <num>",
+			__func__);
+
+	return -1;
+}
+
+/*
+ * cgn-cfg eim-table-size <num>
+ *
+ * Number of entries in the endpoint-independent mapping index used for
+ * inbound session lookups.  0 disables the index.
+ */
+static int cgn_eim_table_size_cfg(FILE *f, int argc, char **argv)
+{
+	int tmp;
+
+	if (argc < 3)
+		goto usage;
+
+	tmp = cgn_arg_to_int(argv[2]);
+	if (tmp < 0 || tmp > CGN_SESSIONS_MAX)
+		return -1;
+
+	return cgn_session_eim_set_size(tmp);
+usage:
+	if (f)
+		fprintf(f, "%s: cgn-cfg eim-table-size <num>",
+			__func__);
+
+	return -1;
+}
+
 static int
 cgn_max_apms_cfg(FILE *f __unused, int argc __unused, char **argv __unused)
 {
@@ -1109,6 +1170,12 @@ int cmd_cgn(FILE *f, int argc, char **argv)
 	else if (strcmp(argv[1], "max-sessions") == 0)
 		rc = cgn_max_sessions_cfg(f, argc, argv);
 
+	else if (strcmp(argv[1], "session-table-size") == 0)
+		rc = cgn_session_table_size_cfg(f, argc, argv);
+
+	else if (strcmp(argv[1], "eim-table-size") == 0)
+		rc = cgn_eim_table_size_cfg(f, argc, argv);
+
 	else if (strcmp(argv[1], "max-apms") == 0)
 		rc = cgn_max_apms_cfg(f, argc, argv);
 
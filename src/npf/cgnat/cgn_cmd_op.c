@@ -53,6 +53,7 @@ static void cgn_show_summary(FILE *f, int argc __unused, char **argv __unused)
 			 rte_atomic32_read(&cgn_sess2_used));
 	jsonw_uint_field(json, "max_sess", cgn_sessions_max);
 	jsonw_bool_field(json, "sess_table_full", cgn_session_table_full);
+	cgn_session_jsonw_mem(json);
 
 	jsonw_uint_field(json, "subs_table_used", cgn_source_get_used());
 	jsonw_uint_field(json, "subs_table_max", cgn_source_get_max());
@@ -63,6 +64,11 @@ static void cgn_show_summary(FILE *f, int argc __unused, char **argv __unused)
 	jsonw_uint_field(json, "pkts_hairpinned",
 			 cgn_rc_read(CGN_DIR_OUT, CGN_HAIRPINNED));
 
+	/* Progress of time-sliced table walks */
+	cgn_session_jsonw_walk(json);
+	cgn_source_jsonw_gc(json);
+	apm_jsonw_gc(json);
+
 	if (rte_atomic64_read(&cgn_sess2_ht_created) > 0) {
 		jsonw_uint_field(json, "sess_ht_created",
 				 rte_atomic64_read(&cgn_sess2_ht_created));
@@ -216,6 +222,26 @@ static int cgn_op_ut(FILE *f __unused, int argc, char **argv)
 			else if (!strcmp(argv[3], "pub"))
 				apm_gc_pass();
 		}
+	} else if (!strcmp(argv[2], "gc-slice") && argc >= 4) {
+		if (!strcmp(argv[3], "subs"))
+			cgn_source_gc_slice();
+		else if (!strcmp(argv[3], "pub"))
+			apm_gc_slice();
+	} else if (!strcmp(argv[2], "walk") && argc >= 4) {
+		/*
+		 * walk batch <n> - entries per slice, 0 for the default
+		 * walk slice     - run one slice of the session walks
+		 * walk remove    - remove the session at the walk cursor
+		 */
+		if (!strcmp(argv[3], "batch") && argc >= 5) {
+			int tmp = cgn_arg_to_int(argv[4]);
+
+			if (tmp >= 0)
+				cgn_session_walk_batch_ut(tmp);
+		} else if (!strcmp(argv[3], "slice"))
+			cgn_session_walk_slice_ut();
+		else if (!strcmp(argv[3], "remove"))
+			cgn_session_walk_remove_ut();
 	}
 
 	return 0;
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/**
+ * @file cgn_eim.c - Endpoint-independent mapping index
+ *
+ * Compact, fixed size index of 3-tuple sessions keyed by the public (back)
+ * address, port, protocol and interface.  Used to short-cut the inbound
+ * lookup, which would otherwise walk the back session hash table.
+ *
+ * The index is not authoritative.  Each bucket is one cache-line containing
+ * four slots of hash signature and session pointer.  Lookups return the
+ * first slot whose signature matches, and the caller verifies the session
+ * key.  A miss, or a failed verification, falls back to the session hash
+ * table.  A session that cannot be added because its bucket is full is
+ * only found via the hash table.
+ *
+ * Slots are claimed by the forwarding threads with a cmpxchg on the session
+ * pointer, and released by the gc (master thread) when the session is
+ * deactivated.  Session memory is freed via rcu, so a reader holding a stale
+ * pointer will fail the key check rather than touch freed memory.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <rte_atomic.h>
+#include <rte_common.h>
+#include <rte_jhash.h>
+#include <rte_memory.h>
+#include <urcu.h>
+#include <urcu/uatomic.h>
+
+#include "compiler.h"
+#include "util.h"
+
+#include "npf/cgnat/cgn_eim.h"
+#include "npf/cgnat/cgn_hash_key.h"
+#include "npf/cgnat/cgn_limits.h"
+
+#define CGN_EIM_SLOTS	4
+
+struct cgn_eim_slot {
+	uint32_t		es_sig;
+	uint32_t		es_pad;
+	struct cgn_session	*es_cse;
+};
+
+struct cgn_eim_bucket {
+	struct cgn_eim_slot	eb_slot[CGN_EIM_SLOTS];
+} __rte_cache_aligned;
+
+static_assert(sizeof(struct cgn_eim_bucket) == 64,
+	      "cgn_eim_bucket not one cache line");
+
+struct cgn_eim_table {
+	uint32_t		et_mask;
+	uint32_t		et_nbuckets;
+	struct rcu_head		et_rcu;
+	struct cgn_eim_bucket	*et_bkt;
+};
+
+static struct cgn_eim_table *cgn_eim_tbl;
+
+/* Configured number of entries */
+static uint32_t cgn_eim_entries;
+
+static rte_atomic32_t cgn_eim_used;
+static rte_atomic64_t cgn_eim_full;
+
+struct cgn_eim_stats *cgn_eim_stats;
+
+static ALWAYS_INLINE uint32_t
+cgn_eim_hash(const struct cgn_3tuple_key *key)
+{
+	return rte_jhash_32b((const uint32_t *)key,
+			     sizeof(*key) / sizeof(uint32_t), 0);
+}
+
+/*
+ * Sessions are added and removed with the expired flag set to whatever it
+ * is at that time.  Hash on the unexpired key so that they are always found.
+ */
+static inline uint32_t
+cgn_eim_hash_unexpired(const struct cgn_3tuple_key *key)
+{
+	struct cgn_3tuple_key tmp = *key;
+
+	tmp.k_expired = false;
+	return cgn_eim_hash(&tmp);
+}
+
+static ALWAYS_INLINE struct cgn_eim_bucket *
+cgn_eim_bucket(struct cgn_eim_table *tbl, uint32_t hash)
+{
+	return &tbl->et_bkt[hash & tbl->et_mask];
+}
+
+/*
+ * Lookup the index.  Returns a candidate session, which the caller must
+ * verify.
+ */
+struct cgn_session *cgn_eim_lookup(const struct cgn_3tuple_key *key)
+{
+	struct cgn_eim_table *tbl = rcu_dereference(cgn_eim_tbl);
+	struct cgn_eim_bucket *bkt;
+	struct cgn_session *cse;
+	uint32_t hash;
+	uint i;
+
+	if (!tbl)
+		return NULL;
+
+	hash = cgn_eim_hash(key);
+	bkt = cgn_eim_bucket(tbl, hash);
+
+	for (i = 0; i < CGN_EIM_SLOTS; i++) {
+		cse = CMM_LOAD_SHARED(bkt->eb_slot[i].es_cse);
+		if (cse && CMM_LOAD_SHARED(bkt->eb_slot[i].es_sig) == hash)
+			return cse;
+	}
+
+	cgn_eim_stats_inc(false);
+	return NULL;
+}
+
+/*
+ * Returns 1 if added, 0 if already present, or -ENOSPC if the bucket is full
+ */
+static int
+cgn_eim_insert_tbl(struct cgn_eim_table *tbl, uint32_t hash,
+		   struct cgn_session *cse)
+{
+	struct cgn_eim_bucket *bkt = cgn_eim_bucket(tbl, hash);
+	struct cgn_eim_slot *slot;
+	uint i;
+
+	/* Already present?  e.g. re-populating after a resize */
+	for (i = 0; i < CGN_EIM_SLOTS; i++)
+		if (CMM_LOAD_SHARED(bkt->eb_slot[i].es_cse) == cse)
+			return 0;
+
+	for (i = 0; i < CGN_EIM_SLOTS; i++) {
+		slot = &bkt->eb_slot[i];
+
+		if (CMM_LOAD_SHARED(slot->es_cse))
+			continue;
+
+		if (uatomic_cmpxchg(&slot->es_cse, NULL, cse) != NULL)
+			continue;
+
+		/*
+		 * A reader may briefly see the new session with the previous
+		 * signature.  It will then miss, and use the hash table.
+		 */
+		CMM_STORE_SHARED(slot->es_sig, hash);
+		return 1;
+	}
+	return -ENOSPC;
+}
+
+/*
+ * Add a session to the index.  Called by the forwarding threads after the
+ * back sentry has been added to the session hash table.
+ */
+void cgn_eim_insert(const struct cgn_3tuple_key *key,
+		    struct cgn_session *cse)
+{
+	struct cgn_eim_table *tbl = rcu_dereference(cgn_eim_tbl);
+	int rc;
+
+	if (!tbl)
+		return;
+
+	rc = cgn_eim_insert_tbl(tbl, cgn_eim_hash_unexpired(key), cse);
+	if (likely(rc > 0))
+		rte_atomic32_inc(&cgn_eim_used);
+	else if (rc < 0)
+		rte_atomic64_inc(&cgn_eim_full);
+}
+
+/*
+ * Remove a session from the index.  Called when the session is deactivated.
+ * Every slot is checked in case a re-populate raced with the packet path
+ * and added the session twice.
+ */
+void cgn_eim_delete(const struct cgn_3tuple_key *key,
+		    struct cgn_session *cse)
+{
+	struct cgn_eim_table *tbl = rcu_dereference(cgn_eim_tbl);
+	struct cgn_eim_bucket *bkt;
+	uint i;
+
+	if (!tbl)
+		return;
+
+	bkt = cgn_eim_bucket(tbl, cgn_eim_hash_unexpired(key));
+
+	for (i = 0; i < CGN_EIM_SLOTS; i++) {
+		if (uatomic_cmpxchg(&bkt->eb_slot[i].es_cse, cse, NULL) == cse)
+			rte_atomic32_dec(&cgn_eim_used);
+	}
+}
+
+static void cgn_eim_tbl_free(struct cgn_eim_table *tbl)
+{
+	if (tbl) {
+		free(tbl->et_bkt);
+		free(tbl);
+	}
+}
+
+static void cgn_eim_tbl_rcu_free(struct rcu_head *head)
+{
+	cgn_eim_tbl_free(caa_container_of(head, struct cgn_eim_table, et_rcu));
+}
+
+static struct cgn_eim_table *cgn_eim_tbl_create(uint32_t nentries)
+{
+	struct cgn_eim_table *tbl;
+	uint32_t nbuckets;
+
+	nbuckets = rte_align32pow2((nentries + CGN_EIM_SLOTS - 1) /
+				   CGN_EIM_SLOTS);
+
+	tbl = zmalloc_aligned(sizeof(*tbl));
+	if (!tbl)
+		return NULL;
+
+	tbl->et_bkt = zmalloc_aligned(nbuckets * sizeof(*tbl->et_bkt));
+	if (!tbl->et_bkt) {
+		free(tbl);
+		return NULL;
+	}
+
+	tbl->et_nbuckets = nbuckets;
+	tbl->et_mask = nbuckets - 1;
+
+	return tbl;
+}
+
+/*
+ * Set the number of entries in the index.  The index is replaced with an
+ * empty index of the new size.  The old index is freed after an rcu grace
+ * period.  Sessions already in the old index are only found via the hash
+ * table until the caller re-populates the index.
+ */
+int cgn_eim_set_size(uint32_t nentries)
+{
+	struct cgn_eim_table *new = NULL, *old;
+
+	if (nentries > CGN_SESSIONS_MAX)
+		nentries = CGN_SESSIONS_MAX;
+
+	if (nentries > 0) {
+		if (!cgn_eim_stats) {
+			cgn_eim_stats = zmalloc_aligned((get_lcore_max() + 1) *
+							sizeof(*cgn_eim_stats));
+			if (!cgn_eim_stats)
+				return -ENOMEM;
+		}
+
+		new = cgn_eim_tbl_create(nentries);
+		if (!new)
+			return -ENOMEM;
+	}
+
+	old = cgn_eim_tbl;
+	rcu_assign_pointer(cgn_eim_tbl, new);
+	cgn_eim_entries = nentries;
+	rte_atomic32_clear(&cgn_eim_used);
+	rte_atomic64_clear(&cgn_eim_full);
+
+	if (cgn_eim_stats)
+		memset(cgn_eim_stats, 0,
+		       (get_lcore_max() + 1) * sizeof(*cgn_eim_stats));
+
+	if (old)
+		call_rcu(&old->et_rcu, cgn_eim_tbl_rcu_free);
+
+	return 0;
+}
+
+void cgn_eim_jsonw(json_writer_t *json)
+{
+	struct cgn_eim_table *tbl = cgn_eim_tbl;
+	uint32_t nbuckets = tbl ? tbl->et_nbuckets : 0;
+	uint64_t hits = 0, misses = 0;
+	uint i;
+
+	if (cgn_eim_stats) {
+		FOREACH_DP_LCORE(i) {
+			hits += cgn_eim_stats[i].es_hits;
+			misses += cgn_eim_stats[i].es_misses;
+		}
+	}
+
+	jsonw_name(json, "eim");
+	jsonw_start_object(json);
+	jsonw_uint_field(json, "entries", cgn_eim_entries);
+	jsonw_uint_field(json, "buckets", nbuckets);
+	jsonw_uint_field(json, "mem_bytes",
+			 nbuckets * sizeof(struct cgn_eim_bucket));
+	jsonw_uint_field(json, "used", rte_atomic32_read(&cgn_eim_used));
+	jsonw_uint_field(json, "bucket_full",
+			 rte_atomic64_read(&cgn_eim_full));
+	jsonw_uint_field(json, "hits", hits);
+	jsonw_uint_field(json, "misses", misses);
+	jsonw_end_object(json);
+}
+
+void cgn_eim_uninit(void)
+{
+	(void)cgn_eim_set_size(0);
+
+	free(cgn_eim_stats);
+	cgn_eim_stats = NULL;
+}
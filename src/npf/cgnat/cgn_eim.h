@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef _CGN_EIM_H_
+#define _CGN_EIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <rte_memory.h>
+
+#include "compiler.h"
+#include "json_writer.h"
+#include "util.h"
+
+struct cgn_3tuple_key;
+struct cgn_session;
+
+/* Per-lcore inbound lookup counts, while the index is enabled */
+struct cgn_eim_stats {
+	uint64_t	es_hits;	/* served by the index */
+	uint64_t	es_misses;	/* fell back to the session table */
+} __rte_cache_aligned;
+
+extern struct cgn_eim_stats *cgn_eim_stats;
+
+static ALWAYS_INLINE void cgn_eim_stats_inc(bool hit)
+{
+	if (likely(cgn_eim_stats != NULL)) {
+		if (hit)
+			cgn_eim_stats[dp_lcore_id()].es_hits++;
+		else
+			cgn_eim_stats[dp_lcore_id()].es_misses++;
+	}
+}
+
+/*
+ * Endpoint-independent mapping index.  Maps public address, port and
+ * protocol to a 3-tuple session.  Returns a candidate session which the
+ * caller verifies, and then accounts for with cgn_eim_stats_inc().
+ */
+struct cgn_session *cgn_eim_lookup(const struct cgn_3tuple_key *key);
+void cgn_eim_insert(const struct cgn_3tuple_key *key,
+		    struct cgn_session *cse);
+void cgn_eim_delete(const struct cgn_3tuple_key *key,
+		    struct cgn_session *cse);
+
+/*
+ * Set the number of entries.  0 disables the index.  The new index is
+ * empty, and is populated by the caller.
+ */
+int cgn_eim_set_size(uint32_t nentries);
+
+void cgn_eim_jsonw(json_writer_t *json);
+
+void cgn_eim_uninit(void);
+
+#endif /* _CGN_EIM_H_ */
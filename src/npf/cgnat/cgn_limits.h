@@ -14,6 +14,14 @@
 #define EIGHT_THOUSAND		(1<<13)
 #define ONE_MILLION		(1<<20)
 
+/*
+ * Large table walks on the master thread (session clear, subscriber and
+ * public address gc) visit this many entries per slice, and are continued
+ * CGN_WALK_SLICE_MS later.
+ */
+#define CGN_WALK_BATCH		(8 * ONE_THOUSAND)
+#define CGN_WALK_SLICE_MS	10
+
 #define ONE_SECOND		1
 #define ONE_MINUTE		(60 * ONE_SECOND)
 #define ONE_HOUR		(60 * ONE_MINUTE)
@@ -123,6 +123,21 @@ struct cgn_policy *cgn_policy_lookup(const char *name)
 	return NULL;
 }
 
+/*
+ * Number of policies in the hash table
+ */
+ulong cgn_policy_count(void)
+{
+	unsigned long count;
+	long dummy;
+
+	if (!cgn_policy_ht)
+		return 0;
+
+	cds_lfht_count_nodes(cgn_policy_ht, &dummy, &count, &dummy);
+	return count;
+}
+
 /*
  * Insert cgnat policy into hash table
  */
@@ -156,6 +156,7 @@ void cgn_policy_update_sess_rate(struct cgn_policy *cp,
 int cgn_policy_cmp(struct cgn_policy *p1, struct cgn_policy *p2);
 
 struct cgn_policy *cgn_policy_lookup(const char *name);
+ulong cgn_policy_count(void);
 struct cgn_policy *cgn_policy_get(struct cgn_policy *cp);
 void cgn_policy_put(struct cgn_policy *cp);
 
@@ -71,6 +71,7 @@ struct cgn_sess2 {
 	uint8_t			s2_log_start:1;
 	uint8_t			s2_log_end:1;
 	uint8_t			s2_log_active:1;
+	uint8_t			s2_pool_obj:1;	/* from cgn_sess2_pools */
 	uint64_t		s2_bytes_out_tot; /* bytes out total */
 	uint64_t		s2_start_time;  /* epoch, microsecs */
 
@@ -88,6 +89,12 @@ static_assert(sizeof(struct cgn_sess2) == 128,
 #define s2_expired  s2_key.k_expired
 
 
+/* Per-socket sess2 mempools */
+static struct cgn_mempools cgn_sess2_pools = {
+	.mp_name = "cgn_sess2",
+	.mp_elt_size = sizeof(struct cgn_sess2),
+};
+
 /* Forward references */
 static struct cds_lfht *cgn_sess2_ht_create(ulong nbuckets);
 static void cgn_sess2_ht_destroy(struct cds_lfht **htp);
@@ -205,6 +212,14 @@ static void cgn_sess_s2_slot_put(struct cgn_sess_s2 *cs2)
 	rte_atomic32_dec(&cgn_sess2_used);
 }
 
+static void cgn_sess2_free(struct cgn_sess2 *s2)
+{
+	if (s2->s2_pool_obj)
+		cgn_mempools_put(s2);
+	else
+		free(s2);
+}
+
 /*
  * Activate an s2 session
  */
@@ -219,7 +234,7 @@ int cgn_sess_s2_activate(struct cgn_sess_s2 *cs2, struct cgn_sess2 *s2)
 		 * Failed to s2.  Return reserved slot and free s2.
 		 */
 		cgn_sess_s2_slot_put(cs2);
-		free(s2);
+		cgn_sess2_free(s2);
 		return rc;
 	}
 
@@ -351,7 +366,12 @@ cgn_sess_s2_establish(struct cgn_sess_s2 *cs2, struct cgn_packet *cpk,
 		return NULL;
 	}
 
-	s2 = zmalloc_aligned(sizeof(struct cgn_sess2));
+	s2 = cgn_mempools_get(&cgn_sess2_pools);
+	if (likely(s2 != NULL))
+		s2->s2_pool_obj = true;
+	else
+		s2 = zmalloc_aligned(sizeof(struct cgn_sess2));
+
 	if (!s2) {
 		/* Return reserved slot */
 		cgn_sess_s2_slot_put(cs2);
@@ -697,7 +717,7 @@ static void cgn_sess2_rcu_free(struct rcu_head *head)
 {
 	struct cgn_sess2 *s2 = caa_container_of(head, struct cgn_sess2,
 						s2_rcu_head);
-	free(s2);
+	cgn_sess2_free(s2);
 }
 
 static void
@@ -1121,3 +1141,22 @@ size_t cgn_sess2_size(void)
 {
 	return sizeof(struct cgn_sess2);
 }
+
+/*
+ * Per-socket sess2 mempools.  Created and sized along with the 3-tuple
+ * session mempools.
+ */
+int cgn_sess2_mempools_create(uint32_t count)
+{
+	return cgn_mempools_create(&cgn_sess2_pools, count);
+}
+
+void cgn_sess2_mempools_destroy(void)
+{
+	cgn_mempools_destroy(&cgn_sess2_pools);
+}
+
+void cgn_sess2_mempools_jsonw(json_writer_t *json)
+{
+	cgn_mempools_jsonw(json, &cgn_sess2_pools);
+}
@@ -162,6 +162,10 @@ uint64_t cgn_sess2_pkts_in_tot(struct cgn_sess2 *s2);
 uint64_t cgn_sess2_bytes_in_tot(struct cgn_sess2 *s2);
 uint8_t cgn_sess2_dir(struct cgn_sess2 *s2);
 
+int cgn_sess2_mempools_create(uint32_t count);
+void cgn_sess2_mempools_destroy(void);
+void cgn_sess2_mempools_jsonw(json_writer_t *json);
+
 /* Used by unit-tests only */
 size_t cgn_sess2_size(void);
 
@@ -32,6 +32,7 @@
 #include <rte_jhash.h>
 #include <rte_mbuf.h>
 #include <rte_timer.h>
+#include <string.h>
 #include <time.h>
 
 #include "compiler.h"
@@ -49,6 +50,7 @@
 #include "npf/cgnat/cgn.h"
 #include "npf/apm/apm.h"
 #include "npf/cgnat/cgn_cmd_cfg.h"
+#include "npf/cgnat/cgn_eim.h"
 #include "npf/cgnat/cgn_errno.h"
 #include "npf/cgnat/cgn_if.h"
 #include "npf/cgnat/cgn_hash_key.h"
@@ -108,6 +110,7 @@ struct cgn_session {
 	/* Session instantiated by map cmd and/or a packet */
 	uint8_t			cs_pkt_instd:1;
 	uint8_t			cs_map_instd:1;
+	uint8_t			cs_pool_obj:1;	/* from cgn_sess_pools */
 	uint8_t			cs_pad1[1];
 
 	uint16_t		cs_l3_chk_delta;
@@ -145,6 +148,9 @@ static_assert(sizeof(struct cgn_session) == 256,
 /* session hash tables */
 struct cds_lfht *cgn_sess_ht[CGN_DIR_SZ];
 
+/* Buckets the installed session hash tables were created with */
+static ulong cgn_sess_ht_buckets;
+
 /* GC Timer */
 struct rte_timer cgn_gc_timer;
 
@@ -164,8 +170,21 @@ rte_atomic32_t cgn_sess2_used;
 /* Set true when table is full.  Re-evaluated after GC. */
 bool cgn_session_table_full;
 
+/*
+ * Expected number of sessions.  Used to pre-size the session hash tables and
+ * the per-socket session mempools.  0 means not configured.
+ */
+static uint32_t cgn_sessions_expected;
+
+/* Per-socket session mempools */
+static struct cgn_mempools cgn_sess_pools = {
+	.mp_name = "cgn_sess",
+	.mp_elt_size = sizeof(struct cgn_session),
+};
+
 /* Forward references */
 static void cgn_session_expire_all(bool clear_map, bool restart_timer);
+static bool cgn_session_walk_active(void);
 
 static void session_table_threshold_timer_expiry(
 		struct rte_timer *timer __unused,
@@ -402,7 +421,12 @@ static struct cgn_session *cgn_session_create(int *error)
 		return NULL;
 	}
 
-	cse = zmalloc_aligned(sizeof(struct cgn_session));
+	cse = cgn_mempools_get(&cgn_sess_pools);
+	if (likely(cse != NULL))
+		cse->cs_pool_obj = true;
+	else
+		cse = zmalloc_aligned(sizeof(struct cgn_session));
+
 	if (unlikely(cse == NULL)) {
 		*error = -CGN_S1_ENOMEM;
 		return NULL;
@@ -414,12 +438,20 @@ static struct cgn_session *cgn_session_create(int *error)
 	return cse;
 }
 
+static void cgn_session_free(struct cgn_session *cse)
+{
+	if (cse->cs_pool_obj)
+		cgn_mempools_put(cse);
+	else
+		free(cse);
+}
+
 static void cgn_session_rcu_free(struct rcu_head *head)
 {
 	struct cgn_session *cse = caa_container_of(head, struct cgn_session,
 						   cs_rcu_head);
 
-	free(cse);
+	cgn_session_free(cse);
 }
 
 /*
@@ -463,7 +495,7 @@ void cgn_session_destroy(struct cgn_session *cse, bool rcu_free)
 	if (rcu_free)
 		call_rcu(&cse->cs_rcu_head, cgn_session_rcu_free);
 	else
-		free(cse);
+		cgn_session_free(cse);
 }
 
 /*
@@ -502,6 +534,170 @@ void cgn_session_set_max(int32_t val)
 				    session_table_threshold_time);
 }
 
+static void cgn_session_ht_destroy(struct cds_lfht **ht)
+{
+	int dir;
+
+	for (dir = 0; dir < CGN_DIR_SZ; dir++) {
+		if (ht[dir]) {
+			struct cds_lfht *tmp = ht[dir];
+
+			rcu_assign_pointer(ht[dir], NULL);
+			dp_ht_destroy_deferred(tmp);
+		}
+	}
+}
+
+/*
+ * Number of buckets to create each session hash table with.  If an expected
+ * session count has been configured then the tables start at, and never
+ * shrink below, that size.
+ */
+static ulong cgn_session_ht_size(void)
+{
+	ulong size = CGN_SESSION_HT_INIT;
+
+	if (cgn_sessions_expected > size)
+		size = rte_align32pow2(cgn_sessions_expected);
+
+	return RTE_MIN(size, (ulong)CGN_SESSION_HT_MAX);
+}
+
+static void cgn_session_ht_create(void)
+{
+	ulong size = cgn_session_ht_size();
+	int dir;
+
+	for (dir = 0; dir < CGN_DIR_SZ; dir++)
+		rcu_assign_pointer(cgn_sess_ht[dir],
+			cds_lfht_new(size, size, CGN_SESSION_HT_MAX,
+				     CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING,
+				     NULL));
+	cgn_sess_ht_buckets = size;
+}
+
+/*
+ * Re-create the session hash tables at the expected size.  This is only safe
+ * while there are no policies, since forwarding threads may otherwise be
+ * adding sessions to the old tables.  Otherwise the new size is used the
+ * next time the tables are created.
+ */
+static void cgn_session_ht_presize(void)
+{
+	struct cds_lfht *old[CGN_DIR_SZ];
+	ulong size = cgn_session_ht_size();
+	ulong old_size = cgn_sess_ht_buckets;
+	int dir;
+
+	if (!cgn_sess_ht[CGN_DIR_FORW])
+		return;
+
+	if (cgn_policy_count() > 0 || cgn_session_count() > 0 ||
+	    cgn_session_walk_active()) {
+		RTE_LOG(NOTICE, CGNAT,
+			"Session table size %lu deferred until restart\n",
+			size);
+		return;
+	}
+
+	for (dir = 0; dir < CGN_DIR_SZ; dir++)
+		old[dir] = cgn_sess_ht[dir];
+
+	cgn_session_ht_create();
+
+	for (dir = 0; dir < CGN_DIR_SZ; dir++) {
+		if (!cgn_sess_ht[dir]) {
+			/* Keep the old tables */
+			cgn_session_ht_destroy(cgn_sess_ht);
+			for (dir = 0; dir < CGN_DIR_SZ; dir++)
+				cgn_sess_ht[dir] = old[dir];
+			cgn_sess_ht_buckets = old_size;
+			return;
+		}
+	}
+
+	cgn_session_ht_destroy(old);
+}
+
+/*
+ * Set expected number of sessions.  Pre-sizes the session hash tables, and
+ * creates the per-socket mempools for 3-tuple and 2-tuple sessions.  Pool
+ * sizes are fixed once the pools have been created.
+ *
+ * If a mempool cannot be created then the expected count is left unchanged,
+ * so that the same count may be retried.
+ */
+int cgn_session_set_expected(uint32_t count)
+{
+	int rc;
+
+	if (count > CGN_SESSIONS_MAX)
+		count = CGN_SESSIONS_MAX;
+
+	if (count == cgn_sessions_expected)
+		return 0;
+
+	if (count > 0) {
+		rc = cgn_mempools_create(&cgn_sess_pools, count);
+		if (rc == 0)
+			rc = cgn_sess2_mempools_create(count);
+		if (rc < 0) {
+			RTE_LOG(ERR, CGNAT,
+				"Failed to create session mempools for %u "
+				"sessions: %s\n", count, strerror(-rc));
+			return rc;
+		}
+	}
+
+	cgn_sessions_expected = count;
+	cgn_session_ht_presize();
+
+	return 0;
+}
+
+uint32_t cgn_session_get_expected(void)
+{
+	return cgn_sessions_expected;
+}
+
+static int cgn_session_eim_populate_cb(struct cgn_session *cse,
+				       void *data __unused)
+{
+	if (cse->cs_back_entry.ce_active && !cse->cs_back_entry.ce_expired)
+		cgn_eim_insert(&cse->cs_back_entry.ce_key, cse);
+	return 0;
+}
+
+/*
+ * Set the size of the endpoint-independent mapping index, and add the
+ * existing sessions to the new index.
+ */
+int cgn_session_eim_set_size(uint32_t nentries)
+{
+	int rc;
+
+	rc = cgn_eim_set_size(nentries);
+	if (rc < 0)
+		return rc;
+
+	if (nentries > 0)
+		(void)cgn_session_walk(cgn_session_eim_populate_cb, NULL);
+
+	return 0;
+}
+
+/*
+ * Write json for session table and mempool sizes
+ */
+void cgn_session_jsonw_mem(json_writer_t *json)
+{
+	jsonw_uint_field(json, "sess_expected", cgn_sessions_expected);
+	jsonw_uint_field(json, "sess_ht_buckets", cgn_sess_ht_buckets);
+	cgn_mempools_jsonw(json, &cgn_sess_pools);
+	cgn_sess2_mempools_jsonw(json);
+	cgn_eim_jsonw(json);
+}
+
 /*
  * Generate session table threshold log
  * and restart timer if required.
@@ -721,7 +917,7 @@ cgn_session_establish(struct cgn_packet *cpk, int dir,
 		*error = cgn_sess_s2_enable(cs2);
 
 		if (*error < 0) {
-			free(cse);
+			cgn_session_free(cse);
 			cgn_session_slot_put();
 			return NULL;
 		}
@@ -946,6 +1142,9 @@ int cgn_session_activate(struct cgn_session *cse,
 		goto end;
 	}
 
+	/* Add to the endpoint-independent mapping index */
+	cgn_eim_insert(&cse->cs_back_entry.ce_key, cse);
+
 	/* Increment 3-tuple sessions created in subscriber */
 	cgn_source_stats_sess_created(cse->cs_src);
 
@@ -989,9 +1188,10 @@ static void
 cgn_session_deactivate(struct cgn_session *cse)
 {
 	if (cse->cs_forw_entry.ce_active) {
-		/* Remove from sentry table */
+		/* Remove from sentry table and mapping index */
 		cgn_sentry_delete(&cse->cs_forw_entry, CGN_DIR_FORW);
 		cgn_sentry_delete(&cse->cs_back_entry, CGN_DIR_BACK);
+		cgn_eim_delete(&cse->cs_back_entry.ce_key, cse);
 
 		/* Release the slot */
 		cgn_session_slot_put();
@@ -1120,6 +1320,24 @@ cgn_sentry_lookup(const struct cgn_3tuple_key *key, int dir)
 	struct cds_lfht_iter iter;
 	struct cds_lfht_node *node;
 
+	/*
+	 * Try the mapping index first for inbound packets.  The index is not
+	 * authoritative, so verify the key.  An expired session will not
+	 * match since the expired flag is part of the key.
+	 */
+	if (dir == CGN_DIR_BACK) {
+		struct cgn_session *cse = cgn_eim_lookup(key);
+
+		if (cse) {
+			bool hit = !memcmp(&cse->cs_back_entry.ce_key, key,
+					   sizeof(*key));
+
+			cgn_eim_stats_inc(hit);
+			if (hit)
+				return &cse->cs_back_entry;
+		}
+	}
+
 	node = cgn_session_node(key, dir, &iter);
 	if (!node)
 		return NULL;
@@ -2278,117 +2496,113 @@ static void cgn_session_clear_mapping(struct cgn_session *cse)
 }
 
 /*
- * addr must be specified.  port=0 means any/all ports.
+ * Expire one session, and optionally release its mapping.  Returns the
+ * number of 2-tuple sessions expired.
  */
-static void
-cgn_session_clear_fltr(struct cgn_sess_fltr *fltr, bool clear_map,
-		       bool restart_timer)
+static uint cgn_session_expire_one(struct cgn_session *cse, bool clear_map)
 {
-	struct cds_lfht_iter iter;
-	struct cgn_session *cse;
-	struct cgn_sentry *ce, *bk;
-	uint count = 0; /* count 2-tuple sessions cleared */
-
-	if (!cgn_sess_ht[CGN_DIR_FORW])
-		return;
-
-	/*
-	 * We do not want an expired timer competing with the cli or ut, so
-	 * stop timer while expiring sessions.
-	 */
-	cgn_session_stop_timer();
+	uint count = 0;
 
-	cds_lfht_for_each_entry(cgn_sess_ht[CGN_DIR_FORW], &iter, ce, ce_node) {
-		if (!clear_map && ce->ce_expired)
-			continue;
+	if (!cse->cs_forw_entry.ce_expired) {
+		if (cgn_sess_s2_is_enabled(cse))
+			count += cgn_sess_s2_expire_all(&cse->cs_s2);
 
-		/* Filter on IP protocol */
-		if (fltr->cf_subs.k_ipproto &&
-		    fltr->cf_subs.k_ipproto != ce->ce_ipproto)
-			continue;
+		cgn_session_set_expired(cse, true);
+	}
 
-		/* Filter on Subscriber address and port */
-		if (fltr->cf_subs_mask &&
-		    fltr->cf_subs.k_addr != (ce->ce_addr & fltr->cf_subs_mask))
-			continue;
+	if (clear_map)
+		cgn_session_clear_mapping(cse);
 
-		if (fltr->cf_subs.k_port && fltr->cf_subs.k_port != ce->ce_port)
-			continue;
+	return count;
+}
 
-		cse = caa_container_of(ce, struct cgn_session, cs_forw_entry);
-		bk = &cse->cs_back_entry;
+/*
+ * addr must be specified.  port=0 means any/all ports.
+ *
+ * Returns the number of 2-tuple sessions expired.
+ */
+static uint
+cgn_session_clear_fltr_one(struct cgn_sess_fltr *fltr, struct cgn_sentry *ce,
+			   bool clear_map)
+{
+	struct cgn_session *cse;
+	struct cgn_sentry *bk;
+	uint count = 0;
 
-		/* Filter on Public address and port */
-		if (fltr->cf_pub_mask &&
-		    fltr->cf_pub.k_addr != (bk->ce_addr & fltr->cf_pub_mask))
-			continue;
+	if (!clear_map && ce->ce_expired)
+		return 0;
 
-		if (fltr->cf_pub.k_port && fltr->cf_pub.k_port != bk->ce_port)
-			continue;
+	/* Filter on IP protocol */
+	if (fltr->cf_subs.k_ipproto &&
+	    fltr->cf_subs.k_ipproto != ce->ce_ipproto)
+		return 0;
 
-		/*
-		 * Filter on destination port.  This is the special case where
-		 * 2-tuple sessions are *not* enabled, and we have only ever
-		 * seen one dest port inuse on the 3-tuple session.
-		 */
-		if (fltr->cf_dst.k_port && !cgn_sess_s2_is_enabled(cse) &&
-		    cse->cs_s2.cs2_dst_port != 0 &&
-		    fltr->cf_dst.k_port != cse->cs_s2.cs2_dst_port)
-			continue;
+	/* Filter on Subscriber address and port */
+	if (fltr->cf_subs_mask &&
+	    fltr->cf_subs.k_addr != (ce->ce_addr & fltr->cf_subs_mask))
+		return 0;
 
-		/* Filter on session ID */
-		if (fltr->cf_id1) {
-			if (fltr->cf_id1 != cse->cs_id)
-				continue;
+	if (fltr->cf_subs.k_port && fltr->cf_subs.k_port != ce->ce_port)
+		return 0;
 
-			/* Expire one or all 2-tuple sessions */
-			if (cgn_sess_s2_is_enabled(cse))
-				count += cgn_sess_s2_expire_id(&cse->cs_s2,
-							       fltr->cf_id2);
+	cse = caa_container_of(ce, struct cgn_session, cs_forw_entry);
+	bk = &cse->cs_back_entry;
 
-			/*
-			 * If no unexpired 2-tuple sessions remain then expire
-			 * 3-tuple session and clear mapping.
-			 */
-			if (!cgn_sess_s2_is_enabled(cse) ||
-			    cgn_sess_s2_unexpired(&cse->cs_s2) == 0) {
+	/* Filter on Public address and port */
+	if (fltr->cf_pub_mask &&
+	    fltr->cf_pub.k_addr != (bk->ce_addr & fltr->cf_pub_mask))
+		return 0;
 
-				if (!ce->ce_expired)
-					cgn_session_set_expired(cse, true);
+	if (fltr->cf_pub.k_port && fltr->cf_pub.k_port != bk->ce_port)
+		return 0;
 
-				if (clear_map)
-					cgn_session_clear_mapping(cse);
-			}
+	/*
+	 * Filter on destination port.  This is the special case where
+	 * 2-tuple sessions are *not* enabled, and we have only ever
+	 * seen one dest port inuse on the 3-tuple session.
+	 */
+	if (fltr->cf_dst.k_port && !cgn_sess_s2_is_enabled(cse) &&
+	    cse->cs_s2.cs2_dst_port != 0 &&
+	    fltr->cf_dst.k_port != cse->cs_s2.cs2_dst_port)
+		return 0;
 
-			continue;
-		}
+	/* Filter on session ID */
+	if (fltr->cf_id1) {
+		if (fltr->cf_id1 != cse->cs_id)
+			return 0;
 
-		/* Filter on interface */
-		if (fltr->cf_ifindex && fltr->cf_ifindex != cse->cs_ifindex)
-			continue;
+		/* Expire one or all 2-tuple sessions */
+		if (cgn_sess_s2_is_enabled(cse))
+			count += cgn_sess_s2_expire_id(&cse->cs_s2,
+						       fltr->cf_id2);
 
-		/* Filter on NAT pool */
-		if (fltr->cf_np &&
-		    fltr->cf_np != cgn_source_get_pool(cse->cs_src))
-			continue;
+		/*
+		 * If no unexpired 2-tuple sessions remain then expire
+		 * 3-tuple session and clear mapping.
+		 */
+		if (!cgn_sess_s2_is_enabled(cse) ||
+		    cgn_sess_s2_unexpired(&cse->cs_s2) == 0) {
 
-		if (!ce->ce_expired) {
-			if (cgn_sess_s2_is_enabled(cse))
-				count += cgn_sess_s2_expire_all(&cse->cs_s2);
+			if (!ce->ce_expired)
+				cgn_session_set_expired(cse, true);
 
-			cgn_session_set_expired(cse, true);
+			if (clear_map)
+				cgn_session_clear_mapping(cse);
 		}
 
-		if (clear_map)
-			cgn_session_clear_mapping(cse);
+		return count;
 	}
 
-	/* Log session clear command instead of every session */
-	if (count)
-		cgn_log_sess_clear(fltr->cf_desc, count, soft_ticks);
+	/* Filter on interface */
+	if (fltr->cf_ifindex && fltr->cf_ifindex != cse->cs_ifindex)
+		return 0;
 
-	if (restart_timer)
-		cgn_session_start_timer();
+	/* Filter on NAT pool */
+	if (fltr->cf_np &&
+	    fltr->cf_np != cgn_source_get_pool(cse->cs_src))
+		return 0;
+
+	return cgn_session_expire_one(cse, clear_map);
 }
 
 /*
@@ -2565,148 +2779,436 @@ void cgn_session_update(FILE *f, int argc, char **argv)
 		cgn_session_clear_or_update_stats_fltr(&fltr, false);
 }
 
+/*
+ * Session clear and expire walks.
+ *
+ * Clearing sessions, or expiring them after a policy or pool change, may
+ * mean visiting every entry in a very large table.  These walks are queued
+ * and done in slices of CGN_WALK_BATCH entries per timer tick on the master
+ * thread.  The first slice is run straight away, so small tables are still
+ * cleared synchronously.
+ *
+ * The gc timer is stopped while any walk is outstanding, so expired
+ * sessions stay in the table until the walk completes.  An iterator must not
+ * be kept across slices, since sessions may still be removed by the
+ * forwarding threads and the table may be resized.  Instead each slice
+ * resumes after the last entry visited by the previous slice, found by
+ * looking it up again.  The hash table is split-ordered, so the walk order
+ * is not changed by a resize.  If the cursor entry has since been removed
+ * then the walk restarts from the beginning.  Sessions already expired by
+ * the walk are not counted again.  One log is generated per walk, when it
+ * completes.
+ */
+enum cgn_sess_walk_type {
+	CGN_SESS_WALK_ALL,
+	CGN_SESS_WALK_FLTR,
+	CGN_SESS_WALK_POOL,
+	CGN_SESS_WALK_POLICY,
+};
+
+struct cgn_sess_walk {
+	struct cds_list_head	sw_list_node;
+	enum cgn_sess_walk_type	sw_type;
+	bool			sw_clear_map;
+	bool			sw_started;
+	bool			sw_cursor_valid;
+	struct cds_lfht_node	*sw_cursor;	/* last entry visited */
+	ulong			sw_cursor_hash;
+	uint			sw_restarts;
+	struct cgn_sess_fltr	sw_fltr;
+	struct nat_pool		*sw_np;
+	struct cgn_policy	*sw_cp;
+	uint64_t		sw_visited;
+	uint64_t		sw_start_count;	/* table size at walk start */
+	uint			sw_count;	/* 2-tuple sessions expired */
+	char			sw_desc[CGN_SESS_FLTR_DESC_SZ];
+};
+
+/* Outstanding walks.  Only the walk at the head of the list is active. */
+static CDS_LIST_HEAD(cgn_sess_walk_list);
+static struct rte_timer cgn_sess_walk_timer;
+
+/* Restart the gc timer when all walks complete */
+static bool cgn_sess_walk_restart_gc;
+
+/* Unit-tests run each slice after the first by hand */
+static bool cgn_sess_walk_manual;
+
+static bool cgn_session_walk_active(void)
+{
+	return !cds_list_empty(&cgn_sess_walk_list);
+}
+
+static uint
+cgn_session_walk_one(struct cgn_sess_walk *sw, struct cgn_sentry *ce)
+{
+	struct cgn_session *cse;
+
+	cse = caa_container_of(ce, struct cgn_session, cs_forw_entry);
+
+	switch (sw->sw_type) {
+	case CGN_SESS_WALK_ALL:
+		return cgn_session_expire_one(cse, sw->sw_clear_map);
+
+	case CGN_SESS_WALK_FLTR:
+		return cgn_session_clear_fltr_one(&sw->sw_fltr, ce,
+						  sw->sw_clear_map);
+
+	case CGN_SESS_WALK_POOL:
+		if (cgn_source_get_pool(cse->cs_src) != sw->sw_np)
+			return 0;
+		return cgn_session_expire_one(cse, sw->sw_clear_map);
+
+	case CGN_SESS_WALK_POLICY:
+		if (ce->ce_expired)
+			return 0;
+		if (cse->cs_src && cse->cs_src->sr_policy != sw->sw_cp)
+			return 0;
+		return cgn_session_expire_one(cse, false);
+	}
+	return 0;
+}
+
+static void cgn_session_walk_done(struct cgn_sess_walk *sw)
+{
+	cds_list_del(&sw->sw_list_node);
+
+	if (sw->sw_type == CGN_SESS_WALK_POOL)
+		/* Clear address hints */
+		nat_pool_clear_addr_hints(sw->sw_np);
+
+	/* Log session clear command instead of every session */
+	if (sw->sw_count)
+		cgn_log_sess_clear(sw->sw_desc, sw->sw_count, soft_ticks);
+
+	if (sw->sw_np)
+		nat_pool_put(sw->sw_np);
+	if (sw->sw_cp)
+		cgn_policy_put(sw->sw_cp);
+	free(sw);
+}
+
+/* Match the walk cursor node itself, whether or not it has expired */
+static int cgn_sess_match_node(struct cds_lfht_node *node, const void *key)
+{
+	return node == key;
+}
+
+/*
+ * Position the iterator after the walk cursor, or at the start of the table
+ * if the walk has not started or the cursor entry has gone.
+ */
 static void
-cgn_session_expire_all(bool clear_map, bool restart_timer)
+cgn_session_walk_resume(struct cgn_sess_walk *sw, struct cds_lfht *ht,
+			struct cds_lfht_iter *iter)
+{
+	if (sw->sw_cursor_valid) {
+		cds_lfht_lookup(ht, sw->sw_cursor_hash, cgn_sess_match_node,
+				sw->sw_cursor, iter);
+		if (cds_lfht_iter_get_node(iter)) {
+			cds_lfht_next(ht, iter);
+			return;
+		}
+		sw->sw_cursor_valid = false;
+		sw->sw_restarts++;
+	}
+	cds_lfht_first(ht, iter);
+}
+
+/*
+ * Visit up to 'budget' entries.  Returns true when the walk is complete.
+ */
+static bool cgn_session_walk_slice(struct cgn_sess_walk *sw, uint budget)
 {
+	struct cds_lfht *ht = cgn_sess_ht[CGN_DIR_FORW];
+	struct cgn_sentry *ce = NULL;
 	struct cds_lfht_iter iter;
-	struct cgn_session *cse;
-	struct cgn_sentry *ce;
-	uint count = 0;
+	struct cds_lfht_node *node;
+	struct cgn_3tuple_key key;
 
-	if (!cgn_sess_ht[CGN_DIR_FORW])
-		return;
+	if (!ht)
+		return true;
+
+	if (!sw->sw_started) {
+		sw->sw_started = true;
+		sw->sw_start_count = cgn_session_count();
+	}
+
+	cgn_session_walk_resume(sw, ht, &iter);
+
+	while ((node = cds_lfht_iter_get_node(&iter)) != NULL) {
+		if (budget-- == 0)
+			break;
+
+		ce = caa_container_of(node, struct cgn_sentry, ce_node);
+		cds_lfht_next(ht, &iter);
+
+		sw->sw_count += cgn_session_walk_one(sw, ce);
+		sw->sw_visited++;
+	}
+
+	if (!node)
+		return true;
 
 	/*
-	 * We do not want an expired timer competing with the cli or ut, so
-	 * stop timer while expiring sessions.
+	 * Remember where we got to.  Entries are hashed before they are
+	 * expired, so the hash is of the unexpired key.
 	 */
-	cgn_session_stop_timer();
+	if (ce) {
+		key = ce->ce_key;
+		key.k_expired = false;
+		sw->sw_cursor = &ce->ce_node;
+		sw->sw_cursor_hash = cgn_hash(&key);
+		sw->sw_cursor_valid = true;
+	}
+	return false;
+}
 
-	cds_lfht_for_each_entry(cgn_sess_ht[CGN_DIR_FORW], &iter, ce, ce_node) {
-		if (!clear_map && ce->ce_expired)
-			continue;
+/*
+ * Run outstanding walks until 'budget' entries have been visited.
+ */
+static void cgn_session_walk_run(uint budget)
+{
+	struct cgn_sess_walk *sw;
 
-		cse = caa_container_of(ce, struct cgn_session, cs_forw_entry);
+	while (cgn_session_walk_active()) {
+		uint64_t visited;
+		bool done;
 
-		if (!ce->ce_expired) {
-			if (cgn_sess_s2_is_enabled(cse))
-				count += cgn_sess_s2_expire_all(&cse->cs_s2);
+		sw = cds_list_first_entry(&cgn_sess_walk_list,
+					  struct cgn_sess_walk, sw_list_node);
 
-			cgn_session_set_expired(cse, true);
-		}
+		visited = sw->sw_visited;
+		done = cgn_session_walk_slice(sw, budget);
 
-		if (clear_map)
-			cgn_session_clear_mapping(cse);
-	}
+		if (!done)
+			return;
 
-	/* Log session clear command instead of every session */
-	if (count)
-		cgn_log_sess_clear("all", count, soft_ticks);
+		budget -= RTE_MIN(budget, sw->sw_visited - visited);
+		cgn_session_walk_done(sw);
+	}
 
-	if (restart_timer)
+	if (cgn_sess_walk_restart_gc) {
+		cgn_sess_walk_restart_gc = false;
 		cgn_session_start_timer();
+	}
+}
+
+static void
+cgn_session_walk_timer_expiry(struct rte_timer *timer __unused,
+			      void *arg __unused)
+{
+	cgn_session_walk_run(cgn_walk_batch);
+
+	if (cgn_session_walk_active() && running && !cgn_sess_walk_manual)
+		rte_timer_reset(&cgn_sess_walk_timer,
+				CGN_WALK_SLICE_MS * rte_get_timer_hz() / 1000,
+				SINGLE, rte_get_master_lcore(),
+				cgn_session_walk_timer_expiry, NULL);
 }
 
 /*
- * Expire all sessions that use public addresses from the given nat pool.
- *
- * If clear_mapping is true, then also release mapping used by any sessions
- * that are expired.
+ * Queue a walk, and run the first slice.
  */
-void cgn_session_expire_pool(bool restart_timer, struct nat_pool *np,
-			     bool clear_mapping)
+static void
+cgn_session_walk_start(struct cgn_sess_walk *sw, bool restart_timer)
 {
-	struct cds_lfht_iter iter;
-	struct cgn_session *cse;
-	struct cgn_sentry *ce;
-	uint count = 0;
-
-	if (!cgn_sess_ht[CGN_DIR_FORW])
+	if (!cgn_sess_ht[CGN_DIR_FORW]) {
+		cgn_session_walk_done(sw);
 		return;
+	}
 
 	/*
 	 * We do not want an expired timer competing with the cli or ut, so
 	 * stop timer while expiring sessions.
 	 */
 	cgn_session_stop_timer();
+	if (restart_timer)
+		cgn_sess_walk_restart_gc = true;
 
-	cds_lfht_for_each_entry(cgn_sess_ht[CGN_DIR_FORW], &iter, ce, ce_node) {
-		struct nat_pool *cs_np;
+	cds_list_add_tail(&sw->sw_list_node, &cgn_sess_walk_list);
 
-		cse = caa_container_of(ce, struct cgn_session, cs_forw_entry);
+	cgn_session_walk_timer_expiry(NULL, NULL);
+}
 
-		cs_np = cgn_source_get_pool(cse->cs_src);
-		if (cs_np != np)
-			continue;
+static struct cgn_sess_walk *
+cgn_session_walk_create(enum cgn_sess_walk_type type, bool clear_map)
+{
+	struct cgn_sess_walk *sw;
 
-		if (!ce->ce_expired) {
-			if (cgn_sess_s2_is_enabled(cse))
-				count += cgn_sess_s2_expire_all(&cse->cs_s2);
+	sw = zmalloc_aligned(sizeof(*sw));
+	if (!sw) {
+		RTE_LOG(ERR, CGNAT, "Failed to allocate session walk\n");
+		return NULL;
+	}
 
-			cgn_session_set_expired(cse, true);
-		}
+	CDS_INIT_LIST_HEAD(&sw->sw_list_node);
+	sw->sw_type = type;
+	sw->sw_clear_map = clear_map;
 
-		if (clear_mapping)
-			cgn_session_clear_mapping(cse);
-	}
+	return sw;
+}
 
-	/* Clear address hints */
-	nat_pool_clear_addr_hints(np);
+/*
+ * Complete all outstanding walks.  Used when the table is about to be
+ * cleaned up.
+ */
+static void cgn_session_walk_flush(void)
+{
+	rte_timer_stop(&cgn_sess_walk_timer);
+	cgn_sess_walk_restart_gc = false;
+	cgn_session_walk_run(UINT_MAX);
+}
 
-	/* Log session clear command instead of every session */
-	if (count) {
-		char desc[60];
-		snprintf(desc, sizeof(desc), "pool %s", nat_pool_name(np));
-		cgn_log_sess_clear(desc, count, soft_ticks);
-	}
+/*
+ * Called via hidden vplsh command.  Set the number of entries visited per
+ * slice.  A non-zero value also stops the slices after the first being run
+ * from the timer, so that the unit-tests can run them one at a time.  0
+ * restores the default.
+ */
+void cgn_session_walk_batch_ut(uint32_t batch)
+{
+	cgn_walk_batch = batch ? batch : CGN_WALK_BATCH;
+	cgn_sess_walk_manual = batch != 0;
 
-	if (restart_timer)
-		cgn_session_start_timer();
+	if (!cgn_sess_walk_manual && cgn_session_walk_active())
+		cgn_session_walk_timer_expiry(NULL, NULL);
 }
 
 /*
- * Expire all sessions associated with a specific policy
+ * Called via hidden vplsh command.  Run one slice of the outstanding walks.
  */
-void cgn_session_expire_policy(bool restart_timer, struct cgn_policy *cp)
+void cgn_session_walk_slice_ut(void)
 {
+	cgn_session_walk_timer_expiry(NULL, NULL);
+}
+
+/*
+ * Called via hidden vplsh command.  Remove the session at the cursor of the
+ * active walk from the table, as a forwarding thread may do between slices.
+ */
+void cgn_session_walk_remove_ut(void)
+{
+	struct cds_lfht *ht = cgn_sess_ht[CGN_DIR_FORW];
+	struct cgn_sess_walk *sw;
 	struct cds_lfht_iter iter;
+	struct cds_lfht_node *node;
 	struct cgn_session *cse;
-	struct cgn_sentry *ce;
-	uint count = 0;
 
-	if (!cgn_sess_ht[CGN_DIR_FORW])
+	if (!ht || !cgn_session_walk_active())
 		return;
 
-	/*
-	 * We do not want an expired timer competing with the cli or ut, so
-	 * stop timer while expiring sessions.
-	 */
-	cgn_session_stop_timer();
+	sw = cds_list_first_entry(&cgn_sess_walk_list,
+				  struct cgn_sess_walk, sw_list_node);
+	if (!sw->sw_cursor_valid)
+		return;
 
-	cds_lfht_for_each_entry(cgn_sess_ht[CGN_DIR_FORW], &iter, ce, ce_node) {
-		if (ce->ce_expired)
-			continue;
+	cds_lfht_lookup(ht, sw->sw_cursor_hash, cgn_sess_match_node,
+			sw->sw_cursor, &iter);
+	node = cds_lfht_iter_get_node(&iter);
+	if (!node)
+		return;
 
-		cse = caa_container_of(ce, struct cgn_session, cs_forw_entry);
+	cse = caa_container_of(node, struct cgn_session, cs_forw_entry.ce_node);
+	cgn_session_deactivate(cse);
+	cgn_session_destroy(cse, true);
+}
 
-		if (cse->cs_src && cse->cs_src->sr_policy != cp)
-			continue;
+/*
+ * Write json for the progress of outstanding walks
+ */
+void cgn_session_jsonw_walk(json_writer_t *json)
+{
+	struct cgn_sess_walk *sw;
 
-		if (cgn_sess_s2_is_enabled(cse))
-			count += cgn_sess_s2_expire_all(&cse->cs_s2);
+	jsonw_name(json, "sess_clear");
+	jsonw_start_array(json);
 
-		cgn_session_set_expired(cse, true);
+	cds_list_for_each_entry(sw, &cgn_sess_walk_list, sw_list_node) {
+		jsonw_start_object(json);
+		jsonw_string_field(json, "desc", sw->sw_desc);
+		jsonw_bool_field(json, "active", sw->sw_started);
+		jsonw_uint_field(json, "visited", sw->sw_visited);
+		jsonw_uint_field(json, "total", sw->sw_start_count);
+		jsonw_uint_field(json, "sess2_cleared", sw->sw_count);
+		jsonw_uint_field(json, "restarts", sw->sw_restarts);
+		jsonw_end_object(json);
 	}
 
-	/* Log session clear command instead of every session */
-	if (count) {
-		char desc[60];
-		snprintf(desc, sizeof(desc), "policy %s", cp->cp_name);
-		cgn_log_sess_clear(desc, count, soft_ticks);
-	}
+	jsonw_end_array(json);
+}
 
-	if (restart_timer)
-		cgn_session_start_timer();
+static void
+cgn_session_clear_fltr(struct cgn_sess_fltr *fltr, bool clear_map,
+		       bool restart_timer)
+{
+	struct cgn_sess_walk *sw;
+
+	sw = cgn_session_walk_create(CGN_SESS_WALK_FLTR, clear_map);
+	if (!sw)
+		return;
+
+	sw->sw_fltr = *fltr;
+	sw->sw_fltr.cf_pool_name = NULL;
+	if (sw->sw_fltr.cf_np)
+		sw->sw_np = nat_pool_get(sw->sw_fltr.cf_np);
+	snprintf(sw->sw_desc, sizeof(sw->sw_desc), "%s", fltr->cf_desc);
+
+	cgn_session_walk_start(sw, restart_timer);
+}
+
+static void
+cgn_session_expire_all(bool clear_map, bool restart_timer)
+{
+	struct cgn_sess_walk *sw;
+
+	sw = cgn_session_walk_create(CGN_SESS_WALK_ALL, clear_map);
+	if (!sw)
+		return;
+
+	snprintf(sw->sw_desc, sizeof(sw->sw_desc), "all");
+
+	cgn_session_walk_start(sw, restart_timer);
+}
+
+/*
+ * Expire all sessions that use public addresses from the given nat pool.
+ *
+ * If clear_mapping is true, then also release mapping used by any sessions
+ * that are expired.
+ */
+void cgn_session_expire_pool(bool restart_timer, struct nat_pool *np,
+			     bool clear_mapping)
+{
+	struct cgn_sess_walk *sw;
+
+	sw = cgn_session_walk_create(CGN_SESS_WALK_POOL, clear_mapping);
+	if (!sw)
+		return;
+
+	sw->sw_np = nat_pool_get(np);
+	snprintf(sw->sw_desc, sizeof(sw->sw_desc), "pool %s",
+		 nat_pool_name(np));
+
+	cgn_session_walk_start(sw, restart_timer);
+}
+
+/*
+ * Expire all sessions associated with a specific policy
+ */
+void cgn_session_expire_policy(bool restart_timer, struct cgn_policy *cp)
+{
+	struct cgn_sess_walk *sw;
+
+	sw = cgn_session_walk_create(CGN_SESS_WALK_POLICY, false);
+	if (!sw)
+		return;
+
+	sw->sw_cp = cgn_policy_get(cp);
+	snprintf(sw->sw_desc, sizeof(sw->sw_desc), "policy %s",
+		 cp->cp_name);
+
+	cgn_session_walk_start(sw, restart_timer);
 }
 
 /*
@@ -2846,6 +3348,13 @@ static void cgn_session_gc(struct rte_timer *timer, void *arg __rte_unused)
 	if (!cgn_sess_ht[CGN_DIR_FORW])
 		return;
 
+	/*
+	 * A clear walk is in progress.  The timer is restarted when the walk
+	 * completes.
+	 */
+	if (cgn_session_walk_active())
+		return;
+
 	/* Walk the forwards-flow session table */
 	cds_lfht_for_each_entry(cgn_sess_ht[CGN_DIR_FORW], &iter, ce, ce_node) {
 
@@ -3022,7 +3531,9 @@ void cgn_session_cleanup(void)
 	uint i;
 
 	/* Stop timer, and expire all entries. Do not restart gc timer */
+	cgn_session_walk_flush();
 	cgn_session_expire_all(false, false);
+	cgn_session_walk_flush();
 
 	for (i = 0; i < CGN_SESS_GC_COUNT + 2; i++)
 		/* Do not restart gc timer */
@@ -3074,19 +3585,10 @@ void cgn_session_init(void)
 	if (cgn_sess_ht[CGN_DIR_FORW])
 		return;
 
-	cgn_sess_ht[CGN_DIR_FORW] =
-		cds_lfht_new(CGN_SESSION_HT_INIT, CGN_SESSION_HT_MIN,
-			     CGN_SESSION_HT_MAX,
-			     CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING,
-			     NULL);
-
-	cgn_sess_ht[CGN_DIR_BACK] =
-		cds_lfht_new(CGN_SESSION_HT_INIT, CGN_SESSION_HT_MIN,
-			     CGN_SESSION_HT_MAX,
-			     CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING,
-			     NULL);
+	cgn_session_ht_create();
 
 	rte_timer_init(&cgn_gc_timer);
+	rte_timer_init(&cgn_sess_walk_timer);
 	start_timer(&cgn_gc_timer);
 }
 
@@ -3104,12 +3606,13 @@ void cgn_session_uninit(void)
 	assert(cgn_session_table_nodes(cgn_sess_ht[CGN_DIR_FORW]) == 0);
 	assert(cgn_session_table_nodes(cgn_sess_ht[CGN_DIR_BACK]) == 0);
 
-	/* Destroy the session hash tables */
-	dp_ht_destroy_deferred(cgn_sess_ht[CGN_DIR_FORW]);
-	cgn_sess_ht[CGN_DIR_FORW] = NULL;
+	/* Destroy the mapping index and session hash tables */
+	cgn_eim_uninit();
+	cgn_session_ht_destroy(cgn_sess_ht);
+	cgn_sess_ht_buckets = 0;
 
-	dp_ht_destroy_deferred(cgn_sess_ht[CGN_DIR_BACK]);
-	cgn_sess_ht[CGN_DIR_BACK] = NULL;
+	cgn_mempools_destroy(&cgn_sess_pools);
+	cgn_sess2_mempools_destroy();
 }
 
 /* Used by unit-tests only */
@@ -7,6 +7,7 @@
 #ifndef _CGN_SESSION_H_
 #define _CGN_SESSION_H_
 
+#include "json_writer.h"
 #include "util.h"
 
 struct cgn_3tuple_key;
@@ -88,6 +89,14 @@ struct cgn_session *cgn_session_get(struct cgn_session *cse);
 void cgn_session_put(struct cgn_session *cse);
 
 void cgn_session_set_max(int32_t val);
+int cgn_session_set_expected(uint32_t count);
+uint32_t cgn_session_get_expected(void);
+int cgn_session_eim_set_size(uint32_t nentries);
+void cgn_session_jsonw_mem(json_writer_t *json);
+void cgn_session_jsonw_walk(json_writer_t *json);
+void cgn_session_walk_batch_ut(uint32_t batch);
+void cgn_session_walk_slice_ut(void);
+void cgn_session_walk_remove_ut(void);
 
 /* Threshold */
 void session_table_threshold_set(int32_t threshold, uint32_t interval);
@@ -12,6 +12,7 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <linux/if.h>
 #include <dpdk/rte_jhash.h>
@@ -1351,17 +1352,72 @@ unlock:
 	rte_spinlock_unlock(&src->sr_lock);
 }
 
-static void cgn_source_gc(struct rte_timer *timer, void *arg __unused)
+/*
+ * gc walk state.  The source table is walked CGN_WALK_BATCH entries at a
+ * time.  An iterator is not kept between slices, as the table may be
+ * resized in the meantime.  Each slice resumes after the last entry kept by
+ * the previous slice, found by looking it up again.  The hash table is
+ * split-ordered, so the walk order is not changed by a resize.  If the
+ * cursor entry has since been removed then the pass ends early, and the
+ * remaining entries are inspected on the next pass.
+ */
+static struct cds_lfht_node *cgn_src_gc_cursor;
+static ulong cgn_src_gc_cursor_hash;
+static bool cgn_src_gc_in_progress;
+static uint64_t cgn_src_gc_visited;
+static uint64_t cgn_src_gc_passes;
+
+/* Match the gc cursor node itself, whatever its state */
+static int cgn_source_match_node(struct cds_lfht_node *node, const void *key)
+{
+	return node == key;
+}
+
+/*
+ * Visit up to 'budget' source table entries.  Returns true when a full pass
+ * of the table is complete.
+ */
+static bool cgn_source_gc_walk(uint budget)
 {
 	struct cds_lfht_iter iter;
+	struct cds_lfht_node *node;
 	struct cgn_source *src;
 
-	if (!cgn_src_ht)
-		return;
+	if (!cgn_src_gc_in_progress) {
+		cgn_src_gc_in_progress = true;
+		cgn_src_gc_visited = 0;
+		cgn_src_gc_cursor = NULL;
+	}
+
+	if (cgn_src_gc_cursor) {
+		cds_lfht_lookup(cgn_src_ht, cgn_src_gc_cursor_hash,
+				cgn_source_match_node, cgn_src_gc_cursor,
+				&iter);
+		if (cds_lfht_iter_get_node(&iter))
+			cds_lfht_next(cgn_src_ht, &iter);
+	} else
+		cds_lfht_first(cgn_src_ht, &iter);
+
+	while ((node = cds_lfht_iter_get_node(&iter)) != NULL) {
+		if (budget-- == 0)
+			return false;
+
+		/* Move on before the entry is possibly destroyed */
+		src = caa_container_of(node, struct cgn_source, sr_node);
+		cds_lfht_next(cgn_src_ht, &iter);
 
-	/* Walk the source table */
-	cds_lfht_for_each_entry(cgn_src_ht, &iter, src, sr_node)
 		cgn_source_gc_inspect(src);
+		cgn_src_gc_visited++;
+
+		if (!(src->sr_flags & SF_DEAD)) {
+			cgn_src_gc_cursor = &src->sr_node;
+			cgn_src_gc_cursor_hash =
+				cgn_source_hash(src->sr_addr, src->sr_vrfid);
+		}
+	}
+
+	cgn_src_gc_in_progress = false;
+	cgn_src_gc_passes++;
 
 	/* Is table still full? */
 	if (cgn_src_table_full &&
@@ -1374,14 +1430,47 @@ static void cgn_source_gc(struct rte_timer *timer, void *arg __unused)
 		cgn_src_table_full = false;
 	}
 
+	return true;
+}
+
+static void cgn_source_gc(struct rte_timer *timer, void *arg __unused)
+{
+	uint64_t ticks = CGN_SRC_GC_INTERVAL * rte_get_timer_hz();
+	uint budget = timer ? cgn_walk_batch : UINT_MAX;
+
+	if (!cgn_src_ht)
+		return;
+
+	/* Continue the pass on the next slice if it did not complete */
+	if (!cgn_source_gc_walk(budget))
+		ticks = CGN_WALK_SLICE_MS * rte_get_timer_hz() / 1000;
+
 	/* Restart timer if the dataplane is still running */
 	if (running && timer)
-		rte_timer_reset(timer,
-				CGN_SRC_GC_INTERVAL * rte_get_timer_hz(),
+		rte_timer_reset(timer, ticks,
 				SINGLE, rte_get_master_lcore(), cgn_source_gc,
 				NULL);
 }
 
+/*
+ * Complete a pass that is part way through
+ */
+static void cgn_source_gc_flush(void)
+{
+	if (cgn_src_gc_in_progress)
+		cgn_source_gc_walk(UINT_MAX);
+}
+
+void cgn_source_jsonw_gc(json_writer_t *json)
+{
+	jsonw_name(json, "subs_gc");
+	jsonw_start_object(json);
+	jsonw_bool_field(json, "in_progress", cgn_src_gc_in_progress);
+	jsonw_uint_field(json, "visited", cgn_src_gc_visited);
+	jsonw_uint_field(json, "passes", cgn_src_gc_passes);
+	jsonw_end_object(json);
+}
+
 /*
  * Called from unit-test and from cgn_source_uninit.
  */
@@ -1390,19 +1479,36 @@ void cgn_source_cleanup(void)
 	uint i;
 
 	rte_timer_stop(&cgn_src_timer);
+	cgn_source_gc_flush();
 
 	for (i = 0; i <= CGN_SRC_GC_COUNT; i++)
 		/* Do not restart gc timer */
 		cgn_source_gc(NULL, NULL);
 }
 
+/*
+ * Called via hidden vplsh command.  Run one slice of a gc pass.
+ */
+void cgn_source_gc_slice(void)
+{
+	if (cgn_src_ht)
+		cgn_source_gc_walk(cgn_walk_batch);
+}
+
 /*
  * Called via hidden vplsh command.  Used by unit-test and by dev testers.
  */
 void cgn_source_gc_pass(void)
 {
 	rte_timer_stop(&cgn_src_timer);
-	cgn_source_gc(&cgn_src_timer, NULL);
+	cgn_source_gc_flush();
+	cgn_source_gc_walk(UINT_MAX);
+
+	if (running)
+		rte_timer_reset(&cgn_src_timer,
+				CGN_SRC_GC_INTERVAL * rte_get_timer_hz(),
+				SINGLE, rte_get_master_lcore(), cgn_source_gc,
+				NULL);
 }
 
 /*
@@ -174,6 +174,8 @@ void cgn_source_list(FILE *f, int argc, char **argv);
 /* Unit-test only */
 void cgn_source_cleanup(void);
 void cgn_source_gc_pass(void);
+void cgn_source_gc_slice(void);
+void cgn_source_jsonw_gc(json_writer_t *json);
 
 void cgn_source_init(void);
 void cgn_source_uninit(void);
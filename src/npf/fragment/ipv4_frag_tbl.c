@@ -41,6 +41,8 @@
  */
 
 #include <linux/snmp.h>
+#include <rte_atomic.h>
+#include <rte_branch_prediction.h>
 #include <rte_common.h>
 #include <rte_cycles.h>
 #include <rte_jhash.h>
@@ -51,8 +53,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "compiler.h"
 #include "ipv4_frag_tbl.h"
 #include "ipv4_rsmbl.h"
+#include "json_writer.h"
 #include "snmp_mib.h"
 #include "util.h"
 #include "vplane_log.h"
@@ -63,6 +67,17 @@ struct cds_lfht;
 static struct rte_timer ipv4_timer;
 static uint32_t hash_seed;
 
+/* All sets in creation order, and their count */
+static CDS_LIST_HEAD(ipv4_frag_lru);
+static unsigned int ipv4_frag_sets;
+static rte_spinlock_t ipv4_frag_lru_lock = RTE_SPINLOCK_INITIALIZER;
+
+/* Fragments held across all sets, and the limit */
+static rte_atomic32_t ipv4_frag_held;
+static unsigned int ipv4_frag_held_max = IPV4_MAX_FRAGS_HELD;
+
+struct frag_drop_stats ipv4_frag_drops[RTE_MAX_LCORE];
+
 /* free a pkt */
 static void ipv4_frag_free_pkt(struct rcu_head *head)
 {
@@ -91,36 +106,134 @@ static void ipv4_frag_timeout_stats(struct ipv4_frag_pkt *pkt)
 	}
 }
 
-/* Delete a frag packet struct from the hash table */
-void ipv4_frag_free(struct cds_lfht *frag_table, struct ipv4_frag_pkt *pkt)
+/*
+ * Remove a frag packet struct from the hash table and the list.  The
+ * caller holds both the pkt lock and the list lock.  Fragments still held
+ * stop counting against the limit now, and are freed with the pkt after
+ * a grace period.
+ */
+static void ipv4_frag_unlink(struct ipv4_frag_pkt *pkt)
 {
-	if (!cds_lfht_del(frag_table, &pkt->pkt_node))
+	pkt->pkt_dead = true;
+	rte_atomic32_sub(&ipv4_frag_held, pkt->pkt_held);
+	pkt->pkt_held = 0;
+
+	cds_list_del(&pkt->pkt_lru);
+	ipv4_frag_sets--;
+
+	if (!cds_lfht_del(pkt->pkt_table, &pkt->pkt_node))
 		call_rcu(&pkt->pkt_rcu_head, ipv4_frag_free_pkt);
 }
 
+/* Delete a frag packet struct from the hash table, pkt lock held */
+void ipv4_frag_free(struct cds_lfht *frag_table __unused,
+		    struct ipv4_frag_pkt *pkt)
+{
+	if (pkt->pkt_dead)
+		return;
+
+	rte_spinlock_lock(&ipv4_frag_lru_lock);
+	ipv4_frag_unlink(pkt);
+	rte_spinlock_unlock(&ipv4_frag_lru_lock);
+}
+
+/*
+ * Free the oldest set, other than the one the caller may have locked.
+ * Sets locked by other cores are skipped rather than waited for, as the
+ * lock order here is the reverse of ipv4_frag_free().
+ */
+static bool ipv4_frag_evict(struct ipv4_frag_pkt *self)
+{
+	struct ipv4_frag_pkt *pkt;
+	bool evicted = false;
+
+	rte_spinlock_lock(&ipv4_frag_lru_lock);
+	cds_list_for_each_entry(pkt, &ipv4_frag_lru, pkt_lru) {
+		if (pkt == self || !rte_spinlock_trylock(&pkt->pkt_lock))
+			continue;
+
+		IPV4_FRAG_DROP_ADD(FRAG_DROP_EVICTED, pkt->pkt_held);
+		ipv4_frag_unlink(pkt);
+		rte_spinlock_unlock(&pkt->pkt_lock);
+		evicted = true;
+		break;
+	}
+	rte_spinlock_unlock(&ipv4_frag_lru_lock);
+
+	if (evicted)
+		IPSTAT_INC(VRF_DEFAULT_ID, IPSTATS_MIB_REASMFAILS);
+	return evicted;
+}
+
+/*
+ * Account for a fragment about to be stored in a set, pkt lock held.
+ * Makes room by evicting the oldest set if at the limit, and fails if
+ * there is none to evict.
+ */
+bool ipv4_frag_hold(struct ipv4_frag_pkt *pkt)
+{
+	if (unlikely((unsigned int)rte_atomic32_read(&ipv4_frag_held) >=
+		     ipv4_frag_held_max) && !ipv4_frag_evict(pkt))
+		return false;
+
+	rte_atomic32_inc(&ipv4_frag_held);
+	pkt->pkt_held++;
+	return true;
+}
+
+/*
+ * Clean out frag pkts expired by the given time.  They are in expiry
+ * order, so stop at the first one that has not expired.  One that is
+ * locked is being worked on, so leave it until next time.
+ */
+static void ipv4_frag_expire(uint64_t current)
+{
+	struct ipv4_frag_pkt *pkt, *next;
+
+	rte_spinlock_lock(&ipv4_frag_lru_lock);
+	cds_list_for_each_entry_safe(pkt, next, &ipv4_frag_lru, pkt_lru) {
+		if (pkt->pkt_expire >= current)
+			break;
+		if (!rte_spinlock_trylock(&pkt->pkt_lock))
+			continue;
+
+		ipv4_frag_timeout_stats(pkt);
+		IPV4_FRAG_DROP_ADD(FRAG_DROP_TIMEOUT, pkt->pkt_held);
+		ipv4_frag_unlink(pkt);
+		rte_spinlock_unlock(&pkt->pkt_lock);
+	}
+	rte_spinlock_unlock(&ipv4_frag_lru_lock);
+}
+
 /*
- * Clean out expired frag pkts
- *
  * NB ipv4_gc() is a callback function for rte_timer_reset(),
  *    so we use __rte_unused rather than __unused.
  */
 static void ipv4_gc(struct rte_timer *t __rte_unused, void *arg __rte_unused)
 {
-	struct cds_lfht_iter iter;
-	struct ipv4_frag_pkt *pkt;
-	uint64_t current = rte_get_timer_cycles();
-	vrfid_t vrfid;
-	struct vrf *vrf;
-
-	VRF_FOREACH(vrf, vrfid) {
-		cds_lfht_for_each_entry(vrf->v_ipv4_frag_table, &iter, pkt,
-					pkt_node) {
-			if (pkt->pkt_expire < current) {
-				ipv4_frag_timeout_stats(pkt);
-				ipv4_frag_free(vrf->v_ipv4_frag_table, pkt);
-			}
-		}
-	}
+	ipv4_frag_expire(rte_get_timer_cycles());
+}
+
+/* Test hooks */
+void ipv4_frag_held_max_ut(unsigned int max)
+{
+	ipv4_frag_held_max = max ? : IPV4_MAX_FRAGS_HELD;
+}
+
+void ipv4_frag_expire_ut(void)
+{
+	ipv4_frag_expire(rte_get_timer_cycles() +
+			 rte_get_timer_hz() * (IPV4_FRAG_SET_TTL + 1));
+}
+
+unsigned int ipv4_frag_sets_ut(void)
+{
+	return CMM_LOAD_SHARED(ipv4_frag_sets);
+}
+
+unsigned int ipv4_frag_held_ut(void)
+{
+	return rte_atomic32_read(&ipv4_frag_held);
 }
 
 /* Clear the rte_mbufs from a pkt */
@@ -160,28 +273,17 @@ static int ipv4_match(struct cds_lfht_node *node, const void *data)
 	return rc;
 }
 
-/* Count nodes */
-static unsigned long ipv4_frag_count(struct cds_lfht *frag_table)
-{
-	unsigned long count;
-	long dummy;
-
-	cds_lfht_count_nodes(frag_table, &dummy, &count, &dummy);
-	return count;
-}
-
-/* Add a new pkt if max not reached */
+/* Add a new pkt, evicting the oldest if max reached */
 static struct ipv4_frag_pkt *
 ipv4_frag_create(struct cds_lfht *frag_table, unsigned long hash,
 		 const struct ipv4_frag_key *key)
 {
 	struct ipv4_frag_pkt *pkt;
 	struct cds_lfht_node *node;
-	unsigned long count;
 
 	/* Max packets reached? */
-	count = ipv4_frag_count(frag_table);
-	if (count >= IPV4_MAX_FRAG_SETS)
+	if (CMM_LOAD_SHARED(ipv4_frag_sets) >= IPV4_MAX_FRAG_SETS &&
+	    !ipv4_frag_evict(NULL))
 		return NULL;
 
 	pkt = calloc(1, sizeof(struct ipv4_frag_pkt));
@@ -192,16 +294,25 @@ ipv4_frag_create(struct cds_lfht *frag_table, unsigned long hash,
 	pkt->pkt_key.src_dst = key->src_dst;
 	pkt->pkt_key.id = key->id;
 	pkt->last_idx = FIRST_INTERMEDIATE_FRAG_IDX;
+	pkt->pkt_table = frag_table;
 	cds_lfht_node_init(&pkt->pkt_node);
-	pkt->pkt_expire = rte_get_timer_cycles() +
-		(rte_get_timer_hz() * IPV4_FRAG_SET_TTL);
 
 	/*
 	 * Now try to add the new pkt, if somebody beat us to it,
-	 * use that one.
+	 * use that one.  Hold the list lock across this so that the
+	 * pkt is on the list before anyone can find it to free it.
 	 */
+	rte_spinlock_lock(&ipv4_frag_lru_lock);
 	node = cds_lfht_add_unique(frag_table, hash, ipv4_match,
 				key, &pkt->pkt_node);
+	if (node == &pkt->pkt_node) {
+		pkt->pkt_expire = rte_get_timer_cycles() +
+			(rte_get_timer_hz() * IPV4_FRAG_SET_TTL);
+		cds_list_add_tail(&pkt->pkt_lru, &ipv4_frag_lru);
+		ipv4_frag_sets++;
+	}
+	rte_spinlock_unlock(&ipv4_frag_lru_lock);
+
 	if (node != &pkt->pkt_node) {
 		free(pkt);
 		pkt = caa_container_of(node, struct ipv4_frag_pkt, pkt_node);
@@ -257,7 +368,9 @@ ipv4_fragment_table_uninit(struct vrf *vrf)
 
 	cds_lfht_for_each_entry(vrf->v_ipv4_frag_table, &iter, pkt,
 				pkt_node) {
+		rte_spinlock_lock(&pkt->pkt_lock);
 		ipv4_frag_free(vrf->v_ipv4_frag_table, pkt);
+		rte_spinlock_unlock(&pkt->pkt_lock);
 	}
 
 	dp_ht_destroy_deferred(vrf->v_ipv4_frag_table);
@@ -313,6 +426,45 @@ void fragment_tables_uninit(struct vrf *vrf)
 	ipv6_fragment_table_uninit(vrf);
 }
 
+static const char * const frag_drop_names[FRAG_DROP_MAX] = {
+	[FRAG_DROP_DUPLICATE]	= "duplicate",
+	[FRAG_DROP_OVERLAP]	= "overlap",
+	[FRAG_DROP_TOO_MANY]	= "too_many",
+	[FRAG_DROP_NO_SET]	= "no_set",
+	[FRAG_DROP_OVER_BUDGET]	= "over_budget",
+	[FRAG_DROP_EVICTED]	= "evicted",
+	[FRAG_DROP_TIMEOUT]	= "timeout",
+	[FRAG_DROP_REASM]	= "reassembly_failed",
+	[FRAG_DROP_STALE]	= "stale",
+};
+
+static void fragment_drops_show(json_writer_t *wr, const char *name,
+				struct frag_drop_stats *stats)
+{
+	uint64_t sum[FRAG_DROP_MAX] = { 0 };
+	unsigned int lcore, i;
+
+	FOREACH_DP_LCORE(lcore)
+		for (i = 0; i < FRAG_DROP_MAX; i++)
+			sum[i] += stats[lcore].drops[i];
+
+	jsonw_name(wr, name);
+	jsonw_start_object(wr);
+	for (i = 0; i < FRAG_DROP_MAX; i++)
+		jsonw_uint_field(wr, frag_drop_names[i], sum[i]);
+	jsonw_end_object(wr);
+}
+
+/* Fragment drop counts, by reason, for netstat */
+void fragment_stats_show(json_writer_t *wr)
+{
+	jsonw_name(wr, "frag_drops");
+	jsonw_start_object(wr);
+	fragment_drops_show(wr, "ip", ipv4_frag_drops);
+	fragment_drops_show(wr, "ip6", ipv6_frag_drops);
+	jsonw_end_object(wr);
+}
+
 static void
 ipv4_fragment_tables_timer_init(void)
 	{
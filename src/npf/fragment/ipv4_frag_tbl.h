@@ -46,8 +46,10 @@
 
 #include <rte_memory.h>
 #include <rte_spinlock.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <urcu.h>
+#include <urcu/list.h>
 
 #include "urcu.h"
 #include "vrf_internal.h"
@@ -67,14 +69,17 @@ struct vrf;
 #define IPV4_FRAG_HT_MIN	64
 #define IPV4_FRAG_HT_MAX	512
 
-/* Max number of fragment sets we support */
+/* Max number of fragment sets we support, across all vrfs */
 #define IPV4_MAX_FRAG_SETS	1024
 
 /* Max number of fragments per fragment set */
 #define IPV4_MAX_FRAGS_PER_SET	44
 
-/* GC periodic hash table cleanup interval (seconds) */
-#define IPV4_FRAG_INTERVAL	10
+/* Max number of fragments held across all sets */
+#define IPV4_MAX_FRAGS_HELD	8192
+
+/* GC periodic expiry interval (seconds) */
+#define IPV4_FRAG_INTERVAL	1
 
 /* Timeout period for incomplete fragment sets */
 #define IPV4_FRAG_SET_TTL       15
@@ -96,16 +101,24 @@ struct ipv4_frag_key {
 /*
  * Fragmented packet to reassemble.
  * First two entries in the frags[] array are for the last and first fragments.
+ *
+ * All sets are also on a list in creation order.  As they all have the
+ * same lifetime this is also expiry order, so the GC only looks at the
+ * head of the list, and the head is the set to evict when short of room.
  */
 struct ipv4_frag_pkt {
 	struct rcu_head		pkt_rcu_head;	/* for call_rcu */
 	struct cds_lfht_node	pkt_node;	/* For hash table */
+	struct cds_list_head	pkt_lru;	/* creation order list */
+	struct cds_lfht		*pkt_table;	/* table we are in */
 	rte_spinlock_t		pkt_lock;	/* lock for this pkt */
+	bool			pkt_dead;	/* removed from table */
 	struct ipv4_frag_key	pkt_key;	/* src_dst/id key */
 	uint64_t		pkt_expire;	/* expiration timestamp */
 	uint32_t		total_size;	/* expected reassembled size */
 	uint32_t		frag_size;	/* size of fragments received */
 	uint32_t		last_idx;	/* next entry to fill */
+	uint32_t		pkt_held;	/* fragments held */
 	struct ipv4_frag	frags[IPV4_MAX_FRAGS_PER_SET];
 } __rte_cache_aligned;
 
@@ -113,7 +126,18 @@ struct ipv4_frag_pkt {
 void ipv4_frag_tbl_create(void);
 void ipv4_frag_free(struct cds_lfht *frag_table, struct ipv4_frag_pkt *);
 void ipv4_frag_clear(struct ipv4_frag_pkt *);
+bool ipv4_frag_hold(struct ipv4_frag_pkt *);
 struct ipv4_frag_pkt *ipv4_frag_find(struct vrf *vrf,
 				     const struct ipv4_frag_key *);
 
+/*
+ * Test hooks.  Set the held fragment limit (0 for the default), expire
+ * all sets as the GC would once their TTL has passed, and get the number
+ * of sets and fragments held.
+ */
+void ipv4_frag_held_max_ut(unsigned int max);
+void ipv4_frag_expire_ut(void);
+unsigned int ipv4_frag_sets_ut(void);
+unsigned int ipv4_frag_held_ut(void);
+
 #endif /* IPV4_FRAG_TBL_H */
@@ -50,6 +50,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "compiler.h"
 #include "in_cksum.h"
 #include "ip_funcs.h"
 #include "ipv4_frag_tbl.h"
@@ -186,11 +187,20 @@ ipv4_frag_process(struct cds_lfht *frag_tables, struct ipv4_frag_pkt *fp,
 	/* Lock the frag pkt */
 	rte_spinlock_lock(&fp->pkt_lock);
 
+	/* completed, expired or evicted since we found it */
+	if (unlikely(fp->pkt_dead)) {
+		IPV4_FRAG_DROP_ADD(FRAG_DROP_STALE, 1);
+		rte_pktmbuf_free(mb);
+		mb = NULL;
+		goto done;
+	}
+
 	if (ofs == 0) {
 		/* is this a repeat of the first fragment? */
 		if (fp->frags[FIRST_FRAG_IDX].mb == NULL) {
 			idx = FIRST_FRAG_IDX;
 		} else {
+			IPV4_FRAG_DROP_ADD(FRAG_DROP_DUPLICATE, 1);
 			rte_pktmbuf_free(mb);
 			mb = NULL;
 			goto done;
@@ -209,6 +219,7 @@ ipv4_frag_process(struct cds_lfht *frag_tables, struct ipv4_frag_pkt *fp,
 		 */
 		for (i = 0; i < fp->last_idx; i++) {
 			if (fp->frags[i].ofs == ofs) {
+				IPV4_FRAG_DROP_ADD(FRAG_DROP_DUPLICATE, 1);
 				rte_pktmbuf_free(mb);
 				mb = NULL;
 				goto done;
@@ -220,6 +231,7 @@ ipv4_frag_process(struct cds_lfht *frag_tables, struct ipv4_frag_pkt *fp,
 				 * We already have a fragment that includes
 				 * the start byte of this one.
 				 */
+				IPV4_FRAG_DROP_ADD(FRAG_DROP_OVERLAP, 1);
 				rte_pktmbuf_free(mb);
 				mb = NULL;
 				goto done;
@@ -232,6 +244,7 @@ ipv4_frag_process(struct cds_lfht *frag_tables, struct ipv4_frag_pkt *fp,
 				 * We already have a fragment that includes
 				 * the end byte of this one.
 				 */
+				IPV4_FRAG_DROP_ADD(FRAG_DROP_OVERLAP, 1);
 				rte_pktmbuf_free(mb);
 				mb = NULL;
 				goto done;
@@ -244,6 +257,8 @@ ipv4_frag_process(struct cds_lfht *frag_tables, struct ipv4_frag_pkt *fp,
 
 	/* errorneous packet: exceeded max allowed number of fragments */
 	if (idx >= ARRAY_SIZE(fp->frags)) {
+		IPV4_FRAG_DROP_ADD(idx == UINT32_MAX ? FRAG_DROP_DUPLICATE :
+				   FRAG_DROP_TOO_MANY, fp->pkt_held + 1);
 		ipv4_frag_free(frag_tables, fp);
 		IPSTAT_INC(vrf_id, IPSTATS_MIB_REASMFAILS);
 		rte_pktmbuf_free(mb);	/* drop bad packet as well */
@@ -256,6 +271,14 @@ ipv4_frag_process(struct cds_lfht *frag_tables, struct ipv4_frag_pkt *fp,
 		goto done;
 	}
 
+	if (unlikely(!ipv4_frag_hold(fp))) {
+		IPV4_FRAG_DROP_ADD(FRAG_DROP_OVER_BUDGET, 1);
+		IPSTAT_INC(vrf_id, IPSTATS_MIB_REASMFAILS);
+		rte_pktmbuf_free(mb);
+		mb = NULL;
+		goto done;
+	}
+
 	IPSTAT_INC(vrf_id, IPSTATS_MIB_REASMREQDS);
 
 	/* Remove session if we enqueue or reassemble */
@@ -281,6 +304,7 @@ ipv4_frag_process(struct cds_lfht *frag_tables, struct ipv4_frag_pkt *fp,
 		mb = ipv4_frag_reassemble(fp);
 		if (!mb) {
 			IPSTAT_INC(vrf_id, IPSTATS_MIB_REASMFAILS);
+			IPV4_FRAG_DROP_ADD(FRAG_DROP_REASM, fp->pkt_held);
 			ipv4_frag_free(frag_tables, fp);
 		} else {
 			/*
@@ -303,7 +327,8 @@ done:
 /*
  * Process new mbuf with fragment of IPV4 packet.
  */
-static struct rte_mbuf *ipv4_frag_mbuf(struct rte_mbuf *mb)
+static ALWAYS_INLINE struct rte_mbuf *
+ipv4_frag_mbuf(struct rte_mbuf *mb, bool stale_ut)
 {
 	struct ipv4_frag_pkt *fp;
 	struct ipv4_frag_key key;
@@ -337,11 +362,19 @@ static struct rte_mbuf *ipv4_frag_mbuf(struct rte_mbuf *mb)
 	/* try to find/add entry into the fragment's table. */
 	fp = ipv4_frag_find(vrf, &key);
 	if (fp == NULL) {
+		IPV4_FRAG_DROP_ADD(FRAG_DROP_NO_SET, 1);
 		IPSTAT_INC(pktmbuf_get_vrf(mb), IPSTATS_MIB_REASMFAILS);
 		rte_pktmbuf_free(mb);
 		return NULL;
 	}
 
+	/* Test hook: another core frees the set before we lock it */
+	if (unlikely(stale_ut)) {
+		rte_spinlock_lock(&fp->pkt_lock);
+		ipv4_frag_free(vrf->v_ipv4_frag_table, fp);
+		rte_spinlock_unlock(&fp->pkt_lock);
+	}
+
 	/* process the fragmented packet. */
 	mb = ipv4_frag_process(vrf->v_ipv4_frag_table,
 			       fp, mb, ip_ofs, ip_len, ip_flag);
@@ -365,9 +398,29 @@ struct rte_mbuf *ipv4_handle_fragment(struct rte_mbuf *m)
 	m->l2_len = RTE_ETHER_HDR_LEN;
 	m->l3_len = hlen;
 
-	mo = ipv4_frag_mbuf(m);
+	mo = ipv4_frag_mbuf(m, false);
 	if (mo)
 		pktmbuf_mdata_set(mo, PKT_MDATA_DEFRAG);
 
 	return mo;
 }
+
+/*
+ * Test hook: handle a fragment as if the set it belongs to were freed by
+ * another core between finding and locking it.
+ */
+struct rte_mbuf *ipv4_handle_fragment_stale_ut(struct rte_mbuf *m)
+{
+	struct rte_mbuf *mo;
+	struct iphdr *ip;
+
+	ip = iphdr(m);
+	m->l2_len = RTE_ETHER_HDR_LEN;
+	m->l3_len = ip->ihl << 2;
+
+	rcu_read_lock();
+	mo = ipv4_frag_mbuf(m, true);
+	rcu_read_unlock();
+
+	return mo;
+}
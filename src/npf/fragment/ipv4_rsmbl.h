@@ -9,9 +9,16 @@
 #ifndef IPV4_RSMBL_H
 #define IPV4_RSMBL_H
 
+#include <rte_lcore.h>
+#include <rte_memory.h>
+#include <stdint.h>
+
+#include "util.h"
 #include "vrf_internal.h"
 
+struct rte_mbuf;
 struct vrf;
+typedef struct json_writer json_writer_t;
 
 /*
  * Index into the fragment set table.  We store the last and first
@@ -24,6 +31,40 @@ enum {
 	FIRST_INTERMEDIATE_FRAG_IDX,
 };
 
+/*
+ * Reasons for dropping fragments.  Each counts the fragments dropped,
+ * including those already held in a set that is given up on.
+ */
+enum frag_drop {
+	FRAG_DROP_DUPLICATE,	/* already have this fragment */
+	FRAG_DROP_OVERLAP,	/* overlaps a fragment we have */
+	FRAG_DROP_TOO_MANY,	/* set has too many fragments */
+	FRAG_DROP_NO_SET,	/* could not create a set */
+	FRAG_DROP_OVER_BUDGET,	/* held fragment limit reached */
+	FRAG_DROP_EVICTED,	/* set evicted to make room */
+	FRAG_DROP_TIMEOUT,	/* set expired before completion */
+	FRAG_DROP_REASM,	/* reassembly failed, e.g. a hole */
+	FRAG_DROP_STALE,	/* set was completed or freed meanwhile */
+	FRAG_DROP_MAX
+};
+
+struct frag_drop_stats {
+	uint64_t drops[FRAG_DROP_MAX];
+} __rte_cache_aligned;
+
+extern struct frag_drop_stats ipv4_frag_drops[RTE_MAX_LCORE];
+extern struct frag_drop_stats ipv6_frag_drops[RTE_MAX_LCORE];
+
+#define IPV4_FRAG_DROP_ADD(r, n) \
+	(ipv4_frag_drops[dp_lcore_id()].drops[(r)] += (n))
+#define IPV6_FRAG_DROP_ADD(r, n) \
+	(ipv6_frag_drops[dp_lcore_id()].drops[(r)] += (n))
+
+void fragment_stats_show(json_writer_t *wr);
+
+/* Test hook, see ipv6_handle_fragment_stale_ut() for IPv6 */
+struct rte_mbuf *ipv4_handle_fragment_stale_ut(struct rte_mbuf *m);
+
 extern int ipv6_fragment_table_init(struct vrf *vrf);
 extern void ipv6_fragment_table_uninit(struct vrf *vrf);
 extern void ipv6_fragment_tables_timer_init(void);
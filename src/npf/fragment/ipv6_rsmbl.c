@@ -266,6 +266,14 @@ ipv6_frag_process(struct cds_lfht *frag_table, struct ipv6_frag_pkt *fp,
 	/* Lock the frag pkt */
 	rte_spinlock_lock(&fp->pkt_lock);
 
+	/* completed, expired or evicted since we found it */
+	if (unlikely(fp->pkt_dead)) {
+		IPV6_FRAG_DROP_ADD(FRAG_DROP_STALE, 1);
+		rte_pktmbuf_free(m);
+		m = NULL;
+		goto done;
+	}
+
 	if (npc->fh_offset == 0) {
 		/*
 		 * First fragment
@@ -273,6 +281,7 @@ ipv6_frag_process(struct cds_lfht *frag_table, struct ipv6_frag_pkt *fp,
 		if (fp->frags[FIRST_FRAG_IDX].mb == NULL) {
 			idx = FIRST_FRAG_IDX;
 		} else {
+			IPV6_FRAG_DROP_ADD(FRAG_DROP_DUPLICATE, 1);
 			rte_pktmbuf_free(m);
 			m = NULL;
 			goto done;
@@ -317,6 +326,7 @@ ipv6_frag_process(struct cds_lfht *frag_table, struct ipv6_frag_pkt *fp,
 		 */
 		for (i = 0; i < fp->last_idx; i++) {
 			if (fp->frags[i].ofs == npc->fh_offset) {
+				IPV6_FRAG_DROP_ADD(FRAG_DROP_DUPLICATE, 1);
 				rte_pktmbuf_free(m);
 				m = NULL;
 				goto done;
@@ -329,6 +339,7 @@ ipv6_frag_process(struct cds_lfht *frag_table, struct ipv6_frag_pkt *fp,
 				 * We already have a fragment that includes
 				 * the start byte of this one.
 				 */
+				IPV6_FRAG_DROP_ADD(FRAG_DROP_OVERLAP, 1);
 				rte_pktmbuf_free(m);
 				m = NULL;
 				goto done;
@@ -342,6 +353,7 @@ ipv6_frag_process(struct cds_lfht *frag_table, struct ipv6_frag_pkt *fp,
 				 * We already have a fragment that includes
 				 * the end byte of this one.
 				 */
+				IPV6_FRAG_DROP_ADD(FRAG_DROP_OVERLAP, 1);
 				rte_pktmbuf_free(m);
 				m = NULL;
 				goto done;
@@ -367,6 +379,9 @@ ipv6_frag_process(struct cds_lfht *frag_table, struct ipv6_frag_pkt *fp,
 	 */
 	if (idx >= ARRAY_SIZE(fp->frags) ||
 		fp->frags[idx].mb != NULL) {
+		IPV6_FRAG_DROP_ADD(idx < ARRAY_SIZE(fp->frags) ||
+				   idx == UINT32_MAX ? FRAG_DROP_DUPLICATE :
+				   FRAG_DROP_TOO_MANY, fp->pkt_held + 1);
 		ipv6_frag_free(frag_table, fp);
 		IP6STAT_INC(vrf_id, IPSTATS_MIB_REASMFAILS);
 		rte_pktmbuf_free(m);	/* drop bad packet as well */
@@ -379,6 +394,14 @@ ipv6_frag_process(struct cds_lfht *frag_table, struct ipv6_frag_pkt *fp,
 		goto done;
 	}
 
+	if (unlikely(!ipv6_frag_hold(fp))) {
+		IPV6_FRAG_DROP_ADD(FRAG_DROP_OVER_BUDGET, 1);
+		IP6STAT_INC(vrf_id, IPSTATS_MIB_REASMFAILS);
+		rte_pktmbuf_free(m);
+		m = NULL;
+		goto done;
+	}
+
 	fp->frags[idx].ofs = npc->fh_offset;
 	/* Payload bytes in this fragment */
 	fp->frags[idx].len = plen - extra_hlen;
@@ -402,6 +425,7 @@ ipv6_frag_process(struct cds_lfht *frag_table, struct ipv6_frag_pkt *fp,
 		m = ipv6_frag_reassemble(fp);
 		if (!m) {
 			IP6STAT_INC(vrf_id, IPSTATS_MIB_REASMFAILS);
+			IPV6_FRAG_DROP_ADD(FRAG_DROP_REASM, fp->pkt_held);
 			ipv6_frag_free(frag_table, fp);
 		} else {
 			/*
@@ -446,9 +470,9 @@ done:
 /*
  * Process new mbuf with fragment of IPv6 packet.
  */
-static struct rte_mbuf *
+static ALWAYS_INLINE struct rte_mbuf *
 ipv6_frag_mbuf(struct rte_mbuf *m, npf_cache_t *npc,
-	       uint16_t *gleaned_mtu)
+	       uint16_t *gleaned_mtu, bool stale_ut)
 {
 	struct ipv6_frag_pkt *fp;
 	struct ipv6_frag_key key;
@@ -478,11 +502,19 @@ ipv6_frag_mbuf(struct rte_mbuf *m, npf_cache_t *npc,
 	 */
 	fp = ipv6_frag_find_or_create(vrf, &key);
 	if (fp == NULL) {
+		IPV6_FRAG_DROP_ADD(FRAG_DROP_NO_SET, 1);
 		IP6STAT_INC_VRF(vrf, IPSTATS_MIB_REASMFAILS);
 		rte_pktmbuf_free(m);
 		return NULL;
 	}
 
+	/* Test hook: another core frees the set before we lock it */
+	if (unlikely(stale_ut)) {
+		rte_spinlock_lock(&fp->pkt_lock);
+		ipv6_frag_free(vrf->v_ipv6_frag_table, fp);
+		rte_spinlock_unlock(&fp->pkt_lock);
+	}
+
 	/* process the fragmented packet. */
 	m = ipv6_frag_process(vrf->v_ipv6_frag_table, fp, m, npc, gleaned_mtu);
 
@@ -520,7 +552,7 @@ ipv6_handle_fragment(struct rte_mbuf *m, uint16_t *npf_flag)
 	 * ipv6_frag_mbuf will return NULL if it holds onto a
 	 * fragment, or on error
 	 */
-	m = ipv6_frag_mbuf(m, npc, &gleaned_mtu);
+	m = ipv6_frag_mbuf(m, npc, &gleaned_mtu, false);
 	if (m) {
 		npc->gleaned_mtu = gleaned_mtu;
 
@@ -540,3 +572,22 @@ ipv6_handle_fragment(struct rte_mbuf *m, uint16_t *npf_flag)
 	}
 	return m;
 }
+
+/*
+ * Test hook: handle a fragment as if the set it belongs to were freed by
+ * another core between finding and locking it.
+ */
+struct rte_mbuf *
+ipv6_handle_fragment_stale_ut(struct rte_mbuf *m, uint16_t *npf_flag)
+{
+	uint16_t gleaned_mtu = RTE_ETHER_MTU;
+
+	if (!m || (*npf_flag & NPF_FLAG_CACHE_EMPTY) != 0)
+		return m;
+
+	rcu_read_lock();
+	m = ipv6_frag_mbuf(m, npf_cache(), &gleaned_mtu, true);
+	rcu_read_unlock();
+
+	return m;
+}
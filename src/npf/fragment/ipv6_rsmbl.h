@@ -23,5 +23,7 @@ struct rte_mbuf;
 #define IPV6_MAX_FRAGS_PER_SET  16
 
 struct rte_mbuf *ipv6_handle_fragment(struct rte_mbuf *, uint16_t *npf_flag);
+struct rte_mbuf *ipv6_handle_fragment_stale_ut(struct rte_mbuf *,
+					       uint16_t *npf_flag);
 
 #endif
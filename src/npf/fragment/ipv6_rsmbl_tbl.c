@@ -6,6 +6,8 @@
  * SPDX-License-Identifier: LGPL-2.1-only
  */
 
+#include <rte_atomic.h>
+#include <rte_branch_prediction.h>
 #include <rte_common.h>
 #include <rte_cycles.h>
 #include <rte_jhash.h>
@@ -31,6 +33,17 @@ struct cds_lfht;
 static struct rte_timer ipv6_timer;
 static uint32_t ipv6_hash_seed;
 
+/* All sets in creation order, and their count */
+static CDS_LIST_HEAD(ipv6_frag_lru);
+static unsigned int ipv6_frag_sets;
+static rte_spinlock_t ipv6_frag_lru_lock = RTE_SPINLOCK_INITIALIZER;
+
+/* Fragments held across all sets, and the limit */
+static rte_atomic32_t ipv6_frag_held;
+static unsigned int ipv6_frag_held_max = IPV6_MAX_FRAGS_HELD;
+
+struct frag_drop_stats ipv6_frag_drops[RTE_MAX_LCORE];
+
 static inline void
 ipv6_frag_key_copy(struct ipv6_frag_key *dst,
 		   const struct ipv6_frag_key *src)
@@ -95,42 +108,138 @@ static void ipv6_frag_free_pkt(struct rcu_head *head)
 }
 
 /*
- * Delete a frag packet struct from the hash table
+ * Remove a frag packet struct from the hash table and the list.  The
+ * caller holds both the pkt lock and the list lock.
  */
-void
-ipv6_frag_free(struct cds_lfht *frag_table, struct ipv6_frag_pkt *fp)
+static void
+ipv6_frag_unlink(struct ipv6_frag_pkt *fp)
 {
-	if (!cds_lfht_del(frag_table, &fp->pkt_node))
+	fp->pkt_dead = true;
+	rte_atomic32_sub(&ipv6_frag_held, fp->pkt_held);
+	fp->pkt_held = 0;
+
+	cds_list_del(&fp->pkt_lru);
+	ipv6_frag_sets--;
+
+	if (!cds_lfht_del(fp->pkt_table, &fp->pkt_node))
 		call_rcu(&fp->pkt_rcu_head, ipv6_frag_free_pkt);
 }
 
 /*
- * Clean out expired frag pkts
- *
+ * Delete a frag packet struct from the hash table, pkt lock held
+ */
+void
+ipv6_frag_free(struct cds_lfht *frag_table __unused,
+	       struct ipv6_frag_pkt *fp)
+{
+	if (fp->pkt_dead)
+		return;
+
+	rte_spinlock_lock(&ipv6_frag_lru_lock);
+	ipv6_frag_unlink(fp);
+	rte_spinlock_unlock(&ipv6_frag_lru_lock);
+}
+
+/*
+ * Free the oldest set other than the caller's, skipping any that are
+ * locked by other cores.
+ */
+static bool
+ipv6_frag_evict(struct ipv6_frag_pkt *self)
+{
+	struct ipv6_frag_pkt *fp;
+	bool evicted = false;
+
+	rte_spinlock_lock(&ipv6_frag_lru_lock);
+	cds_list_for_each_entry(fp, &ipv6_frag_lru, pkt_lru) {
+		if (fp == self || !rte_spinlock_trylock(&fp->pkt_lock))
+			continue;
+
+		IPV6_FRAG_DROP_ADD(FRAG_DROP_EVICTED, fp->pkt_held);
+		ipv6_frag_unlink(fp);
+		rte_spinlock_unlock(&fp->pkt_lock);
+		evicted = true;
+		break;
+	}
+	rte_spinlock_unlock(&ipv6_frag_lru_lock);
+
+	return evicted;
+}
+
+/*
+ * Account for a fragment about to be stored in a set, pkt lock held
+ */
+bool
+ipv6_frag_hold(struct ipv6_frag_pkt *fp)
+{
+	if (unlikely((unsigned int)rte_atomic32_read(&ipv6_frag_held) >=
+		     ipv6_frag_held_max) && !ipv6_frag_evict(fp))
+		return false;
+
+	rte_atomic32_inc(&ipv6_frag_held);
+	fp->pkt_held++;
+	return true;
+}
+
+/*
+ * Clean out frag pkts expired by the given uptime, stopping at the first
+ * unexpired one
+ */
+static void
+ipv6_frag_expire(uint64_t current)
+{
+	struct ipv6_frag_pkt *fp, *next;
+
+	rte_spinlock_lock(&ipv6_frag_lru_lock);
+	cds_list_for_each_entry_safe(fp, next, &ipv6_frag_lru, pkt_lru) {
+		if (fp->pkt_expire >= current)
+			break;
+		if (!rte_spinlock_trylock(&fp->pkt_lock))
+			continue;
+
+		ipv6_frag_timeout_stats(fp);
+		IPV6_FRAG_DROP_ADD(FRAG_DROP_TIMEOUT, fp->pkt_held);
+		ipv6_frag_unlink(fp);
+		rte_spinlock_unlock(&fp->pkt_lock);
+	}
+	rte_spinlock_unlock(&ipv6_frag_lru_lock);
+}
+
+/*
  * NB ipv6_gc() is a callback function for rte_timer_reset(),
  *    so we use __rte_unused rather than __unused.
  */
 static void
 ipv6_gc(struct rte_timer *t __rte_unused, void *arg __rte_unused)
 {
-	struct cds_lfht_iter iter;
-	struct ipv6_frag_pkt *fp;
-	uint64_t current = get_time_uptime(); /* uptime in secs */
-	vrfid_t vrfid;
-	struct vrf *vrf;
+	ipv6_frag_expire(get_time_uptime()); /* uptime in secs */
+}
 
-	VRF_FOREACH(vrf, vrfid) {
-		if (!vrf)
-			continue;
+/*
+ * Test hooks
+ */
+void
+ipv6_frag_held_max_ut(unsigned int max)
+{
+	ipv6_frag_held_max = max ? : IPV6_MAX_FRAGS_HELD;
+}
 
-		cds_lfht_for_each_entry(vrf->v_ipv6_frag_table, &iter, fp,
-					pkt_node) {
-			if (fp->pkt_expire < current) {
-				ipv6_frag_timeout_stats(fp);
-				ipv6_frag_free(vrf->v_ipv6_frag_table, fp);
-			}
-		}
-	}
+void
+ipv6_frag_expire_ut(void)
+{
+	ipv6_frag_expire(get_time_uptime() + IPV6_FRAG_SET_TTL + 1);
+}
+
+unsigned int
+ipv6_frag_sets_ut(void)
+{
+	return CMM_LOAD_SHARED(ipv6_frag_sets);
+}
+
+unsigned int
+ipv6_frag_held_ut(void)
+{
+	return rte_atomic32_read(&ipv6_frag_held);
 }
 
 /*
@@ -167,19 +276,8 @@ ipv6_match(struct cds_lfht_node *node, const void *data)
 	return ipv6_frag_key_cmp(key, &fp->pkt_key) == 0 ? 1 : 0;
 }
 
-/* Count nodes */
-static unsigned long
-ipv6_frag_count(struct cds_lfht *frag_table)
-{
-	unsigned long count;
-	long dummy;
-
-	cds_lfht_count_nodes(frag_table, &dummy, &count, &dummy);
-	return count;
-}
-
 /*
- * Add a new pkt if max not reached
+ * Add a new pkt, evicting the oldest if max reached
  */
 static struct ipv6_frag_pkt *
 ipv6_frag_create(struct cds_lfht *frag_table, unsigned long hash,
@@ -187,11 +285,10 @@ ipv6_frag_create(struct cds_lfht *frag_table, unsigned long hash,
 {
 	struct cds_lfht_node *node;
 	struct ipv6_frag_pkt *fp;
-	unsigned long count;
 
 	/* Max packets reached? */
-	count = ipv6_frag_count(frag_table);
-	if (count >= IPV6_MAX_FRAG_SETS)
+	if (CMM_LOAD_SHARED(ipv6_frag_sets) >= IPV6_MAX_FRAG_SETS &&
+	    !ipv6_frag_evict(NULL))
 		return NULL;
 
 	fp = calloc(1, sizeof(struct ipv6_frag_pkt));
@@ -201,15 +298,24 @@ ipv6_frag_create(struct cds_lfht *frag_table, unsigned long hash,
 	rte_spinlock_init(&fp->pkt_lock);
 	ipv6_frag_key_copy(&fp->pkt_key, key);
 	fp->last_idx = FIRST_INTERMEDIATE_FRAG_IDX;
+	fp->pkt_table = frag_table;
 	cds_lfht_node_init(&fp->pkt_node);
-	fp->pkt_expire = get_time_uptime() + IPV6_FRAG_SET_TTL;
 
 	/*
 	 * Now try to add the new pkt, if somebody beat us to it, use
-	 * that one.
+	 * that one.  Hold the list lock across this so that the pkt is
+	 * on the list before anyone can find it to free it.
 	 */
+	rte_spinlock_lock(&ipv6_frag_lru_lock);
 	node = cds_lfht_add_unique(frag_table, hash, ipv6_match,
 				   key, &fp->pkt_node);
+	if (node == &fp->pkt_node) {
+		fp->pkt_expire = get_time_uptime() + IPV6_FRAG_SET_TTL;
+		cds_list_add_tail(&fp->pkt_lru, &ipv6_frag_lru);
+		ipv6_frag_sets++;
+	}
+	rte_spinlock_unlock(&ipv6_frag_lru_lock);
+
 	if (node != &fp->pkt_node) {
 		free(fp);
 		fp = caa_container_of(node, struct ipv6_frag_pkt, pkt_node);
@@ -268,7 +374,9 @@ ipv6_fragment_table_uninit(struct vrf *vrf)
 
 	cds_lfht_for_each_entry(vrf->v_ipv6_frag_table, &iter, pkt,
 				pkt_node) {
+		rte_spinlock_lock(&pkt->pkt_lock);
 		ipv6_frag_free(vrf->v_ipv6_frag_table, pkt);
+		rte_spinlock_unlock(&pkt->pkt_lock);
 	}
 
 	dp_ht_destroy_deferred(vrf->v_ipv6_frag_table);
@@ -10,7 +10,9 @@
 #define IPV6_FRAG_TBL_H
 
 #include <rte_spinlock.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <urcu/list.h>
 
 #include "npf/fragment/ipv6_rsmbl.h"
 #include "urcu.h"
@@ -31,11 +33,14 @@ struct vrf;
 #define IPV6_FRAG_HT_MIN	64
 #define IPV6_FRAG_HT_MAX	512
 
-/* Max number of fragment sets we support */
+/* Max number of fragment sets we support, across all vrfs */
 #define IPV6_MAX_FRAG_SETS	1024
 
-/* GC periodic hash table cleanup interval (seconds) */
-#define IPV6_FRAG_INTERVAL	10
+/* Max number of fragments held across all sets */
+#define IPV6_MAX_FRAGS_HELD	8192
+
+/* GC periodic expiry interval (seconds) */
+#define IPV6_FRAG_INTERVAL	1
 
 /* Timeout period for incomplete fragment sets */
 #define IPV6_FRAG_SET_TTL       15
@@ -75,16 +80,22 @@ struct ipv6_frag_key {
 /*
  * IPv6 fragmented packet to reassemble.  First two entries in the
  * frags[] array are for the last and first fragments.
+ *
+ * All sets are also on a list in creation, and so expiry, order.
  */
 struct ipv6_frag_pkt {
 	struct rcu_head		pkt_rcu_head;	/* for call_rcu */
 	struct cds_lfht_node	pkt_node;	/* For hash table */
+	struct cds_list_head	pkt_lru;	/* creation order list */
+	struct cds_lfht		*pkt_table;	/* table we are in */
 	rte_spinlock_t		pkt_lock;	/* lock for this pkt */
+	bool			pkt_dead;	/* removed from table */
 	struct ipv6_frag_key	pkt_key;	/* src_dst/id key */
 	uint64_t		pkt_expire;	/* expiration timestamp */
 	uint32_t		total_size;	/* expected reassd size */
 	uint32_t		frag_size;	/* size of fragments rcvd */
 	uint32_t		last_idx;	/* next entry to fill */
+	uint32_t		pkt_held;	/* fragments held */
 	/*
 	 * Offset  (from  start   of  l3  hdr)  and   length  of  last
 	 * unfragmentable  extension header  before the  fragmentation
@@ -104,5 +115,16 @@ struct ipv6_frag_pkt *
 ipv6_frag_find_or_create(struct vrf *vrf, const struct ipv6_frag_key *);
 void ipv6_frag_free(struct cds_lfht *frag_table, struct ipv6_frag_pkt *);
 void ipv6_frag_clear(struct ipv6_frag_pkt *);
+bool ipv6_frag_hold(struct ipv6_frag_pkt *);
+
+/*
+ * Test hooks.  Set the held fragment limit (0 for the default), expire
+ * all sets as the GC would once their TTL has passed, and get the number
+ * of sets and fragments held.
+ */
+void ipv6_frag_held_max_ut(unsigned int max);
+void ipv6_frag_expire_ut(void);
+unsigned int ipv6_frag_sets_ut(void);
+unsigned int ipv6_frag_held_ut(void);
 
 #endif
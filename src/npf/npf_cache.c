@@ -1527,6 +1527,154 @@ npf_v4_rwrcksums(npf_cache_t *npc, struct rte_mbuf *nbuf, void *n_ptr,
 	return true;
 }
 
+/*
+ * Initialise an IPv4 rewrite template for one direction of a session.
+ * Protocols whose L4 header we do not know how to rewrite are left
+ * invalid, and use the general path.
+ */
+void npf_v4_rwr_tmpl_init(struct npf_rwr_tmpl *rt, uint8_t ipproto, int di,
+			  uint32_t addr, in_port_t port, bool port_changed,
+			  uint16_t l3_chk_delta, uint16_t l4_chk_delta)
+{
+	memset(rt, 0, sizeof(*rt));
+
+	rt->rt_addr = addr;
+	rt->rt_port = port;
+	rt->rt_l3_delta = l3_chk_delta;
+	rt->rt_l4_delta = l4_chk_delta;
+	rt->rt_di = di;
+	rt->rt_ipproto = ipproto;
+
+	switch (ipproto) {
+	case IPPROTO_TCP:
+		rt->rt_cksum_off = offsetof(struct tcphdr, check);
+		rt->rt_l4_len = sizeof(struct tcphdr);
+		rt->rt_flags = NPF_RWR_L4_CKSUM;
+		break;
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+		rt->rt_cksum_off = offsetof(struct udphdr, check);
+		rt->rt_l4_len = sizeof(struct udphdr);
+		rt->rt_flags = NPF_RWR_L4_CKSUM | NPF_RWR_UDP;
+		break;
+	case IPPROTO_DCCP:
+		rt->rt_cksum_off = offsetof(struct npf_dccp, dc_checksum);
+		rt->rt_l4_len = sizeof(struct npf_dccp);
+		rt->rt_flags = NPF_RWR_L4_CKSUM;
+		break;
+	case IPPROTO_SCTP:
+		/* We never NAT ports for SCTP */
+		rt->rt_l4_len = sizeof(struct npf_sctp);
+		rt->rt_flags = NPF_RWR_VALID;
+		return;
+	case IPPROTO_ICMP:
+		rt->rt_cksum_off = offsetof(struct icmp, icmp_cksum);
+		rt->rt_port_off = offsetof(struct icmp, icmp_id);
+		rt->rt_l4_len = ICMP_MINLEN;
+		rt->rt_flags = NPF_RWR_L4_CKSUM | NPF_RWR_ICMP;
+		break;
+	default:
+		return;
+	}
+
+	if (ipproto != IPPROTO_ICMP && di != PFIL_OUT)
+		rt->rt_port_off = offsetof(struct npf_ports, d_port);
+
+	if (port_changed)
+		rt->rt_flags |= NPF_RWR_L4_PORT;
+
+	rt->rt_flags |= NPF_RWR_VALID;
+}
+
+/*
+ * Apply an IPv4 rewrite template.  Equivalent to npf_v4_rwrcksums followed
+ * by npf_rwrip and npf_rwrport (or npf_rwricmpid), but with the offsets and
+ * checksum deltas already worked out.
+ *
+ * Returns false, without changing the packet, if the template does not
+ * apply to this packet or the headers are not contiguous.  The caller
+ * should then use the general path.
+ */
+bool npf_v4_rwr_tmpl(npf_cache_t *npc, struct rte_mbuf *nbuf, void *n_ptr,
+		     const struct npf_rwr_tmpl *rt)
+{
+	struct ip *cip = &npc->npc_ip.v4;
+	struct ip *ip = n_ptr;
+	char *l4, *cl4;
+	uint hlen;
+
+	if (unlikely(!(rt->rt_flags & NPF_RWR_VALID) ||
+		     rt->rt_ipproto != npf_cache_ipproto(npc)))
+		return false;
+
+	if (rt->rt_flags & NPF_RWR_ICMP) {
+		if (unlikely(!npf_iscached(npc, NPC_ICMP_ECHO)))
+			return false;
+	} else if (rt->rt_l4_len && unlikely(!npf_iscached(npc, NPC_L4PORTS)))
+		return false;
+
+	hlen = npf_cache_hlen(npc);
+	l4 = (char *)n_ptr + hlen;
+
+	/* All headers we touch must be in the first segment */
+	if (unlikely(l4 + rt->rt_l4_len > rte_pktmbuf_mtod(nbuf, char *) +
+		     rte_pktmbuf_data_len(nbuf)))
+		return false;
+
+	/* IPv4 header checksum */
+	cip->ip_sum = ip_fixup16_cksum(cip->ip_sum, 0xffff, rt->rt_l3_delta);
+	ip->ip_sum = cip->ip_sum;
+
+	/* Source or destination address */
+	if (rt->rt_di == PFIL_OUT) {
+		ip->ip_src.s_addr = rt->rt_addr;
+		memcpy(npf_cache_v4src(npc), &rt->rt_addr, sizeof(rt->rt_addr));
+		npf_update_grouper(npc, npf_cache_v4src(npc),
+				   NPC_GPR_SADDR_OFF_v4, NPC_GPR_SADDR_LEN_v4);
+	} else {
+		ip->ip_dst.s_addr = rt->rt_addr;
+		memcpy(npf_cache_v4dst(npc), &rt->rt_addr, sizeof(rt->rt_addr));
+		npf_update_grouper(npc, npf_cache_v4dst(npc),
+				   NPC_GPR_DADDR_OFF_v4, NPC_GPR_DADDR_LEN_v4);
+	}
+
+	cl4 = (char *)&npc->npc_l4;
+
+	/* Transport checksum */
+	if (rt->rt_flags & NPF_RWR_L4_CKSUM) {
+		uint16_t *cksum = (uint16_t *)(cl4 + rt->rt_cksum_off);
+
+		if (!((rt->rt_flags & NPF_RWR_UDP) && *cksum == 0)) {
+			/* L3 pseudo header is not included in ICMP checksum */
+			uint16_t l3_delta = (rt->rt_flags & NPF_RWR_ICMP) ?
+				0 : rt->rt_l3_delta;
+
+			*cksum = ip_fixup16_cksum(*cksum, ~l3_delta,
+						  rt->rt_l4_delta);
+			*(uint16_t *)(l4 + rt->rt_cksum_off) = *cksum;
+		}
+	}
+
+	/* Port or ICMP query id */
+	if (rt->rt_flags & NPF_RWR_L4_PORT) {
+		*(uint16_t *)(l4 + rt->rt_port_off) = rt->rt_port;
+		*(uint16_t *)(cl4 + rt->rt_port_off) = rt->rt_port;
+
+		if (!(rt->rt_flags & NPF_RWR_ICMP)) {
+			if (rt->rt_di == PFIL_OUT)
+				npf_update_grouper(npc, (void *)&rt->rt_port,
+						   NPC_GPR_SPORT_OFF_v4,
+						   NPC_GPR_SPORT_LEN_v4);
+			else
+				npf_update_grouper(npc, (void *)&rt->rt_port,
+						   NPC_GPR_DPORT_OFF_v4,
+						   NPC_GPR_DPORT_LEN_v4);
+		}
+	}
+
+	return true;
+}
+
 /* Convert a string port to a port */
 in_port_t npf_port_from_str(const char *p)
 {
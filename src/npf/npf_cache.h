@@ -278,6 +278,30 @@ typedef struct npf_cache {
 
 #include "npf/npf_session.h"
 
+/*
+ * Precomputed IPv4 rewrite template.  Built once per session direction from
+ * the NAT translation entry, and applied to subsequent packets by
+ * npf_v4_rwr_tmpl.  Offsets are relative to the start of the L4 header.
+ */
+#define NPF_RWR_VALID		0x01
+#define NPF_RWR_L4_CKSUM	0x02	/* L4 checksum to update */
+#define NPF_RWR_L4_PORT		0x04	/* Port or ICMP id to rewrite */
+#define NPF_RWR_UDP		0x08	/* Zero L4 checksum is not updated */
+#define NPF_RWR_ICMP		0x10	/* No pseudo header in L4 checksum */
+
+struct npf_rwr_tmpl {
+	uint32_t	rt_addr;	/* new address (net order) */
+	uint16_t	rt_port;	/* new port or ICMP id (net order) */
+	uint16_t	rt_l3_delta;	/* IPv4 header checksum delta */
+	uint16_t	rt_l4_delta;	/* L4 checksum delta for port change */
+	uint8_t		rt_di;		/* PFIL_IN or PFIL_OUT */
+	uint8_t		rt_ipproto;
+	uint8_t		rt_cksum_off;
+	uint8_t		rt_port_off;
+	uint8_t		rt_l4_len;	/* Contiguous L4 bytes needed */
+	uint8_t		rt_flags;
+};
+
 int npf_tcpsaw(const npf_cache_t *npc, tcp_seq *seq, tcp_seq *ack,
 	       uint32_t *win);
 bool npf_fetch_grouper(npf_cache_t *npc, char **ptr);
@@ -315,6 +339,11 @@ bool npf_rwricmpid(npf_cache_t *npc, struct rte_mbuf *nbuf, void *n_ptr,
 		   uint16_t new_id);
 bool npf_v4_rwrcksums(npf_cache_t *npc, struct rte_mbuf *nbuf, void *n_ptr,
 		      uint16_t l3_chk_delta, uint16_t l4_chk_delta);
+void npf_v4_rwr_tmpl_init(struct npf_rwr_tmpl *rt, uint8_t ipproto, int di,
+			  uint32_t addr, in_port_t port, bool port_changed,
+			  uint16_t l3_chk_delta, uint16_t l4_chk_delta);
+bool npf_v4_rwr_tmpl(npf_cache_t *npc, struct rte_mbuf *nbuf, void *n_ptr,
+		     const struct npf_rwr_tmpl *rt);
 in_port_t npf_port_from_str(const char *p);
 npf_cache_t *npf_cache(void);
 uint16_t npf_cache_mtu(void);
@@ -120,6 +120,8 @@
 #include "npf_tblset.h"
 #include "npf_addr.h"
 #include "pktmbuf_internal.h"
+#include "session/session.h"
+#include "session/session_feature.h"
 #include "urcu.h"
 #include "vplane_log.h"
 
@@ -185,6 +187,8 @@ struct npf_nat {
 	uint16_t		nt_tport;
 	uint16_t		nt_oport;
 	uint16_t		nt_mtu;		/* kludge for dnat+snat */
+	/* Rewrite templates, indexed by 'forw' */
+	struct npf_rwr_tmpl	nt_tmpl[2];
 };
 
 /* Helpers for seq/ack usage */
@@ -760,8 +764,9 @@ npf_nat_t *npf_nat_custom_nat(npf_nat_t *pnat, uint32_t flags)
  * and so can make use of the 0x0000 to indicate that
  * the corresponding checksum needs no update.
  */
-void
-npf_nat_finalise(npf_cache_t *npc, npf_session_t *se, int di, npf_nat_t *nt)
+static void
+npf_nat_finalise_deltas(npf_cache_t *npc, npf_session_t *se, int di,
+			npf_nat_t *nt)
 {
 	const uint32_t *oip32 = (const uint32_t *)&nt->nt_oaddr;
 	const uint32_t *nip32 = (const uint32_t *)&nt->nt_taddr;
@@ -812,6 +817,36 @@ calc_l4_chk_delta:
 
 }
 
+/*
+ * Build the rewrite templates for both directions of the session.  'di' is
+ * the direction of the forwards flow.
+ *
+ * The forwards flow is translated to the translation address and port, and
+ * the backwards flow to the original address and port, with the checksum
+ * deltas inverted.  See npf_nat_translate_at.
+ */
+static void
+npf_nat_tmpl_init(npf_nat_t *nt, uint8_t ipproto, int di)
+{
+	int back_di = (di == PFIL_IN) ? PFIL_OUT : PFIL_IN;
+	bool l4_changed = nt->nt_l4_chk;
+
+	npf_v4_rwr_tmpl_init(&nt->nt_tmpl[true], ipproto, di,
+			     nt->nt_taddr, nt->nt_tport, l4_changed,
+			     nt->nt_l3_chk, nt->nt_l4_chk);
+
+	npf_v4_rwr_tmpl_init(&nt->nt_tmpl[false], ipproto, back_di,
+			     nt->nt_oaddr, nt->nt_oport, l4_changed,
+			     ~nt->nt_l3_chk, ~nt->nt_l4_chk);
+}
+
+void
+npf_nat_finalise(npf_cache_t *npc, npf_session_t *se, int di, npf_nat_t *nt)
+{
+	npf_nat_finalise_deltas(npc, se, di, nt);
+	npf_nat_tmpl_init(nt, npf_cache_ipproto(npc), di);
+}
+
 /*
  * perform address and/or port translation.
  */
@@ -914,11 +949,21 @@ npf_nat_translate(npf_cache_t *npc, struct rte_mbuf *nbuf,
 		  npf_nat_t *nt, const bool forw, const int di)
 {
 	void *n_ptr = dp_pktmbuf_mtol3(nbuf, void *);
+	const struct npf_rwr_tmpl *rt = &nt->nt_tmpl[forw];
 
-	int rc = npf_nat_translate_at(npc, nbuf, nt, forw, di,
-				      n_ptr, false);
-	if (rc)
-		return rc;
+	/*
+	 * Use the session rewrite template if we can.  ALGs may change the
+	 * packet or the translation, so always use the general path.
+	 */
+	if (likely(!nt->nt_alg && rt->rt_di == di) &&
+	    likely(npf_v4_rwr_tmpl(npc, nbuf, n_ptr, rt))) {
+		npc->npc_info |= NPC_NATTED;
+	} else {
+		int rc = npf_nat_translate_at(npc, nbuf, nt, forw, di,
+					      n_ptr, false);
+		if (rc)
+			return rc;
+	}
 
 	/* Mark as SNAT / DNAT for the rest of the packet path */
 	uint32_t pkt_flags
@@ -1407,6 +1452,51 @@ const struct npf_alg *npf_nat_getalg(npf_nat_t *nt)
 	return nt->nt_alg;
 }
 
+struct npf_nat_tmpl_ut_ctx {
+	unsigned int	tmpl;
+	unsigned int	general;
+};
+
+static int npf_nat_tmpl_ut_feat(struct session *s __unused,
+				struct session_feature *sf, void *data)
+{
+	struct npf_nat_tmpl_ut_ctx *ctx = data;
+	npf_nat_t *nt = npf_session_get_nat(sf->sf_data);
+
+	if (!nt)
+		return 0;
+
+	if (!nt->nt_alg && (nt->nt_tmpl[true].rt_flags & NPF_RWR_VALID) &&
+	    (nt->nt_tmpl[false].rt_flags & NPF_RWR_VALID))
+		ctx->tmpl++;
+	else
+		ctx->general++;
+	return 0;
+}
+
+static int npf_nat_tmpl_ut_sess(struct session *s, void *data)
+{
+	session_feature_walk_session(s, SESSION_FEATURE_NPF,
+				     npf_nat_tmpl_ut_feat, data);
+	return 0;
+}
+
+/*
+ * Test hook.  Count the NAT sessions translated with the rewrite
+ * templates, and those that always take the general path.
+ */
+void npf_nat_tmpl_ut(unsigned int *tmpl, unsigned int *general)
+{
+	struct npf_nat_tmpl_ut_ctx ctx = { 0 };
+
+	rcu_read_lock();
+	session_table_walk(npf_nat_tmpl_ut_sess, &ctx);
+	rcu_read_unlock();
+
+	*tmpl = ctx.tmpl;
+	*general = ctx.general;
+}
+
 static uint64_t npf_natpolicy_table_range(const npf_natpolicy_t *np)
 {
 	return npf_addrgrp_naddrs(AG_IPv4, np->n_table_id, false);
@@ -1672,6 +1762,8 @@ int npf_nat_npf_pack_restore(struct npf_session *se,
 
 	nt->nt_mtu = ifp->if_mtu;
 	nt->nt_session = se;
+	npf_nat_tmpl_init(nt, npf_session_get_proto(se),
+			  (np->n_type == NPF_NATOUT) ? PFIL_OUT : PFIL_IN);
 	npf_session_setnat(se, nt,
 			(nt->nt_natpolicy->n_flags & NPF_NAT_PINHOLE));
 
@@ -144,4 +144,11 @@ int npf_nat_npf_pack_pack(npf_nat_t *nt, struct npf_pack_npf_nat *nat,
 int npf_nat_npf_pack_restore(struct npf_session *se,
 			     struct npf_pack_npf_nat *nat,
 			     struct ifnet *ifp);
+
+/*
+ * Test hook.  Count the NAT sessions translated with the rewrite
+ * templates, and those that always take the general path.
+ */
+void npf_nat_tmpl_ut(unsigned int *tmpl, unsigned int *general);
+
 #endif /* NPF_NAT_H */
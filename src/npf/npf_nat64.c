@@ -62,6 +62,33 @@ struct nat64_sess_stats {
 #define NAT64_STATS_SIZE	(sizeof(struct nat64_sess_stats) *	\
 				 (get_lcore_max() + 1))
 
+/*
+ * Per-session, per-direction header template for established flows.  Holds
+ * the translated L3 header, the new L4 IDs, and the L4 checksum delta for
+ * the change of pseudo header and IDs, such that subsequent packets do not
+ * need to map addresses or recompute checksums from scratch.
+ *
+ * Built once, from the first packet in each direction after the sessions
+ * are linked, and never changed after being marked valid.  nt_peer records
+ * the peer session the template was built from, and is cleared when the
+ * sessions are unlinked or the peer is destroyed.  A template is only used
+ * while nt_peer matches the current peer, so a peer session that is freed
+ * and its memory reused cannot match a stale template.
+ */
+struct nat64_tmpl {
+	npf_session_t		*nt_peer;
+	bool			nt_valid;
+	uint8_t			nt_proto;
+	uint8_t			nt_cksum_off;
+	uint16_t		nt_sid;
+	uint16_t		nt_did;
+	uint16_t		nt_l4_delta;
+	union {
+		struct iphdr	ip;
+		struct ip6_hdr	ip6;
+	} nt_hdr;
+};
+
 /*
  * NAT64 session data
  *
@@ -89,6 +116,9 @@ struct npf_nat64 {
 	/* session stats - per-core arrays */
 	struct nat64_sess_stats	*n64_stats_in;
 	struct nat64_sess_stats	*n64_stats_out;
+
+	/* Header templates, indexed by 'forw' */
+	struct nat64_tmpl	n64_tmpl[2];
 };
 
 npf_rule_t *
@@ -540,6 +570,314 @@ npf_6to4_convert(struct rte_mbuf **m, npf_cache_t *npc,
 	return true;
 }
 
+/*
+ * Is this packet eligible for a header template?  Only TCP and UDP without
+ * IPv4 options or IPv6 extension headers, and with a UDP checksum.
+ */
+static bool
+nat64_tmpl_eligible(npf_cache_t *npc, uint hlen)
+{
+	uint8_t proto = npf_cache_ipproto(npc);
+
+	if (npf_cache_hlen(npc) != hlen || !npf_iscached(npc, NPC_L4PORTS))
+		return false;
+
+	if (proto == IPPROTO_TCP)
+		return true;
+
+	return proto == IPPROTO_UDP && npc->npc_l4.udp.check != 0;
+}
+
+static uint8_t
+nat64_tmpl_cksum_off(uint8_t proto)
+{
+	if (proto == IPPROTO_TCP)
+		return offsetof(struct tcphdr, check);
+	return offsetof(struct udphdr, check);
+}
+
+/*
+ * Fixup an L4 checksum for the change of IDs.  'c' has already been fixed
+ * up for the change of addresses.  Returns the checksum delta in the same
+ * form as the NAT44 deltas, i.e. applied with ip_fixup16_cksum(x, 0xffff,
+ * delta).
+ */
+static uint16_t
+nat64_tmpl_l4_delta(uint16_t c, const struct npf_ports *ports,
+		    uint16_t sid, uint16_t did)
+{
+	c = ip_fixup16_cksum(c, ports->s_port, sid);
+	c = ip_fixup16_cksum(c, ports->d_port, did);
+
+	return ~c;
+}
+
+/*
+ * Build a 6-to-4 template from the first IPv6 packet.
+ */
+static void
+nat64_tmpl_6to4_init(struct nat64_tmpl *t, npf_cache_t *npc,
+		     npf_session_t *peer, uint32_t saddr, uint16_t sid,
+		     uint32_t daddr, uint16_t did)
+{
+	const struct ip6_hdr *ip6 = &npc->npc_ip.v6;
+	struct iphdr *ip = &t->nt_hdr.ip;
+	uint16_t c = 0;
+	uint i;
+
+	for (i = 0; i < 4; i++) {
+		c = ip_fixup32_cksum(c, ip6->ip6_src.s6_addr32[i],
+				     i == 0 ? saddr : 0);
+		c = ip_fixup32_cksum(c, ip6->ip6_dst.s6_addr32[i],
+				     i == 0 ? daddr : 0);
+	}
+
+	t->nt_proto = npf_cache_ipproto(npc);
+	t->nt_cksum_off = nat64_tmpl_cksum_off(t->nt_proto);
+	t->nt_sid = sid;
+	t->nt_did = did;
+	t->nt_l4_delta = nat64_tmpl_l4_delta(c, &npc->npc_l4.ports, sid, did);
+
+	/* ttl and tot_len are zero, and fixed up per packet */
+	memset(ip, 0, sizeof(*ip));
+	ip->ihl = sizeof(struct iphdr) >> 2;
+	ip->version = IPVERSION;
+	ip->protocol = t->nt_proto;
+	ip->saddr = saddr;
+	ip->daddr = daddr;
+	ip->check = in_cksum(ip, sizeof(struct iphdr));
+
+	t->nt_peer = peer;
+}
+
+/*
+ * Build a 4-to-6 template from the first IPv4 packet.
+ */
+static void
+nat64_tmpl_4to6_init(struct nat64_tmpl *t, npf_cache_t *npc,
+		     npf_session_t *peer, npf_addr_t *src, uint16_t sid,
+		     npf_addr_t *dst, uint16_t did)
+{
+	const struct ip *ip = &npc->npc_ip.v4;
+	struct ip6_hdr *ip6 = &t->nt_hdr.ip6;
+	uint16_t c = 0;
+	uint i;
+
+	for (i = 0; i < 4; i++) {
+		c = ip_fixup32_cksum(c, i == 0 ? ip->ip_src.s_addr : 0,
+				     src->s6_addr32[i]);
+		c = ip_fixup32_cksum(c, i == 0 ? ip->ip_dst.s_addr : 0,
+				     dst->s6_addr32[i]);
+	}
+
+	t->nt_proto = npf_cache_ipproto(npc);
+	t->nt_cksum_off = nat64_tmpl_cksum_off(t->nt_proto);
+	t->nt_sid = sid;
+	t->nt_did = did;
+	t->nt_l4_delta = nat64_tmpl_l4_delta(c, &npc->npc_l4.ports, sid, did);
+
+	/* ip6_plen and ip6_hlim are set per packet */
+	memset(ip6, 0, sizeof(*ip6));
+	ip6->ip6_vfc = IPV6_VERSION;
+	ip6->ip6_nxt = t->nt_proto;
+	memcpy(&ip6->ip6_src, src, 16);
+	memcpy(&ip6->ip6_dst, dst, 16);
+
+	t->nt_peer = peer;
+}
+
+/*
+ * Get a valid template for this packet, building it if necessary.  'lock'
+ * is the v6 session lock, which serialises building the templates.
+ * Returns NULL if the general path should be used.
+ */
+static struct nat64_tmpl *
+nat64_tmpl_get(struct npf_nat64 *n64, bool forw, npf_session_t *peer,
+	       npf_cache_t *npc, bool v6, rte_spinlock_t *lock,
+	       npf_addr_t *src, uint16_t sid, npf_addr_t *dst, uint16_t did)
+{
+	struct nat64_tmpl *t = &n64->n64_tmpl[forw];
+
+	if (!nat64_tmpl_eligible(npc, v6 ? sizeof(struct ip6_hdr) :
+				 sizeof(struct iphdr)))
+		return NULL;
+
+	if (likely(CMM_LOAD_SHARED(t->nt_valid))) {
+		cmm_smp_rmb();
+		if (unlikely(CMM_LOAD_SHARED(t->nt_peer) != peer ||
+			     t->nt_proto != npf_cache_ipproto(npc)))
+			return NULL;
+		return t;
+	}
+
+	rte_spinlock_lock(lock);
+	if (!t->nt_valid) {
+		if (v6)
+			nat64_tmpl_6to4_init(t, npc, peer, src->s6_addr32[0],
+					     sid, dst->s6_addr32[0], did);
+		else
+			nat64_tmpl_4to6_init(t, npc, peer, src, sid, dst, did);
+		cmm_smp_wmb();
+		CMM_STORE_SHARED(t->nt_valid, true);
+	}
+	rte_spinlock_unlock(lock);
+
+	return CMM_LOAD_SHARED(t->nt_peer) == peer ? t : NULL;
+}
+
+/*
+ * Retire the templates of a session whose peer is going away.  The rest of
+ * the template is left alone as it may be in use by another core.  'lock'
+ * is the v6 session lock, if the v6 session still exists.
+ */
+static void
+nat64_tmpl_clear(struct npf_nat64 *n64, rte_spinlock_t *lock)
+{
+	uint i;
+
+	if (lock)
+		rte_spinlock_lock(lock);
+	for (i = 0; i < ARRAY_SIZE(n64->n64_tmpl); i++)
+		CMM_STORE_SHARED(n64->n64_tmpl[i].nt_peer, NULL);
+	if (lock)
+		rte_spinlock_unlock(lock);
+}
+
+/* The lock that serialises building the templates of a session pair */
+static rte_spinlock_t *
+nat64_tmpl_lock(struct npf_nat64 *n64, struct npf_nat64 *peer)
+{
+	if (n64 && n64->n64_v6)
+		return &n64->n64_lock;
+	if (peer && peer->n64_v6)
+		return &peer->n64_lock;
+	return NULL;
+}
+
+/* Apply a template L4 checksum delta and IDs */
+static ALWAYS_INLINE void
+nat64_tmpl_l4_apply(const struct nat64_tmpl *t, char *l4hdr)
+{
+	struct npf_ports *ports = (struct npf_ports *)l4hdr;
+	uint16_t *cksum = (uint16_t *)(l4hdr + t->nt_cksum_off);
+
+	ports->s_port = t->nt_sid;
+	ports->d_port = t->nt_did;
+
+	*cksum = ip_fixup16_cksum(*cksum, 0xffff, t->nt_l4_delta);
+	if (t->nt_proto == IPPROTO_UDP && *cksum == 0)
+		*cksum = 0xffff;
+}
+
+/*
+ * 6-to-4 conversion using a session template.  Equivalent to
+ * npf_6to4_convert.  Returns false without changing the packet if the
+ * headers are not contiguous.
+ */
+static bool
+nat64_tmpl_6to4_convert(struct rte_mbuf **m, npf_cache_t *npc,
+			const struct nat64_tmpl *t)
+{
+	struct ip6_hdr *ip6;
+	struct iphdr *ip;
+	uint16_t old_w;
+	char *l2, *new_l2;
+
+	if (npf_prepare_for_l4_header_change(m, npc) != 0)
+		return false;
+
+	if (rte_pktmbuf_data_len(*m) < (*m)->l2_len + sizeof(struct ip6_hdr) +
+	    sizeof(struct tcphdr) * (t->nt_proto == IPPROTO_TCP) +
+	    sizeof(struct udphdr) * (t->nt_proto == IPPROTO_UDP))
+		return false;
+
+	ip6 = ip6hdr(*m);
+	uint8_t hlim = ip6->ip6_hlim;
+	uint16_t data_len = ntohs(ip6->ip6_plen);
+
+	l2 = rte_pktmbuf_mtod(*m, char *);
+	new_l2 = rte_pktmbuf_adj(*m, sizeof(struct ip6_hdr) -
+				 sizeof(struct iphdr));
+	if (!new_l2)
+		return false;
+
+	memmove(new_l2, l2, (*m)->l2_len);
+	l2 = new_l2;
+
+	dp_pktmbuf_l3_len(*m) = sizeof(struct iphdr);
+
+	if ((*m)->l2_len == RTE_ETHER_HDR_LEN) {
+		struct rte_ether_hdr *eth = (struct rte_ether_hdr *)l2;
+		eth->ether_type = htons(RTE_ETHER_TYPE_IPV4);
+	}
+
+	ip = iphdr(*m);
+	*ip = t->nt_hdr.ip;
+
+	/* Fixup header checksum for the ttl and length */
+	old_w = *(uint16_t *)&ip->ttl;
+	ip->ttl = hlim;
+	ip->tot_len = htons(sizeof(struct iphdr) + data_len);
+	ip->check = ip_fixup16_cksum(ip->check, old_w,
+				     *(uint16_t *)&ip->ttl);
+	ip->check = ip_fixup16_cksum(ip->check, 0, ip->tot_len);
+
+	nat64_tmpl_l4_apply(t, (char *)(ip + 1));
+
+	return true;
+}
+
+/*
+ * 4-to-6 conversion using a session template.  Equivalent to
+ * npf_4to6_convert.  Returns false without changing the packet if the
+ * headers are not contiguous.
+ */
+static bool
+nat64_tmpl_4to6_convert(struct rte_mbuf **m, npf_cache_t *npc,
+			const struct nat64_tmpl *t)
+{
+	struct ip6_hdr *ip6;
+	struct iphdr *ip;
+	char *l2, *new_l2;
+
+	if (npf_prepare_for_l4_header_change(m, npc) != 0)
+		return false;
+
+	if (rte_pktmbuf_data_len(*m) < (*m)->l2_len + sizeof(struct iphdr) +
+	    sizeof(struct tcphdr) * (t->nt_proto == IPPROTO_TCP) +
+	    sizeof(struct udphdr) * (t->nt_proto == IPPROTO_UDP))
+		return false;
+
+	ip = iphdr(*m);
+	uint8_t ttl = ip->ttl;
+	uint16_t data_len = ntohs(ip->tot_len) - sizeof(struct iphdr);
+
+	l2 = rte_pktmbuf_mtod(*m, char *);
+	new_l2 = rte_pktmbuf_prepend(*m, sizeof(struct ip6_hdr) -
+				     sizeof(struct iphdr));
+	if (!new_l2)
+		return false;
+
+	memmove(new_l2, l2, (*m)->l2_len);
+	l2 = new_l2;
+
+	dp_pktmbuf_l3_len(*m) = sizeof(struct ip6_hdr);
+
+	if ((*m)->l2_len == RTE_ETHER_HDR_LEN) {
+		struct rte_ether_hdr *eth = (struct rte_ether_hdr *)l2;
+		eth->ether_type = htons(RTE_ETHER_TYPE_IPV6);
+	}
+
+	ip6 = ip6hdr(*m);
+	*ip6 = t->nt_hdr.ip6;
+	ip6->ip6_plen = htons(data_len);
+	ip6->ip6_hlim = ttl;
+
+	nat64_tmpl_l4_apply(t, (char *)(ip6 + 1));
+
+	return true;
+}
+
 /*
  * npf_nat64_session_establish
  *
@@ -735,10 +1073,14 @@ void npf_nat64_session_unlink(struct npf_session *se)
 	if (npf_nat64_session_log_enabled(n64))
 		npf_session_nat64_log(se, false);
 
-	if (n64)
+	if (n64) {
 		n64->n64_peer = NULL;
-	if (n64_peer)
+		nat64_tmpl_clear(n64, nat64_tmpl_lock(n64, n64_peer));
+	}
+	if (n64_peer) {
 		n64_peer->n64_peer = NULL;
+		nat64_tmpl_clear(n64_peer, nat64_tmpl_lock(n64, n64_peer));
+	}
 }
 
 void
@@ -754,8 +1096,10 @@ npf_nat64_session_destroy(struct npf_session *se)
 	struct npf_nat64 *peer;
 
 	peer = npf_session_get_nat64(nat64->n64_peer);
-	if (peer)
+	if (peer) {
 		peer->n64_peer = NULL;
+		nat64_tmpl_clear(peer, nat64_tmpl_lock(nat64, peer));
+	}
 
 	if (nat64->n64_np) {
 		npf_nat_free_map(nat64->n64_np, nat64->n64_rule,
@@ -1093,11 +1437,22 @@ npf_nat64_6to4_in(npf_action_t *action, const struct npf_config *npf_config,
 	}
 
 	/*
-	 * Do the 6-to-4 conversion
+	 * Do the 6-to-4 conversion.  Established flows use the session
+	 * header template, if possible.
 	 */
 	uint64_t bytes = rte_pktmbuf_pkt_len(*m);
-	bool ok = npf_6to4_convert(m, npc, src->s6_addr32[0], sid,
-				   dst->s6_addr32[0], did);
+	struct nat64_tmpl *t = NULL;
+	bool ok = false;
+
+	if (likely(!new_flow))
+		t = nat64_tmpl_get(n64, npf_session_forward_dir(se6, PFIL_IN),
+				   se4, npc, true, &n64->n64_lock,
+				   src, sid, dst, did);
+	if (t)
+		ok = nat64_tmpl_6to4_convert(m, npc, t);
+	if (!ok)
+		ok = npf_6to4_convert(m, npc, src->s6_addr32[0], sid,
+				      dst->s6_addr32[0], did);
 
 	if (likely(ok)) {
 		/*
@@ -1396,10 +1751,27 @@ npf_nat64_4to6_in(npf_action_t *action, const struct npf_config *npf_config,
 	}
 
 	/*
-	 * Do the 4-to-6 conversion
+	 * Do the 4-to-6 conversion.  Established flows use the session
+	 * header template, if possible.  The template is built under the v6
+	 * session lock.
 	 */
 	uint64_t bytes = rte_pktmbuf_pkt_len(*m);
-	bool ok = npf_4to6_convert(m, npc, src, sid, dst, did);
+	struct nat64_tmpl *t = NULL;
+	bool ok = false;
+
+	if (likely(!new_flow)) {
+		struct npf_nat64 *n64_6 = npf_session_get_nat64(se6);
+
+		if (n64_6)
+			t = nat64_tmpl_get(n64, npf_session_forward_dir(
+						   se4, PFIL_IN),
+					   se6, npc, false, &n64_6->n64_lock,
+					   src, sid, dst, did);
+	}
+	if (t)
+		ok = nat64_tmpl_4to6_convert(m, npc, t);
+	if (!ok)
+		ok = npf_4to6_convert(m, npc, src, sid, dst, did);
 
 	if (likely(ok)) {
 		/*
@@ -47,15 +47,21 @@
 #include <netinet/ip_icmp.h>
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
+#include <pthread.h>
+#include <rte_atomic.h>
 #include <rte_ether.h>
 #include <rte_log.h>
 #include <rte_mbuf.h>
+#include <rte_mempool.h>
+#include <rte_ring.h>
+#include <rte_spinlock.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 #include "compiler.h"
 #include "if_var.h"
@@ -68,7 +74,9 @@
 #include "npf/npf_session.h"
 #include "npf/rproc/npf_ext_log.h"
 #include "pktmbuf_internal.h"
+#include "soft_ticks.h"
 #include "util.h"
+#include "vplane_log.h"
 
 #define BUF_SIZE        64
 #define PRBUF_SIZE      128
@@ -76,6 +84,71 @@
 #define NPF_LOG(type, fmt, args...)		      \
 	rte_log(RTE_LOG_NOTICE, type, fmt "\n", ## args)
 
+#define NPF_LOG_RING_SZ		1024	/* per lcore */
+#define NPF_LOG_POOL_SZ		8191
+#define NPF_LOG_BURST		32
+#define NPF_LOG_RATE		1000	/* default, per rule per lcore per sec */
+#define NPF_LOG_REPEAT_MAX	1000
+#define NPF_LOG_IDLE_USECS	10000
+
+/*
+ * The parts of the packet that are logged, saved from the npf cache on
+ * the forwarding core so the log line can be formatted elsewhere.
+ */
+struct npf_log_ip {
+	uint32_t	li_info;	/* npc_info flags */
+	uint8_t		li_alen;
+	uint8_t		li_proto;
+	union {
+		struct ip	v4;
+		struct ip6_hdr	v6;
+	} li_ip;
+	union {
+		struct tcphdr		tcp;
+		struct udphdr		udp;
+		struct icmp		icmp;
+		struct icmp6_hdr	icmp6;
+		struct npf_sctp		sctp;
+		struct npf_dccp		dccp;
+		struct npf_ports	ports;
+	} li_l4;
+	npf_addr_t	li_src;
+	npf_addr_t	li_dst;
+};
+
+struct npf_log_data;
+
+/* A logged packet, passed from the forwarding core to the log writer */
+struct npf_log_rec {
+	struct npf_log_data	*lr_ld;
+	uint8_t			lr_dir;
+	bool			lr_pass;
+	bool			lr_has_mac;
+	bool			lr_has_err;	/* lr_err holds ICMP error */
+	uint16_t		lr_etype;
+	struct rte_ether_addr	lr_smac;
+	struct rte_ether_addr	lr_dmac;
+	struct npf_log_ip	lr_ip;		/* only if NPC_IP46 */
+	struct npf_log_ip	lr_err;
+};
+
+static struct rte_mempool *npf_log_pool;
+/*
+ * One ring per dp lcore.  dp_lcore_id() is 0 on every thread that is not
+ * a forwarding one (master, shadow and so on), so several threads may
+ * log on lcore 0 at once: its ring is multi-producer, and its stats are
+ * kept under the rule's ld_lock.
+ */
+static struct rte_ring **npf_log_rings;
+static pthread_once_t npf_log_once = PTHREAD_ONCE_INIT;
+static bool npf_log_async;
+
+/* Test hooks: hold records in the rings, and copy out the lines written */
+static volatile bool npf_log_ut_paused;
+static FILE *npf_log_ut_stream;
+static unsigned int npf_log_ut_lines;
+static pthread_mutex_t npf_log_ut_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static char const *ecn_txt[] = {
 	"Not",
 	"ECT(1)",
@@ -84,17 +157,10 @@ static char const *ecn_txt[] = {
 };
 
 static void
-npf_log_mac_fields(const struct rte_mbuf *mbuf,
+npf_log_mac_fields(const struct npf_log_rec *lr,
 		   char const *mprefix, char *macs_buf,
 		   char const *eprefix, char *etype_buf)
 {
-	if (dp_pktmbuf_l2_len(mbuf) != RTE_ETHER_HDR_LEN &&
-	    dp_pktmbuf_l2_len(mbuf) != VLAN_HDR_LEN)
-		return;
-
-	const struct rte_ether_hdr *eth
-		= rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
-
 	unsigned int pl;
 	char *bp;
 
@@ -105,22 +171,20 @@ npf_log_mac_fields(const struct rte_mbuf *mbuf,
 	memcpy(bp, mprefix, pl + 1);
 	bp += pl;
 
-	ether_ntoa_r(&eth->s_addr, bp);
+	ether_ntoa_r(&lr->lr_smac, bp);
 	bp += strlen(bp);
 
 	*bp++ = '-';
 	*bp++ = '>';
 
-	ether_ntoa_r(&eth->d_addr, bp);
+	ether_ntoa_r(&lr->lr_dmac, bp);
 	bp += strlen(bp);
 
 	*bp++ = ' ';
 	*bp++ = '\0';
 
 	/* Now the ethertype */
-	uint16_t etype = ntohs(ethtype(mbuf, RTE_ETHER_TYPE_VLAN));
-
-	snprintf(etype_buf, BUF_SIZE, "%s%04X", eprefix, etype);
+	snprintf(etype_buf, BUF_SIZE, "%s%04X", eprefix, lr->lr_etype);
 }
 
 static void
@@ -273,12 +337,21 @@ npf_log_icmpv6_header(const struct icmp6_hdr *icmp6,
 		class, type, icmp6->icmp6_code);
 }
 
+/* Per lcore rate limiting state and drop counters for a log rule */
+struct npf_log_stats {
+	uint64_t	ls_window;	/* soft_ticks at start of second */
+	uint32_t	ls_count;	/* records this second */
+	uint64_t	ls_limited;	/* not logged due to rate limit */
+	uint64_t	ls_dropped;	/* not logged as no buffer or ring */
+} __rte_cache_aligned;
+
 /*
  * Log action data structure
  */
 struct npf_log_data {
 	char       *ld_rule_buf;
 	uint32_t    ld_type;
+	uint32_t    ld_rate;	/* records per sec per lcore, 0 no limit */
 	bool        ld_is_l2;
 	bool        ld_is_nat44;
 
@@ -290,19 +363,98 @@ struct npf_log_data {
 	 * the caller context.
 	 */
 	char        ld_ifname[IFNAMSIZ];
+
+	/* Held by the rule, and by each record waiting to be written */
+	rte_atomic32_t ld_refcnt;
+
+	/* Serialises the threads sharing lcore 0's stats */
+	rte_spinlock_t ld_lock;
+
+	struct npf_log_stats *ld_stats;
 };
 
+static void *npf_log_writer(void *arg);
+
+/*
+ * Set up the per lcore rings and the writer thread the first time a log
+ * rule is created.  If that fails, packets are logged directly from the
+ * forwarding thread as before.
+ */
+static void
+npf_log_start(void)
+{
+	char name[RTE_RING_NAMESIZE];
+	pthread_t thread;
+	unsigned int id;
+
+	npf_log_rings = calloc(get_lcore_max() + 1, sizeof(*npf_log_rings));
+	if (!npf_log_rings)
+		goto fail;
+
+	npf_log_pool = rte_mempool_create("npf_log", NPF_LOG_POOL_SZ,
+					  sizeof(struct npf_log_rec),
+					  NPF_LOG_BURST, 0, NULL, NULL,
+					  NULL, NULL, SOCKET_ID_ANY, 0);
+	if (!npf_log_pool)
+		goto fail;
+
+	FOREACH_DP_LCORE(id) {
+		snprintf(name, sizeof(name), "npf_log_%u", id);
+		npf_log_rings[id] = rte_ring_create(name, NPF_LOG_RING_SZ,
+						    SOCKET_ID_ANY,
+						    (id ? RING_F_SP_ENQ : 0) |
+						    RING_F_SC_DEQ);
+		if (!npf_log_rings[id])
+			goto fail;
+	}
+
+	if (pthread_create(&thread, NULL, npf_log_writer, NULL) != 0)
+		goto fail;
+
+	pthread_setname_np(thread, "dataplane/log");
+	pthread_detach(thread);
+	npf_log_async = true;
+	return;
+
+ fail:
+	RTE_LOG(ERR, DATAPLANE,
+		"npf log: async setup failed, logging inline\n");
+	if (npf_log_rings) {
+		FOREACH_DP_LCORE(id)
+			rte_ring_free(npf_log_rings[id]);
+		free(npf_log_rings);
+		npf_log_rings = NULL;
+	}
+	rte_mempool_free(npf_log_pool);
+	npf_log_pool = NULL;
+}
+
 /*
  * Log creator
  *
  * Pre-compute as much as possible from the rule and its attach point.
+ *
+ * The optional argument is the number of records per second the rule may
+ * log on each lcore, e.g. "rproc=log(100)".  0 means no limit.
  */
 static int
-npf_log_create(npf_rule_t *rl, const char *args __unused, void **handle)
+npf_log_create(npf_rule_t *rl, const char *args, void **handle)
 {
 	struct npf_log_data *ld;
 	enum npf_ruleset_type rlset_type;
 	const char *rstype_name;
+	unsigned long rate = NPF_LOG_RATE;
+	char *end;
+
+	if (args && *args) {
+		errno = 0;
+		rate = strtoul(args, &end, 10);
+		if (errno || *end || rate > UINT32_MAX) {
+			RTE_LOG(ERR, FIREWALL, "npf log: bad rate \"%s\"\n",
+				args);
+			return -EINVAL;
+		}
+	}
 
 	rlset_type = npf_type_of_ruleset(npf_ruleset(rl));
 	rstype_name = npf_get_ruleset_type_log_name(rlset_type);
@@ -310,9 +462,14 @@ npf_log_create(npf_rule_t *rl, const char *args __unused, void **handle)
 	if (!rstype_name)
 		return -EINVAL;
 
-	ld = calloc(1, sizeof(*ld));
+	ld = zmalloc_aligned(sizeof(*ld) +
+			     sizeof(struct npf_log_stats) *
+			     (get_lcore_max() + 1));
 	if (!ld)
 		return -ENOMEM;
+	ld->ld_stats = (void *)&ld[1];
+	ld->ld_rate = rate;
+	rte_spinlock_init(&ld->ld_lock);
 
 	const char *rlname = npf_rule_get_name(rl);
 	const struct ifnet *ifp;
@@ -354,20 +511,30 @@ npf_log_create(npf_rule_t *rl, const char *args __unused, void **handle)
 			ld->ld_has_ether = true;
 	}
 
+	rte_atomic32_set(&ld->ld_refcnt, 1);
+	pthread_once(&npf_log_once, npf_log_start);
+
 	*handle = ld;
 	return 0;
 }
 
+static void
+npf_log_data_put(struct npf_log_data *ld)
+{
+	if (rte_atomic32_dec_and_test(&ld->ld_refcnt)) {
+		free(ld->ld_rule_buf);
+		free(ld);
+	}
+}
+
 /* Log destructor */
 static void
 npf_log_destroy(void *handle)
 {
 	struct npf_log_data *ld = handle;
 
-	if (ld) {
-		free(ld->ld_rule_buf);
-		free(ld);
-	}
+	if (ld)
+		npf_log_data_put(ld);
 }
 
 /*
@@ -380,34 +547,34 @@ npf_log_destroy(void *handle)
  * "tcp=(ACK,res:0,doff:8,seq:0xf1ffdee5,ack:0x262b9403,win:4,urgp:0)"
  */
 static void
-npf_log_ip_pkt(npf_cache_t *npc, char *out_buf, uint32_t buf_size,
+npf_log_ip_pkt(const struct npf_log_ip *li, char *out_buf, uint32_t buf_size,
 	       char const *macs, bool const icmp_err)
 {
 	/* Fields extracted from the IP header, excluding addresses */
 	int addr_family
-		= (npc->npc_alen == sizeof(struct in_addr)) ? AF_INET : AF_INET6;
+		= (li->li_alen == sizeof(struct in_addr)) ? AF_INET : AF_INET6;
 	char ip_buf[BUF_SIZE];
 	if (addr_family == AF_INET) {
-		const struct ip *ip = &npc->npc_ip.v4;
+		const struct ip *ip = &li->li_ip.v4;
 		npf_log_ipv4_header(ip, ip_buf, BUF_SIZE);
 	} else {
-		const struct ip6_hdr *ip6 = &npc->npc_ip.v6;
+		const struct ip6_hdr *ip6 = &li->li_ip.v6;
 		npf_log_ipv6_header(ip6, ip_buf, BUF_SIZE);
 	}
 
 	/* get ip/ipv6 srcip and dstip */
 	char s_ip_buf[INET6_ADDRSTRLEN], d_ip_buf[INET6_ADDRSTRLEN];
-	inet_ntop(addr_family, npf_cache_srcip(npc),
+	inet_ntop(addr_family, &li->li_src,
 			s_ip_buf, INET6_ADDRSTRLEN);
-	inet_ntop(addr_family, npf_cache_dstip(npc),
+	inet_ntop(addr_family, &li->li_dst,
 			d_ip_buf, INET6_ADDRSTRLEN);
 
 	/* Extract transport port fields */
 	char ports_buf[BUF_SIZE];
 	ports_buf[0] = '\0';
 
-	if (npf_iscached(npc, NPC_L4PORTS)) {
-		const struct npf_ports *ports = &npc->npc_l4.ports;
+	if (li->li_info & NPC_L4PORTS) {
+		const struct npf_ports *ports = &li->li_l4.ports;
 
 		snprintf(ports_buf, sizeof(ports_buf), " port=%u->%u",
 			 ntohs(ports->s_port), ntohs(ports->d_port));
@@ -418,9 +585,9 @@ npf_log_ip_pkt(npf_cache_t *npc, char *out_buf, uint32_t buf_size,
 	proto_buf[0] = '\0';
 	char const *prname;
 
-	const void *l4_hdr = &npc->npc_l4;
+	const void *l4_hdr = &li->li_l4;
 
-	const uint8_t proto = npf_cache_ipproto(npc);
+	const uint8_t proto = li->li_proto;
 	switch (proto) {
 	case IPPROTO_TCP:
 		prname = "tcp";
@@ -449,7 +616,7 @@ npf_log_ip_pkt(npf_cache_t *npc, char *out_buf, uint32_t buf_size,
 	}
 
 	/* If this is an error embedded packet, it may be truncated */
-	if (!npf_iscached(npc, NPC_SHORT_ICMP_ERR)) {
+	if (!(li->li_info & NPC_SHORT_ICMP_ERR)) {
 		switch (proto) {
 		case IPPROTO_TCP:
 			npf_log_tcp_header(l4_hdr, proto_buf, PRBUF_SIZE);
@@ -485,29 +652,47 @@ npf_log_ip_pkt(npf_cache_t *npc, char *out_buf, uint32_t buf_size,
 		macs, ip_buf, proto_buf);
 }
 
+/* Write out a formatted log line */
+static void
+npf_log_line(uint32_t log_type, const char *line)
+{
+	NPF_LOG(log_type, "%s", line);
+
+	if (unlikely(npf_log_ut_stream != NULL)) {
+		pthread_mutex_lock(&npf_log_ut_lock);
+		if (npf_log_ut_stream) {
+			fprintf(npf_log_ut_stream, "%s\n", line);
+			fflush(npf_log_ut_stream);
+			npf_log_ut_lines++;
+		}
+		pthread_mutex_unlock(&npf_log_ut_lock);
+	}
+}
+
 /*
  * A log line typically looks as follows
  *
  *    "Out:dp0s5 PASS fw rule stPassAllIn:10 "
  *
- * followed by the per packet information as shown above.
+ * followed by the per packet information as shown above.  Consecutive
+ * records for the same flow are written once, with a repeat count.
  */
-void
-npf_log_pkt(npf_cache_t *npc, struct rte_mbuf *mbuf, npf_rule_t *rl,
-	    int dir)
+static void
+npf_log_rec_write(const struct npf_log_rec *lr, unsigned int repeats)
 {
-	struct npf_log_data *ld = npf_rule_rproc_handle_for_logger(rl);
-	if (!ld)
-		return;
-
+	const struct npf_log_data *ld = lr->lr_ld;
 	char const *rule = ld->ld_rule_buf;
 	uint32_t log_type = ld->ld_type;
 	char const *if_name = ld->ld_ifname;
-	char const *fate = npf_rule_get_pass(rl) ?
+	char const *fate = lr->lr_pass ?
 				(ld->ld_is_nat44 ? "TRAN" : "PASS") :
 				(ld->ld_is_nat44 ? "EXCL" : "DROP");
-	bool const want_mac =
-		ld->ld_has_ether && (dir == PFIL_IN || ld->ld_is_l2);
+	char rpt[BUF_SIZE];
+	char line[2 * 1024 + 256];
+
+	rpt[0] = '\0';
+	if (repeats)
+		snprintf(rpt, sizeof(rpt), " repeat=%u", repeats);
 
 	/* Get the MAC fields */
 	char macs[ETH_ADDR_STR_LEN*2 + sizeof("-> ") + sizeof("macs=")];
@@ -515,39 +700,39 @@ npf_log_pkt(npf_cache_t *npc, struct rte_mbuf *mbuf, npf_rule_t *rl,
 	macs[0] = '\0';
 	etype[0] = '\0';
 
-	if (want_mac)
-		npf_log_mac_fields(mbuf, "macs=", macs, "etype=", etype);
+	if (lr->lr_has_mac)
+		npf_log_mac_fields(lr, "macs=", macs, "etype=", etype);
 
-	char const *dirn = (dir == PFIL_IN) ? " In" : "Out";
+	char const *dirn = (lr->lr_dir == PFIL_IN) ? " In" : "Out";
 
 	/* Non IP packets handled here */
-	if (!npf_iscached(npc, NPC_IP46)) {
-		NPF_LOG(log_type,
-			"%s:%s %s %s "
-			"%s %s",
-			dirn, if_name, fate, rule,
-			macs, etype);
+	if (!(lr->lr_ip.li_info & NPC_IP46)) {
+		snprintf(line, sizeof(line),
+			 "%s:%s %s %s "
+			 "%s %s%s",
+			 dirn, if_name, fate, rule,
+			 macs, etype, rpt);
+		npf_log_line(log_type, line);
 		return;
 	}
 
 	/* The following packet is IP only */
 
-	bool const icmp_err = npf_iscached(npc, NPC_ICMP_ERR);
+	bool const icmp_err = lr->lr_ip.li_info & NPC_ICMP_ERR;
 
 	char main_buf[1024];
 	main_buf[0] = '\0';
 
-	npf_log_ip_pkt(npc, main_buf, sizeof(main_buf), macs, icmp_err);
+	npf_log_ip_pkt(&lr->lr_ip, main_buf, sizeof(main_buf), macs, icmp_err);
 
 	/* The simple IP case, not an ICMP error */
-	if (!icmp_err) {
-simple_ip:
-		NPF_LOG(log_type,
-			"%s:%s %s %s "
-			"%s",
-			dirn, if_name, fate, rule,
-			main_buf);
-
+	if (!lr->lr_has_err) {
+		snprintf(line, sizeof(line),
+			 "%s:%s %s %s "
+			 "%s%s",
+			 dirn, if_name, fate, rule,
+			 main_buf, rpt);
+		npf_log_line(log_type, line);
 		return;
 	}
 
@@ -555,6 +740,37 @@ simple_ip:
 	char err_buf[1024];
 	err_buf[0] = '\0';
 
+	npf_log_ip_pkt(&lr->lr_err, err_buf, sizeof(err_buf), "",
+		       lr->lr_err.li_info & NPC_ICMP_ERR);
+
+	snprintf(line, sizeof(line),
+		 "%s:%s %s %s "
+		 "%s >TRIGGER> %s%s",
+		 dirn, if_name, fate, rule,
+		 main_buf, err_buf, rpt);
+	npf_log_line(log_type, line);
+}
+
+static void
+npf_log_ip_save(const npf_cache_t *npc, struct npf_log_ip *li)
+{
+	li->li_info = npc->npc_info;
+	if (!npf_iscached(npc, NPC_IP46))
+		return;
+
+	li->li_alen = npc->npc_alen;
+	li->li_proto = npf_cache_ipproto(npc);
+	memcpy(&li->li_ip, &npc->npc_ip, sizeof(li->li_ip));
+	memcpy(&li->li_l4, &npc->npc_l4, sizeof(li->li_l4));
+	memcpy(&li->li_src, npf_cache_srcip(npc), npc->npc_alen);
+	memcpy(&li->li_dst, npf_cache_dstip(npc), npc->npc_alen);
+}
+
+/* Save the packet embedded in an ICMP error, if it can be parsed */
+static bool
+npf_log_err_save(npf_cache_t *npc, struct rte_mbuf *mbuf,
+		 struct npf_log_ip *li)
+{
 	uint16_t ether_proto;
 	if (npf_iscached(npc, NPC_IP4))
 		ether_proto = htons(RTE_ETHER_TYPE_IPV4);
@@ -566,7 +782,7 @@ simple_ip:
 	/* Find the start of the packet embedded in the ICMP error. */
 	n_ptr = nbuf_advance(&mbuf, n_ptr, ICMP_MINLEN);
 	if (!n_ptr)
-		goto simple_ip;
+		return false;
 
 	/* Init the embedded npc. */
 	npf_cache_t enpc;
@@ -574,16 +790,218 @@ simple_ip:
 
 	/* Inspect the embedded packet. */
 	if (!npf_cache_all_at(&enpc, mbuf, n_ptr, ether_proto, true))
-		goto simple_ip;
+		return false;
+
+	npf_log_ip_save(&enpc, li);
+	return true;
+}
 
-	npf_log_ip_pkt(&enpc, err_buf, sizeof(err_buf), "",
-		       npf_iscached(&enpc, NPC_ICMP_ERR));
+/* Records for the same rule, direction and flow are coalesced */
+static bool
+npf_log_rec_dup(const struct npf_log_rec *a, const struct npf_log_rec *b)
+{
+	if (a->lr_ld != b->lr_ld || a->lr_dir != b->lr_dir ||
+	    a->lr_pass != b->lr_pass || a->lr_has_err || b->lr_has_err ||
+	    a->lr_has_mac != b->lr_has_mac ||
+	    a->lr_ip.li_info != b->lr_ip.li_info)
+		return false;
+
+	if (!(a->lr_ip.li_info & NPC_IP46))
+		return !a->lr_has_mac ||
+			(a->lr_etype == b->lr_etype &&
+			 rte_is_same_ether_addr(&a->lr_smac, &b->lr_smac) &&
+			 rte_is_same_ether_addr(&a->lr_dmac, &b->lr_dmac));
+
+	return a->lr_ip.li_proto == b->lr_ip.li_proto &&
+		!memcmp(&a->lr_ip.li_src, &b->lr_ip.li_src,
+			a->lr_ip.li_alen) &&
+		!memcmp(&a->lr_ip.li_dst, &b->lr_ip.li_dst,
+			a->lr_ip.li_alen) &&
+		(!(a->lr_ip.li_info & NPC_L4PORTS) ||
+		 !memcmp(&a->lr_ip.li_l4.ports, &b->lr_ip.li_l4.ports,
+			 sizeof(a->lr_ip.li_l4.ports))) &&
+		(a->lr_ip.li_proto != IPPROTO_TCP ||
+		 a->lr_ip.li_l4.tcp.th_flags == b->lr_ip.li_l4.tcp.th_flags);
+}
 
-	NPF_LOG(log_type,
-		"%s:%s %s %s "
-		"%s >TRIGGER> %s",
-		dirn, if_name, fate, rule,
-		main_buf, err_buf);
+static void
+npf_log_rec_free(struct npf_log_rec *lr)
+{
+	npf_log_data_put(lr->lr_ld);
+	rte_mempool_put(npf_log_pool, lr);
+}
+
+/*
+ * Log writer thread.  Drains the per lcore rings, formats the records
+ * and writes them out, so that none of that is done on the forwarding
+ * cores.
+ */
+static void *
+npf_log_writer(void *arg __unused)
+{
+	struct npf_log_rec *recs[NPF_LOG_BURST];
+	struct npf_log_rec *last = NULL;
+	unsigned int repeats = 0;
+	unsigned int id, i, n, total;
+
+	for (;;) {
+		total = 0;
+
+		if (unlikely(npf_log_ut_paused)) {
+			usleep(NPF_LOG_IDLE_USECS);
+			continue;
+		}
+
+		FOREACH_DP_LCORE(id) {
+			n = rte_ring_sc_dequeue_burst(npf_log_rings[id],
+						      (void **)recs,
+						      NPF_LOG_BURST, NULL);
+			total += n;
+
+			for (i = 0; i < n; i++) {
+				if (last && repeats < NPF_LOG_REPEAT_MAX &&
+				    npf_log_rec_dup(last, recs[i])) {
+					repeats++;
+					npf_log_rec_free(recs[i]);
+					continue;
+				}
+				if (last) {
+					npf_log_rec_write(last, repeats);
+					npf_log_rec_free(last);
+				}
+				last = recs[i];
+				repeats = 0;
+			}
+		}
+
+		if (total)
+			continue;
+
+		/* Nothing more to coalesce with, so write what is held */
+		if (last) {
+			npf_log_rec_write(last, repeats);
+			npf_log_rec_free(last);
+			last = NULL;
+			repeats = 0;
+		}
+		usleep(NPF_LOG_IDLE_USECS);
+	}
+
+	return NULL;
+}
+
+/* Allow the rule's rate of records per second on each lcore */
+static bool
+npf_log_rate_ok(const struct npf_log_data *ld, struct npf_log_stats *ls)
+{
+	uint64_t now = soft_ticks;
+
+	if (!ld->ld_rate)
+		return true;
+
+	if (now - ls->ls_window >= 1000) {
+		ls->ls_window = now;
+		ls->ls_count = 0;
+	}
+
+	if (ls->ls_count >= ld->ld_rate) {
+		ls->ls_limited++;
+		return false;
+	}
+	ls->ls_count++;
+	return true;
+}
+
+static inline void
+npf_log_lock(struct npf_log_data *ld, unsigned int core)
+{
+	if (unlikely(core == 0))
+		rte_spinlock_lock(&ld->ld_lock);
+}
+
+static inline void
+npf_log_unlock(struct npf_log_data *ld, unsigned int core)
+{
+	if (unlikely(core == 0))
+		rte_spinlock_unlock(&ld->ld_lock);
+}
+
+static void
+npf_log_dropped(struct npf_log_data *ld, unsigned int core)
+{
+	npf_log_lock(ld, core);
+	ld->ld_stats[core].ls_dropped++;
+	npf_log_unlock(ld, core);
+}
+
+void
+npf_log_pkt(npf_cache_t *npc, struct rte_mbuf *mbuf, npf_rule_t *rl,
+	    int dir)
+{
+	struct npf_log_data *ld = npf_rule_rproc_handle_for_logger(rl);
+	struct npf_log_stats *ls;
+	struct npf_log_rec *lr;
+	struct npf_log_rec rec;
+	unsigned int core;
+	bool ok;
+	int rc;
+
+	if (!ld)
+		return;
+
+	core = dp_lcore_id();
+	ls = &ld->ld_stats[core];
+	npf_log_lock(ld, core);
+	ok = npf_log_rate_ok(ld, ls);
+	npf_log_unlock(ld, core);
+	if (!ok)
+		return;
+
+	if (likely(npf_log_async)) {
+		if (unlikely(rte_mempool_get(npf_log_pool,
+					     (void **)&lr) < 0)) {
+			npf_log_dropped(ld, core);
+			return;
+		}
+	} else
+		lr = &rec;
+
+	lr->lr_ld = ld;
+	lr->lr_dir = dir;
+	lr->lr_pass = npf_rule_get_pass(rl);
+	lr->lr_has_mac = false;
+	lr->lr_has_err = false;
+
+	if (ld->ld_has_ether && (dir == PFIL_IN || ld->ld_is_l2) &&
+	    (dp_pktmbuf_l2_len(mbuf) == RTE_ETHER_HDR_LEN ||
+	     dp_pktmbuf_l2_len(mbuf) == VLAN_HDR_LEN)) {
+		const struct rte_ether_hdr *eth
+			= rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+
+		rte_ether_addr_copy(&eth->s_addr, &lr->lr_smac);
+		rte_ether_addr_copy(&eth->d_addr, &lr->lr_dmac);
+		lr->lr_etype = ntohs(ethtype(mbuf, RTE_ETHER_TYPE_VLAN));
+		lr->lr_has_mac = true;
+	}
+
+	npf_log_ip_save(npc, &lr->lr_ip);
+	if (npf_iscached(npc, NPC_IP46) && npf_iscached(npc, NPC_ICMP_ERR))
+		lr->lr_has_err = npf_log_err_save(npc, mbuf, &lr->lr_err);
+
+	if (unlikely(lr == &rec)) {
+		npf_log_rec_write(lr, 0);
+		return;
+	}
+
+	rte_atomic32_inc(&ld->ld_refcnt);
+	if (likely(core))
+		rc = rte_ring_sp_enqueue(npf_log_rings[core], lr);
+	else
+		rc = rte_ring_mp_enqueue(npf_log_rings[core], lr);
+	if (unlikely(rc != 0)) {
+		npf_log_dropped(ld, core);
+		npf_log_rec_free(lr);
+	}
 }
 
 static bool
@@ -594,6 +1012,69 @@ npf_log(npf_cache_t *npc __unused, struct rte_mbuf **nbuf __unused,
 	return true;
 }
 
+/*
+ * Log rproc JSON
+ */
+static void
+npf_log_json(json_writer_t *json,
+	     npf_rule_t *rl __unused,
+	     const char *params __unused,
+	     void *handle)
+{
+	struct npf_log_data *ld = handle;
+	uint64_t limited = 0, dropped = 0;
+	unsigned int id;
+
+	if (!ld)
+		return;
+
+	FOREACH_DP_LCORE(id) {
+		limited += ld->ld_stats[id].ls_limited;
+		dropped += ld->ld_stats[id].ls_dropped;
+	}
+
+	jsonw_uint_field(json, "log-rate", ld->ld_rate);
+	jsonw_uint_field(json, "log-rate-limited", limited);
+	jsonw_uint_field(json, "log-dropped", dropped);
+}
+
+static void
+npf_log_clear_stats(void *handle)
+{
+	struct npf_log_data *ld = handle;
+	unsigned int id;
+
+	FOREACH_DP_LCORE(id) {
+		npf_log_lock(ld, id);
+		ld->ld_stats[id].ls_limited = 0;
+		ld->ld_stats[id].ls_dropped = 0;
+		npf_log_unlock(ld, id);
+	}
+}
+
+void npf_log_pause_ut(bool pause)
+{
+	npf_log_ut_paused = pause;
+}
+
+void npf_log_stream_ut(FILE *f)
+{
+	pthread_mutex_lock(&npf_log_ut_lock);
+	npf_log_ut_stream = f;
+	npf_log_ut_lines = 0;
+	pthread_mutex_unlock(&npf_log_ut_lock);
+}
+
+unsigned int npf_log_lines_ut(void)
+{
+	unsigned int lines;
+
+	pthread_mutex_lock(&npf_log_ut_lock);
+	lines = npf_log_ut_lines;
+	pthread_mutex_unlock(&npf_log_ut_lock);
+	return lines;
+}
+
 const npf_rproc_ops_t npf_log_ops = {
 	.ro_name   = "log",
 	.ro_type   = NPF_RPROC_TYPE_ACTION,
@@ -603,4 +1084,6 @@ const npf_rproc_ops_t npf_log_ops = {
 	.ro_ctor   = npf_log_create,
 	.ro_dtor   = npf_log_destroy,
 	.ro_action = npf_log,
+	.ro_json   = npf_log_json,
+	.ro_clear_stats = npf_log_clear_stats,
 };
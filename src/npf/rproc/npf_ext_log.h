@@ -7,6 +7,9 @@
 #ifndef NPF_EXT_LOG_H
 #define NPF_EXT_LOG_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
 struct rte_mbuf;
 struct npf_cache;
 struct npf_rule;
@@ -15,4 +18,12 @@ struct ifnet;
 void npf_log_pkt(struct npf_cache *npc, struct rte_mbuf *mbuf,
 		 struct npf_rule *rl, int dir);
 
+/*
+ * Test hooks.  Hold logged records in the rings until unpaused, and copy
+ * each line written to f, counting them.
+ */
+void npf_log_pause_ut(bool pause);
+void npf_log_stream_ut(FILE *f);
+unsigned int npf_log_lines_ut(void);
+
 #endif /* NPF_EXT_LOG_H */
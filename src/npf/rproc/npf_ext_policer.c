@@ -9,7 +9,9 @@
 #include <errno.h>
 #include <rte_atomic.h>
 #include <rte_branch_prediction.h>
+#include <rte_common.h>
 #include <rte_ether.h>
+#include <rte_lcore.h>
 #include <rte_log.h>
 #include <rte_mbuf.h>
 #include <rte_spinlock.h>
@@ -31,20 +33,37 @@
 
 struct ifnet;
 
+/*
+ * Per-core state.  Each core claims credit from the shared bucket in
+ * slices and spends it locally, so the shared bucket, and its lock, are
+ * only touched once per slice rather than once per packet.
+ *
+ * A slice is only spent in the interval it was claimed in.  The slice
+ * word holds the interval (epoch) alongside the credit, so that the core
+ * refilling the bucket can take back the credit of an idle core with a
+ * single compare-and-set.
+ */
 struct policer_cntrs {
 	uint64_t excess;
 	uint64_t bytes_excess;
-	uint64_t pad[6];
+	uint64_t slice;		/* Epoch and credit claimed, not yet used */
+	uint64_t pad[5];
 };
 
+#define	POLICE_SLICE(epoch, credit)	((uint64_t)(epoch) << 32 | (credit))
+#define	POLICE_SLICE_EPOCH(s)		((uint32_t)((s) >> 32))
+#define	POLICE_SLICE_CREDIT(s)		((uint32_t)(s))
+
 struct npf_policer {
 	uint64_t time;		/* Time of last update */
 	uint32_t tc;		/* TC in ms */
 	rte_atomic32_t credit;	/* Packets/bytes left to send this interval */
-	rte_spinlock_t lock;
+	rte_atomic32_t epoch;	/* Number of refills */
+	rte_spinlock_t lock;	/* Serialises refilling the credit */
 	struct policer_cntrs  *cntrs;
 	uint32_t rate;		/* Packets/bytes per interval */
 	uint32_t burst;		/* burst bytes */
+	uint32_t slice;		/* Credit claimed by a core at a time */
 	int16_t overhead;	/* L2 overhead per packet */
 
 	enum {
@@ -62,7 +81,10 @@ struct npf_policer {
 };
 
 #define	ONE_SECOND		1000
-#define	POLICE_PARAMS		8
+#define	POLICE_PARAMS		9
+#define	POLICE_TOLERANCE	1	/* default, percent of rate + burst */
+#define	POLICE_SLICE_FRAMES	4	/* min slice, in max sized frames */
+#define	POLICE_SLICE_PKTS	32	/* min slice of a packets policer */
 #define	POLICE_ENABLE_INNER	0x80
 #define	POLICE_PCP_MASK		0x07
 
@@ -75,6 +97,9 @@ npf_policer_create(npf_rule_t *rl, const char *params, void **handle)
 	uint64_t pps;
 	uint32_t burst;
 	uint32_t tcs_per_sec;
+	uint32_t tolerance = POLICE_TOLERANCE;
+	unsigned int ncores;
+	uint64_t slice;
 	int16_t overhead;
 	uint32_t tc;
 	union police_cmd {
@@ -87,6 +112,7 @@ npf_policer_create(npf_rule_t *rl, const char *params, void **handle)
 			char *overhead;
 			char *tc;
 			char *inner;
+			char *tolerance;
 		};
 		char *ptrs[POLICE_PARAMS];
 	} police_info;
@@ -110,12 +136,13 @@ npf_policer_create(npf_rule_t *rl, const char *params, void **handle)
 	rte_spinlock_init(&po->lock);
 
 	/*
-	 * The policer can have up to 8 parameters, 7 is ok though
-	 * since a value is only passed for marking.
+	 * The policer can have up to 9 parameters, 7 is ok though
+	 * since a value is only passed for marking, and the tolerance
+	 * is optional.
 	 */
 	no_vars = rte_strsplit(args, strlen(args), police_info.ptrs,
 			       POLICE_PARAMS, ',');
-	if (no_vars < (POLICE_PARAMS - 1)) {
+	if (no_vars < (POLICE_PARAMS - 2)) {
 		RTE_LOG(ERR, QOS,
 			"Invalid input argument string for policer\n");
 		free(po);
@@ -127,7 +154,9 @@ npf_policer_create(npf_rule_t *rl, const char *params, void **handle)
 	rate = strtoull(police_info.rate, NULL, 10);
 	burst = strtoul(police_info.burst, NULL, 10);
 	tc = strtoul(police_info.tc, NULL, 10);
-	if (errno != 0 || tc == 0) {
+	if (no_vars == POLICE_PARAMS)
+		tolerance = strtoul(police_info.tolerance, NULL, 10);
+	if (errno != 0 || tc == 0 || tolerance > 100) {
 		RTE_LOG(ERR, QOS,
 			"Invalid input argument string %s\n", strerror(errno));
 		free(po);
@@ -197,6 +226,25 @@ npf_policer_create(npf_rule_t *rl, const char *params, void **handle)
 		rte_atomic32_set(&po->credit, po->rate);
 	}
 
+	/*
+	 * Size the slices the cores claim.  The tolerance lets fast
+	 * policers claim more at a time, but a slice always covers a few
+	 * packets, else nearly every packet would go to the shared bucket.
+	 * No core claims more than its share of an interval, so that at low
+	 * rates one core can't hold credit the others need.  What bounds
+	 * the credit stranded in the slices of idle cores is not the slice
+	 * size but policer_reclaim(), which returns it within two intervals.
+	 */
+	ncores = rte_lcore_count();
+	slice = ((uint64_t)po->rate + po->burst) * tolerance / 100 / ncores;
+	if (po->type == POLICE_BYTES)
+		slice = RTE_MAX(slice, (uint64_t)POLICE_SLICE_FRAMES *
+				RTE_ETHER_MAX_VLAN_FRAME_LEN);
+	else
+		slice = RTE_MAX(slice, (uint64_t)POLICE_SLICE_PKTS);
+	slice = RTE_MIN(slice, (uint64_t)po->rate / ncores);
+	po->slice = RTE_MAX(slice, (uint64_t)1);
+
 	if (strcmp(police_info.action, "pass") == 0)
 		po->action = ACTION_PASS;
 	else if (strcmp(police_info.action, "drop") == 0)
@@ -218,9 +266,10 @@ npf_policer_create(npf_rule_t *rl, const char *params, void **handle)
 	}
 
 	RTE_LOG(DEBUG, QOS,
-		"Policer create (%d%s, %u, %d, %d, %d, %u) %p\n",
+		"Policer create (%d%s, %u, %d, %d, %d, %u, %u) %p\n",
 		po->rate, (po->type == POLICE_BYTES ? "bytes/tc" : "pkts/tc"),
-		po->burst, po->action, po->mark_val, po->overhead, po->tc, po);
+		po->burst, po->action, po->mark_val, po->overhead, po->tc,
+		po->slice, po);
 
 	*handle = po;
 
@@ -236,116 +285,210 @@ npf_policer_destroy(void *handle)
 	free(po);
 }
 
-static inline void
-update_tokens(uint32_t credit, struct npf_policer *po, const uint64_t ticks)
+/* Has an interval passed since the credit was last topped up? */
+static inline bool
+policer_due(const struct npf_policer *po)
 {
-	po->time += ticks;
-	if (credit > (po->rate + po->burst))
-		credit = po->rate + po->burst;
-	rte_atomic32_set(&po->credit, credit);
+	return soft_ticks - po->time >= po->tc;
 }
 
-static bool
-npf_policer(npf_cache_t *npc, struct rte_mbuf **nbuf, void *arg,
-	    npf_session_t *se __unused, npf_rproc_result_t *result)
+/*
+ * Add to the shared credit, up to the bucket size.  Other cores may be
+ * claiming from it at the same time, so this can't be a plain set.
+ */
+static void
+policer_add(struct npf_policer *po, uint32_t tokens)
 {
-	struct npf_policer	*po = arg;
-	int32_t			tok_with_oh;
-	uint32_t		tokens;
-	unsigned int		core;
+	int32_t credit;
+	uint32_t new;
+
+	do {
+		credit = rte_atomic32_read(&po->credit);
+		new = RTE_MIN((uint32_t)credit + tokens, po->rate + po->burst);
+	} while (!rte_atomic32_cmpset((volatile uint32_t *)&po->credit.cnt,
+				      credit, new));
+}
 
-	/* Dropped packets do not count against policer */
-	if (result->decision == NPF_DECISION_BLOCK)
-		return true;
+/*
+ * Give credit a core didn't use back to the shared bucket.  A packets
+ * policer starts each interval afresh, so there it just expires.
+ */
+static void
+policer_return(struct npf_policer *po, uint32_t unused)
+{
+	if (po->type == POLICE_BYTES && unused)
+		policer_add(po, unused);
+}
 
-	/* Assume this is a setup problem */
-	if (unlikely(po == NULL)) {
-		result->decision = NPF_DECISION_BLOCK;
-		return true;
+/*
+ * Take back the credit of cores that haven't claimed any since before
+ * the last interval, i.e. have gone idle, so that it isn't stranded.
+ * Cores with a slice from the last interval may still be spending it,
+ * and give it back themselves on their next claim.  Called with the
+ * policer lock held, once per interval.
+ */
+static void
+policer_reclaim(struct npf_policer *po, uint32_t epoch)
+{
+	unsigned int id;
+	uint64_t s;
+
+	FOREACH_DP_LCORE(id) {
+		s = po->cntrs[id].slice;
+		if (!POLICE_SLICE_CREDIT(s) ||
+		    (uint32_t)(epoch - POLICE_SLICE_EPOCH(s)) < 2)
+			continue;
+
+		if (rte_atomic64_cmpset(&po->cntrs[id].slice, s,
+					POLICE_SLICE(POLICE_SLICE_EPOCH(s), 0)))
+			policer_return(po, POLICE_SLICE_CREDIT(s));
 	}
+}
+
+/*
+ * Add the credit for the intervals that have passed since the last
+ * update, and start a new epoch.  Called with the policer lock held.
+ */
+static void
+policer_refill(struct npf_policer *po)
+{
+	if (!policer_due(po))
+		return;
 
 	if (po->type == POLICE_BYTES) {
 		uint64_t	lapsed;
 		unsigned int	intervals;
 
-		rte_spinlock_lock(&po->lock);
-
 		lapsed = soft_ticks - po->time;
 
 		/*
-		 * Try to add some tokens
 		 * First we check how many intervals have passed since
 		 * the last update.
 		 */
 		intervals = lapsed / po->tc;
-		if (intervals > 2) {
-			tokens = rte_atomic32_read(&po->credit);
-			tokens += intervals * po->rate;
-			update_tokens(tokens, po,
-				      ((uint64_t)po->tc * intervals));
+		if (intervals <= 2)
+			intervals = 1;
+		po->time += (uint64_t)po->tc * intervals;
+		policer_add(po, RTE_MIN((uint64_t)intervals * po->rate,
+					(uint64_t)po->rate + po->burst));
+	} else {
+		uint64_t tc_lapsed = po->time + po->tc;
+
 		/*
-		 * This will hopefully be the normal case where we're
-		 * processing multiple packets per TC.  In this path
-		 * we don't do the complex operations.
+		 * If more than 2 Tcs have lapsed
 		 */
-		} else if (lapsed > po->tc) {
-			tokens = rte_atomic32_read(&po->credit);
-			tokens += po->rate;
-			update_tokens(tokens, po, po->tc);
-		}
+		if (soft_ticks >= (tc_lapsed + po->tc))
+			po->time = soft_ticks;
+		else
+			po->time += po->tc;
+		rte_atomic32_set(&po->credit, po->rate);
+	}
+
+	rte_atomic32_inc(&po->epoch);
+	policer_reclaim(po, rte_atomic32_read(&po->epoch));
+}
+
+/*
+ * The core's slice doesn't cover the packet, so claim another from the
+ * shared bucket.  The lock is only taken to top the bucket up once an
+ * interval has passed, and if another core is already doing so then
+ * just use what is there.
+ */
+static bool
+policer_claim(struct npf_policer *po, struct policer_cntrs *pc,
+	      uint32_t need)
+{
+	uint32_t epoch, held, want;
+	int32_t credit, take;
+	uint64_t s;
 
+	if (policer_due(po) && rte_spinlock_trylock(&po->lock)) {
+		policer_refill(po);
 		rte_spinlock_unlock(&po->lock);
+	}
 
-		/*
-		 * Now we can check the tokens and if we have enough credit
-		 * subtract them and let the packet go.  NB for stats we
-		 * report L3 bytes sent/dropped, for token bucket we include
-		 * the L2 overhead if configured.
-		 */
-		tokens = rte_pktmbuf_pkt_len(*nbuf) - dp_pktmbuf_l2_len(*nbuf);
-		tok_with_oh = tokens + po->overhead;
-		if (tok_with_oh < 0)
-			tok_with_oh = 1;
-		if (tok_with_oh <= po->credit.cnt) {
-			rte_atomic32_sub(&po->credit, tok_with_oh);
-			return true;
-		}
-	} else {
-		uint64_t tc_lapsed;
+	epoch = rte_atomic32_read(&po->epoch);
+	s = pc->slice;
+	held = POLICE_SLICE_CREDIT(s);
 
-		/*
-		 * If we have available bandwidth let the packet through.
-		 */
-		if (po->credit.cnt) {
-			rte_atomic32_sub(&po->credit, 1);
-			return true;
-		}
+	/* Anything left from an earlier interval goes back first */
+	if (POLICE_SLICE_EPOCH(s) != epoch) {
+		s = rte_atomic64_exchange(&pc->slice, POLICE_SLICE(epoch, 0));
+		policer_return(po, POLICE_SLICE_CREDIT(s));
+		held = 0;
+	}
 
-		/*
-		 * Try and replenish tokens
-		 */
-		rte_spinlock_lock(&po->lock);
-		tc_lapsed = po->time + po->tc;
-		if (soft_ticks >= tc_lapsed) {
-			/*
-			 * If more than 2 Tcs have lapsed
-			 */
-			if (soft_ticks >= (tc_lapsed + po->tc))
-				po->time = soft_ticks;
-			else
-				po->time += po->tc;
-			rte_atomic32_set(&po->credit, po->rate);
-			rte_spinlock_unlock(&po->lock);
-			return true;
-		}
-		rte_spinlock_unlock(&po->lock);
+	want = RTE_MAX(po->slice, need) - held;
+	do {
+		credit = rte_atomic32_read(&po->credit);
+		if (credit <= 0 || held + credit < need)
+			return false;
+		take = RTE_MIN((uint32_t)credit, want);
+	} while (!rte_atomic32_cmpset((volatile uint32_t *)&po->credit.cnt,
+				      credit, credit - take));
 
-		tokens = rte_pktmbuf_pkt_len(*nbuf) - dp_pktmbuf_l2_len(*nbuf);
+	pc->slice = POLICE_SLICE(epoch, held + take - need);
+	return true;
+}
+
+/* Spend from the core's slice, claiming more if need be */
+static inline bool
+policer_conform(struct npf_policer *po, struct policer_cntrs *pc,
+		uint32_t need)
+{
+	uint64_t s = pc->slice;
+
+	/* Normal case, the core still has credit from its last claim */
+	if (likely(POLICE_SLICE_EPOCH(s) ==
+		   (uint32_t)rte_atomic32_read(&po->epoch) &&
+		   POLICE_SLICE_CREDIT(s) >= need)) {
+		pc->slice = s - need;
+		return true;
+	}
+
+	return policer_claim(po, pc, need);
+}
+
+static bool
+npf_policer(npf_cache_t *npc, struct rte_mbuf **nbuf, void *arg,
+	    npf_session_t *se __unused, npf_rproc_result_t *result)
+{
+	struct npf_policer	*po = arg;
+	struct policer_cntrs	*pc;
+	int32_t			tok_with_oh;
+	uint32_t		tokens;
+	unsigned int		core;
+
+	/* Dropped packets do not count against policer */
+	if (result->decision == NPF_DECISION_BLOCK)
+		return true;
+
+	/* Assume this is a setup problem */
+	if (unlikely(po == NULL)) {
+		result->decision = NPF_DECISION_BLOCK;
+		return true;
 	}
 
 	core = dp_lcore_id();
-	po->cntrs[core].excess++;
-	po->cntrs[core].bytes_excess += tokens;
+	pc = &po->cntrs[core];
+
+	/*
+	 * NB for stats we report L3 bytes sent/dropped, for token bucket
+	 * we include the L2 overhead if configured.
+	 */
+	tokens = rte_pktmbuf_pkt_len(*nbuf) - dp_pktmbuf_l2_len(*nbuf);
+	if (po->type == POLICE_BYTES) {
+		tok_with_oh = tokens + po->overhead;
+		if (tok_with_oh < 0)
+			tok_with_oh = 1;
+	} else
+		tok_with_oh = 1;
+
+	if (policer_conform(po, pc, tok_with_oh))
+		return true;
+
+	pc->excess++;
+	pc->bytes_excess += tokens;
 
 	/* Over limit */
 	switch (po->action) {
@@ -389,17 +532,25 @@ void policer_show(json_writer_t *wr, void *arg)
 {
 	struct npf_policer *po = arg;
 	unsigned int excess, excess_b;
+	uint64_t slices = 0;
 	uint32_t credit;
+	unsigned int id;
 
 	policer_get_stats(po, &excess, &excess_b);
 	if (!excess)
 		return;
 
+	FOREACH_DP_LCORE(id)
+		slices += POLICE_SLICE_CREDIT(po->cntrs[id].slice);
+
 	credit = rte_atomic32_read(&po->credit);
 	jsonw_start_object(wr);
 	jsonw_uint_field(wr, "time", po->time);
 	jsonw_uint_field(wr, "tc", po->tc);
 	jsonw_uint_field(wr, "credit", credit);
+	jsonw_uint_field(wr, "core-credit", slices);
+	jsonw_uint_field(wr, "slice", po->slice);
+	jsonw_uint_field(wr, "epoch", rte_atomic32_read(&po->epoch));
 	jsonw_uint_field(wr, "rate", po->rate);
 	jsonw_uint_field(wr, "burst", po->burst);
 	jsonw_int_field(wr, "overhead", po->overhead);
@@ -463,6 +614,35 @@ npf_policer_json(json_writer_t *json,
 	jsonw_uint_field(json, "exceed-bytes", excess_bytes);
 }
 
+/*
+ * Test hooks.  Police a packet costing tokens as though on the given
+ * core, make it look as though the given number of intervals have passed
+ * since the last refill, and read the credit.
+ */
+bool npf_policer_conform_ut(void *handle, unsigned int core, uint32_t tokens)
+{
+	struct npf_policer *po = handle;
+
+	return policer_conform(po, &po->cntrs[core], tokens);
+}
+
+void npf_policer_age_ut(void *handle, unsigned int intervals)
+{
+	struct npf_policer *po = handle;
+
+	po->time = soft_ticks - (uint64_t)po->tc * intervals;
+}
+
+void npf_policer_credit_ut(void *handle, unsigned int core,
+			   uint32_t *credit, uint32_t *held, uint32_t *slice)
+{
+	struct npf_policer *po = handle;
+
+	*credit = rte_atomic32_read(&po->credit);
+	*held = POLICE_SLICE_CREDIT(po->cntrs[core].slice);
+	*slice = po->slice;
+}
+
 const npf_rproc_ops_t npf_policer_ops = {
 	.ro_name   = "policer",
 	.ro_type   = NPF_RPROC_TYPE_ACTION,
@@ -143,6 +143,11 @@ void
 npf_policer_json(json_writer_t *json, npf_rule_t *rl,
 		 const char *params, void *handle);
 
+bool npf_policer_conform_ut(void *handle, unsigned int core, uint32_t tokens);
+void npf_policer_age_ut(void *handle, unsigned int intervals);
+void npf_policer_credit_ut(void *handle, unsigned int core,
+			   uint32_t *credit, uint32_t *held, uint32_t *slice);
+
 /* npf_ext_mark.c */
 void npf_remark_dscp(npf_cache_t *npc, struct rte_mbuf **m, uint8_t n,
 		     npf_rproc_result_t *result);
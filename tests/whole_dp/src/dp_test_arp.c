@@ -16,6 +16,7 @@
 #include "if_var.h"
 #include "main.h"
 #include "arp.h"
+#include "if_llatbl.h"
 
 #include "dp_test.h"
 #include "dp_test_controller.h"
@@ -1754,3 +1755,205 @@ DP_START_TEST(proxy_arp, bridge_vlan_route_exists)
 	bridge_vlan_set_free(vlans);
 	dp_test_arp_teardown();
 } DP_END_TEST;
+
+/*
+ * Resolve addr on ifname as the forwarding path does for a packet routed
+ * to it, discarding any ARP request sent.
+ */
+static int arp_test_resolve(const char *ifname, const char *addr)
+{
+	struct ifnet *ifp = dp_ifnet_byifindex(dp_test_intf_name2index(ifname));
+	struct rte_ether_addr desten;
+	struct rte_mbuf *m, *bufs[8];
+	int len = 64;
+	in_addr_t a;
+	int rc, count;
+
+	dp_test_fail_unless(inet_pton(AF_INET, addr, &a) == 1,
+			    "failed to parse ip address %s", addr);
+
+	m = dp_test_create_ipv4_pak("10.42.42.42", addr, 1, &len);
+	rc = arpresolve(ifp, m, a, &desten);
+
+	while ((count = dp_test_pak_get_from_ring(ifname, bufs, 8)) > 0)
+		while (count)
+			rte_pktmbuf_free(bufs[--count]);
+
+	return rc;
+}
+
+static int16_t arp_test_held(const char *ifname)
+{
+	struct ifnet *ifp = dp_ifnet_byifindex(dp_test_intf_name2index(ifname));
+
+	return rte_atomic16_read(&ifp->if_lltable->lle_held);
+}
+
+/*
+ * Send pkts packets to each of hosts new neighbours 1.1.<net>.2 onwards on
+ * ifname.  The first packet for every neighbour is sent before any second
+ * packet.
+ */
+static void arp_test_fill(const char *ifname, unsigned int net,
+			  unsigned int hosts, unsigned int pkts)
+{
+	char addr[INET_ADDRSTRLEN];
+	unsigned int h, p;
+	int rc;
+
+	for (p = 0; p < pkts; p++) {
+		for (h = 0; h < hosts; h++) {
+			snprintf(addr, sizeof(addr), "1.1.%u.%u", net, h + 2);
+			rc = arp_test_resolve(ifname, addr);
+			dp_test_fail_unless(rc == -EWOULDBLOCK,
+					    "%s %s: resolve returned %d",
+					    ifname, addr, rc);
+		}
+	}
+}
+
+static void arp_test_clear(const char *ifname, unsigned int net,
+			   unsigned int hosts)
+{
+	char addr[INET_ADDRSTRLEN];
+	unsigned int h;
+
+	for (h = 0; h < hosts; h++) {
+		snprintf(addr, sizeof(addr), "1.1.%u.%u", net, h + 2);
+		dp_test_neigh_clear_entry(ifname, addr);
+	}
+}
+
+DP_DECL_TEST_CASE(arp_suite, arp_resolve_limits, NULL, NULL);
+
+/*
+ * Test that ARP resolution of new neighbours is throttled to
+ * ARP_RES_TOKEN per table per second, and that a throttled packet creates
+ * no entry.
+ */
+DP_START_TEST(arp_resolve_limits, res_token)
+{
+	struct ifnet *ifp;
+	in_addr_t addr;
+
+	dp_test_arp_setup();
+	dp_test_nl_add_ip_addr_and_connected(IIFNAME, OUR_IP "/24");
+	ifp = dp_ifnet_byifindex(dp_test_intf_name2index(IIFNAME));
+
+	/* the tokens are refilled every second, so start with a full bucket */
+	rte_atomic16_set(&ifp->if_lltable->lle_restoken, ARP_RES_TOKEN);
+	arp_test_fill(IIFNAME, 1, ARP_RES_TOKEN, 1);
+	DP_TEST_VERIFY_AND_CLEAR_ARP_STAT(IIFNAME, txrequests, ARP_RES_TOKEN);
+
+	/* packets to an existing entry need no token */
+	arp_test_fill(IIFNAME, 1, 1, 1);
+
+	dp_test_fail_unless(arp_test_resolve(IIFNAME, "1.1.1.200") == -ENOMEM,
+			    "resolution not throttled");
+	DP_TEST_VERIFY_AND_CLEAR_ARP_STAT(IIFNAME, resthrot, 1);
+
+	inet_pton(AF_INET, "1.1.1.200", &addr);
+	dp_test_fail_unless(!in_lltable_find(ifp, addr),
+			    "throttled resolution created an entry");
+	dp_test_fail_unless(arp_test_held(IIFNAME) == ARP_RES_TOKEN + 1,
+			    "%d packets held, expected %d",
+			    arp_test_held(IIFNAME), ARP_RES_TOKEN + 1);
+
+	arp_test_clear(IIFNAME, 1, ARP_RES_TOKEN);
+	DP_TEST_VERIFY_AND_CLEAR_ARP_STAT(IIFNAME, dropped, ARP_RES_TOKEN + 1);
+	dp_test_fail_unless(arp_test_held(IIFNAME) == 0,
+			    "%d packets still held", arp_test_held(IIFNAME));
+
+	dp_test_nl_del_ip_addr_and_connected(IIFNAME, OUR_IP "/24");
+	dp_test_arp_teardown();
+} DP_END_TEST;
+
+/*
+ * Test that the packets held awaiting resolution are capped at
+ * ARP_MAXHOLD per entry and LL_HOLD_TBL_MAX per table.  Past the cap an
+ * entry that holds packets drops its oldest for the new one.
+ */
+DP_START_TEST(arp_resolve_limits, hold_table)
+{
+	struct ifnet *ifp;
+	unsigned int sent = ARP_RES_TOKEN * (ARP_MAXHOLD + 1);
+
+	dp_test_arp_setup();
+	dp_test_nl_add_ip_addr_and_connected(IIFNAME, OUR_IP "/24");
+	ifp = dp_ifnet_byifindex(dp_test_intf_name2index(IIFNAME));
+
+	rte_atomic16_set(&ifp->if_lltable->lle_restoken, ARP_RES_TOKEN);
+	arp_test_fill(IIFNAME, 1, ARP_RES_TOKEN, ARP_MAXHOLD + 1);
+	DP_TEST_VERIFY_AND_CLEAR_ARP_STAT(IIFNAME, txrequests, ARP_RES_TOKEN);
+
+	dp_test_fail_unless(arp_test_held(IIFNAME) == LL_HOLD_TBL_MAX,
+			    "%d packets held, expected %d",
+			    arp_test_held(IIFNAME), LL_HOLD_TBL_MAX);
+	DP_TEST_VERIFY_AND_CLEAR_ARP_STAT(IIFNAME, dropped,
+					  (int)(sent - LL_HOLD_TBL_MAX));
+
+	/* clearing the entries frees what they hold */
+	arp_test_clear(IIFNAME, 1, ARP_RES_TOKEN);
+	DP_TEST_VERIFY_AND_CLEAR_ARP_STAT(IIFNAME, dropped, LL_HOLD_TBL_MAX);
+	dp_test_fail_unless(arp_test_held(IIFNAME) == 0,
+			    "%d packets still held", arp_test_held(IIFNAME));
+
+	dp_test_nl_del_ip_addr_and_connected(IIFNAME, OUR_IP "/24");
+	dp_test_arp_teardown();
+} DP_END_TEST;
+
+/*
+ * Test that once LL_HOLD_MAX packets are held across all the tables, a new
+ * entry holds nothing, so that one interface can't hold every mbuf.
+ */
+DP_START_TEST(arp_resolve_limits, hold_global)
+{
+	const char *ifnames[] = {
+		"dp1T0", "dp1T1", "dp1T2", "dp1T3",
+		"dp2T0", "dp2T1", "dp2T2", "dp2T3", "dp3T0",
+	};
+	unsigned int hosts = LL_HOLD_TBL_MAX / ARP_MAXHOLD;
+	unsigned int full = LL_HOLD_MAX / LL_HOLD_TBL_MAX;
+	char prefix[INET_ADDRSTRLEN + 3];
+	struct ifnet *ifp;
+	unsigned int i;
+
+	dp_test_fail_unless(full < ARRAY_SIZE(ifnames),
+			    "need more than %u interfaces", full);
+
+	dp_test_arp_setup();
+
+	for (i = 0; i <= full; i++) {
+		snprintf(prefix, sizeof(prefix), "1.1.%u.1/24", i + 10);
+		dp_test_nl_add_ip_addr_and_connected(ifnames[i], prefix);
+		ifp = dp_ifnet_byifindex(dp_test_intf_name2index(ifnames[i]));
+		rte_atomic16_set(&ifp->if_lltable->lle_restoken,
+				 ARP_RES_TOKEN);
+
+		arp_test_fill(ifnames[i], i + 10, hosts, ARP_MAXHOLD);
+	}
+
+	for (i = 0; i < full; i++)
+		dp_test_fail_unless(arp_test_held(ifnames[i]) ==
+				    LL_HOLD_TBL_MAX,
+				    "%s holds %d packets, expected %d",
+				    ifnames[i], arp_test_held(ifnames[i]),
+				    LL_HOLD_TBL_MAX);
+	dp_test_fail_unless(arp_test_held(ifnames[full]) == 0,
+			    "%s holds %d packets past the global limit",
+			    ifnames[full], arp_test_held(ifnames[full]));
+
+	for (i = 0; i <= full; i++) {
+		arp_test_clear(ifnames[i], i + 10, hosts);
+		dp_test_fail_unless(arp_test_held(ifnames[i]) == 0,
+				    "%s still holds %d packets", ifnames[i],
+				    arp_test_held(ifnames[i]));
+
+		snprintf(prefix, sizeof(prefix), "1.1.%u.1/24", i + 10);
+		dp_test_nl_del_ip_addr_and_connected(ifnames[i], prefix);
+	}
+
+	/* all in the default vrf */
+	dp_test_zero_arp_stats(IIFNAME);
+	dp_test_arp_teardown();
+} DP_END_TEST;
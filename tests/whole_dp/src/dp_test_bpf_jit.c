@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Check that compiled capture filters give the same result as the
+ * bpf_filter() interpreter.
+ */
+
+#include <netinet/ip_icmp.h>
+#include <netinet/tcp.h>
+#include <pcap/pcap.h>
+
+#include "bpf_jit.h"
+#include "util.h"
+
+#include "dp_test.h"
+#include "dp_test_controller.h"
+#include "dp_test_pktmbuf_lib_internal.h"
+#include "dp_test/dp_test_macros.h"
+
+DP_DECL_TEST_SUITE(bpf_jit);
+
+/* Filters of the sort given to tcpdump */
+static const char *bpf_jit_exprs[] = {
+	"ip",
+	"ip6",
+	"arp",
+	"tcp",
+	"udp port 53",
+	"host 10.73.0.1",
+	"net 10.73.0.0/16 and tcp",
+	"src host 10.73.2.1 or dst host 2001:1:1::1",
+	"tcp[tcpflags] & (tcp-syn|tcp-fin) != 0",
+	"tcp[((tcp[12:1] & 0xf0) >> 2):4] = 0x47455420",
+	"ip[2:2] > 100",
+	"udp and ip[6:2] & 0x1fff = 0",
+	"ip6 and tcp dst port 80",
+	"vlan 10 and ip",
+	"ether broadcast",
+	"len > 100",
+	"len <= 64",
+	"(tcp port 22 or udp port 1000) and not host 10.73.0.3",
+	"icmp[icmptype] == icmp-echo",
+	"ip[0] & 0xf != 5",
+	"tcp portrange 1000-2000",
+};
+
+/* Buffer lengths to try, to exercise the bounds checks on loads */
+static const unsigned int bpf_jit_buflens[] = {
+	0, 1, 13, 14, 15, 23, 34, 38, 40, 53, 54, 58, 66, 100,
+};
+
+static struct rte_mbuf *bpf_jit_pak(unsigned int i)
+{
+	int len = 60;
+
+	switch (i) {
+	case 0:
+		return dp_test_create_tcp_ipv4_pak("10.73.0.1", "10.73.2.1",
+						   1001, 22, TH_SYN, 0, 0,
+						   8192, NULL, 1, &len);
+	case 1:
+		return dp_test_create_udp_ipv4_pak("10.73.0.3", "10.73.2.1",
+						   53, 1000, 1, &len);
+	case 2:
+		return dp_test_create_tcp_ipv6_pak("2001:1:1::2", "2001:1:1::1",
+						   1001, 80, TH_ACK | TH_FIN,
+						   1, 1, 8192, NULL, 1, &len);
+	case 3:
+		return dp_test_create_udp_ipv6_pak("2001:1:1::2", "2001:2:2::2",
+						   1500, 53, 1, &len);
+	case 4:
+		return dp_test_create_icmp_ipv4_pak("10.73.0.1", "10.73.2.1",
+						    ICMP_ECHO, 0, 0, 1, &len,
+						    NULL, NULL, NULL);
+	case 5:
+		return dp_test_create_8021q_l2_pak("ff:ff:ff:ff:ff:ff",
+						   "0:0:a4:0:0:1", 10,
+						   RTE_ETHER_TYPE_VLAN,
+						   RTE_ETHER_TYPE_IPV4, 1, &len);
+	default:
+		return NULL;
+	}
+}
+
+#define BPF_JIT_PAKS	6
+
+DP_DECL_TEST_CASE(bpf_jit, differential, NULL, NULL);
+
+/*
+ * TESTCASE: Compiled filters match the interpreter
+ *
+ * Compile each filter expression, then run it both ways over each
+ * packet, with the full packet and with it truncated at various points.
+ */
+DP_START_TEST(differential, corpus)
+{
+	struct rte_mbuf *paks[BPF_JIT_PAKS];
+	struct bpf_program prog;
+	struct bpf_jit jit;
+	unsigned int i, j, b;
+	int rc;
+
+	for (i = 0; i < BPF_JIT_PAKS; i++) {
+		paks[i] = bpf_jit_pak(i);
+		dp_test_fail_unless(paks[i], "failed to create packet %u", i);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(bpf_jit_exprs); i++) {
+		rc = pcap_compile_nopcap(65535, DLT_EN10MB, &prog,
+					 bpf_jit_exprs[i], 1,
+					 PCAP_NETMASK_UNKNOWN);
+		dp_test_fail_unless(rc == 0, "failed to compile \"%s\"",
+				    bpf_jit_exprs[i]);
+
+		rc = bpf_jit_compile(prog.bf_insns, prog.bf_len, &jit);
+#if defined(__x86_64__)
+		dp_test_fail_unless(rc == 0 && jit.func,
+				    "failed to jit \"%s\": %d",
+				    bpf_jit_exprs[i], rc);
+#endif
+
+		for (j = 0; j < BPF_JIT_PAKS; j++) {
+			const u_char *p = rte_pktmbuf_mtod(paks[j],
+							   const u_char *);
+			u_int wirelen = rte_pktmbuf_pkt_len(paks[j]);
+			u_int exp, res;
+
+			for (b = 0; b <= ARRAY_SIZE(bpf_jit_buflens); b++) {
+				u_int buflen = wirelen;
+
+				if (b < ARRAY_SIZE(bpf_jit_buflens))
+					buflen = RTE_MIN(bpf_jit_buflens[b],
+							 wirelen);
+
+				exp = bpf_filter(prog.bf_insns, p, wirelen,
+						 buflen);
+				res = bpf_jit_filter(&jit, prog.bf_insns, p,
+						     wirelen, buflen);
+				dp_test_fail_unless(exp == res,
+						    "\"%s\" packet %u buflen %u: "
+						    "interpreter %u compiled %u",
+						    bpf_jit_exprs[i], j, buflen,
+						    exp, res);
+			}
+		}
+
+		bpf_jit_free(&jit);
+		pcap_freecode(&prog);
+	}
+
+	for (i = 0; i < BPF_JIT_PAKS; i++)
+		rte_pktmbuf_free(paks[i]);
+} DP_END_TEST;
+
+DP_DECL_TEST_CASE(bpf_jit, programs, NULL, NULL);
+
+/*
+ * TESTCASE: Hand built programs
+ *
+ * Cover the instructions tcpdump doesn't normally generate: division by
+ * a zero X register, scratch memory read before it is written, and
+ * loads at offsets that wrap when added to X.
+ */
+DP_START_TEST(programs, edge_cases)
+{
+	static const struct bpf_insn div0[] = {
+		BPF_STMT(BPF_LD|BPF_IMM, 10),
+		BPF_STMT(BPF_LDX|BPF_IMM, 0),
+		BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+		BPF_STMT(BPF_RET|BPF_K, 1),
+	};
+	static const struct bpf_insn mem[] = {
+		BPF_STMT(BPF_LD|BPF_MEM, 3),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 7),
+		BPF_STMT(BPF_ST, 4),
+		BPF_STMT(BPF_LDX|BPF_MEM, 4),
+		BPF_STMT(BPF_MISC|BPF_TXA, 0),
+		BPF_STMT(BPF_RET|BPF_A, 0),
+	};
+	static const struct bpf_insn wrap[] = {
+		BPF_STMT(BPF_LDX|BPF_IMM, 0xfffffff0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_IND, 0x20),
+		BPF_STMT(BPF_RET|BPF_K, 1),
+	};
+	static const struct {
+		const struct bpf_insn *insns;
+		u_int len;
+	} progs[] = {
+		{ div0, ARRAY_SIZE(div0) },
+		{ mem, ARRAY_SIZE(mem) },
+		{ wrap, ARRAY_SIZE(wrap) },
+	};
+	u_char pkt[64] = { 0 };
+	struct bpf_jit jit;
+	unsigned int i;
+	u_int exp, res;
+	int rc;
+
+	for (i = 0; i < ARRAY_SIZE(progs); i++) {
+		rc = bpf_jit_compile(progs[i].insns, progs[i].len, &jit);
+#if defined(__x86_64__)
+		dp_test_fail_unless(rc == 0 && jit.func,
+				    "failed to jit program %u: %d", i, rc);
+#endif
+
+		exp = bpf_filter(progs[i].insns, pkt, sizeof(pkt),
+				 sizeof(pkt));
+		res = bpf_jit_filter(&jit, progs[i].insns, pkt, sizeof(pkt),
+				     sizeof(pkt));
+		dp_test_fail_unless(exp == res,
+				    "program %u: interpreter %u compiled %u",
+				    i, exp, res);
+
+		bpf_jit_free(&jit);
+	}
+} DP_END_TEST;
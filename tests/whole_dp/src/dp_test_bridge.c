@@ -8,6 +8,8 @@
  * dataplane UT Bridge tests
  */
 
+#include <unistd.h>
+
 #include "dp_test.h"
 #include "dp_test_console.h"
 #include "dp_test_lib_internal.h"
@@ -1492,3 +1494,128 @@ DP_START_TEST(bridge_flush, bridge_flush)
 	dp_test_intf_bridge_remove_port("br1", "dp2T1");
 	dp_test_intf_bridge_del("br1");
 } DP_END_TEST;
+
+/*
+ * Check that a burst of new source addresses, more than can be learnt
+ * directly by the forwarding thread, are all learnt once the deferred
+ * learning events have been applied.
+ */
+#define BRIDGE_LEARN_BURST 64
+
+DP_DECL_TEST_CASE(bridge_suite, bridge_learn_burst, NULL, NULL);
+DP_START_TEST(bridge_learn_burst, bridge_learn_burst)
+{
+	struct rte_mbuf *paks[BRIDGE_LEARN_BURST];
+	char real_ifname[IFNAMSIZ];
+	json_object *expected;
+	char mac_str[32];
+	char cmd[100];
+	int len = 64;
+	int count = 0;
+	int i;
+
+	dp_test_intf_bridge_create("br1");
+	dp_test_intf_bridge_add_port("br1", "dp1T0");
+	dp_test_intf_bridge_add_port("br1", "dp2T1");
+	dp_test_intf_real("dp1T0", real_ifname);
+
+	/* Frames to an unknown destination, each from a new source */
+	for (i = 0; i < BRIDGE_LEARN_BURST; i++) {
+		snprintf(mac_str, sizeof(mac_str), "00:00:a4:01:00:%02x", i);
+		paks[i] = dp_test_create_l2_pak("00:00:a4:00:00:bb", mac_str,
+						DP_TEST_ET_LLDP, 1, &len);
+	}
+	dp_test_pak_add_to_ring("dp1T0", paks, BRIDGE_LEARN_BURST, true);
+
+	/* Each is flooded out of the other port */
+	while (count < BRIDGE_LEARN_BURST) {
+		struct rte_mbuf *bufs[BRIDGE_LEARN_BURST];
+		int n;
+
+		n = dp_test_pak_get_from_ring("dp2T1", bufs,
+					      BRIDGE_LEARN_BURST);
+		dp_test_fail_unless(n > 0, "flooded %d of %d frames",
+				    count, BRIDGE_LEARN_BURST);
+		for (i = 0; i < n; i++)
+			rte_pktmbuf_free(bufs[i]);
+		count += n;
+	}
+
+	for (i = 0; i < BRIDGE_LEARN_BURST; i++) {
+		snprintf(mac_str, sizeof(mac_str), "0:0:a4:1:0:%x", i);
+		expected = dp_test_json_create(
+			"{\"mac_table\" : [{"
+			"\"port\" : \"%s\","
+			"\"dynamic\" : true,"
+			"\"mac\" : \"%s\""
+			"}]}",
+			real_ifname, mac_str);
+		snprintf(cmd, sizeof(cmd), "bridge br1 macs show mac %s",
+			 mac_str);
+		dp_test_check_json_poll_state(cmd, expected,
+					      DP_TEST_JSON_CHECK_SUBSET,
+					      false, 10);
+		json_object_put(expected);
+	}
+
+	dp_test_intf_bridge_remove_port("br1", "dp1T0");
+	dp_test_intf_bridge_remove_port("br1", "dp2T1");
+	dp_test_intf_bridge_del("br1");
+} DP_END_TEST;
+
+static void bridge_flood_list_check(int n_oifs, const char *oif0,
+				    const char *oif1)
+{
+	struct dp_test_expected *exp;
+	struct rte_mbuf *test_pak;
+	int len = 64;
+
+	test_pak = dp_test_create_l2_pak("00:00:a4:00:00:dd",
+					 "00:00:a4:00:00:cc",
+					 DP_TEST_ET_LLDP, 1, &len);
+	exp = dp_test_exp_create_m(test_pak, n_oifs);
+	dp_test_exp_set_oif_name_m(exp, 0, oif0);
+	if (n_oifs > 1)
+		dp_test_exp_set_oif_name_m(exp, 1, oif1);
+
+	dp_test_pak_receive(test_pak, "dp1T0", exp);
+}
+
+/*
+ * Check that flooding uses the current ports and STP state once the
+ * flood list for the vlan has been built, and after it has been
+ * invalidated by a port state change.
+ */
+DP_DECL_TEST_CASE(bridge_suite, bridge_flood_list, NULL, NULL);
+DP_START_TEST(bridge_flood_list, bridge_flood_list)
+{
+	dp_test_intf_bridge_create("br1");
+	dp_test_intf_bridge_add_port("br1", "dp1T0");
+	dp_test_intf_bridge_add_port("br1", "dp2T1");
+	dp_test_intf_bridge_add_port("br1", "dp3T2");
+
+	/* No flood list yet, so the ports are walked */
+	bridge_flood_list_check(2, "dp2T1", "dp3T2");
+
+	/* Allow the flood list to be built, and then use it */
+	usleep(300000);
+	bridge_flood_list_check(2, "dp2T1", "dp3T2");
+
+	/* The list is stale as soon as a port stops forwarding */
+	dp_test_intf_bridge_port_set_vlans_state("br1", "dp3T2", 0, NULL,
+						 NULL, BR_STATE_BLOCKING);
+	bridge_flood_list_check(1, "dp2T1", NULL);
+	usleep(300000);
+	bridge_flood_list_check(1, "dp2T1", NULL);
+
+	dp_test_intf_bridge_port_set_vlans_state("br1", "dp3T2", 0, NULL,
+						 NULL, BR_STATE_FORWARDING);
+	bridge_flood_list_check(2, "dp2T1", "dp3T2");
+
+	dp_test_intf_bridge_remove_port("br1", "dp3T2");
+	bridge_flood_list_check(1, "dp2T1", NULL);
+
+	dp_test_intf_bridge_remove_port("br1", "dp1T0");
+	dp_test_intf_bridge_remove_port("br1", "dp2T1");
+	dp_test_intf_bridge_del("br1");
+} DP_END_TEST;
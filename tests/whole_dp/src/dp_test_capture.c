@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Capture work done outside the capture thread: the snaplen copy, the
+ * pcapng chunks and the drop counts shown by "capture show".
+ */
+
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "capture_chunk.h"
+#include "json_writer.h"
+#include "util.h"
+
+#include "dp_test.h"
+#include "dp_test_controller.h"
+#include "dp_test_json_utils.h"
+#include "dp_test_pktmbuf_lib_internal.h"
+#include "dp_test/dp_test_cmd_check.h"
+#include "dp_test/dp_test_macros.h"
+
+DP_DECL_TEST_SUITE(capture);
+
+/* A two segment packet: 62 bytes, then 60 */
+static struct rte_mbuf *capture_test_pak(void)
+{
+	int len[2] = { 20, 60 };
+
+	return dp_test_create_udp_ipv4_pak("10.73.0.1", "10.73.2.1",
+					   1001, 53, 2, len);
+}
+
+/* Check the first len bytes of a packet match buf */
+static void capture_test_check_data(const struct rte_mbuf *m, uint32_t off,
+				    const uint8_t *buf, uint32_t len,
+				    const char *what)
+{
+	uint8_t tmp[len];
+	const uint8_t *p;
+
+	p = rte_pktmbuf_read(m, off, len, tmp);
+	dp_test_fail_unless(p, "%s: packet shorter than %u", what, off + len);
+	dp_test_fail_unless(memcmp(p, buf, len) == 0,
+			    "%s: data mismatch", what);
+}
+
+static uint32_t capture_test_u32(const struct capture_chunk *chunk,
+				 uint32_t off)
+{
+	uint32_t v;
+
+	memcpy(&v, &chunk->cc_buf[off], sizeof(v));
+	return v;
+}
+
+DP_DECL_TEST_CASE(capture, snap_copy, NULL, NULL);
+
+/*
+ * TESTCASE: The capture copy holds at most snaplen bytes
+ *
+ * The copy of a two segment packet stops at the snaplen, even part way
+ * into the second segment, and is the whole packet when the snaplen is
+ * bigger.  Either way the copy carries the original length.
+ */
+DP_START_TEST(snap_copy, snaplen)
+{
+	static const unsigned int snaplens[] = { 14, 62, 96, 122, 1000 };
+	struct rte_mbuf *ms, *md;
+	uint32_t pkt_len, exp;
+	unsigned int i;
+
+	ms = capture_test_pak();
+	dp_test_fail_unless(ms, "failed to create packet");
+	dp_test_fail_unless(ms->nb_segs == 2, "packet has %u segments",
+			    ms->nb_segs);
+	pkt_len = rte_pktmbuf_pkt_len(ms);
+
+	for (i = 0; i < ARRAY_SIZE(snaplens); i++) {
+		uint8_t buf[pkt_len];
+
+		md = capture_snap_copy(ms->pool, ms, snaplens[i]);
+		dp_test_fail_unless(md, "snaplen %u: copy failed",
+				    snaplens[i]);
+
+		exp = RTE_MIN(pkt_len, snaplens[i]);
+		dp_test_fail_unless(rte_pktmbuf_pkt_len(md) == exp,
+				    "snaplen %u: copied %u, expected %u",
+				    snaplens[i], rte_pktmbuf_pkt_len(md), exp);
+		dp_test_fail_unless(CAPTURE_WIRE_LEN(md) == pkt_len,
+				    "snaplen %u: wire len %u, expected %u",
+				    snaplens[i], CAPTURE_WIRE_LEN(md),
+				    pkt_len);
+
+		rte_pktmbuf_read(ms, 0, exp, buf);
+		capture_test_check_data(md, 0, buf, exp, "snap copy");
+		rte_pktmbuf_free(md);
+	}
+
+	rte_pktmbuf_free(ms);
+} DP_END_TEST;
+
+DP_DECL_TEST_CASE(capture, chunk, NULL, NULL);
+
+/*
+ * TESTCASE: Layout of a pcapng chunk
+ *
+ * A chunk starts with a section header and an interface description,
+ * followed by an enhanced packet block for each packet, padded to 32
+ * bits with zeros.
+ */
+DP_START_TEST(chunk, layout)
+{
+	const struct timeval ts = { .tv_sec = 1, .tv_usec = 2 };
+	struct capture_chunk *chunk;
+	struct rte_mbuf *m;
+	uint32_t pkt_len, off, len;
+	uint8_t pkt[256];
+
+	chunk = malloc(sizeof(*chunk));
+	dp_test_fail_unless(chunk, "failed to allocate chunk");
+	memset(chunk, 0xff, sizeof(*chunk));
+
+	m = capture_test_pak();
+	dp_test_fail_unless(m, "failed to create packet");
+	pkt_len = rte_pktmbuf_pkt_len(m);
+	rte_pktmbuf_read(m, 0, pkt_len, pkt);
+
+	capture_chunk_start(chunk, 96);
+	dp_test_fail_unless(chunk->cc_len == 48 && chunk->cc_pkts == 0,
+			    "started chunk has %u bytes %u packets",
+			    chunk->cc_len, chunk->cc_pkts);
+	dp_test_fail_unless(capture_test_u32(chunk, 0) == PCAPNG_SHB_TYPE &&
+			    capture_test_u32(chunk, 4) == 28 &&
+			    capture_test_u32(chunk, 8) ==
+			    PCAPNG_BYTE_ORDER_MAGIC &&
+			    capture_test_u32(chunk, 24) == 28,
+			    "bad section header");
+	dp_test_fail_unless(capture_test_u32(chunk, 28) == PCAPNG_IDB_TYPE &&
+			    capture_test_u32(chunk, 32) == 20 &&
+			    capture_test_u32(chunk, 40) == 96 &&
+			    capture_test_u32(chunk, 44) == 20,
+			    "bad interface description");
+
+	/* Truncated at the snaplen, no padding needed */
+	off = chunk->cc_len;
+	dp_test_fail_unless(capture_chunk_add(chunk, m, &ts, pkt_len, 96, 0),
+			    "failed to add packet");
+	len = 28 + 96 + 4;
+	dp_test_fail_unless(chunk->cc_len == off + len && chunk->cc_pkts == 1,
+			    "chunk has %u bytes %u packets", chunk->cc_len,
+			    chunk->cc_pkts);
+	dp_test_fail_unless(capture_test_u32(chunk, off) == PCAPNG_EPB_TYPE &&
+			    capture_test_u32(chunk, off + 4) == len &&
+			    capture_test_u32(chunk, off + len - 4) == len,
+			    "bad packet block");
+	dp_test_fail_unless(capture_test_u32(chunk, off + 12) == 0 &&
+			    capture_test_u32(chunk, off + 16) == 1000002,
+			    "bad timestamp");
+	dp_test_fail_unless(capture_test_u32(chunk, off + 20) == 96 &&
+			    capture_test_u32(chunk, off + 24) == pkt_len,
+			    "caplen %u origlen %u",
+			    capture_test_u32(chunk, off + 20),
+			    capture_test_u32(chunk, off + 24));
+	dp_test_fail_unless(memcmp(&chunk->cc_buf[off + 28], pkt, 96) == 0,
+			    "packet data mismatch");
+
+	/* With the VLAN tag put back, and padded */
+	m->vlan_tci = 10;
+	off = chunk->cc_len;
+	dp_test_fail_unless(capture_chunk_add(chunk, m, &ts, pkt_len, 1000,
+					      RTE_ETHER_TYPE_VLAN),
+			    "failed to add tagged packet");
+	len = 28 + pkt_len + 4 + 2 + 4;
+	dp_test_fail_unless(capture_test_u32(chunk, off + 4) == len &&
+			    capture_test_u32(chunk, off + len - 4) == len,
+			    "bad tagged packet block length %u",
+			    capture_test_u32(chunk, off + 4));
+	dp_test_fail_unless(capture_test_u32(chunk, off + 20) == pkt_len + 4 &&
+			    capture_test_u32(chunk, off + 24) == pkt_len + 4,
+			    "tagged caplen %u origlen %u",
+			    capture_test_u32(chunk, off + 20),
+			    capture_test_u32(chunk, off + 24));
+
+	off += 28;
+	dp_test_fail_unless(memcmp(&chunk->cc_buf[off], pkt, 12) == 0,
+			    "tagged packet addresses mismatch");
+	dp_test_fail_unless(chunk->cc_buf[off + 12] == 0x81 &&
+			    chunk->cc_buf[off + 13] == 0x00 &&
+			    chunk->cc_buf[off + 14] == 0x00 &&
+			    chunk->cc_buf[off + 15] == 10,
+			    "bad VLAN tag");
+	dp_test_fail_unless(memcmp(&chunk->cc_buf[off + 16], pkt + 12,
+				   pkt_len - 12) == 0,
+			    "tagged packet data mismatch");
+	dp_test_fail_unless(chunk->cc_buf[off + pkt_len + 4] == 0 &&
+			    chunk->cc_buf[off + pkt_len + 5] == 0,
+			    "padding not zeroed");
+
+	/* Fill it, and the chunk is left alone once a packet won't fit */
+	while (capture_chunk_add(chunk, m, &ts, pkt_len, 1000, 0))
+		;
+	len = 28 + pkt_len + 2 + 4;
+	dp_test_fail_unless(chunk->cc_len <= CAPTURE_CHUNK_SZ &&
+			    chunk->cc_len + len > CAPTURE_CHUNK_SZ,
+			    "full chunk has %u bytes", chunk->cc_len);
+	dp_test_fail_unless(capture_test_u32(chunk, chunk->cc_len -
+					     len + 4) == len,
+			    "last packet block truncated");
+
+	rte_pktmbuf_free(m);
+	free(chunk);
+} DP_END_TEST;
+
+DP_DECL_TEST_CASE(capture, drops, NULL, NULL);
+
+/*
+ * TESTCASE: Ring full drops are counted for each active slot
+ *
+ * A packet the capture ring has no room for is lost to every active
+ * capture, and "capture show" reports the count against each slot.
+ */
+DP_START_TEST(drops, ring_full)
+{
+	struct capture_info ci = { .capture_mask = 0x5 };
+	struct dp_test_json_mismatches *mismatches = NULL;
+	json_object *jexp, *jresp;
+	json_writer_t *wr;
+	char err[256];
+	char *buf = NULL;
+	size_t bufsz = 0;
+	FILE *f;
+
+	capture_drop(&ci, 3);
+	capture_drop(&ci, 1);
+
+	dp_test_fail_unless(rte_atomic64_read(&ci.drops[0]) == 4 &&
+			    rte_atomic64_read(&ci.drops[1]) == 0 &&
+			    rte_atomic64_read(&ci.drops[2]) == 4,
+			    "drops %lu %lu %lu",
+			    rte_atomic64_read(&ci.drops[0]),
+			    rte_atomic64_read(&ci.drops[1]),
+			    rte_atomic64_read(&ci.drops[2]));
+
+	f = open_memstream(&buf, &bufsz);
+	dp_test_fail_unless(f, "failed to open memstream");
+	wr = jsonw_new(f);
+	dp_test_fail_unless(wr, "failed to create json writer");
+	capture_drops_jsonw(wr, &ci);
+	jsonw_destroy(&wr);
+	fclose(f);
+
+	jresp = parse_json(buf, err, sizeof(err));
+	dp_test_fail_unless(jresp, "failed to parse \"%s\": %s", buf, err);
+
+	jexp = dp_test_json_create(
+		"{ \"drops\": ["
+		"  { \"slot\": 1, \"ring-full\": 4 },"
+		"  { \"slot\": 4, \"ring-full\": 4 }"
+		"] }");
+	dp_test_fail_unless(dp_test_json_match(jexp, jresp, &mismatches),
+			    "unexpected drops: %s", buf);
+
+	dp_test_json_mismatch_free(mismatches);
+	json_object_put(jexp);
+	json_object_put(jresp);
+	free(buf);
+} DP_END_TEST;
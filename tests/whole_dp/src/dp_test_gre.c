@@ -842,6 +842,66 @@ DP_START_TEST(gre_encap, tos_inherit_encap)
 
 } DP_END_TEST;
 
+/*
+ * Encapsulate a packet through a tunnel that inherits the tos, with the
+ * inner tos and ttl given.  The outer header is copied from the tunnel's
+ * template and only the words that differ are folded into its checksum,
+ * while the expected header's checksum is computed afresh.
+ */
+static void dp_test_gre_tmpl_encap(uint8_t tos, uint8_t ttl,
+				   uint8_t outer_tos)
+{
+	struct dp_test_expected *exp;
+	struct iphdr *exp_inner, *exp_outer;
+	struct rte_mbuf *m, *exp_pak;
+	struct iphdr *inner_ip;
+	int len = 32;
+
+	m = dp_test_create_ipv4_pak("1.1.1.2", "10.0.0.1", 1, &len);
+	(void)dp_test_pktmbuf_eth_init(m, dp_test_intf_name2mac_str("dp1T1"),
+				       DP_TEST_INTF_DEF_SRC_MAC,
+				       RTE_ETHER_TYPE_IPV4);
+	inner_ip = iphdr(m);
+	dp_test_set_pak_ip_field(inner_ip, DP_TEST_SET_TOS, tos);
+	dp_test_set_pak_ip_field(inner_ip, DP_TEST_SET_TTL, ttl);
+
+	exp_pak = gre_test_create_pak("1.1.2.1", "1.1.2.2", inner_ip,
+				      &exp_inner, &exp_outer);
+	dp_test_set_pak_ip_field(exp_inner, DP_TEST_SET_TTL, ttl - 1);
+	dp_test_set_pak_ip_field(exp_outer, DP_TEST_SET_TTL, ttl - 1);
+	dp_test_set_pak_ip_field(exp_outer, DP_TEST_SET_TOS, outer_tos);
+	dp_test_pktmbuf_eth_init(exp_pak, "aa:bb:cc:dd:ee:ff",
+				 dp_test_intf_name2mac_str("dp2T2"),
+				 RTE_ETHER_TYPE_IPV4);
+
+	exp = dp_test_exp_create_m(NULL, 1);
+	dp_test_exp_set_pak_m(exp, 0, exp_pak);
+	dp_test_exp_set_oif_name_m(exp, 0, "dp2T2");
+	dp_test_pak_receive(m, "dp1T1", exp);
+}
+
+/*
+ * Packets that change different words of the outer header in turn, each
+ * checked against a fresh checksum, so that one packet's fixup must not
+ * leak into the template used by the next.
+ */
+DP_START_TEST(gre_encap, tmpl_cksum)
+{
+	dp_test_set_gre_tos(1);
+	dp_test_gre_setup_tunnel(VRF_DEFAULT_ID, "1.1.2.1", "1.1.2.2");
+
+	/* tos with CE, so ECT(0) outside, and a low ttl */
+	dp_test_gre_tmpl_encap(0xb8 | IPTOS_ECN_CE, 10, 0xb8 | IPTOS_ECN_ECT0);
+	/* neither tos nor ttl inherited from the last packet */
+	dp_test_gre_tmpl_encap(0, DP_TEST_PAK_DEFAULT_TTL, 0);
+	dp_test_gre_tmpl_encap(0x10 | IPTOS_ECN_ECT1, 200,
+			       0x10 | IPTOS_ECN_ECT1);
+	dp_test_gre_tmpl_encap(0xb8 | IPTOS_ECN_CE, 10, 0xb8 | IPTOS_ECN_ECT0);
+
+	dp_test_gre_teardown_tunnel(VRF_DEFAULT_ID, "1.1.2.1", "1.1.2.2");
+	dp_test_reset_gre_tos();
+} DP_END_TEST;
+
 DP_START_TEST(gre_encap, no_route)
 {
 	struct dp_test_expected *exp;
@@ -1232,6 +1292,61 @@ DP_START_TEST(gre_decap, invalid_paks)
 	dp_test_gre_teardown_tunnel(VRF_DEFAULT_ID, "1.1.2.1", "1.1.2.2");
 } DP_END_TEST;
 
+/*
+ * Send a packet encapsulated by the peer at nbma, expecting it to be
+ * decapsulated and forwarded, or dropped if there is no tunnel for it.
+ */
+static void gre_test_decap_from(const char *nbma, bool fwd)
+{
+	struct dp_test_expected *exp;
+	struct iphdr *inner_ip;
+	struct iphdr *outer_ip;
+	struct rte_mbuf *e;
+	struct rte_mbuf *m;
+
+	exp = gre_test_build_expected_ecn_pak(&e);
+	m = gre_test_create_pak(nbma, "1.1.2.1", iphdr(e), &inner_ip,
+				&outer_ip);
+	(void)dp_test_pktmbuf_eth_init(m,
+				       dp_test_intf_name2mac_str("dp2T2"),
+				       DP_TEST_INTF_DEF_SRC_MAC,
+				       RTE_ETHER_TYPE_IPV4);
+	if (!fwd)
+		dp_test_exp_set_fwd_status(exp, DP_TEST_FWD_DROPPED);
+	dp_test_pak_receive(m, "dp2T2", exp);
+}
+
+/*
+ * Delete the tunnel between packets.  Its packets must then be dropped,
+ * rather than decapsulated on the deleted tunnel still in the per-lcore
+ * tunnel cache, and be decapsulated on a new tunnel with the same
+ * endpoints once it is created.
+ */
+DP_START_TEST(gre_decap, tunnel_delete)
+{
+	dp_test_gre_setup_tunnel(VRF_DEFAULT_ID, "1.1.2.1", "1.1.2.2");
+
+	gre_test_decap_from("1.1.2.2", true);
+	gre_test_decap_from("1.1.2.2", true);
+
+	dp_test_netlink_del_route("10.0.0.0/8 nh 2.2.2.3 int:tun1");
+	dp_test_netlink_del_ip_address("tun1", "2.2.2.2/24");
+	dp_test_intf_gre_delete("tun1", "1.1.2.1", "1.1.2.2", 0,
+				VRF_DEFAULT_ID);
+
+	gre_test_decap_from("1.1.2.2", false);
+	gre_test_decap_from("1.1.2.2", false);
+
+	dp_test_intf_gre_create("tun1", "1.1.2.1", "1.1.2.2", 0,
+				VRF_DEFAULT_ID);
+	dp_test_netlink_add_ip_address("tun1", "2.2.2.2/24");
+	dp_test_netlink_add_route("10.0.0.0/8 nh 2.2.2.3 int:tun1");
+
+	gre_test_decap_from("1.1.2.2", true);
+
+	dp_test_gre_teardown_tunnel(VRF_DEFAULT_ID, "1.1.2.1", "1.1.2.2");
+} DP_END_TEST;
+
 DP_DECL_TEST_CASE(gre_suite, mgre_encap, NULL, NULL);
 
 DP_START_TEST(mgre_encap, simple_encap)
@@ -1293,6 +1408,97 @@ DP_START_TEST(mgre_encap, simple_encap)
 	dp_test_gre_teardown_tunnel(VRF_DEFAULT_ID, "1.1.2.1", "0.0.0.0");
 } DP_END_TEST;
 
+/*
+ * Send a packet into the mGRE tunnel, expecting it to be encapsulated to
+ * the peer at nbma, or to go to the slow path if there is no peer.
+ */
+static void mgre_test_encap_to(const char *nbma)
+{
+	struct dp_test_expected *exp;
+	struct iphdr *exp_inner, *exp_outer;
+	struct rte_mbuf *m, *exp_pak;
+	int len = 32;
+
+	m = dp_test_create_ipv4_pak("1.1.1.2", "10.0.0.1", 1, &len);
+	(void)dp_test_pktmbuf_eth_init(m, dp_test_intf_name2mac_str("dp1T1"),
+				       NULL, RTE_ETHER_TYPE_IPV4);
+	if (!nbma) {
+		exp = dp_test_exp_create(m);
+		dp_test_ipv4_decrement_ttl(dp_test_exp_get_pak(exp));
+		dp_test_exp_set_fwd_status(exp, DP_TEST_FWD_LOCAL);
+		dp_test_pak_receive(m, "dp1T1", exp);
+		return;
+	}
+
+	exp_pak = gre_test_create_pak("1.1.2.1", nbma, iphdr(m), &exp_inner,
+				      &exp_outer);
+	dp_test_pktmbuf_eth_init(exp_pak, "aa:bb:cc:dd:ee:ff",
+				 dp_test_intf_name2mac_str("dp2T2"),
+				 RTE_ETHER_TYPE_IPV4);
+	exp = dp_test_exp_create_m(NULL, 1);
+	dp_test_exp_set_pak_m(exp, 0, exp_pak);
+	dp_test_exp_set_oif_name_m(exp, 0, "dp2T2");
+	dp_test_pak_receive(m, "dp1T1", exp);
+}
+
+/* The peer's counts, summed over the lcores, are as expected */
+static void mgre_test_peer_counts(const char *nbma, unsigned int rx,
+				  unsigned int tx)
+{
+	json_object *expected;
+
+	expected = dp_test_json_create(
+		"{ \"neighbors\":"
+		"  ["
+		"    {"
+		"       \"ifname\": \"tun1\","
+		"       \"ip\": \"2.2.2.3\","
+		"       \"nbma\": \"%s\","
+		"       \"rx_packets\": %u,"
+		"       \"tx_packets\": %u,"
+		"    }"
+		"  ]"
+		"}",
+		nbma, rx, tx);
+	dp_test_check_json_state("gre tunnel tun1", expected,
+				 DP_TEST_JSON_CHECK_SUBSET, false);
+	json_object_put(expected);
+}
+
+/*
+ * Remove, then re-add, an mGRE peer at a new NBMA address between
+ * packets.  Packets must stop once it goes, rather than use the peer
+ * still in the per-lcore peer cache, and then go to its new address.
+ * The new peer's counts start from zero.
+ */
+DP_START_TEST(mgre_encap, peer_change)
+{
+	dp_test_gre_setup_tunnel(VRF_DEFAULT_ID, "1.1.2.1", "0.0.0.0");
+	dp_test_netlink_add_neigh("dp2T2", "1.1.2.3", "aa:bb:cc:dd:ee:ff");
+
+	dp_test_netlink_add_neigh("tun1", "2.2.2.3", "1.1.2.2");
+	mgre_test_encap_to("1.1.2.2");
+	mgre_test_encap_to("1.1.2.2");
+	mgre_test_encap_to("1.1.2.2");
+	gre_test_decap_from("1.1.2.2", true);
+	gre_test_decap_from("1.1.2.2", true);
+	mgre_test_peer_counts("1.1.2.2", 2, 3);
+
+	dp_test_netlink_del_neigh("tun1", "2.2.2.3", "1.1.2.2");
+	mgre_test_encap_to(NULL);
+	mgre_test_encap_to(NULL);
+
+	dp_test_netlink_add_neigh("tun1", "2.2.2.3", "1.1.2.3");
+	mgre_test_encap_to("1.1.2.3");
+	mgre_test_encap_to("1.1.2.3");
+	gre_test_decap_from("1.1.2.3", true);
+	mgre_test_peer_counts("1.1.2.3", 1, 2);
+
+	dp_test_netlink_del_neigh("tun1", "2.2.2.3", "1.1.2.3");
+	dp_test_netlink_del_neigh("dp2T2", "1.1.2.3", "aa:bb:cc:dd:ee:ff");
+	dp_test_gre_teardown_tunnel(VRF_DEFAULT_ID, "1.1.2.1", "0.0.0.0");
+} DP_END_TEST;
+
 DP_DECL_TEST_CASE(gre_suite, gre_vrf_encap, NULL, NULL);
 
 /* TODO: MR change to non-default VRF after v4 plumbing */
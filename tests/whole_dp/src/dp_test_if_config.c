@@ -12,6 +12,7 @@
 
 #include "dp_test.h"
 #include "dp_test_controller.h"
+#include "dp_test/dp_test_cmd_check.h"
 #include "dp_test_netlink_state_internal.h"
 #include "dp_test_lib_internal.h"
 #include "dp_test_lib_intf_internal.h"
@@ -73,3 +74,38 @@ DP_START_TEST(if_config_vtun, add_vtun)
 	dp_test_netlink_del_interface_l2("vtun0");
 	dp_test_intf_virt_del("vtun0");
 } DP_END_TEST;
+
+DP_DECL_TEST_CASE(if_cfg_suite, if_config_queue_pair, NULL, NULL);
+
+/*
+ * A transmit queue paired with its rx queue, as for vhost ports, must
+ * land on the lcore that polls that rx queue.
+ */
+DP_START_TEST(if_config_queue_pair, tx_follows_rx)
+{
+	json_object *expected;
+	int lcore;
+
+	lcore = tx_queue_lcore_ut(dp_test_intf_name2port("dp1T0"), 0);
+	dp_test_fail_unless(lcore >= 0, "Expected an lcore for dp1T0 txq 0");
+
+	expected = dp_test_json_create(
+		"{ \"lcore\":"
+		"  ["
+		"    {"
+		"       \"core\": %d,"
+		"       \"rx\":"
+		"       ["
+		"         {"
+		"           \"interface\": \"dp1T0\","
+		"           \"queue\": 0,"
+		"         }"
+		"       ]"
+		"    }"
+		"  ]"
+		"}",
+		lcore);
+	dp_test_check_json_state("cpu", expected,
+				 DP_TEST_JSON_CHECK_SUBSET, false);
+	json_object_put(expected);
+} DP_END_TEST;
@@ -1360,6 +1360,42 @@ DP_START_TEST(ip_arp_nh_share,
 
 } DP_END_TEST;
 
+DP_DECL_TEST_CASE(ip_arp_suite, ip_arp_mac_change, NULL, NULL);
+/*
+ * Check that forwarding follows a change of mac address for a neighbour,
+ * and its removal, so that nothing stale is used from the neighbour
+ * cache.
+ */
+DP_START_TEST(ip_arp_mac_change, ip_arp_mac_change)
+{
+	const char *nh_mac_str1 = "aa:bb:cc:dd:ee:ff";
+	const char *nh_mac_str2 = "aa:bb:cc:dd:ee:fe";
+	struct nh_info nh1 = {.nh_mac_str = nh_mac_str1,
+			      .nh_int = "dp1T1"};
+	struct nh_info nh2 = {.nh_mac_str = nh_mac_str2,
+			      .nh_int = "dp1T1"};
+	struct nh_info nh_arp = {.nh_int = "dp1T1",
+				 .arp = true};
+
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp1T1", "2.2.2.2/24");
+
+	dp_test_netlink_add_neigh("dp1T1", "2.2.2.1", nh_mac_str1);
+	build_and_send_pak("10.73.0.0", "2.2.2.1", nh1);
+	build_and_send_pak("10.73.0.0", "2.2.2.1", nh1);
+
+	dp_test_netlink_add_neigh("dp1T1", "2.2.2.1", nh_mac_str2);
+	build_and_send_pak("10.73.0.0", "2.2.2.1", nh2);
+
+	dp_test_netlink_del_neigh("dp1T1", "2.2.2.1", nh_mac_str2);
+	build_and_send_pak("10.73.0.0", "2.2.2.1", nh_arp);
+
+	/* Clean Up */
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp1T1", "2.2.2.2/24");
+
+} DP_END_TEST;
+
 DP_DECL_TEST_CASE(ip_arp_suite, ip_arp_nh_scale, NULL, NULL);
 /*
  * Not run by default due to the time taken to set up and remove all
@@ -7,9 +7,20 @@
  *
  * dataplane UT Multicast IP tests
  */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <libmnl/libmnl.h>
+#include <linux/netconf.h>
+#include <linux/rtnetlink.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "ip_funcs.h"
 #include "in_cksum.h"
+#include "netinet/ip_mroute.h"
+#include "netinet6/ip6_mroute.h"
 
+#include "dp_test_controller.h"
 #include "dp_test_lib_exp.h"
 #include "dp_test/dp_test_macros.h"
 #include "dp_test_netlink_state_internal.h"
@@ -106,3 +117,316 @@ DP_START_TEST(ip_mfwd_3, limited_broadcast)
 	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
 	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
 } DP_END_TEST;
+
+#define MCAST_OLIST_MAX	4
+
+/*
+ * Enable or disable multicast forwarding on an interface, as the kernel
+ * does when the routing daemon adds or deletes the vif, and wait for the
+ * vif to come or go.
+ */
+static void mcast_fwd_set(const char *ifname, int af, bool enable)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	char topic[DP_TEST_TMP_BUF];
+	char real_ifname[IFNAMSIZ];
+	struct netconfmsg *ncm;
+	struct nlmsghdr *nlh;
+	json_object *jexp;
+
+	dp_test_intf_real(ifname, real_ifname);
+
+	memset(buf, 0, sizeof(buf));
+	nlh = mnl_nlmsg_put_header(buf);
+	nlh->nlmsg_type = RTM_NEWNETCONF;
+	nlh->nlmsg_flags = NLM_F_ACK;
+
+	ncm = mnl_nlmsg_put_extra_header(nlh, sizeof(*ncm));
+	ncm->ncm_family = af;
+
+	mnl_attr_put_u32(nlh, NETCONFA_IFINDEX,
+			 dp_test_intf_name2index(real_ifname));
+	mnl_attr_put_u32(nlh, NETCONFA_MC_FORWARDING, enable);
+
+	if (nl_generate_topic(nlh, topic, sizeof(topic)) < 0)
+		dp_test_assert_internal(0);
+	nl_propagate(topic, nlh);
+
+	jexp = dp_test_json_create("{ \"%s\": [ { \"interface\": \"%s\" } ] }",
+				   af == AF_INET ? "mif" : "mif6",
+				   real_ifname);
+	dp_test_check_json_poll_state(af == AF_INET ? "multicast mif" :
+				      "multicast mif6", jexp,
+				      DP_TEST_JSON_CHECK_SUBSET, !enable, 0);
+	json_object_put(jexp);
+}
+
+/* Add, change or delete an (S,G) route, as the kernel sends it */
+static void mcast_route(uint16_t type, int af, const char *src,
+			const char *grp, const char *iif,
+			const char * const *oifs, unsigned int n)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	char topic[DP_TEST_TMP_BUF];
+	struct nlattr *mpath_start;
+	struct rtnexthop *rtnh;
+	struct in6_addr addr;
+	struct nlmsghdr *nlh;
+	struct rtmsg *rtm;
+	size_t alen = af == AF_INET ? sizeof(struct in_addr) :
+		sizeof(struct in6_addr);
+	unsigned int i;
+
+	memset(buf, 0, sizeof(buf));
+	nlh = mnl_nlmsg_put_header(buf);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_ACK;
+
+	rtm = mnl_nlmsg_put_extra_header(nlh, sizeof(*rtm));
+	rtm->rtm_family = af == AF_INET ? RTNL_FAMILY_IPMR : RTNL_FAMILY_IP6MR;
+	rtm->rtm_dst_len = alen * 8;
+	rtm->rtm_src_len = alen * 8;
+	rtm->rtm_table = RT_TABLE_DEFAULT;
+	rtm->rtm_protocol = RTPROT_MROUTED;
+	rtm->rtm_scope = RT_SCOPE_UNIVERSE;
+	rtm->rtm_type = RTN_MULTICAST;
+
+	dp_test_fail_unless(inet_pton(af, src, &addr) == 1,
+			    "bad source %s", src);
+	mnl_attr_put(nlh, RTA_SRC, alen, &addr);
+	dp_test_fail_unless(inet_pton(af, grp, &addr) == 1,
+			    "bad group %s", grp);
+	mnl_attr_put(nlh, RTA_DST, alen, &addr);
+	mnl_attr_put_u32(nlh, RTA_IIF, dp_test_intf_name2index(iif));
+
+	mpath_start = mnl_attr_nest_start(nlh, RTA_MULTIPATH);
+	for (i = 0; i < n; i++) {
+		rtnh = (struct rtnexthop *)mnl_nlmsg_get_payload_tail(nlh);
+		nlh->nlmsg_len += MNL_ALIGN(sizeof(*rtnh));
+		memset(rtnh, 0, sizeof(*rtnh));
+		rtnh->rtnh_len = sizeof(*rtnh);
+		rtnh->rtnh_hops = 1;	/* TTL threshold */
+		rtnh->rtnh_ifindex = dp_test_intf_name2index(oifs[i]);
+	}
+	mnl_attr_nest_end(nlh, mpath_start);
+
+	if (nl_generate_topic(nlh, topic, sizeof(topic)) < 0)
+		dp_test_assert_internal(0);
+	nl_propagate(topic, nlh);
+}
+
+/* Get the ifindexes in the output vector of an (S,G) */
+static int mcast_olist(int af, const char *src, const char *grp,
+		       unsigned int *ifindex)
+{
+	struct in6_addr src6, grp6;
+	struct in_addr src4, grp4;
+
+	if (af == AF_INET) {
+		inet_pton(af, src, &src4);
+		inet_pton(af, grp, &grp4);
+		return mfc_olist_ut(src4, grp4, ifindex, MCAST_OLIST_MAX);
+	}
+	inet_pton(af, src, &src6);
+	inet_pton(af, grp, &grp6);
+	return mf6c_olist_ut(src6, grp6, ifindex, MCAST_OLIST_MAX);
+}
+
+/* Find which of the interfaces has the given ifindex */
+static const char *mcast_oif_name(const char * const *oifs, unsigned int n,
+				  unsigned int ifindex)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (dp_test_intf_name2index(oifs[i]) == (int)ifindex)
+			return oifs[i];
+	return NULL;
+}
+
+/*
+ * Does the output vector hold exactly these interfaces?  All of its
+ * entries must still be in the vif table, so a deleted vif is not being
+ * used after it has been handed to call_rcu.
+ */
+static bool mcast_olist_is(int af, const char *src, const char *grp,
+			   const char * const *oifs, unsigned int n)
+{
+	unsigned int ifindex[MCAST_OLIST_MAX];
+	unsigned int i;
+	int count;
+
+	count = mcast_olist(af, src, grp, ifindex);
+	if (count != (int)n)
+		return false;
+	for (i = 0; i < n; i++)
+		if (!mcast_oif_name(oifs, n, ifindex[i]))
+			return false;
+	return true;
+}
+
+/*
+ * Wait for a route change to be compiled into the output vector, or with
+ * no interfaces given for the route to be deleted.
+ */
+static void mcast_olist_wait(int af, const char *src, const char *grp,
+			     const char * const *oifs, unsigned int n)
+{
+	unsigned int ifindex[MCAST_OLIST_MAX];
+	unsigned int wait;
+
+	for (wait = 0; wait < 100; wait++) {
+		if (oifs ? mcast_olist_is(af, src, grp, oifs, n) :
+		    mcast_olist(af, src, grp, ifindex) == -ENOENT)
+			return;
+		usleep(10000);
+	}
+	dp_test_fail("(%s, %s) olist is not the expected %u interfaces",
+		     src, grp, n);
+}
+
+/*
+ * Send a packet to the group from dp1T0, and check a copy goes out of
+ * each of the interfaces, in the order of the output vector.
+ */
+static void mcast_fwd_check(int af, const char *src, const char *grp,
+			    const char *l2_grp,
+			    const char * const *oifs, unsigned int n)
+{
+	unsigned int ifindex[MCAST_OLIST_MAX];
+	struct dp_test_expected *exp;
+	struct rte_mbuf *test_pak, *pak;
+	const char *oif;
+	unsigned int i;
+	int len = 32;
+
+	dp_test_fail_unless(mcast_olist_is(af, src, grp, oifs, n),
+			    "(%s, %s) olist is not the expected %u interfaces",
+			    src, grp, n);
+	mcast_olist(af, src, grp, ifindex);
+
+	if (af == AF_INET)
+		test_pak = dp_test_create_udp_ipv4_pak(src, grp, 1001, 1002,
+						       1, &len);
+	else
+		test_pak = dp_test_create_udp_ipv6_pak(src, grp, 1001, 1002,
+						       1, &len);
+	dp_test_pktmbuf_eth_init(test_pak, dp_test_intf_name2mac_str("dp1T0"),
+				 DP_TEST_INTF_DEF_SRC_MAC,
+				 af == AF_INET ? RTE_ETHER_TYPE_IPV4 :
+				 RTE_ETHER_TYPE_IPV6);
+
+	if (!n) {
+		exp = dp_test_exp_create(test_pak);
+		dp_test_exp_set_fwd_status(exp, DP_TEST_FWD_DROPPED);
+		dp_test_pak_receive(test_pak, "dp1T0", exp);
+		return;
+	}
+
+	exp = dp_test_exp_create_m(test_pak, n);
+	for (i = 0; i < n; i++) {
+		oif = mcast_oif_name(oifs, n, ifindex[i]);
+		dp_test_exp_set_oif_name_m(exp, i, oif);
+
+		pak = dp_test_exp_get_pak_m(exp, i);
+		dp_test_pktmbuf_eth_init(pak, l2_grp,
+					 dp_test_intf_name2mac_str(oif),
+					 af == AF_INET ? RTE_ETHER_TYPE_IPV4 :
+					 RTE_ETHER_TYPE_IPV6);
+		if (af == AF_INET)
+			dp_test_ipv4_decrement_ttl(pak);
+		else
+			dp_test_ipv6_decrement_ttl(pak);
+	}
+	dp_test_pak_receive(test_pak, "dp1T0", exp);
+}
+
+/*
+ * Output vector rebuilds.  With an (S,G) in place, add an output vif,
+ * change the route's interfaces and delete the vif again.  Forwarding
+ * must follow each change, and once the vif is deleted no output vector
+ * may still point at it, including after its grace period has passed.
+ *
+ *                         +-----+ dp2T1
+ *   source ---------------| uut |-------------
+ *                   dp1T0 |     | dp3T2
+ *                         +-----+-------------
+ */
+static void mcast_olist_rebuild(int af, const char *src, const char *grp,
+				const char *l2_grp)
+{
+	const char *oifs_both[] = { "dp2T1", "dp3T2" };
+	const char *oifs_dp2[] = { "dp2T1" };
+	const char *oifs_dp3[] = { "dp3T2" };
+
+	mcast_fwd_set("dp1T0", af, true);
+	mcast_fwd_set("dp2T1", af, true);
+
+	/* dp3T2 has no vif yet, so is left out of the olist */
+	mcast_route(RTM_NEWROUTE, af, src, grp, "dp1T0", oifs_both, 2);
+	mcast_olist_wait(af, src, grp, oifs_dp2, 1);
+	mcast_fwd_check(af, src, grp, l2_grp, oifs_dp2, 1);
+
+	/* Adding the vif does not change a route that does not use it */
+	mcast_fwd_set("dp3T2", af, true);
+	mcast_fwd_check(af, src, grp, l2_grp, oifs_dp2, 1);
+
+	/* Once the route includes it, copies go out of both */
+	mcast_route(RTM_NEWROUTE, af, src, grp, "dp1T0", oifs_both, 2);
+	mcast_olist_wait(af, src, grp, oifs_both, 2);
+	mcast_fwd_check(af, src, grp, l2_grp, oifs_both, 2);
+
+	/* Change the route's interfaces */
+	mcast_route(RTM_NEWROUTE, af, src, grp, "dp1T0", oifs_dp3, 1);
+	mcast_olist_wait(af, src, grp, oifs_dp3, 1);
+	mcast_fwd_check(af, src, grp, l2_grp, oifs_dp3, 1);
+
+	mcast_route(RTM_NEWROUTE, af, src, grp, "dp1T0", oifs_both, 2);
+	mcast_olist_wait(af, src, grp, oifs_both, 2);
+	mcast_fwd_check(af, src, grp, l2_grp, oifs_both, 2);
+
+	/*
+	 * Delete the vif while the route still names it.  The olist is
+	 * rebuilt before the vif is freed, and stays clean after.
+	 */
+	mcast_fwd_set("dp3T2", af, false);
+	mcast_fwd_check(af, src, grp, l2_grp, oifs_dp2, 1);
+	usleep(100000);
+	mcast_fwd_check(af, src, grp, l2_grp, oifs_dp2, 1);
+
+	/* Clean up */
+	mcast_route(RTM_DELROUTE, af, src, grp, "dp1T0", oifs_dp2, 1);
+	mcast_olist_wait(af, src, grp, NULL, 0);
+
+	mcast_fwd_set("dp2T1", af, false);
+	mcast_fwd_set("dp1T0", af, false);
+}
+
+DP_DECL_TEST_CASE(ip_msuite, ip_mfwd_olist, NULL, NULL);
+DP_START_TEST(ip_mfwd_olist, ipv4)
+{
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_nl_add_ip_addr_and_connected("dp3T2", "3.3.3.3/24");
+
+	mcast_olist_rebuild(AF_INET, "1.1.1.11", "239.1.1.1",
+			    "01:00:5e:01:01:01");
+
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_nl_del_ip_addr_and_connected("dp3T2", "3.3.3.3/24");
+} DP_END_TEST;
+
+DP_START_TEST(ip_mfwd_olist, ipv6)
+{
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "2001:1:1::1/64");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2002:2:2::2/64");
+	dp_test_nl_add_ip_addr_and_connected("dp3T2", "2003:3:3::3/64");
+
+	mcast_olist_rebuild(AF_INET6, "2001:1:1::11", "ff0e::1:1",
+			    "33:33:00:01:00:01");
+
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "2001:1:1::1/64");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2002:2:2::2/64");
+	dp_test_nl_del_ip_addr_and_connected("dp3T2", "2003:3:3::3/64");
+} DP_END_TEST;
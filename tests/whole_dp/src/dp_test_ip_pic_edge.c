@@ -13,9 +13,12 @@
 #include "in_cksum.h"
 #include "if_var.h"
 #include "main.h"
+#include "nh_common.h"
 
 #include "dp_test.h"
+#include "dp_test_console.h"
 #include "dp_test_controller.h"
+#include "dp_test_json_utils.h"
 #include "dp_test_netlink_state_internal.h"
 #include "dp_test_lib_internal.h"
 #include "dp_test_lib_intf_internal.h"
@@ -854,3 +857,100 @@ DP_START_TEST(ip_pic_edge11, ip_pic_edge11)
 
 } DP_END_TEST;
 
+
+/*
+ * Read the resilient map of the route used for addr, which always has
+ * NH_MAP_MAX_ENTRIES buckets.
+ */
+static void dp_test_get_resilient_map(const char *addr, int map[])
+{
+	struct dp_test_json_mismatches *mismatches = NULL;
+	json_object *jresp, *jarray, *jroute, *jmap;
+	char cmd[100];
+	int i;
+
+	snprintf(cmd, sizeof(cmd), "route lookup %s", addr);
+	jresp = dp_test_json_do_show_cmd(cmd, &mismatches, false);
+	dp_test_fail_unless(jresp, "no response to \"%s\"", cmd);
+
+	dp_test_fail_unless(
+		json_object_object_get_ex(jresp, "route_lookup", &jarray) &&
+		json_object_array_length(jarray) == 1,
+		"no route for %s", addr);
+	jroute = json_object_array_get_idx(jarray, 0);
+
+	dp_test_fail_unless(
+		json_object_object_get_ex(jroute, "nh_map", &jmap) &&
+		json_object_array_length(jmap) == NH_MAP_MAX_ENTRIES,
+		"no resilient map for %s", addr);
+
+	for (i = 0; i < NH_MAP_MAX_ENTRIES; i++)
+		map[i] = json_object_get_int(
+			json_object_array_get_idx(jmap, i));
+
+	json_object_put(jresp);
+}
+
+DP_DECL_TEST_CASE(ip_pic_edge_suite, ip_ecmp_resilient, NULL, NULL);
+DP_START_TEST(ip_ecmp_resilient, ip_ecmp_resilient)
+{
+	int map3[NH_MAP_MAX_ENTRIES], map2[NH_MAP_MAX_ENTRIES];
+	int again[NH_MAP_MAX_ENTRIES];
+	/* map2 paths 0 and 1 are map3 paths 0 and 2 */
+	int path2to3[] = { 0, 2 };
+	int i, moved = 0;
+
+	dp_test_console_request_reply("ecmp mode resilient", false);
+
+	dp_test_nl_add_ip_addr_and_connected("dp1T1", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_nl_add_ip_addr_and_connected("dp3T1", "3.3.3.3/24");
+
+	dp_test_netlink_add_route(
+		"10.0.1.0/24 nh 1.1.1.2 int:dp1T1 nh 2.2.2.1 int:dp2T1 "
+		"nh 3.3.3.1 int:dp3T1");
+	dp_test_get_resilient_map("10.0.1.4", map3);
+	dp_test_netlink_del_route(
+		"10.0.1.0/24 nh 1.1.1.2 int:dp1T1 nh 2.2.2.1 int:dp2T1 "
+		"nh 3.3.3.1 int:dp3T1");
+
+	/* Losing the middle path must only move the buckets it held */
+	dp_test_netlink_add_route(
+		"10.0.1.0/24 nh 1.1.1.2 int:dp1T1 nh 3.3.3.1 int:dp3T1");
+	dp_test_get_resilient_map("10.0.1.4", map2);
+	dp_test_netlink_del_route(
+		"10.0.1.0/24 nh 1.1.1.2 int:dp1T1 nh 3.3.3.1 int:dp3T1");
+
+	for (i = 0; i < NH_MAP_MAX_ENTRIES; i++) {
+		if (map3[i] == 1) {
+			moved++;
+			continue;
+		}
+		dp_test_fail_unless(path2to3[map2[i]] == map3[i],
+				    "bucket %d moved from path %d to %d",
+				    i, map3[i], path2to3[map2[i]]);
+	}
+	dp_test_fail_unless(moved > 0, "middle path had no buckets");
+
+	/* and getting it back restores the original map */
+	dp_test_netlink_add_route(
+		"10.0.1.0/24 nh 1.1.1.2 int:dp1T1 nh 2.2.2.1 int:dp2T1 "
+		"nh 3.3.3.1 int:dp3T1");
+	dp_test_get_resilient_map("10.0.1.4", again);
+	dp_test_netlink_del_route(
+		"10.0.1.0/24 nh 1.1.1.2 int:dp1T1 nh 2.2.2.1 int:dp2T1 "
+		"nh 3.3.3.1 int:dp3T1");
+
+	for (i = 0; i < NH_MAP_MAX_ENTRIES; i++)
+		dp_test_fail_unless(again[i] == map3[i],
+				    "bucket %d is path %d, was %d",
+				    i, again[i], map3[i]);
+
+	/* Clean Up */
+	dp_test_nl_del_ip_addr_and_connected("dp1T1", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_nl_del_ip_addr_and_connected("dp3T1", "3.3.3.3/24");
+
+	dp_test_console_request_reply("ecmp mode hrw", false);
+
+} DP_END_TEST;
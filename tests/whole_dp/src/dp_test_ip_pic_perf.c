@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Measure pic edge switchover time against the number of prefixes
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "util.h"
+
+#include "dp_test/dp_test_macros.h"
+#include "dp_test/dp_test_cmd_check.h"
+#include "dp_test_lib_internal.h"
+#include "dp_test_lib_intf_internal.h"
+#include "dp_test_netlink_state_internal.h"
+
+#define PIC_PERF_NH	"nh 1.1.1.2 int:dp1T1 nh 2.2.2.1 int:dp2T1 backup"
+
+DP_DECL_TEST_SUITE(ip_pic_perf);
+
+/*
+ * Add the prefixes without waiting for each in turn.  Netlink messages are
+ * processed in order, so verifying the last one is enough to know they are
+ * all present.
+ */
+static void pic_perf_add_routes(unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count - 1; i++)
+		dp_test_nl_add_route_fmt(false, "10.%u.%u.0/24 " PIC_PERF_NH,
+					 i / 256, i % 256);
+	dp_test_nl_add_route_fmt(true, "10.%u.%u.0/24 " PIC_PERF_NH,
+				 i / 256, i % 256);
+}
+
+static void pic_perf_del_routes(unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count - 1; i++)
+		dp_test_nl_del_route_fmt(false, "10.%u.%u.0/24 " PIC_PERF_NH,
+					 i / 256, i % 256);
+	dp_test_nl_del_route_fmt(true, "10.%u.%u.0/24 " PIC_PERF_NH,
+				 i / 256, i % 256);
+}
+
+/*
+ * Add count prefixes that all use the same primary and backup path, then
+ * time how long it takes to move all of them onto the backup when the
+ * primary becomes unusable, and back again.
+ */
+static void pic_perf_run(unsigned int count)
+{
+	struct timespec start, end;
+	uint64_t down_usecs, up_usecs;
+	char cmd[64];
+
+	pic_perf_add_routes(count);
+
+	snprintf(cmd, sizeof(cmd), "route lookup 10.%u.%u.1",
+		 (count - 1) / 256, (count - 1) % 256);
+	dp_test_check_state_show(cmd, "\"nh_map\":[0]", false);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dp_test_make_nh_unusable("dp1T1", "1.1.1.2");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	down_usecs = timespec_diff_us(&start, &end);
+
+	dp_test_check_state_show(cmd, "\"nh_map\":[1]", false);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dp_test_make_nh_usable("dp1T1", "1.1.1.2");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	up_usecs = timespec_diff_us(&start, &end);
+
+	dp_test_check_state_show(cmd, "\"nh_map\":[0]", false);
+
+	pic_perf_del_routes(count);
+	dp_test_clear_path_unusable();
+
+	printf("PIC %u prefixes: switch to backup %lu us, "
+	       "switch to primary %lu us\n",
+	       count, down_usecs, up_usecs);
+}
+
+DP_DECL_TEST_CASE(ip_pic_perf, switchover, NULL, NULL);
+
+/*
+ * TESTCASE: Switchover time against prefix count
+ *
+ * All the prefixes share one next_hop_list, so the switchover should take
+ * the same time however many prefixes there are.  Not run as part of the
+ * build, as the result depends on the machine and its workload.
+ */
+DP_START_TEST_DONT_RUN(switchover, prefixes)
+{
+	dp_test_nl_add_ip_addr_and_connected("dp1T1", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+
+	pic_perf_run(1);
+	pic_perf_run(1000);
+	pic_perf_run(10000);
+	pic_perf_run(60000);
+
+	dp_test_nl_del_ip_addr_and_connected("dp1T1", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+
+} DP_END_TEST;
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Measure L2TPv3 pseudowire throughput
+ */
+
+#include <arpa/inet.h>
+#include <libmnl/libmnl.h>
+#include <linux/genetlink.h>
+#include <linux/if_arp.h>
+#include <linux/l2tp.h>
+#include <linux/rtnetlink.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdio.h>
+
+#include "dp_test.h"
+#include "dp_test_console.h"
+#include "dp_test_controller.h"
+#include "dp_test_lib_internal.h"
+#include "dp_test_lib_intf_internal.h"
+#include "dp_test_lib_perf.h"
+#include "dp_test_netlink_state_internal.h"
+#include "dp_test_pktmbuf_lib_internal.h"
+
+/*
+ *                      1.1.1.1/24 +-----+
+ *   L2TPv3/UDP peer  -------------| uut |------------- attachment circuit
+ *        1.1.1.2            dp1T1 |     | dp2T2
+ *                                 +-----+
+ *
+ * Session 1 on lttpv1 is cross-connected to dp2T2.
+ */
+
+#define L2TP_PERF_FRAME_LEN	64
+#define L2TP_PERF_PORT		1701
+#define L2TP_PERF_TUNNEL	1
+#define L2TP_PERF_SESSION	1
+#define L2TP_PERF_COOKIE	0x12345678
+/* UDP session header, then a 4 byte cookie */
+#define L2TP_PERF_HDR_LEN	(8 + 4)
+
+DP_DECL_TEST_SUITE(l2tp_perf);
+
+/* Create or delete the l2tpeth interface, which has no link kind */
+static void l2tp_perf_link(const char *ifname, uint16_t nlmsg_type)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	char topic[DP_TEST_TMP_BUF];
+	struct ifinfomsg *ifi;
+	struct nlmsghdr *nlh;
+
+	memset(buf, 0, sizeof(buf));
+	nlh = mnl_nlmsg_put_header(buf);
+	nlh->nlmsg_type = nlmsg_type;
+	nlh->nlmsg_flags = NLM_F_ACK;
+
+	ifi = mnl_nlmsg_put_extra_header(nlh, sizeof(*ifi));
+	ifi->ifi_type = ARPHRD_ETHER;
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_index = dp_test_intf_name2index(ifname);
+	ifi->ifi_flags = IFF_UP | IFF_RUNNING | IFF_LOWER_UP |
+		IFF_BROADCAST | IFF_MULTICAST;
+	ifi->ifi_change = 0xffffffff;
+
+	mnl_attr_put(nlh, IFLA_ADDRESS, RTE_ETHER_ADDR_LEN,
+		     dp_test_intf_name2mac(ifname));
+	mnl_attr_put_strz(nlh, IFLA_IFNAME, ifname);
+	mnl_attr_put_u32(nlh, IFLA_MTU, 1500);
+
+	if (nl_generate_topic(nlh, topic, sizeof(topic)) < 0)
+		dp_test_assert_internal(0);
+	nl_propagate(topic, nlh);
+}
+
+/* Send an l2tp genetlink message, as the controller would */
+static struct nlmsghdr *
+l2tp_perf_genl_start(char *buf, uint8_t cmd)
+{
+	struct genlmsghdr *genl;
+	struct nlmsghdr *nlh;
+
+	/* The family id is not checked, so is left as 0 */
+	memset(buf, 0, MNL_SOCKET_BUFFER_SIZE);
+	nlh = mnl_nlmsg_put_header(buf);
+
+	genl = mnl_nlmsg_put_extra_header(nlh, sizeof(*genl));
+	genl->cmd = cmd;
+	genl->version = L2TP_GENL_VERSION;
+
+	mnl_attr_put_u32(nlh, L2TP_ATTR_CONN_ID, L2TP_PERF_TUNNEL);
+	return nlh;
+}
+
+static void l2tp_perf_tunnel(uint8_t cmd)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh = l2tp_perf_genl_start(buf, cmd);
+	struct in_addr local, peer;
+
+	inet_pton(AF_INET, "1.1.1.1", &local);
+	inet_pton(AF_INET, "1.1.1.2", &peer);
+
+	mnl_attr_put_u32(nlh, L2TP_ATTR_PEER_CONN_ID, L2TP_PERF_TUNNEL);
+	mnl_attr_put_u16(nlh, L2TP_ATTR_ENCAP_TYPE, L2TP_ENCAPTYPE_UDP);
+	mnl_attr_put_u32(nlh, L2TP_ATTR_IP_SADDR, local.s_addr);
+	mnl_attr_put_u32(nlh, L2TP_ATTR_IP_DADDR, peer.s_addr);
+	mnl_attr_put_u16(nlh, L2TP_ATTR_UDP_SPORT, L2TP_PERF_PORT);
+	mnl_attr_put_u16(nlh, L2TP_ATTR_UDP_DPORT, L2TP_PERF_PORT);
+
+	nl_propagate("l2tp_tunnel", nlh);
+}
+
+static void l2tp_perf_session(uint8_t cmd, const char *ifname)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh = l2tp_perf_genl_start(buf, cmd);
+	uint32_t cookie = htonl(L2TP_PERF_COOKIE);
+
+	mnl_attr_put_u32(nlh, L2TP_ATTR_SESSION_ID, L2TP_PERF_SESSION);
+	mnl_attr_put_u32(nlh, L2TP_ATTR_PEER_SESSION_ID, L2TP_PERF_SESSION);
+	mnl_attr_put(nlh, L2TP_ATTR_COOKIE, sizeof(cookie), &cookie);
+	mnl_attr_put(nlh, L2TP_ATTR_PEER_COOKIE, sizeof(cookie), &cookie);
+	mnl_attr_put_strz(nlh, L2TP_ATTR_IFNAME, ifname);
+
+	nl_propagate("l2tp_session", nlh);
+}
+
+/* Wait for the session on lttpv1, cross-connected to xconnect_ifname */
+static void l2tp_perf_verify(const char *xconnect_ifname)
+{
+	json_object *expected;
+
+	expected = dp_test_json_create("{ \"l2tp\":"
+				       "  ["
+				       "    {"
+				       "      \"session\": %u,"
+				       "      \"ifname\": \"lttpv1\","
+				       "      \"xconnect_ifname\": \"%s\","
+				       "    }"
+				       "  ]"
+				       "}",
+				       L2TP_PERF_SESSION, xconnect_ifname);
+	dp_test_check_json_state("l2tpeth -s lttpv1", expected,
+				 DP_TEST_JSON_CHECK_SUBSET, false);
+	json_object_put(expected);
+}
+
+static void l2tp_perf_setup(void)
+{
+	char real_ifname[IFNAMSIZ];
+	char cmd[TEST_MAX_CMD_LEN];
+
+	dp_test_nl_add_ip_addr_and_connected("dp1T1", "1.1.1.1/24");
+	dp_test_netlink_add_neigh("dp1T1", "1.1.1.2", "aa:bb:cc:dd:ee:02");
+
+	dp_test_intf_virt_add("lttpv1");
+	l2tp_perf_link("lttpv1", RTM_NEWLINK);
+	l2tp_perf_tunnel(L2TP_CMD_TUNNEL_CREATE);
+	l2tp_perf_session(L2TP_CMD_SESSION_CREATE, "lttpv1");
+	l2tp_perf_verify("");
+
+	dp_test_intf_real("dp2T2", real_ifname);
+	snprintf(cmd, sizeof(cmd), "l2tpeth -c add %s lttpv1 64",
+		 real_ifname);
+	dp_test_console_request_reply(cmd, false);
+	l2tp_perf_verify(real_ifname);
+}
+
+static void l2tp_perf_teardown(void)
+{
+	char real_ifname[IFNAMSIZ];
+	char cmd[TEST_MAX_CMD_LEN];
+
+	dp_test_intf_real("dp2T2", real_ifname);
+	snprintf(cmd, sizeof(cmd), "l2tpeth -c remove %s lttpv1 0",
+		 real_ifname);
+	dp_test_console_request_reply(cmd, false);
+
+	l2tp_perf_session(L2TP_CMD_SESSION_DELETE, "lttpv1");
+	l2tp_perf_tunnel(L2TP_CMD_TUNNEL_DELETE);
+	l2tp_perf_link("lttpv1", RTM_DELLINK);
+	dp_test_intf_virt_del("lttpv1");
+
+	dp_test_netlink_del_neigh("dp1T1", "1.1.1.2", "aa:bb:cc:dd:ee:02");
+	dp_test_nl_del_ip_addr_and_connected("dp1T1", "1.1.1.1/24");
+}
+
+/* Write an attachment circuit frame from the given flow */
+static void l2tp_perf_frame(struct rte_ether_hdr *eh, uint32_t flow)
+{
+	memset(eh, 0, L2TP_PERF_FRAME_LEN);
+	eh->d_addr = (struct rte_ether_addr){
+		.addr_bytes = { 0xaa, 0xbb, 0xcc, 0x00, 0x00, 0x01 } };
+	eh->s_addr = (struct rte_ether_addr){
+		.addr_bytes = { 0xaa, 0xbb, 0xcc, 0x01, flow / 256,
+				flow % 256 } };
+	eh->ether_type = htons(RTE_ETHER_TYPE_IPV4);
+}
+
+/* An encapsulated frame from the peer, received on dp1T1 */
+static struct rte_mbuf *l2tp_perf_decap_pak(void *arg, unsigned int i,
+					    uint32_t flow)
+{
+	int len = L2TP_PERF_HDR_LEN + L2TP_PERF_FRAME_LEN;
+	struct rte_mbuf *test_pak;
+	uint32_t *l2tp;
+
+	test_pak = dp_test_create_udp_ipv4_pak("1.1.1.2", "1.1.1.1",
+					       L2TP_PERF_PORT, L2TP_PERF_PORT,
+					       1, &len);
+	(void)dp_test_pktmbuf_eth_init(test_pak,
+				       dp_test_intf_name2mac_str("dp1T1"),
+				       NULL, RTE_ETHER_TYPE_IPV4);
+
+	l2tp = (uint32_t *)(rte_pktmbuf_mtod(test_pak, char *) +
+			    RTE_ETHER_HDR_LEN + sizeof(struct iphdr) +
+			    sizeof(struct udphdr));
+	l2tp[0] = htonl(0x00030000);	/* version 3 */
+	l2tp[1] = htonl(L2TP_PERF_SESSION);
+	l2tp[2] = htonl(L2TP_PERF_COOKIE);
+	l2tp_perf_frame((struct rte_ether_hdr *)&l2tp[3], flow);
+
+	return test_pak;
+}
+
+/* A frame from the attachment circuit, received on dp2T2 */
+static struct rte_mbuf *l2tp_perf_encap_pak(void *arg, unsigned int i,
+					    uint32_t flow)
+{
+	int len = L2TP_PERF_FRAME_LEN - RTE_ETHER_HDR_LEN;
+	struct rte_mbuf *test_pak;
+
+	test_pak = dp_test_create_l2_pak("aa:bb:cc:0:0:1", "aa:bb:cc:1:0:0",
+					 RTE_ETHER_TYPE_IPV4, 1, &len);
+	l2tp_perf_frame(rte_pktmbuf_mtod(test_pak, struct rte_ether_hdr *),
+			flow);
+	return test_pak;
+}
+
+DP_DECL_TEST_CASE(l2tp_perf, pseudowire_throughput, NULL, NULL);
+
+/*
+ * TESTCASE: Pseudowire throughput
+ *
+ * Frames from DPT_PERF_FLOWS source MACs, decapsulated and encapsulated.
+ */
+DP_START_TEST_DONT_RUN(pseudowire_throughput, udpv4)
+{
+	l2tp_perf_setup();
+
+	dpt_perf_run("dp1T1", "dp2T2", l2tp_perf_decap_pak, NULL,
+		     "L2TPv3 decap");
+	dpt_perf_run("dp2T2", "dp1T1", l2tp_perf_encap_pak, NULL,
+		     "L2TPv3 encap");
+
+	l2tp_perf_teardown();
+
+} DP_END_TEST;
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * 802.3ad software distributor tests
+ */
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "if_var.h"
+#include "lag.h"
+
+#include "dp_test.h"
+#include "dp_test_lib_internal.h"
+#include "dp_test_lib_intf_internal.h"
+#include "dp_test_pktmbuf_lib_internal.h"
+#include "dp_test/dp_test_macros.h"
+
+#define LAG_TEST_FLOWS		256
+#define LAG_TEST_MAX_MEMBERS	4
+
+DP_DECL_TEST_SUITE(lag_suite);
+
+/* A UDP packet from flow, which is the bottom 16 bits of the source */
+static struct rte_mbuf *lag_test_pak(uint32_t flow)
+{
+	char saddr[INET_ADDRSTRLEN];
+	struct rte_mbuf *m;
+	int len = 64;
+
+	snprintf(saddr, sizeof(saddr), "10.73.%u.%u", flow / 256, flow % 256);
+	m = dp_test_create_udp_ipv4_pak(saddr, "10.73.200.1", 1000, 2000,
+					1, &len);
+	dp_test_fail_unless(m, "failed to create packet for flow %u", flow);
+	return m;
+}
+
+static uint32_t lag_test_flow(struct rte_mbuf *m)
+{
+	struct iphdr *ip = (struct iphdr *)(rte_pktmbuf_mtod(m, char *) +
+					    RTE_ETHER_HDR_LEN);
+
+	return ntohl(ip->saddr) & 0xffff;
+}
+
+/*
+ * Transmit a burst of count packets on bond, the i'th from flow
+ * first + i % nflows.
+ */
+static void lag_test_send(const char *bond, uint32_t first, uint32_t nflows,
+			  uint32_t count)
+{
+	struct ifnet *ifp = ifnet_byport(dp_test_intf_name2port(bond));
+	struct rte_mbuf *bufs[LAG_TEST_FLOWS];
+	uint16_t sent;
+	uint32_t i;
+
+	dp_test_fail_unless(count <= LAG_TEST_FLOWS, "too many flows");
+
+	for (i = 0; i < count; i++)
+		bufs[i] = lag_test_pak(first + i % nflows);
+
+	sent = dpdk_lag_tx_burst(ifp, 0, bufs, count);
+	dp_test_fail_unless(sent == count, "%s: sent %u of %u packets",
+			    bond, sent, count);
+}
+
+/*
+ * Take the packets from a member's transmit ring, recording which flows
+ * were sent on it.  Returns the number of packets.
+ */
+static unsigned int lag_test_receive(const char *member, bool *flows)
+{
+	struct rte_mbuf *bufs[64];
+	unsigned int total = 0;
+	int count, i;
+
+	while ((count = dp_test_pak_get_from_ring(member, bufs, 64)) > 0) {
+		for (i = 0; i < count; i++) {
+			if (flows)
+				flows[lag_test_flow(bufs[i])] = true;
+			rte_pktmbuf_free(bufs[i]);
+		}
+		total += count;
+	}
+	return total;
+}
+
+static void lag_test_dist_set(const char *bond, const char **members,
+			      uint16_t count)
+{
+	portid_t ports[LAG_TEST_MAX_MEMBERS];
+	uint16_t i;
+	int rc;
+
+	for (i = 0; i < count; i++)
+		ports[i] = dp_test_intf_name2port(members[i]);
+
+	rc = dpdk_lag_dist_set_ut(dp_test_intf_name2port(bond), ports, count);
+	dp_test_fail_unless(rc == 0, "failed to set %s distributor: %d",
+			    bond, rc);
+}
+
+static void lag_test_stats_verify(const char *member, uint64_t exp_packets,
+				  uint64_t exp_moves)
+{
+	uint64_t tx_packets, moves;
+
+	dpdk_lag_member_stats_ut(dp_test_intf_name2port(member),
+				 &tx_packets, &moves);
+	dp_test_fail_unless(tx_packets == exp_packets,
+			    "%s tx-packets %lu, expected %lu",
+			    member, tx_packets, exp_packets);
+	dp_test_fail_unless(moves == exp_moves,
+			    "%s flowlet-moves %lu, expected %lu",
+			    member, moves, exp_moves);
+}
+
+DP_DECL_TEST_CASE(lag_suite, lag_dist, NULL, NULL);
+
+/*
+ * TESTCASE: New flows are spread over all the members
+ *
+ * Each flow is sent on exactly one member, every member gets a fair share,
+ * and the per-member tx-packets match what was sent on it.  New flows are
+ * not flowlet moves.
+ */
+DP_START_TEST(lag_dist, spread)
+{
+	const char *members[] = { "dp1T1", "dp1T2", "dp1T3" };
+	bool flows[ARRAY_SIZE(members)][LAG_TEST_FLOWS] = { { false } };
+	unsigned int count[ARRAY_SIZE(members)];
+	unsigned int i, f, n, total = 0;
+
+	lag_test_dist_set("dp1T0", members, ARRAY_SIZE(members));
+	lag_test_send("dp1T0", 0, LAG_TEST_FLOWS, LAG_TEST_FLOWS);
+
+	for (i = 0; i < ARRAY_SIZE(members); i++) {
+		count[i] = lag_test_receive(members[i], flows[i]);
+		total += count[i];
+
+		dp_test_fail_unless(count[i] >= LAG_TEST_FLOWS /
+				    (2 * ARRAY_SIZE(members)),
+				    "%s only sent %u of %u flows",
+				    members[i], count[i], LAG_TEST_FLOWS);
+		lag_test_stats_verify(members[i], count[i], 0);
+	}
+	dp_test_fail_unless(total == LAG_TEST_FLOWS,
+			    "members sent %u packets, expected %u",
+			    total, LAG_TEST_FLOWS);
+
+	for (f = 0; f < LAG_TEST_FLOWS; f++) {
+		n = 0;
+		for (i = 0; i < ARRAY_SIZE(members); i++)
+			n += flows[i][f];
+		dp_test_fail_unless(n == 1, "flow %u sent on %u members",
+				    f, n);
+	}
+
+	/* nothing is sent on the bond port itself */
+	dp_test_fail_unless(lag_test_receive("dp1T0", NULL) == 0,
+			    "packets sent on the bond port");
+
+	lag_test_dist_set("dp1T0", NULL, 0);
+} DP_END_TEST;
+
+/*
+ * TESTCASE: An idle flow moves to the least loaded member
+ *
+ * A burst from one flow loads its member.  Once the flow has been idle for
+ * longer than the flowlet gap (500us) its next packet moves to the other,
+ * idle, member, which counts a flowlet move.  The rest of its burst stays
+ * on the new member.
+ */
+DP_START_TEST(lag_dist, flowlet)
+{
+	const char *members[] = { "dp2T1", "dp2T2" };
+	unsigned int first, other;
+
+	lag_test_dist_set("dp2T0", members, ARRAY_SIZE(members));
+	lag_test_send("dp2T0", 7, 1, 32);
+
+	if (lag_test_receive(members[0], NULL) == 32) {
+		first = 0;
+		other = 1;
+	} else {
+		first = 1;
+		other = 0;
+	}
+	dp_test_fail_unless(lag_test_receive(members[other], NULL) == 0,
+			    "flow split over both members");
+	lag_test_stats_verify(members[first], 32, 0);
+
+	/* well past the flowlet gap */
+	usleep(2000);
+
+	lag_test_send("dp2T0", 7, 1, 2);
+
+	dp_test_fail_unless(lag_test_receive(members[other], NULL) == 2,
+			    "flow did not move to %s", members[other]);
+	dp_test_fail_unless(lag_test_receive(members[first], NULL) == 0,
+			    "flow still sent on %s", members[first]);
+	lag_test_stats_verify(members[first], 32, 0);
+	lag_test_stats_verify(members[other], 2, 1);
+
+	lag_test_dist_set("dp2T0", NULL, 0);
+} DP_END_TEST;
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Whole dataplane test throughput library
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#include "dp_test/dp_test_macros.h"
+#include "dp_test_lib_intf_internal.h"
+#include "dp_test_lib_perf.h"
+
+/* Get packets from the transmit ring and free them */
+static int dpt_perf_receive(const char *ifname)
+{
+	struct rte_mbuf *bufs[64];
+	int count;
+	int i;
+
+	count = dp_test_pak_get_from_ring(ifname, bufs, 64);
+	for (i = 0; i < count; i++)
+		rte_pktmbuf_free(bufs[i]);
+
+	return count;
+}
+
+void dpt_perf_report(const char *desc, uint64_t pkts, uint64_t usecs)
+{
+	printf("%s: %lu pkts in %lu us (%lu pps)\n",
+	       desc, pkts, usecs, usecs ? pkts * 1000000ul / usecs : 0);
+}
+
+void dpt_perf_run(const char *rx_ifname, const char *tx_ifname,
+		  dpt_perf_pak_fn pak, void *arg, const char *desc)
+{
+	struct rte_mbuf *burst[DPT_PERF_BURST];
+	struct timespec start, end;
+	int sent = 0, received = 0;
+	int sleep_count = 0;
+	unsigned int b, i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (b = 0; b < DPT_PERF_BURSTS; b++) {
+		for (i = 0; i < DPT_PERF_BURST; i++)
+			burst[i] = pak(arg, i, (b + i) % DPT_PERF_FLOWS);
+
+		dp_test_pak_add_to_ring(rx_ifname, burst, DPT_PERF_BURST,
+					false);
+		sent += DPT_PERF_BURST;
+		received += dpt_perf_receive(tx_ifname);
+	}
+
+	while (received != sent && sleep_count < 100000) {
+		received += dpt_perf_receive(tx_ifname);
+		usleep(1);
+		sleep_count++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	dp_test_fail_unless(received == sent,
+			    "%s: sent %d packets, but received %d",
+			    desc, sent, received);
+
+	dpt_perf_report(desc, sent, timespec_diff_us(&start, &end));
+}
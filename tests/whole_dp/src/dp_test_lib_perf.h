@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Timing loop shared by the throughput tests.
+ *
+ * The throughput tests are not run as part of the build, as the result
+ * depends on the machine and its workload.  They are only useful for
+ * comparisons between runs on the same machine.
+ */
+
+#ifndef _DP_TEST_LIB_PERF_H_
+#define _DP_TEST_LIB_PERF_H_
+
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+
+#define DPT_PERF_BURST		32
+#define DPT_PERF_BURSTS		2000
+#define DPT_PERF_FLOWS		64
+
+/*
+ * Build the i'th packet of a burst, from one of DPT_PERF_FLOWS flows.  arg
+ * is passed through from dpt_perf_run.
+ */
+typedef struct rte_mbuf *(*dpt_perf_pak_fn)(void *arg, unsigned int i,
+					     uint32_t flow);
+
+/*
+ * Send DPT_PERF_BURSTS bursts of DPT_PERF_BURST packets into rx_ifname,
+ * and time how long until they have all come out of tx_ifname.  The time
+ * includes building the packets.  Fails the test if any are lost, and
+ * prints the rate as "<desc>: ...".
+ */
+void dpt_perf_run(const char *rx_ifname, const char *tx_ifname,
+		  dpt_perf_pak_fn pak, void *arg, const char *desc);
+
+/* Print the rate in the same form as dpt_perf_run */
+void dpt_perf_report(const char *desc, uint64_t pkts, uint64_t usecs);
+
+#endif /* _DP_TEST_LIB_PERF_H_ */
@@ -5970,6 +5970,92 @@ DP_START_TEST(mpls_size, config)
 	dp_test_netlink_set_mpls_forwarding("dp1T1", false);
 } DP_END_TEST;
 
+static void
+mpls_size_lswap_pak(label_t in_label, label_t out_label,
+		    const char *nh_mac_str)
+{
+	struct dp_test_expected *exp;
+	struct rte_mbuf *expected_pak;
+	struct rte_mbuf *payload_pak;
+	struct rte_mbuf *test_pak;
+	int len = 22;
+
+	payload_pak = dp_test_create_ipv4_pak("99.99.0.0", "88.88.0.0",
+					      1, &len);
+
+	test_pak = dp_test_create_mpls_pak(
+		1, (label_t []){in_label},
+		(uint8_t []){DP_TEST_PAK_DEFAULT_TTL},
+		payload_pak);
+	(void)dp_test_pktmbuf_eth_init(test_pak,
+				       dp_test_intf_name2mac_str("dp1T1"),
+				       NULL,
+				       RTE_ETHER_TYPE_MPLS);
+
+	expected_pak = dp_test_create_mpls_pak(
+		1, (label_t []){out_label},
+		(uint8_t []){DP_TEST_PAK_DEFAULT_TTL - 1},
+		payload_pak);
+	(void)dp_test_pktmbuf_eth_init(expected_pak,
+				       nh_mac_str,
+				       dp_test_intf_name2mac_str("dp2T2"),
+				       RTE_ETHER_TYPE_MPLS);
+
+	exp = dp_test_exp_create(expected_pak);
+	rte_pktmbuf_free(expected_pak);
+	rte_pktmbuf_free(payload_pak);
+	dp_test_exp_set_oif_name(exp, "dp2T2");
+
+	dp_test_pak_receive(test_pak, "dp1T1", exp);
+}
+
+/*
+ * Labels below the label table size are found via the direct index, and
+ * labels above it, or above the largest index, via the hash table.  Check
+ * both are forwarded, and that the index is rebuilt on a resize.
+ */
+DP_START_TEST(mpls_size, direct_index)
+{
+	const char *nh_mac_str = "aa:bb:cc:dd:ee:ff";
+
+	dp_test_netlink_set_mpls_forwarding("dp1T1", true);
+	dp_test_netlink_add_neigh("dp2T2", "3.3.3.1", nh_mac_str);
+
+	dp_test_console_request_reply("mpls labeltablesize 1048576", false);
+
+	dp_test_netlink_add_route("222 mpt:ipv4 nh 3.3.3.1 int:dp2T2 lbls 22");
+	dp_test_netlink_add_route(
+		"1000000 mpt:ipv4 nh 3.3.3.1 int:dp2T2 lbls 33");
+
+	mpls_size_lswap_pak(222, 22, nh_mac_str);
+	mpls_size_lswap_pak(1000000, 33, nh_mac_str);
+
+	/* Shrink the index, and add a label beyond it */
+	dp_test_console_request_reply("mpls labeltablesize 1000", false);
+	dp_test_wait_for_route_gone(
+		"1000000 mpt:ipv4 nh 3.3.3.1 int:dp2T2 lbls 33", false,
+		__FILE__, __func__, __LINE__);
+	dp_test_netlink_add_route(
+		"1001 mpt:ipv4 nh 3.3.3.1 int:dp2T2 lbls 44");
+
+	mpls_size_lswap_pak(222, 22, nh_mac_str);
+	mpls_size_lswap_pak(1001, 44, nh_mac_str);
+
+	/* Replace an indexed label */
+	dp_test_netlink_replace_route(
+		"222 mpt:ipv4 nh 3.3.3.1 int:dp2T2 lbls 55");
+	mpls_size_lswap_pak(222, 55, nh_mac_str);
+
+	/*
+	 * Clean up
+	 */
+	dp_test_netlink_del_route("1001 mpt:ipv4 nh 3.3.3.1 int:dp2T2 lbls 44");
+	dp_test_netlink_del_route("222 mpt:ipv4 nh 3.3.3.1 int:dp2T2 lbls 55");
+	dp_test_console_request_reply("mpls labeltablesize 1048576", false);
+	dp_test_netlink_del_neigh("dp2T2", "3.3.3.1", nh_mac_str);
+	dp_test_netlink_set_mpls_forwarding("dp1T1", false);
+} DP_END_TEST;
+
 DP_DECL_TEST_CASE(mpls, mpls_oam, NULL, NULL);
 
 DP_START_TEST(mpls_oam, v4_ecmp)
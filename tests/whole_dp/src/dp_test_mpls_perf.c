@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Measure MPLS label switching throughput
+ */
+
+#include <netinet/in.h>
+#include <stdio.h>
+
+#include "dp_test/dp_test_macros.h"
+#include "dp_test_lib_internal.h"
+#include "dp_test_lib_intf_internal.h"
+#include "dp_test_lib_perf.h"
+#include "dp_test_netlink_state_internal.h"
+#include "dp_test_pktmbuf_lib_internal.h"
+
+DP_DECL_TEST_SUITE(mpls_perf);
+
+static void mpls_perf_setup(void)
+{
+	dp_test_netlink_set_mpls_forwarding("dp1T1", true);
+
+	dp_test_netlink_add_neigh("dp2T2", "3.3.3.1", "aa:bb:cc:dd:ee:01");
+	dp_test_netlink_add_neigh("dp2T2", "3.3.3.2", "aa:bb:cc:dd:ee:02");
+
+	/* A single path swap, and a two path ecmp swap */
+	dp_test_netlink_add_route("222 mpt:ipv4 nh 3.3.3.1 int:dp2T2 lbls 22");
+	dp_test_netlink_add_route("333 mpt:ipv4"
+				  " nh 3.3.3.1 int:dp2T2 lbls 33"
+				  " nh 3.3.3.2 int:dp2T2 lbls 34");
+}
+
+static void mpls_perf_teardown(void)
+{
+	dp_test_netlink_del_route("333 mpt:ipv4"
+				  " nh 3.3.3.1 int:dp2T2 lbls 33"
+				  " nh 3.3.3.2 int:dp2T2 lbls 34");
+	dp_test_netlink_del_route("222 mpt:ipv4 nh 3.3.3.1 int:dp2T2 lbls 22");
+
+	dp_test_netlink_del_neigh("dp2T2", "3.3.3.2", "aa:bb:cc:dd:ee:02");
+	dp_test_netlink_del_neigh("dp2T2", "3.3.3.1", "aa:bb:cc:dd:ee:01");
+
+	dp_test_netlink_set_mpls_forwarding("dp1T1", false);
+}
+
+static struct rte_mbuf *mpls_perf_pak(label_t label, uint32_t flow)
+{
+	struct rte_mbuf *payload_pak, *test_pak;
+	char saddr[INET_ADDRSTRLEN];
+	int len = 64;
+
+	snprintf(saddr, sizeof(saddr), "99.99.%u.%u",
+		 flow / 256, flow % 256);
+	payload_pak = dp_test_create_ipv4_pak(saddr, "88.88.0.1", 1, &len);
+
+	test_pak = dp_test_create_mpls_pak(
+		1, (label_t []){label},
+		(uint8_t []){DP_TEST_PAK_DEFAULT_TTL},
+		payload_pak);
+	rte_pktmbuf_free(payload_pak);
+
+	(void)dp_test_pktmbuf_eth_init(test_pak,
+				       dp_test_intf_name2mac_str("dp1T1"),
+				       NULL,
+				       RTE_ETHER_TYPE_MPLS);
+	return test_pak;
+}
+
+struct mpls_perf_labels {
+	label_t		*labels;
+	unsigned int	nlabels;
+};
+
+/*
+ * The packets in a burst use the given labels in turn, and DPT_PERF_FLOWS
+ * different payload flows so that the ecmp label uses both paths.
+ */
+static struct rte_mbuf *mpls_perf_burst_pak(void *arg, unsigned int i,
+					    uint32_t flow)
+{
+	struct mpls_perf_labels *l = arg;
+
+	return mpls_perf_pak(l->labels[i % l->nlabels], flow);
+}
+
+static void mpls_perf_run(label_t *labels, unsigned int nlabels,
+			  const char *desc)
+{
+	struct mpls_perf_labels l = { labels, nlabels };
+
+	dpt_perf_run("dp1T1", "dp2T2", mpls_perf_burst_pak, &l, desc);
+}
+
+DP_DECL_TEST_CASE(mpls_perf, lswap_throughput, NULL, NULL);
+
+/*
+ * TESTCASE: Label switching throughput
+ *
+ * A single path swap, an ecmp swap, and bursts alternating between them.
+ */
+DP_START_TEST_DONT_RUN(lswap_throughput, swap)
+{
+	mpls_perf_setup();
+
+	mpls_perf_run((label_t []){222}, 1, "MPLS swap");
+	mpls_perf_run((label_t []){333}, 1, "MPLS ecmp swap");
+	mpls_perf_run((label_t []){222, 333}, 2, "MPLS mixed swap");
+
+	mpls_perf_teardown();
+
+} DP_END_TEST;
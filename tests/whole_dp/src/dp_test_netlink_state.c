@@ -2568,8 +2568,8 @@ _dp_test_netlink_remove_bridge_port(const char *br_name, const char *eth_name,
  */
 static void
 dp_test_netlink_vxlan(const char *vxlan_name, uint16_t nlmsg_type,
-		      uint32_t vni, const char *parent_name, bool verify,
-		      const char *file, const char *func,
+		      uint32_t vni, const char *parent_name, uint8_t tos,
+		      bool verify, const char *file, const char *func,
 		      int line)
 {
 	char buf[MNL_SOCKET_BUFFER_SIZE];
@@ -2641,6 +2641,8 @@ dp_test_netlink_vxlan(const char *vxlan_name, uint16_t nlmsg_type,
 					 dp_test_intf_name2index(parent_name));
 		else
 			dp_test_assert_internal(false);
+		if (tos)
+			mnl_attr_put_u8(nlh, IFLA_VXLAN_TOS, tos);
 		mnl_attr_nest_end(nlh, vxlan_data);
 	}
 	mnl_attr_nest_end(nlh, vxlan_info);
@@ -2689,7 +2691,21 @@ _dp_test_netlink_create_vxlan(const char *vxlan_name, uint32_t vni,
 			      const char *parent_name, bool verify,
 			      const char *file, const char *func, int line)
 {
-	dp_test_netlink_vxlan(vxlan_name, RTM_NEWLINK, vni, parent_name,
+	dp_test_netlink_vxlan(vxlan_name, RTM_NEWLINK, vni, parent_name, 0,
+			      verify,
+			      file, func, line);
+}
+
+/*
+ * Set the outer tos of an existing vxlan interface, 0 to inherit it
+ */
+void
+_dp_test_netlink_set_vxlan_tos(const char *vxlan_name, uint32_t vni,
+			       const char *parent_name, uint8_t tos,
+			       bool verify, const char *file,
+			       const char *func, int line)
+{
+	dp_test_netlink_vxlan(vxlan_name, RTM_NEWLINK, vni, parent_name, tos,
 			      verify,
 			      file, func, line);
 }
@@ -2702,7 +2718,7 @@ _dp_test_netlink_del_vxlan(const char *vxlan_name, uint32_t vni,
 			   bool verify,
 			   const char *file, const char *func, int line)
 {
-	dp_test_netlink_vxlan(vxlan_name, RTM_DELLINK, vni, NULL, verify,
+	dp_test_netlink_vxlan(vxlan_name, RTM_DELLINK, vni, NULL, 0, verify,
 			      file, func, line);
 }
 
@@ -333,6 +333,15 @@ void _dp_test_netlink_create_vxlan(const char *vxlan_name, uint32_t vni,
 	_dp_test_netlink_create_vxlan(vxlan_name, vni, parent_name, true,\
 				      __FILE__, __func__, __LINE__)
 
+void _dp_test_netlink_set_vxlan_tos(const char *vxlan_name, uint32_t vni,
+				    const char *parent_name, uint8_t tos,
+				    bool verify,
+				    const char *file, const char *func,
+				    int line);
+#define dp_test_netlink_set_vxlan_tos(vxlan_name, vni, parent_name, tos) \
+	_dp_test_netlink_set_vxlan_tos(vxlan_name, vni, parent_name, tos, \
+				       true, __FILE__, __func__, __LINE__)
+
 void _dp_test_netlink_del_vxlan(const char *vxlan_name, uint32_t vni,
 				bool verify,
 				const char *file, const char *func,
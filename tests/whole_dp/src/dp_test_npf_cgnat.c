@@ -6881,6 +6881,340 @@ DP_START_TEST(cgnat54, test)
 } DP_END_TEST; /* cgnat54 */
 
 
+/*
+ * Get an integer field from "cgn-op show summary".  If obj is non-NULL then
+ * the field is looked for in the named object within the summary.  Returns
+ * -1 if the field is not found.
+ */
+static int64_t dpt_cgn_summary_int(const char *obj, const char *field)
+{
+	struct dp_test_json_mismatches *mismatches = NULL;
+	json_object *jresp, *jsumm, *jval;
+	int64_t val = -1;
+
+	jresp = dp_test_json_do_show_cmd("cgn-op show summary",
+					 &mismatches, false);
+	if (!jresp)
+		return -1;
+
+	if (!json_object_object_get_ex(jresp, "summary", &jsumm))
+		goto end;
+
+	if (obj && !json_object_object_get_ex(jsumm, obj, &jsumm))
+		goto end;
+
+	if (json_object_object_get_ex(jsumm, field, &jval))
+		val = json_object_get_int64(jval);
+end:
+	json_object_put(jresp);
+	return val;
+}
+
+/*
+ * cgnat55 -- Session table size and session mempools
+ *
+ * Configures the expected number of sessions, and checks the session table
+ * and mempool figures in the summary.  A new session is allocated from the
+ * lcore-local pool, or from the heap if there is no pool on its socket.
+ */
+DP_DECL_TEST_CASE(npf_cgnat, cgnat55, cgnat_setup, cgnat_teardown);
+DP_START_TEST(cgnat55, test)
+{
+	int64_t used;
+
+	dp_test_npf_cmd_fmt(false, "cgn-cfg session-table-size 1000");
+
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "sess_expected") == 1000,
+			    "sess_expected");
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "sess_ht_buckets") ==
+			    1024, "sess_ht_buckets");
+
+	/* Pools are sized for the expected number of sessions */
+	dp_test_fail_unless(dpt_cgn_summary_int("cgn_sess", "count") == 1000,
+			    "cgn_sess pool count");
+	dp_test_fail_unless(dpt_cgn_summary_int("cgn_sess2", "count") == 1000,
+			    "cgn_sess2 pool count");
+	dp_test_fail_unless(dpt_cgn_summary_int("cgn_sess", "mem_bytes") >=
+			    1000 * (int64_t)cgn_session_size(),
+			    "cgn_sess pool mem_bytes");
+
+	used = dpt_cgn_summary_int("cgn_sess", "in_use") +
+		dpt_cgn_summary_int("cgn_sess", "heap_allocs");
+
+	dpt_cgn_cmd_fmt(false, true,
+			"nat-ut pool add POOL1 "
+			"type=cgnat "
+			"prefix=RANGE1/1.1.1.192/26 "
+			"");
+
+	cgnat_policy_add("POLICY1", 10, "100.64.0.0/12", "POOL1",
+			 "dp2T1", CGN_MAP_EIM, CGN_FLTR_EIF, CGN_3TUPLE, true);
+
+	cgnat_udp("dp1T0", "aa:bb:cc:dd:1:a1", 0,
+		  "100.64.0.1", 49152, "1.1.1.1", 80,
+		  "1.1.1.192", 1024, "1.1.1.1", 80,
+		  "aa:bb:cc:dd:2:b1", 0, "dp2T1",
+		  DP_TEST_FWD_FORWARDED);
+
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "sess_count") == 1,
+			    "sess_count");
+	dp_test_fail_unless(dpt_cgn_summary_int("cgn_sess", "in_use") +
+			    dpt_cgn_summary_int("cgn_sess", "heap_allocs") ==
+			    used + 1, "session not accounted to pool or heap");
+
+	/*
+	 * A resize is deferred while there are sessions, so the summary
+	 * still shows the size of the installed tables.
+	 */
+	dp_test_npf_cmd_fmt(false, "cgn-cfg session-table-size 4000");
+
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "sess_expected") == 4000,
+			    "sess_expected");
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "sess_ht_buckets") ==
+			    1024, "sess_ht_buckets after deferred resize");
+
+	/* Cleanup */
+	cgnat_policy_del("POLICY1", 10, "dp2T1");
+	dp_test_npf_cmd_fmt(false, "nat-ut pool delete POOL1");
+
+	/* Revert to the default table size.  Pools are kept. */
+	dp_test_npf_cmd_fmt(false, "cgn-cfg session-table-size 0");
+
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "sess_expected") == 0,
+			    "sess_expected");
+	dp_test_fail_unless(dpt_cgn_summary_int("cgn_sess", "count") == 1000,
+			    "cgn_sess pool count");
+
+} DP_END_TEST; /* cgnat55 */
+
+
+/*
+ * Get an integer field from the first outstanding session walk in
+ * "cgn-op show summary".  Returns -1 if there is no outstanding walk.
+ */
+static int64_t dpt_cgn_walk_int(const char *field)
+{
+	struct dp_test_json_mismatches *mismatches = NULL;
+	json_object *jresp, *jsumm, *jarray, *jwalk, *jval;
+	int64_t val = -1;
+
+	jresp = dp_test_json_do_show_cmd("cgn-op show summary",
+					 &mismatches, false);
+	if (!jresp)
+		return -1;
+
+	if (json_object_object_get_ex(jresp, "summary", &jsumm) &&
+	    json_object_object_get_ex(jsumm, "sess_clear", &jarray) &&
+	    json_object_array_length(jarray) > 0) {
+		jwalk = json_object_array_get_idx(jarray, 0);
+		if (json_object_object_get_ex(jwalk, field, &jval))
+			val = json_object_get_int64(jval);
+	}
+
+	json_object_put(jresp);
+	return val;
+}
+
+/*
+ * cgnat56 -- Time-sliced session clear and gc walks
+ *
+ * Clears sessions one entry per slice, and removes the session at the walk
+ * cursor between slices.  The walk restarts from the beginning of the table
+ * and still visits every session.  Then runs the subscriber and public
+ * address gc one entry per slice, which destroys entries between slices,
+ * until the tables are empty.
+ */
+DP_DECL_TEST_CASE(npf_cgnat, cgnat56, cgnat_setup, cgnat_teardown);
+DP_START_TEST(cgnat56, test)
+{
+	const char *subs[] = { "100.64.0.1", "100.64.0.2", "100.64.0.3",
+			       "100.64.1.1" };
+	const char *smac[] = { "aa:bb:cc:dd:1:a1", "aa:bb:cc:dd:1:a2",
+			       "aa:bb:cc:dd:1:a4", "aa:bb:cc:dd:1:a3" };
+	uint i;
+
+	dpt_cgn_cmd_fmt(false, true,
+			"nat-ut pool add POOL1 "
+			"type=cgnat "
+			"address-range=RANGE1/1.1.1.11-1.1.1.11 "
+			"");
+
+	cgnat_policy_add("POLICY1", 10, "100.64.0.0/12", "POOL1",
+			 "dp2T1", CGN_MAP_EIM, CGN_FLTR_EIF, CGN_3TUPLE, true);
+
+	/* One session per subscriber, each with its own port-block */
+	for (i = 0; i < ARRAY_SIZE(subs); i++)
+		cgnat_udp("dp1T0", smac[i], 0,
+			  subs[i], 49152, "1.1.1.1", 80,
+			  "1.1.1.11", 1024 + 512 * i, "1.1.1.1", 80,
+			  "aa:bb:cc:dd:2:b1", 0, "dp2T1",
+			  DP_TEST_FWD_FORWARDED);
+
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "sess_count") == 4,
+			    "sess_count");
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "subs_table_used") == 4,
+			    "subs_table_used");
+
+	/* Visit one entry per slice, and run slices by hand */
+	dp_test_npf_cmd_fmt(false, "cgn-op ut walk batch 1");
+
+	/* The first slice is run straight away */
+	dp_test_npf_cmd_fmt(false, "cgn-op clear session");
+	dp_test_fail_unless(dpt_cgn_walk_int("visited") == 1,
+			    "walk visited %ld, expected 1",
+			    dpt_cgn_walk_int("visited"));
+
+	/* Remove the cursor entry between slices */
+	dp_test_npf_cmd_fmt(false, "cgn-op ut walk remove");
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "sess_count") == 3,
+			    "sess_count after remove");
+
+	dp_test_npf_cmd_fmt(false, "cgn-op ut walk slice");
+	dp_test_fail_unless(dpt_cgn_walk_int("restarts") == 1,
+			    "walk restarts %ld, expected 1",
+			    dpt_cgn_walk_int("restarts"));
+
+	for (i = 0; i < 10 && dpt_cgn_walk_int("visited") >= 0; i++)
+		dp_test_npf_cmd_fmt(false, "cgn-op ut walk slice");
+
+	dp_test_fail_unless(dpt_cgn_walk_int("visited") < 0,
+			    "walk did not complete");
+
+	/* Every remaining session was expired by the walk */
+	for (i = 0; i < CGN_SESS_GC_COUNT + 1; i++)
+		dp_test_npf_cmd_fmt(false, "cgn-op ut gc session");
+
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "sess_count") == 0,
+			    "sess_count %ld after gc",
+			    dpt_cgn_summary_int(NULL, "sess_count"));
+
+	/*
+	 * gc the subscriber and public address tables one entry per slice.
+	 * Each pass takes one slice per entry plus one to complete.
+	 */
+	for (i = 0; i < 100; i++) {
+		if (dpt_cgn_summary_int(NULL, "subs_table_used") == 0 &&
+		    dpt_cgn_summary_int(NULL, "apm_table_used") == 0)
+			break;
+		dp_test_npf_cmd_fmt(false, "cgn-op ut gc-slice subs");
+		dp_test_npf_cmd_fmt(false, "cgn-op ut gc-slice pub");
+	}
+
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "subs_table_used") == 0,
+			    "subs_table_used %ld",
+			    dpt_cgn_summary_int(NULL, "subs_table_used"));
+	dp_test_fail_unless(dpt_cgn_summary_int(NULL, "apm_table_used") == 0,
+			    "apm_table_used %ld",
+			    dpt_cgn_summary_int(NULL, "apm_table_used"));
+
+	dp_test_npf_cmd_fmt(false, "cgn-op ut walk batch 0");
+
+	/* Cleanup */
+	cgnat_policy_del("POLICY1", 10, "dp2T1");
+	dp_test_npf_cmd_fmt(false, "nat-ut pool delete POOL1");
+
+} DP_END_TEST; /* cgnat56 */
+
+
+/*
+ * cgnat57 -- Endpoint-independent mapping index
+ *
+ * A session created before the index is enabled is added when the index is
+ * populated.  A session created afterwards is added when it is activated.
+ * Inbound packets for both sessions are translated using the index.
+ */
+DP_DECL_TEST_CASE(npf_cgnat, cgnat57, cgnat_setup, cgnat_teardown);
+DP_START_TEST(cgnat57, test)
+{
+	uint i;
+
+	dp_test_npf_cmd_fmt(false, "cgn-cfg eim-table-size 0");
+
+	dpt_cgn_cmd_fmt(false, true,
+			"nat-ut pool add POOL1 "
+			"type=cgnat "
+			"prefix=RANGE1/1.1.1.192/26 "
+			"");
+
+	cgnat_policy_add("POLICY1", 10, "100.64.0.0/12", "POOL1",
+			 "dp2T1", CGN_MAP_EIM, CGN_FLTR_EIF, CGN_3TUPLE, true);
+
+	/* Session created before the index is enabled */
+	cgnat_udp("dp1T0", "aa:bb:cc:dd:1:a1", 0,
+		  "100.64.0.1", 49152, "1.1.1.1", 80,
+		  "1.1.1.192", 1024, "1.1.1.1", 80,
+		  "aa:bb:cc:dd:2:b1", 0, "dp2T1",
+		  DP_TEST_FWD_FORWARDED);
+
+	dp_test_npf_cmd_fmt(false, "cgn-cfg eim-table-size 1024");
+
+	dp_test_fail_unless(dpt_cgn_summary_int("eim", "entries") == 1024,
+			    "eim entries");
+	dp_test_fail_unless(dpt_cgn_summary_int("eim", "buckets") == 256,
+			    "eim buckets");
+	dp_test_fail_unless(dpt_cgn_summary_int("eim", "used") == 1,
+			    "eim used %ld after populate, expected 1",
+			    dpt_cgn_summary_int("eim", "used"));
+
+	/* Inbound, to the existing mapping */
+	cgnat_udp("dp2T1", "aa:bb:cc:dd:2:b1", 0,
+		  "1.1.1.1", 80, "1.1.1.192", 1024,
+		  "1.1.1.1", 80, "100.64.0.1", 49152,
+		  "aa:bb:cc:dd:1:a1", 0, "dp1T0",
+		  DP_TEST_FWD_FORWARDED);
+
+	dp_test_fail_unless(dpt_cgn_summary_int("eim", "hits") == 1,
+			    "eim hits %ld, expected 1",
+			    dpt_cgn_summary_int("eim", "hits"));
+
+	/* Session created while the index is enabled */
+	cgnat_udp("dp1T0", "aa:bb:cc:dd:1:a1", 0,
+		  "100.64.0.1", 49153, "1.1.1.1", 80,
+		  "1.1.1.192", 1025, "1.1.1.1", 80,
+		  "aa:bb:cc:dd:2:b1", 0, "dp2T1",
+		  DP_TEST_FWD_FORWARDED);
+
+	dp_test_fail_unless(dpt_cgn_summary_int("eim", "used") == 2,
+			    "eim used %ld, expected 2",
+			    dpt_cgn_summary_int("eim", "used"));
+
+	/*
+	 * Inbound from a different remote endpoint.  With endpoint
+	 * independent filtering this uses the same mapping.
+	 */
+	cgnat_udp("dp2T1", "aa:bb:cc:dd:2:b2", 0,
+		  "1.1.1.2", 5000, "1.1.1.192", 1025,
+		  "1.1.1.2", 5000, "100.64.0.1", 49153,
+		  "aa:bb:cc:dd:1:a1", 0, "dp1T0",
+		  DP_TEST_FWD_FORWARDED);
+
+	dp_test_fail_unless(dpt_cgn_summary_int("eim", "hits") == 2,
+			    "eim hits %ld, expected 2",
+			    dpt_cgn_summary_int("eim", "hits"));
+	dp_test_fail_unless(dpt_cgn_summary_int("eim", "misses") == 0,
+			    "eim misses %ld, expected 0",
+			    dpt_cgn_summary_int("eim", "misses"));
+
+	/* Expired sessions are removed from the index by the gc */
+	dp_test_npf_cmd_fmt(false, "cgn-op clear session");
+	for (i = 0; i < CGN_SESS_GC_COUNT + 1; i++)
+		dp_test_npf_cmd_fmt(false, "cgn-op ut gc session");
+
+	dp_test_fail_unless(dpt_cgn_summary_int("eim", "used") == 0,
+			    "eim used %ld after gc, expected 0",
+			    dpt_cgn_summary_int("eim", "used"));
+
+	/* Disable the index */
+	dp_test_npf_cmd_fmt(false, "cgn-cfg eim-table-size 0");
+	dp_test_fail_unless(dpt_cgn_summary_int("eim", "buckets") == 0,
+			    "eim buckets");
+
+	cgnat_policy_del("POLICY1", 10, "dp2T1");
+	dp_test_npf_cmd_fmt(false, "nat-ut pool delete POOL1");
+
+} DP_END_TEST; /* cgnat57 */
+
+
 
 
 #ifdef CGN_HASH_COMPARISON
@@ -17,10 +17,18 @@
 #include "in_cksum.h"
 #include "if_var.h"
 #include "main.h"
+#include "npf/npf.h"
+#include "npf/npf_cache.h"
+#include "npf/fragment/ipv4_frag_tbl.h"
+#include "npf/fragment/ipv4_rsmbl.h"
+#include "npf/fragment/ipv6_rsmbl.h"
+#include "npf/fragment/ipv6_rsmbl_tbl.h"
+#include "pktmbuf_internal.h"
 
 #include "dp_test.h"
 #include "dp_test_controller.h"
 #include "dp_test_console.h"
+#include "dp_test_json_utils.h"
 #include "dp_test_netlink_state_internal.h"
 #include "dp_test/dp_test_cmd_check.h"
 #include "dp_test_lib_internal.h"
@@ -35,6 +43,32 @@
 
 DP_DECL_TEST_SUITE(npf_defrag);
 
+/*
+ * Get the count of fragments dropped for the given reason, for "ip" or
+ * "ip6"
+ */
+static int defrag_drops(const char *af, const char *reason)
+{
+	json_object *jresp, *jdrops, *jip;
+	char *response;
+	bool err;
+	int val = -1;
+
+	response = dp_test_console_request_w_err("netstat", &err, false);
+	jresp = parse_json(response, NULL, 0);
+	free(response);
+	dp_test_fail_unless(jresp, "Failed to parse netstat");
+
+	if (json_object_object_get_ex(jresp, "frag_drops", &jdrops) &&
+	    json_object_object_get_ex(jdrops, af, &jip))
+		dp_test_json_int_field_from_obj(jip, reason, &val);
+
+	json_object_put(jresp);
+	dp_test_fail_unless(val >= 0, "No %s %s fragment drop count", af,
+			    reason);
+	return val;
+}
+
 static void defrag_setup(void);
 static void defrag_teardown(void);
 
@@ -351,6 +385,7 @@ DP_START_TEST(defrag5, test)
 		.dir    = "in",
 		.rules  = rset
 	};
+	int dups;
 
 	dp_test_npf_fw_add(&fw, false);
 
@@ -360,12 +395,18 @@ DP_START_TEST(defrag5, test)
 	dp_test_wait_for_pl_feat("dp1T0", "vyatta:ipv4-defrag-out",
 				"ipv4-out");
 
+	dups = defrag_drops("ip", "duplicate");
+
 	defrag_duplicate("dp1T0", "aa:bb:cc:dd:1:a1", 0,
 			"100.64.0.1", 49152, "1.1.1.1", 80,
 			"100.64.0.1", 49152, "1.1.1.1", 80,
 			"aa:bb:cc:dd:2:b1", 0, "dp2T1",
 			DP_TEST_FWD_FORWARDED, 0);
 
+	/* The second copy of the fragment is counted as a duplicate */
+	dp_test_fail_unless(defrag_drops("ip", "duplicate") == dups + 1,
+			    "Expected one duplicate fragment drop");
+
 	defrag_duplicate("dp1T0", "aa:bb:cc:dd:1:a1", 0,
 			"100.64.0.1", 49152, "1.1.1.1", 80,
 			"100.64.0.1", 49152, "1.1.1.1", 80,
@@ -780,3 +821,395 @@ _defrag_duplicate(const char *rx_intf, const char *pre_smac, int pre_vlan,
 			file, func, line);
 }
 
+
+#define DEFRAG_TEST_VRF	50
+
+/*
+ * Fragment a 1200 byte UDP datagram, with the given IP id, in a vrf.
+ * As above, the fragments in order are frags[3], [0], [1] and [2].
+ */
+static void
+defrag_v4_frags(uint16_t id, vrfid_t vrfid, struct rte_mbuf **frags)
+{
+	struct dp_test_pkt_desc_t pkt = {
+		.text       = "IPv4 UDP",
+		.len        = 1200,
+		.ether_type = RTE_ETHER_TYPE_IPV4,
+		.l3_src     = "100.64.0.1",
+		.l2_src     = "aa:bb:cc:dd:1:a1",
+		.l3_dst     = "1.1.1.1",
+		.l2_dst     = "aa:bb:cc:dd:2:b1",
+		.proto      = IPPROTO_UDP,
+		.l4         = {
+			.udp = {
+				.sport = 49152,
+				.dport = 80
+			}
+		},
+		.rx_intf    = "dp1T0",
+		.tx_intf    = "dp2T1"
+	};
+	uint16_t frag_sizes[4] = { 400, 400, 400, 8 };
+	struct rte_mbuf *m;
+	int rc;
+
+	m = dp_test_v4_pkt_from_desc(&pkt);
+	dp_test_fail_unless(m, "Failed to create packet");
+	iphdr(m)->id = htons(id);
+	pktmbuf_set_vrf(m, vrfid);
+
+	rc = dp_test_ipv4_fragment_packet(m, frags, 4, frag_sizes, 0);
+	dp_test_fail_unless(rc == 4, "dp_test_ipv4_fragment_packet failed: %d",
+			    rc);
+	rte_pktmbuf_free(m);
+}
+
+/*
+ * Hand one fragment of a datagram to IPv4 reassembly.  idx is its place
+ * in the datagram.  Returns the reassembled packet, if any.
+ */
+static struct rte_mbuf *
+defrag_v4_rx(uint16_t id, vrfid_t vrfid, unsigned int idx)
+{
+	static const unsigned int order[4] = { 3, 0, 1, 2 };
+	struct rte_mbuf *frags[4];
+	unsigned int i;
+
+	defrag_v4_frags(id, vrfid, frags);
+	for (i = 0; i < ARRAY_SIZE(frags); i++)
+		if (i != order[idx])
+			rte_pktmbuf_free(frags[i]);
+
+	return ipv4_handle_fragment(frags[order[idx]]);
+}
+
+/* Send all of a datagram, and check it is reassembled */
+static void
+defrag_v4_complete(uint16_t id, vrfid_t vrfid)
+{
+	struct rte_mbuf *m;
+	unsigned int i;
+
+	for (i = 0; i < 3; i++)
+		dp_test_fail_unless(!defrag_v4_rx(id, vrfid, i),
+				    "id %u: fragment %u not held", id, i);
+
+	m = defrag_v4_rx(id, vrfid, 3);
+	dp_test_fail_unless(m, "id %u: not reassembled", id);
+	dp_test_fail_unless(ntohs(iphdr(m)->tot_len) ==
+			    sizeof(struct iphdr) + sizeof(struct udphdr) + 1200,
+			    "id %u: reassembled length %u", id,
+			    ntohs(iphdr(m)->tot_len));
+	rte_pktmbuf_free(m);
+}
+
+/* Fragment a 1200 byte UDP datagram, with the given fragment id */
+static void
+defrag_v6_frags(uint32_t id, struct rte_mbuf **frags)
+{
+	struct dp_test_pkt_desc_t pkt = {
+		.text       = "IPv6 UDP",
+		.len        = 1192,
+		.ether_type = RTE_ETHER_TYPE_IPV6,
+		.l3_src     = "2001:1:1::2",
+		.l2_src     = "aa:bb:cc:dd:1:a1",
+		.l3_dst     = "2001:2:2::2",
+		.l2_dst     = "aa:bb:cc:dd:2:b1",
+		.proto      = IPPROTO_UDP,
+		.l4         = {
+			.udp = {
+				.sport = 49152,
+				.dport = 80
+			}
+		},
+		.rx_intf    = "dp1T0",
+		.tx_intf    = "dp2T1"
+	};
+	uint16_t frag_sizes[3] = { 400, 400, 400 };
+	struct rte_mbuf *m;
+	int rc;
+
+	m = dp_test_v6_pkt_from_desc(&pkt);
+	dp_test_fail_unless(m, "Failed to create packet");
+	pktmbuf_set_vrf(m, VRF_DEFAULT_ID);
+
+	rc = dp_test_ipv6_fragment_packet(m, frags, 3, frag_sizes, id);
+	dp_test_fail_unless(rc == 3, "dp_test_ipv6_fragment_packet failed: %d",
+			    rc);
+	rte_pktmbuf_free(m);
+}
+
+/*
+ * Hand one fragment of a datagram to IPv6 reassembly, optionally with
+ * its set freed before it is used.  Returns the reassembled packet, if
+ * any.
+ */
+static struct rte_mbuf *
+defrag_v6_rx(uint32_t id, unsigned int idx, bool stale)
+{
+	struct rte_mbuf *frags[3];
+	uint16_t npf_flag = NPF_FLAG_CACHE_EMPTY;
+	unsigned int i;
+
+	defrag_v6_frags(id, frags);
+	for (i = 0; i < ARRAY_SIZE(frags); i++)
+		if (i != idx)
+			rte_pktmbuf_free(frags[i]);
+
+	dp_test_fail_unless(npf_ipv6_is_fragment(frags[idx], &npf_flag),
+			    "id %u: not a fragment", id);
+	if (stale)
+		return ipv6_handle_fragment_stale_ut(frags[idx], &npf_flag);
+	return ipv6_handle_fragment(frags[idx], &npf_flag);
+}
+
+static void
+defrag_v6_complete(uint32_t id)
+{
+	struct rte_mbuf *m;
+	unsigned int i;
+
+	for (i = 0; i < 2; i++)
+		dp_test_fail_unless(!defrag_v6_rx(id, i, false),
+				    "id %u: fragment %u not held", id, i);
+
+	m = defrag_v6_rx(id, 2, false);
+	dp_test_fail_unless(m, "id %u: not reassembled", id);
+	dp_test_fail_unless(ntohs(ip6hdr(m)->ip6_plen) ==
+			    sizeof(struct udphdr) + 1192,
+			    "id %u: reassembled length %u", id,
+			    ntohs(ip6hdr(m)->ip6_plen));
+	rte_pktmbuf_free(m);
+}
+
+/*
+ * defrag_limits - IPv4 reassembly limits
+ *
+ * Fill the set table, half from each of two vrfs, and check that a new
+ * set evicts the oldest whichever vrf it is in.  Then fill the fragment
+ * budget, and check that the oldest other set is evicted, or the
+ * fragment dropped if there is no other.  Check a set freed under a
+ * fragment is counted as stale, and that sets expire.  After each, a
+ * fresh datagram is still reassembled.
+ */
+DP_DECL_TEST_CASE(npf_defrag, defrag_limits, NULL, NULL);
+DP_START_TEST(defrag_limits, ipv4)
+{
+	int evicted, timeout, budget, stale;
+	struct rte_mbuf *frags[4], *m;
+	struct vrf *vrf;
+	vrfid_t vrfid;
+	unsigned int i;
+
+	dp_test_netlink_add_vrf(DEFRAG_TEST_VRF, 1);
+	vrf = dp_vrf_get_rcu_from_external(
+		dp_test_translate_vrf_id(DEFRAG_TEST_VRF));
+	dp_test_fail_unless(vrf, "Failed to find vrf %u", DEFRAG_TEST_VRF);
+	vrfid = dp_vrf_get_vid(vrf);
+
+	/* Start from nothing held */
+	ipv4_frag_expire_ut();
+	dp_test_fail_unless(ipv4_frag_sets_ut() == 0 &&
+			    ipv4_frag_held_ut() == 0,
+			    "%u sets %u fragments left over",
+			    ipv4_frag_sets_ut(), ipv4_frag_held_ut());
+
+	evicted = defrag_drops("ip", "evicted");
+	timeout = defrag_drops("ip", "timeout");
+	budget = defrag_drops("ip", "over_budget");
+	stale = defrag_drops("ip", "stale");
+
+	/* The set limit is shared by all vrfs */
+	for (i = 0; i < IPV4_MAX_FRAG_SETS; i++)
+		dp_test_fail_unless(!defrag_v4_rx(i + 1, i & 1 ? vrfid :
+						  VRF_DEFAULT_ID, 0),
+				    "fragment %u not held", i);
+	dp_test_fail_unless(ipv4_frag_sets_ut() == IPV4_MAX_FRAG_SETS,
+			    "%u sets, expected %u", ipv4_frag_sets_ut(),
+			    IPV4_MAX_FRAG_SETS);
+
+	/* A new set in the other vrf evicts the oldest, id 1 */
+	dp_test_fail_unless(!defrag_v4_rx(IPV4_MAX_FRAG_SETS + 1, vrfid, 0),
+			    "fragment not held");
+	dp_test_fail_unless(ipv4_frag_sets_ut() == IPV4_MAX_FRAG_SETS,
+			    "%u sets after eviction", ipv4_frag_sets_ut());
+	dp_test_fail_unless(defrag_drops("ip", "evicted") == evicted + 1,
+			    "expected 1 evicted fragment, got %d",
+			    defrag_drops("ip", "evicted") - evicted);
+
+	/* A fresh datagram, evicting id 2 */
+	defrag_v4_complete(IPV4_MAX_FRAG_SETS + 2, VRF_DEFAULT_ID);
+	dp_test_fail_unless(defrag_drops("ip", "evicted") == evicted + 2,
+			    "expected 2 evicted fragments, got %d",
+			    defrag_drops("ip", "evicted") - evicted);
+
+	/* The rest time out */
+	ipv4_frag_expire_ut();
+	dp_test_fail_unless(ipv4_frag_sets_ut() == 0 &&
+			    ipv4_frag_held_ut() == 0,
+			    "%u sets %u fragments after expiry",
+			    ipv4_frag_sets_ut(), ipv4_frag_held_ut());
+	dp_test_fail_unless(defrag_drops("ip", "timeout") ==
+			    timeout + IPV4_MAX_FRAG_SETS - 1,
+			    "expected %u timed out fragments, got %d",
+			    IPV4_MAX_FRAG_SETS - 1,
+			    defrag_drops("ip", "timeout") - timeout);
+
+	/* Fill a budget of 8 fragments with 3 sets */
+	ipv4_frag_held_max_ut(8);
+	for (i = 0; i < 8; i++)
+		dp_test_fail_unless(!defrag_v4_rx(i / 3 + 1, VRF_DEFAULT_ID,
+						  i % 3),
+				    "fragment %u not held", i);
+	dp_test_fail_unless(ipv4_frag_held_ut() == 8,
+			    "%u fragments held", ipv4_frag_held_ut());
+
+	/* One more evicts the 3 fragments of the oldest set */
+	dp_test_fail_unless(!defrag_v4_rx(3, VRF_DEFAULT_ID, 2),
+			    "fragment not held");
+	dp_test_fail_unless(ipv4_frag_sets_ut() == 2 &&
+			    ipv4_frag_held_ut() == 6,
+			    "%u sets %u fragments after eviction",
+			    ipv4_frag_sets_ut(), ipv4_frag_held_ut());
+	dp_test_fail_unless(defrag_drops("ip", "evicted") == evicted + 5,
+			    "expected 5 evicted fragments, got %d",
+			    defrag_drops("ip", "evicted") - evicted);
+
+	/* With only the one set, there is nothing to evict */
+	ipv4_frag_expire_ut();
+	ipv4_frag_held_max_ut(2);
+	dp_test_fail_unless(!defrag_v4_rx(4, VRF_DEFAULT_ID, 0) &&
+			    !defrag_v4_rx(4, VRF_DEFAULT_ID, 1) &&
+			    !defrag_v4_rx(4, VRF_DEFAULT_ID, 2),
+			    "fragment over budget not dropped");
+	dp_test_fail_unless(defrag_drops("ip", "over_budget") == budget + 1,
+			    "expected 1 over budget drop, got %d",
+			    defrag_drops("ip", "over_budget") - budget);
+
+	/* The set is still there, so completes once there is room */
+	ipv4_frag_held_max_ut(0);
+	dp_test_fail_unless(!defrag_v4_rx(4, VRF_DEFAULT_ID, 2),
+			    "fragment not held");
+	m = defrag_v4_rx(4, VRF_DEFAULT_ID, 3);
+	dp_test_fail_unless(m, "not reassembled");
+	rte_pktmbuf_free(m);
+	dp_test_fail_unless(ipv4_frag_sets_ut() == 0 &&
+			    ipv4_frag_held_ut() == 0,
+			    "%u sets %u fragments after reassembly",
+			    ipv4_frag_sets_ut(), ipv4_frag_held_ut());
+
+	/* A fragment whose set is freed under it is dropped as stale */
+	defrag_v4_frags(5, VRF_DEFAULT_ID, frags);
+	for (i = 0; i < 3; i++)
+		rte_pktmbuf_free(frags[i]);
+	dp_test_fail_unless(!ipv4_handle_fragment_stale_ut(frags[3]),
+			    "stale fragment not dropped");
+	dp_test_fail_unless(defrag_drops("ip", "stale") == stale + 1,
+			    "expected 1 stale drop, got %d",
+			    defrag_drops("ip", "stale") - stale);
+	dp_test_fail_unless(ipv4_frag_sets_ut() == 0 &&
+			    ipv4_frag_held_ut() == 0,
+			    "%u sets %u fragments after stale drop",
+			    ipv4_frag_sets_ut(), ipv4_frag_held_ut());
+
+	defrag_v4_complete(5, VRF_DEFAULT_ID);
+	defrag_v4_complete(6, vrfid);
+
+	dp_test_netlink_del_vrf(DEFRAG_TEST_VRF, 0);
+} DP_END_TEST;
+
+/*
+ * defrag_limits - IPv6 reassembly limits
+ *
+ * As for IPv4: fill the set table, then the fragment budget, drop a
+ * fragment for a freed set, and expire sets.  A fresh datagram is still
+ * reassembled after each.
+ */
+DP_START_TEST(defrag_limits, ipv6)
+{
+	int evicted, timeout, budget, stale;
+	struct rte_mbuf *m;
+	unsigned int i;
+
+	ipv6_frag_expire_ut();
+	dp_test_fail_unless(ipv6_frag_sets_ut() == 0 &&
+			    ipv6_frag_held_ut() == 0,
+			    "%u sets %u fragments left over",
+			    ipv6_frag_sets_ut(), ipv6_frag_held_ut());
+
+	evicted = defrag_drops("ip6", "evicted");
+	timeout = defrag_drops("ip6", "timeout");
+	budget = defrag_drops("ip6", "over_budget");
+	stale = defrag_drops("ip6", "stale");
+
+	for (i = 0; i < IPV6_MAX_FRAG_SETS; i++)
+		dp_test_fail_unless(!defrag_v6_rx(i + 1, 0, false),
+				    "fragment %u not held", i);
+	dp_test_fail_unless(ipv6_frag_sets_ut() == IPV6_MAX_FRAG_SETS,
+			    "%u sets, expected %u", ipv6_frag_sets_ut(),
+			    IPV6_MAX_FRAG_SETS);
+
+	/* A fresh datagram evicts the oldest set */
+	defrag_v6_complete(IPV6_MAX_FRAG_SETS + 1);
+	dp_test_fail_unless(defrag_drops("ip6", "evicted") == evicted + 1,
+			    "expected 1 evicted fragment, got %d",
+			    defrag_drops("ip6", "evicted") - evicted);
+	dp_test_fail_unless(ipv6_frag_sets_ut() == IPV6_MAX_FRAG_SETS - 1,
+			    "%u sets after reassembly", ipv6_frag_sets_ut());
+
+	ipv6_frag_expire_ut();
+	dp_test_fail_unless(ipv6_frag_sets_ut() == 0 &&
+			    ipv6_frag_held_ut() == 0,
+			    "%u sets %u fragments after expiry",
+			    ipv6_frag_sets_ut(), ipv6_frag_held_ut());
+	dp_test_fail_unless(defrag_drops("ip6", "timeout") ==
+			    timeout + IPV6_MAX_FRAG_SETS - 1,
+			    "expected %u timed out fragments, got %d",
+			    IPV6_MAX_FRAG_SETS - 1,
+			    defrag_drops("ip6", "timeout") - timeout);
+
+	/* Fill a budget of 6 fragments with 3 sets of 2 */
+	ipv6_frag_held_max_ut(6);
+	for (i = 0; i < 6; i++)
+		dp_test_fail_unless(!defrag_v6_rx(i / 2 + 1, i % 2, false),
+				    "fragment %u not held", i);
+
+	/* One more, for a new set, evicts the oldest */
+	dp_test_fail_unless(!defrag_v6_rx(4, 0, false), "fragment not held");
+	dp_test_fail_unless(ipv6_frag_sets_ut() == 3 &&
+			    ipv6_frag_held_ut() == 5,
+			    "%u sets %u fragments after eviction",
+			    ipv6_frag_sets_ut(), ipv6_frag_held_ut());
+	dp_test_fail_unless(defrag_drops("ip6", "evicted") == evicted + 3,
+			    "expected 3 evicted fragments, got %d",
+			    defrag_drops("ip6", "evicted") - evicted);
+
+	/* With only the one set, there is nothing to evict */
+	ipv6_frag_expire_ut();
+	ipv6_frag_held_max_ut(1);
+	dp_test_fail_unless(!defrag_v6_rx(5, 0, false) &&
+			    !defrag_v6_rx(5, 1, false),
+			    "fragment over budget not dropped");
+	dp_test_fail_unless(defrag_drops("ip6", "over_budget") == budget + 1,
+			    "expected 1 over budget drop, got %d",
+			    defrag_drops("ip6", "over_budget") - budget);
+
+	ipv6_frag_held_max_ut(0);
+	dp_test_fail_unless(!defrag_v6_rx(5, 1, false), "fragment not held");
+	m = defrag_v6_rx(5, 2, false);
+	dp_test_fail_unless(m, "not reassembled");
+	rte_pktmbuf_free(m);
+
+	/* A fragment whose set is freed under it is dropped as stale */
+	dp_test_fail_unless(!defrag_v6_rx(6, 0, true),
+			    "stale fragment not dropped");
+	dp_test_fail_unless(defrag_drops("ip6", "stale") == stale + 1,
+			    "expected 1 stale drop, got %d",
+			    defrag_drops("ip6", "stale") - stale);
+	dp_test_fail_unless(ipv6_frag_sets_ut() == 0 &&
+			    ipv6_frag_held_ut() == 0,
+			    "%u sets %u fragments after stale drop",
+			    ipv6_frag_sets_ut(), ipv6_frag_held_ut());
+
+	defrag_v6_complete(6);
+} DP_END_TEST;
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Dataplane unit-tests for npf rule logging
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "npf/rproc/npf_ext_log.h"
+#include "util.h"
+
+#include "dp_test.h"
+#include "dp_test_lib_internal.h"
+#include "dp_test_lib_exp.h"
+#include "dp_test_lib_pkt.h"
+#include "dp_test_netlink_state_internal.h"
+#include "dp_test_json_utils.h"
+#include "dp_test_npf_lib.h"
+#include "dp_test_npf_fw_lib.h"
+
+DP_DECL_TEST_SUITE(npf_log);
+
+DP_DECL_TEST_CASE(npf_log, log_rate, NULL, NULL);
+
+/* Get a counter from the log rproc of rule 10 */
+static int npf_log_test_counter(const char *name)
+{
+	struct dp_test_json_find_key key[] = { {"rprocs", NULL},
+					       {"log", NULL} };
+	json_object *jrule, *jlog;
+	int val = -1;
+
+	jrule = dp_test_npf_json_get_rule("fw-in", "dp1T0", "in", "FW1_IN",
+					  "10");
+	dp_test_fail_unless(jrule, "failed to find rule 10");
+
+	jlog = dp_test_json_find(jrule, key, ARRAY_SIZE(key));
+	dp_test_fail_unless(jlog, "failed to find log rproc json");
+	dp_test_fail_unless(dp_test_json_int_field_from_obj(jlog, name, &val),
+			    "failed to get %s", name);
+
+	json_object_put(jlog);
+	json_object_put(jrule);
+	return val;
+}
+
+/*
+ * TESTCASE: Log rate limiting, and coalescing of repeated records
+ *
+ * A rule logging at most 5 records a second is hit by 8 packets of the
+ * same flow.  The 3 over the rate are counted as log-rate-limited, which
+ * clearing the rule stats resets.  The 5 records logged are queued
+ * together, so are written as one line with a repeat count.
+ *
+ *                  1.1.1.1 +-----+ 2.2.2.2
+ *                          |     |
+ *          ----------------| uut |----------------
+ *                    dp1T0 |     | dp2T1
+ *                    intf1 +-----+ intf2
+ */
+DP_START_TEST(log_rate, limited)
+{
+	struct dp_test_expected *test_exp;
+	struct rte_mbuf *test_pak;
+	unsigned int i, wait;
+	char *buf = NULL;
+	size_t bufsz = 0;
+	FILE *f;
+
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+
+	dp_test_netlink_add_neigh("dp1T0", "1.1.1.11",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.11",
+				  "aa:bb:cc:dd:2:b1");
+
+	struct dp_test_pkt_desc_t v4_pkt_desc = {
+		.text       = "UDP IPv4",
+		.len        = 20,
+		.ether_type = RTE_ETHER_TYPE_IPV4,
+		.l3_src     = "1.1.1.11",
+		.l2_src     = "aa:bb:cc:dd:1:a1",
+		.l3_dst     = "2.2.2.11",
+		.l2_dst     = "aa:bb:cc:dd:2:b1",
+		.proto      = IPPROTO_UDP,
+		.l4         = {
+			.udp = {
+				.sport = 1000,
+				.dport = 1001
+			}
+		},
+		.rx_intf    = "dp1T0",
+		.tx_intf    = "dp2T1"
+	};
+
+	struct dp_test_npf_rule_t rules[] = {
+		{
+			.rule = "10",
+			.pass = PASS,
+			.stateful = STATELESS,
+			.npf = "rproc=log(5)"
+		},
+		NULL_RULE
+	};
+
+	struct dp_test_npf_ruleset_t fw = {
+		.rstype = "fw-in",
+		.name   = "FW1_IN",
+		.enable = 1,
+		.attach_point   = "dp1T0",
+		.fwd    = FWD,
+		.dir    = "in",
+		.rules  = rules
+	};
+
+	dp_test_npf_fw_add(&fw, false);
+
+	dp_test_fail_unless(npf_log_test_counter("log-rate") == 5,
+			    "log rate not taken from the rule");
+
+	f = open_memstream(&buf, &bufsz);
+	dp_test_fail_unless(f, "failed to open memstream");
+	npf_log_stream_ut(f);
+	npf_log_pause_ut(true);
+
+	for (i = 0; i < 8; i++) {
+		test_pak = dp_test_v4_pkt_from_desc(&v4_pkt_desc);
+		test_exp = dp_test_exp_from_desc(test_pak, &v4_pkt_desc);
+		dp_test_exp_set_fwd_status(test_exp, DP_TEST_FWD_FORWARDED);
+		dp_test_pak_receive(test_pak, v4_pkt_desc.rx_intf, test_exp);
+	}
+
+	dp_test_npf_verify_rule_pkt_count("log rate", &fw, fw.rules[0].rule,
+					  8);
+	dp_test_fail_unless(npf_log_test_counter("log-rate-limited") == 3,
+			    "expected 3 log-rate-limited, got %d",
+			    npf_log_test_counter("log-rate-limited"));
+	dp_test_fail_unless(npf_log_test_counter("log-dropped") == 0,
+			    "expected no log-dropped, got %d",
+			    npf_log_test_counter("log-dropped"));
+
+	/* Let the writer have the records, and wait for it to go idle */
+	npf_log_pause_ut(false);
+	for (wait = 0; wait < 100 && npf_log_lines_ut() == 0; wait++)
+		usleep(10000);
+	usleep(50000);
+
+	dp_test_fail_unless(npf_log_lines_ut() == 1,
+			    "expected 1 log line, got %u",
+			    npf_log_lines_ut());
+	npf_log_stream_ut(NULL);
+	fclose(f);
+
+	dp_test_fail_unless(strstr(buf, " repeat=4\n"),
+			    "log line not coalesced: %s", buf);
+	dp_test_fail_unless(strstr(buf, " In:dp1T0 PASS fw rule FW1_IN:10 "),
+			    "unexpected log line: %s", buf);
+	free(buf);
+
+	/* Clearing the rule stats resets the count */
+	dp_test_npf_clear("fw-in");
+	dp_test_fail_unless(npf_log_test_counter("log-rate-limited") == 0,
+			    "log-rate-limited not cleared, got %d",
+			    npf_log_test_counter("log-rate-limited"));
+
+	/* Cleanup */
+	dp_test_npf_fw_del(&fw, false);
+
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+
+	dp_test_netlink_del_neigh("dp1T0", "1.1.1.11",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.11",
+				  "aa:bb:cc:dd:2:b1");
+} DP_END_TEST;
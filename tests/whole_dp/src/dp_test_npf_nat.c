@@ -9,11 +9,13 @@
  */
 
 #include <libmnl/libmnl.h>
+#include <netinet/udp.h>
 
 #include "ip_funcs.h"
 #include "in_cksum.h"
 #include "if_var.h"
 #include "main.h"
+#include "npf/npf_nat.h"
 
 #include "dp_test.h"
 #include "dp_test_controller.h"
@@ -24,6 +26,7 @@
 #include "dp_test_lib_exp.h"
 #include "dp_test_lib_intf_internal.h"
 #include "dp_test_lib_pkt.h"
+#include "dp_test_lib_tcp.h"
 #include "dp_test_pktmbuf_lib_internal.h"
 #include "dp_test_console.h"
 #include "dp_test_json_utils.h"
@@ -43,6 +46,7 @@
  * 6. Mapping of address ranges
  * 7. The "exclude" option
  * 8. Source NAT (port range)
+ * 9. Session rewrite templates
  *
  * To debug:
  *
@@ -2863,3 +2867,464 @@ DP_START_TEST(npf_snat10, test1)
 	dp_test_nl_del_ip_addr_and_connected("dp2T1", "203.0.114.1/24");
 
 } DP_END_TEST;
+
+
+/*
+ * Session rewrite templates
+ *
+ *                             +-----+
+ * host1            10.0.1.254 |     | 172.0.2.254     host3
+ * 10.0.1.1   -----------------| uut |---------------  172.0.2.3
+ *                      dp1T0  |     | dp2T1
+ *                             +-----+
+ *
+ * SNAT masquerades 10.0.1.1 to 172.0.2.254 on dp2T1 output.  DNAT
+ * translates 172.0.2.10 to 10.0.1.1 on dp2T1 input.
+ *
+ * Established flows are translated with the per-session rewrite templates.
+ * The expected packets are built with the translated addresses and ports
+ * and freshly computed checksums, so each packet verifies the incremental
+ * L3 and L4 checksum updates.  Sessions with an ALG always use the general
+ * translation path.
+ */
+static void npf_nat_tmpl_setup(void)
+{
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "10.0.1.254/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "172.0.2.254/24");
+
+	dp_test_netlink_add_neigh("dp1T0", "10.0.1.1", "aa:bb:cc:dd:1:1");
+	dp_test_netlink_add_neigh("dp2T1", "172.0.2.3", "aa:bb:cc:dd:2:3");
+}
+
+static void npf_nat_tmpl_teardown(void)
+{
+	dp_test_npf_cleanup();
+
+	dp_test_netlink_del_neigh("dp1T0", "10.0.1.1", "aa:bb:cc:dd:1:1");
+	dp_test_netlink_del_neigh("dp2T1", "172.0.2.3", "aa:bb:cc:dd:2:3");
+
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "10.0.1.254/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "172.0.2.254/24");
+}
+
+static void npf_nat_tmpl_snat(bool add)
+{
+	struct dp_test_npf_nat_rule_t snat = {
+		.desc		= "snat rule",
+		.rule		= "10",
+		.ifname		= "dp2T1",
+		.proto		= NAT_NULL_PROTO,
+		.map		= "dynamic",
+		.from_addr	= "10.0.1.0/24",
+		.from_port	= NULL,
+		.to_addr	= NULL,
+		.to_port	= NULL,
+		.trans_addr	= "masquerade",
+		.trans_port	= NULL
+	};
+
+	if (add)
+		dp_test_npf_snat_add(&snat, true);
+	else
+		dp_test_npf_snat_del(snat.ifname, snat.rule, true);
+}
+
+static void npf_nat_tmpl_dnat(bool add)
+{
+	struct dp_test_npf_nat_rule_t dnat = {
+		.desc		= "dnat rule",
+		.rule		= "10",
+		.ifname		= "dp2T1",
+		.proto		= NAT_NULL_PROTO,
+		.map		= "dynamic",
+		.from_addr	= NULL,
+		.from_port	= NULL,
+		.to_addr	= "172.0.2.10",
+		.to_port	= NULL,
+		.trans_addr	= "10.0.1.1",
+		.trans_port	= NULL
+	};
+
+	if (add)
+		dp_test_npf_dnat_add(&dnat, true);
+	else
+		dp_test_npf_dnat_del(dnat.ifname, dnat.rule, true);
+}
+
+/*
+ * Send a UDP packet with a zero checksum.  The translated packet must keep
+ * the zero checksum.
+ */
+static void
+npf_nat_tmpl_udp0(const char *rx_intf, const char *smac,
+		  const char *saddr, uint16_t sport,
+		  const char *daddr, uint16_t dport,
+		  const char *post_saddr, const char *post_daddr,
+		  const char *dmac, const char *tx_intf)
+{
+	struct dp_test_expected *test_exp;
+	struct rte_mbuf *test_pak, *exp_pak;
+	struct udphdr *udp;
+
+	struct dp_test_pkt_desc_t pre = {
+		.text       = "IPv4 UDP zero checksum",
+		.len        = 20,
+		.ether_type = RTE_ETHER_TYPE_IPV4,
+		.l3_src     = saddr,
+		.l2_src     = smac,
+		.l3_dst     = daddr,
+		.l2_dst     = dmac,
+		.proto      = IPPROTO_UDP,
+		.l4         = {
+			.udp = {
+				.sport = sport,
+				.dport = dport
+			}
+		},
+		.rx_intf    = rx_intf,
+		.tx_intf    = tx_intf
+	};
+	struct dp_test_pkt_desc_t post = pre;
+
+	post.l3_src = post_saddr;
+	post.l3_dst = post_daddr;
+
+	test_pak = dp_test_v4_pkt_from_desc(&pre);
+	udp = (struct udphdr *)(iphdr(test_pak) + 1);
+	udp->check = 0;
+
+	exp_pak = dp_test_v4_pkt_from_desc(&post);
+	test_exp = dp_test_exp_from_desc(exp_pak, &post);
+	rte_pktmbuf_free(exp_pak);
+
+	exp_pak = dp_test_exp_get_pak(test_exp);
+	udp = (struct udphdr *)(iphdr(exp_pak) + 1);
+	udp->check = 0;
+
+	dp_test_pak_receive(test_pak, rx_intf, test_exp);
+}
+
+static void npf_nat_tmpl_check(unsigned int exp_tmpl,
+			       unsigned int exp_general)
+{
+	unsigned int tmpl, general;
+
+	npf_nat_tmpl_ut(&tmpl, &general);
+	dp_test_fail_unless(tmpl == exp_tmpl,
+			    "template sessions %u, expected %u",
+			    tmpl, exp_tmpl);
+	dp_test_fail_unless(general == exp_general,
+			    "general path sessions %u, expected %u",
+			    general, exp_general);
+}
+
+/*
+ * TCP call with data in both directions.
+ */
+static void
+npf_nat_tmpl_tcp(struct dp_test_pkt_desc_t *fw_pre,
+		 struct dp_test_pkt_desc_t *fw_pst,
+		 struct dp_test_pkt_desc_t *bk_pre,
+		 struct dp_test_pkt_desc_t *bk_pst)
+{
+	struct dpt_tcp_flow call = {
+		.text[0] = '\0',
+		.isn = {0, 0},
+		.desc[DPT_FORW] = {
+			.pre = fw_pre,
+			.pst = fw_pst,
+		},
+		.desc[DPT_BACK] = {
+			.pre = bk_pre,
+			.pst = bk_pst,
+		},
+		.test_cb = NULL,
+		.post_cb = NULL,
+	};
+	snprintf(call.text, sizeof(call.text), "TCP");
+
+	struct dpt_tcp_flow_pkt pkts[] = {
+		{ DPT_FORW, TH_SYN, 0, NULL, 0, NULL },
+		{ DPT_BACK, TH_SYN | TH_ACK, 0, NULL, 0, NULL },
+		{ DPT_FORW, TH_ACK, 0, NULL, 0, NULL },
+
+		/* session established */
+		{ DPT_FORW, TH_ACK, 40, NULL, 0, NULL },
+		{ DPT_BACK, TH_ACK, 100, NULL, 0, NULL },
+		{ DPT_FORW, TH_ACK, 17, NULL, 0, NULL },
+		{ DPT_BACK, TH_ACK, 0, NULL, 0, NULL },
+		{ DPT_BACK, TH_ACK | TH_PUSH, 33, NULL, 0, NULL },
+		{ DPT_FORW, TH_ACK, 0, NULL, 0, NULL },
+	};
+
+	dpt_tcp_call(&call, pkts, ARRAY_SIZE(pkts), 0, 0, NULL, 0);
+}
+
+DP_DECL_TEST_CASE(npf_nat, npf_nat_tmpl, npf_nat_tmpl_setup,
+		  npf_nat_tmpl_teardown);
+
+/*
+ * SNAT.  TCP, UDP, zero checksum UDP and ICMP echo, several packets each
+ * way.
+ */
+DP_START_TEST(npf_nat_tmpl, snat)
+{
+	struct dp_test_pkt_desc_t *fw_pre, *fw_pst, *bk_pre, *bk_pst;
+	uint i;
+
+	npf_nat_tmpl_snat(true);
+
+	fw_pre = dpt_pdesc_v4_create(
+		"fw_pre", IPPROTO_TCP,
+		"aa:bb:cc:dd:1:1", "10.0.1.1", 41000,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 80,
+		"dp1T0", "dp2T1");
+	fw_pst = dpt_pdesc_v4_create(
+		"fw_pst", IPPROTO_TCP,
+		"aa:bb:cc:dd:1:1", "172.0.2.254", 41000,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 80,
+		"dp1T0", "dp2T1");
+	bk_pre = dpt_pdesc_v4_create(
+		"bk_pre", IPPROTO_TCP,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 80,
+		"aa:bb:cc:dd:1:1", "172.0.2.254", 41000,
+		"dp2T1", "dp1T0");
+	bk_pst = dpt_pdesc_v4_create(
+		"bk_pst", IPPROTO_TCP,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 80,
+		"aa:bb:cc:dd:1:1", "10.0.1.1", 41000,
+		"dp2T1", "dp1T0");
+
+	npf_nat_tmpl_tcp(fw_pre, fw_pst, bk_pre, bk_pst);
+
+	for (i = 0; i < 4; i++) {
+		dpt_udp("dp1T0", "aa:bb:cc:dd:1:1",
+			"10.0.1.1", 41001, "172.0.2.3", 53,
+			"172.0.2.254", 41001, "172.0.2.3", 53,
+			"aa:bb:cc:dd:2:3", "dp2T1",
+			DP_TEST_FWD_FORWARDED);
+
+		dpt_udp("dp2T1", "aa:bb:cc:dd:2:3",
+			"172.0.2.3", 53, "172.0.2.254", 41001,
+			"172.0.2.3", 53, "10.0.1.1", 41001,
+			"aa:bb:cc:dd:1:1", "dp1T0",
+			DP_TEST_FWD_FORWARDED);
+	}
+
+	for (i = 0; i < 4; i++) {
+		npf_nat_tmpl_udp0("dp1T0", "aa:bb:cc:dd:1:1",
+				  "10.0.1.1", 41002, "172.0.2.3", 4789,
+				  "172.0.2.254", "172.0.2.3",
+				  "aa:bb:cc:dd:2:3", "dp2T1");
+
+		npf_nat_tmpl_udp0("dp2T1", "aa:bb:cc:dd:2:3",
+				  "172.0.2.3", 4789, "172.0.2.254", 41002,
+				  "172.0.2.3", "10.0.1.1",
+				  "aa:bb:cc:dd:1:1", "dp1T0");
+	}
+
+	for (i = 0; i < 4; i++) {
+		dpt_icmp(ICMP_ECHO,
+			 "dp1T0", "aa:bb:cc:dd:1:1",
+			 "10.0.1.1", 1234, "172.0.2.3",
+			 "172.0.2.254", 1234, "172.0.2.3",
+			 "aa:bb:cc:dd:2:3", "dp2T1",
+			 DP_TEST_FWD_FORWARDED);
+
+		dpt_icmp(ICMP_ECHOREPLY,
+			 "dp2T1", "aa:bb:cc:dd:2:3",
+			 "172.0.2.3", 1234, "172.0.2.254",
+			 "172.0.2.3", 1234, "10.0.1.1",
+			 "aa:bb:cc:dd:1:1", "dp1T0",
+			 DP_TEST_FWD_FORWARDED);
+	}
+
+	/* TCP, UDP, zero checksum UDP and ICMP sessions */
+	npf_nat_tmpl_check(4, 0);
+
+	free(fw_pre);
+	free(fw_pst);
+	free(bk_pre);
+	free(bk_pst);
+
+	npf_nat_tmpl_snat(false);
+
+} DP_END_TEST;
+
+/*
+ * DNAT.  TCP, UDP, zero checksum UDP and ICMP echo, several packets each
+ * way.
+ */
+DP_START_TEST(npf_nat_tmpl, dnat)
+{
+	struct dp_test_pkt_desc_t *fw_pre, *fw_pst, *bk_pre, *bk_pst;
+	uint i;
+
+	npf_nat_tmpl_dnat(true);
+
+	fw_pre = dpt_pdesc_v4_create(
+		"fw_pre", IPPROTO_TCP,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 42000,
+		"aa:bb:cc:dd:1:1", "172.0.2.10", 80,
+		"dp2T1", "dp1T0");
+	fw_pst = dpt_pdesc_v4_create(
+		"fw_pst", IPPROTO_TCP,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 42000,
+		"aa:bb:cc:dd:1:1", "10.0.1.1", 80,
+		"dp2T1", "dp1T0");
+	bk_pre = dpt_pdesc_v4_create(
+		"bk_pre", IPPROTO_TCP,
+		"aa:bb:cc:dd:1:1", "10.0.1.1", 80,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 42000,
+		"dp1T0", "dp2T1");
+	bk_pst = dpt_pdesc_v4_create(
+		"bk_pst", IPPROTO_TCP,
+		"aa:bb:cc:dd:1:1", "172.0.2.10", 80,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 42000,
+		"dp1T0", "dp2T1");
+
+	npf_nat_tmpl_tcp(fw_pre, fw_pst, bk_pre, bk_pst);
+
+	for (i = 0; i < 4; i++) {
+		dpt_udp("dp2T1", "aa:bb:cc:dd:2:3",
+			"172.0.2.3", 42001, "172.0.2.10", 53,
+			"172.0.2.3", 42001, "10.0.1.1", 53,
+			"aa:bb:cc:dd:1:1", "dp1T0",
+			DP_TEST_FWD_FORWARDED);
+
+		dpt_udp("dp1T0", "aa:bb:cc:dd:1:1",
+			"10.0.1.1", 53, "172.0.2.3", 42001,
+			"172.0.2.10", 53, "172.0.2.3", 42001,
+			"aa:bb:cc:dd:2:3", "dp2T1",
+			DP_TEST_FWD_FORWARDED);
+	}
+
+	for (i = 0; i < 4; i++) {
+		npf_nat_tmpl_udp0("dp2T1", "aa:bb:cc:dd:2:3",
+				  "172.0.2.3", 42002, "172.0.2.10", 4789,
+				  "172.0.2.3", "10.0.1.1",
+				  "aa:bb:cc:dd:1:1", "dp1T0");
+
+		npf_nat_tmpl_udp0("dp1T0", "aa:bb:cc:dd:1:1",
+				  "10.0.1.1", 4789, "172.0.2.3", 42002,
+				  "172.0.2.10", "172.0.2.3",
+				  "aa:bb:cc:dd:2:3", "dp2T1");
+	}
+
+	for (i = 0; i < 4; i++) {
+		dpt_icmp(ICMP_ECHO,
+			 "dp2T1", "aa:bb:cc:dd:2:3",
+			 "172.0.2.3", 1234, "172.0.2.10",
+			 "172.0.2.3", 1234, "10.0.1.1",
+			 "aa:bb:cc:dd:1:1", "dp1T0",
+			 DP_TEST_FWD_FORWARDED);
+
+		dpt_icmp(ICMP_ECHOREPLY,
+			 "dp1T0", "aa:bb:cc:dd:1:1",
+			 "10.0.1.1", 1234, "172.0.2.3",
+			 "172.0.2.10", 1234, "172.0.2.3",
+			 "aa:bb:cc:dd:2:3", "dp2T1",
+			 DP_TEST_FWD_FORWARDED);
+	}
+
+	/* TCP, UDP, zero checksum UDP and ICMP sessions */
+	npf_nat_tmpl_check(4, 0);
+
+	free(fw_pre);
+	free(fw_pst);
+	free(bk_pre);
+	free(bk_pst);
+
+	npf_nat_tmpl_dnat(false);
+
+} DP_END_TEST;
+
+/*
+ * SNAT of an ftp control session.  The ALG may change the payload and the
+ * translation, so the session stays on the general path, while a plain
+ * UDP session alongside it uses the templates.
+ */
+DP_START_TEST(npf_nat_tmpl, alg)
+{
+	struct dp_test_pkt_desc_t *fw_pre, *fw_pst, *bk_pre, *bk_pst;
+
+	npf_nat_tmpl_snat(true);
+
+	fw_pre = dpt_pdesc_v4_create(
+		"fw_pre", IPPROTO_TCP,
+		"aa:bb:cc:dd:1:1", "10.0.1.1", 46682,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 21,
+		"dp1T0", "dp2T1");
+	fw_pst = dpt_pdesc_v4_create(
+		"fw_pst", IPPROTO_TCP,
+		"aa:bb:cc:dd:1:1", "172.0.2.254", 46682,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 21,
+		"dp1T0", "dp2T1");
+	bk_pre = dpt_pdesc_v4_create(
+		"bk_pre", IPPROTO_TCP,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 21,
+		"aa:bb:cc:dd:1:1", "172.0.2.254", 46682,
+		"dp2T1", "dp1T0");
+	bk_pst = dpt_pdesc_v4_create(
+		"bk_pst", IPPROTO_TCP,
+		"aa:bb:cc:dd:2:3", "172.0.2.3", 21,
+		"aa:bb:cc:dd:1:1", "10.0.1.1", 46682,
+		"dp2T1", "dp1T0");
+
+	struct dpt_tcp_flow call = {
+		.text[0] = '\0',
+		.isn = {0, 0},
+		.desc[DPT_FORW] = {
+			.pre = fw_pre,
+			.pst = fw_pst,
+		},
+		.desc[DPT_BACK] = {
+			.pre = bk_pre,
+			.pst = bk_pst,
+		},
+		.test_cb = NULL,
+		.post_cb = NULL,
+	};
+	snprintf(call.text, sizeof(call.text), "Ctrl");
+
+	struct dpt_tcp_flow_pkt pkts[] = {
+		{ DPT_FORW, TH_SYN, 0, NULL, 0, NULL },
+		{ DPT_BACK, TH_SYN | TH_ACK, 0, NULL, 0, NULL },
+		{ DPT_FORW, TH_ACK, 0, NULL, 0, NULL },
+
+		/* session established */
+		{ DPT_FORW, TH_ACK, 0,
+		  (char *)"SYST\x0d\x0a", 0, NULL },
+		{ DPT_BACK, TH_ACK, 0,
+		  (char *)"215 UNIX Type: L8\x0d\x0a", 0, NULL },
+		{ DPT_FORW, TH_ACK, 0,
+		  (char *)"TYPE I\x0d\x0a", 0, NULL },
+		{ DPT_BACK, TH_ACK, 0,
+		  (char *)"200 Switching to Binary mode.\x0d\x0a",
+		  0, NULL },
+	};
+
+	dpt_tcp_call(&call, pkts, ARRAY_SIZE(pkts), 0, 0, NULL, 0);
+
+	dpt_udp("dp1T0", "aa:bb:cc:dd:1:1",
+		"10.0.1.1", 41001, "172.0.2.3", 53,
+		"172.0.2.254", 41001, "172.0.2.3", 53,
+		"aa:bb:cc:dd:2:3", "dp2T1",
+		DP_TEST_FWD_FORWARDED);
+
+	dpt_udp("dp2T1", "aa:bb:cc:dd:2:3",
+		"172.0.2.3", 53, "172.0.2.254", 41001,
+		"172.0.2.3", 53, "10.0.1.1", 41001,
+		"aa:bb:cc:dd:1:1", "dp1T0",
+		DP_TEST_FWD_FORWARDED);
+
+	npf_nat_tmpl_check(1, 1);
+
+	free(fw_pre);
+	free(fw_pst);
+	free(bk_pre);
+	free(bk_pst);
+
+	npf_nat_tmpl_snat(false);
+
+} DP_END_TEST;
@@ -28,9 +28,11 @@
 #include "dp_test_cmd_state.h"
 #include "dp_test_netlink_state_internal.h"
 #include "dp_test_lib_internal.h"
+#include "dp_test_str.h"
 #include "dp_test_lib_exp.h"
 #include "dp_test_lib_intf_internal.h"
 #include "dp_test_lib_pkt.h"
+#include "dp_test_lib_tcp.h"
 #include "dp_test_pktmbuf_lib_internal.h"
 #include "dp_test_console.h"
 #include "dp_test_json_utils.h"
@@ -72,6 +74,9 @@
  * nat64_56 - 56 prefix length; Pkt in each dir; repeat
  * nat64_48 - 48 prefix length; Pkt in each dir; repeat
  *
+ * nat64_tmpl - Established TCP and UDP flows in both directions, then the
+ *              flows are re-established after the sessions are cleared
+ *
  * To run all test cases:
  * make -j4 dataplane_test_run CK_RUN_SUITE=dp_test_npf_nat64.c
  *
@@ -4276,3 +4281,207 @@ DP_START_TEST(nat64_48, test1)
 
 } DP_END_TEST;
 
+
+
+/*
+ * Send one packet of a nat64 TCP call.  The pre and post packets are of
+ * different address families, so build each according to its descriptor.
+ */
+static void
+nat64_tcp_cb(const char *desc, uint pktno __unused, bool forw __unused,
+	     uint8_t flags __unused, struct dp_test_pkt_desc_t *pre,
+	     struct dp_test_pkt_desc_t *post, void *data __unused,
+	     uint index __unused)
+{
+	struct dp_test_expected *test_exp;
+	struct rte_mbuf *pre_pak, *post_pak;
+
+	if (pre->ether_type == RTE_ETHER_TYPE_IPV6)
+		pre_pak = dp_test_v6_pkt_from_desc(pre);
+	else
+		pre_pak = dp_test_v4_pkt_from_desc(pre);
+
+	if (post->ether_type == RTE_ETHER_TYPE_IPV6)
+		post_pak = dp_test_v6_pkt_from_desc(post);
+	else
+		post_pak = dp_test_v4_pkt_from_desc(post);
+
+	test_exp = dp_test_exp_from_desc(post_pak, post);
+	rte_pktmbuf_free(post_pak);
+	dp_test_exp_set_fwd_status(test_exp, DP_TEST_FWD_FORWARDED);
+
+	spush(test_exp->description, sizeof(test_exp->description),
+	      "%s", desc);
+
+	dp_test_pak_receive(pre_pak, pre->rx_intf, test_exp);
+}
+
+/*
+ * TCP call with data in both directions between an IPv6 host and an IPv4
+ * host
+ */
+static void
+nat64_tcp_call(const char *v6_saddr, const char *v6_daddr,
+	       const char *v4_saddr, const char *v4_daddr,
+	       uint16_t sport, uint16_t dport)
+{
+	struct dp_test_pkt_desc_t *fw_pre, *fw_pst, *bk_pre, *bk_pst;
+
+	fw_pre = dpt_pdesc_v6_create(
+		"fw_pre", IPPROTO_TCP,
+		"aa:bb:cc:dd:1:a1", v6_saddr, sport,
+		"aa:bb:cc:dd:2:b1", v6_daddr, dport,
+		"dp1T0", "dp2T1");
+	fw_pst = dpt_pdesc_v4_create(
+		"fw_pst", IPPROTO_TCP,
+		"aa:bb:cc:dd:1:a1", v4_saddr, sport,
+		"aa:bb:cc:dd:2:b1", v4_daddr, dport,
+		"dp1T0", "dp2T1");
+	bk_pre = dpt_pdesc_v4_create(
+		"bk_pre", IPPROTO_TCP,
+		"aa:bb:cc:dd:2:b1", v4_daddr, dport,
+		"aa:bb:cc:dd:1:a1", v4_saddr, sport,
+		"dp2T1", "dp1T0");
+	bk_pst = dpt_pdesc_v6_create(
+		"bk_pst", IPPROTO_TCP,
+		"aa:bb:cc:dd:2:b1", v6_daddr, dport,
+		"aa:bb:cc:dd:1:a1", v6_saddr, sport,
+		"dp2T1", "dp1T0");
+
+	struct dpt_tcp_flow call = {
+		.text[0] = '\0',
+		.isn = {0, 0},
+		.desc[DPT_FORW] = {
+			.pre = fw_pre,
+			.pst = fw_pst,
+		},
+		.desc[DPT_BACK] = {
+			.pre = bk_pre,
+			.pst = bk_pst,
+		},
+		.test_cb = nat64_tcp_cb,
+		.post_cb = NULL,
+	};
+	snprintf(call.text, sizeof(call.text), "TCP64");
+
+	struct dpt_tcp_flow_pkt pkts[] = {
+		{ DPT_FORW, TH_SYN, 0, NULL, 0, NULL },
+		{ DPT_BACK, TH_SYN | TH_ACK, 0, NULL, 0, NULL },
+		{ DPT_FORW, TH_ACK, 0, NULL, 0, NULL },
+
+		/* session established */
+		{ DPT_FORW, TH_ACK, 40, NULL, 0, NULL },
+		{ DPT_BACK, TH_ACK, 100, NULL, 0, NULL },
+		{ DPT_FORW, TH_ACK, 17, NULL, 0, NULL },
+		{ DPT_BACK, TH_ACK | TH_PUSH, 33, NULL, 0, NULL },
+		{ DPT_FORW, TH_ACK, 0, NULL, 0, NULL },
+		{ DPT_BACK, TH_ACK, 250, NULL, 0, NULL },
+		{ DPT_FORW, TH_ACK, 0, NULL, 0, NULL },
+	};
+
+	dpt_tcp_call(&call, pkts, ARRAY_SIZE(pkts), 0, 0, NULL, 0);
+
+	free(fw_pre);
+	free(fw_pst);
+	free(bk_pre);
+	free(bk_pst);
+}
+
+/*
+ * nat64_tmpl
+ *
+ * Established flows are translated with per-session header templates.
+ * Each expected packet is built from scratch, so verifies the translated
+ * headers and the incrementally updated checksums.
+ *
+ * The sessions are then cleared and the flows re-established from a
+ * different IPv6 host.  The new sessions may reuse the memory of the old
+ * ones, so this checks no template outlives the peer it was built for.
+ */
+DP_DECL_TEST_CASE(npf_nat64, nat64_tmpl, NULL, NULL);
+DP_START_TEST(nat64_tmpl, test1)
+{
+	uint i;
+
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "10.10.1.254/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "10.10.2.254/24");
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "2001:101:1::a0a:1fe/96");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2001:101:2::a0a:2fe/96");
+
+	dp_test_netlink_add_neigh("dp1T0", "2001:101:1::a0a:101",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_add_neigh("dp1T0", "2001:101:1::a0a:102",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_add_neigh("dp2T1", "10.10.2.1",
+				  "aa:bb:cc:dd:2:b1");
+
+	const struct dp_test_npf_nat64_rule_t rule96 = {
+		.rule		= "1",
+		.ifname		= "dp1T0",
+		.from_addr	= "2001:101:1::/96",
+		.to_addr	= "2001:101:2::/96",
+		.spl		= 96,
+		.dpl		= 96
+	};
+	dp_test_npf_nat64_add(&rule96, true);
+	dp_test_npf_commit();
+
+	/* UDP, several packets each way */
+	for (i = 0; i < 4; i++) {
+		nat64_v6_to_v4_udp(49152, 80, 49152, 80,
+				   "2001:101:1::a0a:101", "2001:101:2::a0a:201",
+				   "10.10.1.1", "10.10.2.1");
+
+		nat64_v4_to_v6_udp(80, 49152, 80, 49152,
+				   "10.10.2.1", "10.10.1.1",
+				   "2001:101:2::a0a:201", "2001:101:1::a0a:101");
+	}
+
+	/* TCP */
+	nat64_tcp_call("2001:101:1::a0a:101", "2001:101:2::a0a:201",
+		       "10.10.1.1", "10.10.2.1", 49153, 80);
+
+	/* UDP and TCP sessions, each a v6 and v4 pair */
+	dp_test_npf_session_count_verify(4);
+
+	/*
+	 * Clear the sessions and re-establish the flows from a different
+	 * IPv6 host
+	 */
+	dp_test_npf_clear_sessions();
+
+	for (i = 0; i < 4; i++) {
+		nat64_v6_to_v4_udp(49152, 80, 49152, 80,
+				   "2001:101:1::a0a:102", "2001:101:2::a0a:201",
+				   "10.10.1.2", "10.10.2.1");
+
+		nat64_v4_to_v6_udp(80, 49152, 80, 49152,
+				   "10.10.2.1", "10.10.1.2",
+				   "2001:101:2::a0a:201", "2001:101:1::a0a:102");
+	}
+
+	nat64_tcp_call("2001:101:1::a0a:102", "2001:101:2::a0a:201",
+		       "10.10.1.2", "10.10.2.1", 49153, 80);
+
+	dp_test_npf_session_count_verify(4);
+
+	/*
+	 * Cleanup
+	 */
+	dp_test_npf_clear_sessions();
+	dp_test_npf_nat64_del(&rule96, true);
+	dp_test_npf_commit();
+
+	dp_test_netlink_del_neigh("dp1T0", "2001:101:1::a0a:101",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_del_neigh("dp1T0", "2001:101:1::a0a:102",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_del_neigh("dp2T1", "10.10.2.1",
+				  "aa:bb:cc:dd:2:b1");
+
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "10.10.1.254/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "10.10.2.254/24");
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "2001:101:1::a0a:1fe/96");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2001:101:2::a0a:2fe/96");
+
+} DP_END_TEST;
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2020, AT&T Intellectual Property.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Measure NAT64 translation throughput for established flows
+ */
+#include <stdbool.h>
+#include <time.h>
+
+#include "ip_funcs.h"
+#include "if_var.h"
+#include "util.h"
+
+#include "npf/npf.h"
+#include "npf/npf_if.h"
+#include "npf/npf_cache.h"
+#include "npf/npf_session.h"
+#include "npf/npf_nat64.h"
+
+#include "dp_test.h"
+#include "dp_test_lib_internal.h"
+#include "dp_test_lib_exp.h"
+#include "dp_test_lib_intf_internal.h"
+#include "dp_test_lib_perf.h"
+#include "dp_test_lib_pkt.h"
+#include "dp_test_pktmbuf_lib_internal.h"
+#include "dp_test_npf_lib.h"
+#include "dp_test_npf_sess_lib.h"
+
+/*
+ *                        inside         outside
+ *
+ *        2001:101:1::a0a:1fe/96 +-----+ 10.10.2.254/24
+ *   IPv6  ----------------------| uut |--------------------------- IPv4
+ *                         dp1T0 |     | dp2T1
+ *                               +-----+
+ *
+ * 2001:101:1::a0a:101 is mapped to 10.10.1.1 (one-to-one), and
+ * 2001:101:2::a0a:201 to 10.10.2.1 (rfc6052, /96).
+ */
+
+#define N64_PERF_BURST	256
+#define N64_PERF_ROUNDS	400
+
+DP_DECL_TEST_SUITE(npf_nat64_perf);
+
+static struct dp_test_pkt_desc_t n64_perf_v6_pkt = {
+	.text       = "IPv6 UDP",
+	.len        = 64,
+	.ether_type = RTE_ETHER_TYPE_IPV6,
+	.l3_src     = "2001:101:1::a0a:101",
+	.l2_src     = "aa:bb:cc:dd:1:a1",
+	.l3_dst     = "2001:101:2::a0a:201",
+	.l2_dst     = "aa:bb:cc:dd:2:b1",
+	.proto      = IPPROTO_UDP,
+	.l4         = {
+		.udp = {
+			.sport = 49152,
+			.dport = 80
+		}
+	},
+	.rx_intf    = "dp1T0",
+	.tx_intf    = "dp2T1"
+};
+
+static struct dp_test_pkt_desc_t n64_perf_v4_pkt = {
+	.text       = "IPv4 UDP",
+	.len        = 64,
+	.ether_type = RTE_ETHER_TYPE_IPV4,
+	.l3_src     = "10.10.2.1",
+	.l2_src     = "aa:bb:cc:dd:2:b1",
+	.l3_dst     = "10.10.1.1",
+	.l2_dst     = "aa:bb:cc:dd:1:a1",
+	.proto      = IPPROTO_UDP,
+	.l4         = {
+		.udp = {
+			.sport = 80,
+			.dport = 49152
+		}
+	},
+	.rx_intf    = "dp2T1",
+	.tx_intf    = "dp1T0"
+};
+
+/* Expected packets after translation */
+static struct dp_test_pkt_desc_t n64_perf_v6_pkt_post = {
+	.text       = "IPv4 UDP after NAT64",
+	.len        = 64,
+	.ether_type = RTE_ETHER_TYPE_IPV4,
+	.l3_src     = "10.10.1.1",
+	.l2_src     = "aa:bb:cc:dd:1:a1",
+	.l3_dst     = "10.10.2.1",
+	.l2_dst     = "aa:bb:cc:dd:2:b1",
+	.proto      = IPPROTO_UDP,
+	.l4         = {
+		.udp = {
+			.sport = 49152,
+			.dport = 80
+		}
+	},
+	.rx_intf    = "dp1T0",
+	.tx_intf    = "dp2T1"
+};
+
+static struct dp_test_pkt_desc_t n64_perf_v4_pkt_post = {
+	.text       = "IPv6 UDP after NAT46",
+	.len        = 64,
+	.ether_type = RTE_ETHER_TYPE_IPV6,
+	.l3_src     = "2001:101:2::a0a:201",
+	.l2_src     = "aa:bb:cc:dd:2:b1",
+	.l3_dst     = "2001:101:1::a0a:101",
+	.l2_dst     = "aa:bb:cc:dd:1:a1",
+	.proto      = IPPROTO_UDP,
+	.l4         = {
+		.udp = {
+			.sport = 80,
+			.dport = 49152
+		}
+	},
+	.rx_intf    = "dp2T1",
+	.tx_intf    = "dp1T0"
+};
+
+static void n64_perf_setup(void)
+{
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "2001:101:1::a0a:1fe/96");
+	dp_test_netlink_add_neigh("dp1T0", "2001:101:1::a0a:101",
+				  "aa:bb:cc:dd:1:a1");
+
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "10.10.2.254/24");
+	dp_test_netlink_add_neigh("dp2T1", "10.10.2.1",
+				  "aa:bb:cc:dd:2:b1");
+
+	dp_test_npf_cmd_fmt(
+		false,
+		"npf-ut add nat64:NAT64_GRP1 10 action=accept "
+		"src-addr=2001:101:1::/96 dst-addr=2001:101:2::/96 "
+		"handle=nat64("
+		"stype=one2one,saddr=10.10.1.1/32,"
+		"dtype=rfc6052,dpl=96)");
+	dp_test_npf_commit();
+
+	dp_test_npf_cmd_fmt(
+		false,
+		"npf-ut attach interface:dpT10 nat64 nat64:NAT64_GRP1");
+	dp_test_npf_commit();
+}
+
+static void n64_perf_teardown(void)
+{
+	dp_test_npf_cmd_fmt(
+		false,
+		"npf-ut detach interface:dpT10 nat64 nat64:NAT64_GRP1");
+	dp_test_npf_commit();
+
+	dp_test_npf_cmd_fmt(false, "npf-ut delete nat64:NAT64_GRP1 10");
+	dp_test_npf_commit();
+
+	dp_test_npf_clear_sessions();
+
+	dp_test_netlink_del_neigh("dp1T0", "2001:101:1::a0a:101",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_del_neigh("dp2T1", "10.10.2.1",
+				  "aa:bb:cc:dd:2:b1");
+
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "10.10.2.254/24");
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "2001:101:1::a0a:1fe/96");
+}
+
+/*
+ * Send one packet in each direction through the whole dataplane in order to
+ * create and link the v6 and v4 sessions.
+ */
+static void n64_perf_establish(void)
+{
+	struct rte_mbuf *pak, *exp_pak;
+	struct dp_test_expected *exp;
+
+	pak = dp_test_v6_pkt_from_desc(&n64_perf_v6_pkt);
+	exp_pak = dp_test_v4_pkt_from_desc(&n64_perf_v6_pkt_post);
+	exp = dp_test_exp_from_desc(exp_pak, &n64_perf_v6_pkt_post);
+	rte_pktmbuf_free(exp_pak);
+	dp_test_exp_set_fwd_status(exp, DP_TEST_FWD_FORWARDED);
+	dp_test_pak_receive(pak, "dp1T0", exp);
+
+	pak = dp_test_v4_pkt_from_desc(&n64_perf_v4_pkt);
+	exp_pak = dp_test_v6_pkt_from_desc(&n64_perf_v4_pkt_post);
+	exp = dp_test_exp_from_desc(exp_pak, &n64_perf_v4_pkt_post);
+	rte_pktmbuf_free(exp_pak);
+	dp_test_exp_set_fwd_status(exp, DP_TEST_FWD_FORWARDED);
+	dp_test_pak_receive(pak, "dp2T1", exp);
+
+	dp_test_npf_session_count_verify(2);
+}
+
+/*
+ * Translate N64_PERF_ROUNDS bursts of N64_PERF_BURST packets on an
+ * established flow, timing only the npf cache, session lookup and
+ * translation.
+ */
+static void n64_perf_run(const char *ifname, bool v6)
+{
+	struct rte_mbuf *burst[N64_PERF_BURST];
+	struct timespec start, end;
+	char real_ifname[IFNAMSIZ];
+	uint64_t usecs = 0, pkts = 0;
+	struct npf_config *npf_config;
+	struct ifnet *ifp;
+	uint round, i;
+
+	dp_test_intf_real(ifname, real_ifname);
+	ifp = dp_ifnet_byifname(real_ifname);
+	dp_test_fail_unless(ifp, "ifp for %s", ifname);
+
+	npf_config = npf_if_conf(rcu_dereference(ifp->if_npf));
+	dp_test_fail_unless(npf_config, "npf config for %s", ifname);
+
+	for (round = 0; round < N64_PERF_ROUNDS; round++) {
+		for (i = 0; i < N64_PERF_BURST; i++) {
+			burst[i] = v6 ?
+				dp_test_v6_pkt_from_desc(&n64_perf_v6_pkt) :
+				dp_test_v4_pkt_from_desc(&n64_perf_v4_pkt);
+			dp_test_fail_unless(burst[i], "packet create");
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		for (i = 0; i < N64_PERF_BURST; i++) {
+			npf_cache_t npc_cache, *npc = &npc_cache;
+			npf_decision_t decision;
+			npf_action_t action;
+			uint16_t npf_flags = 0;
+			bool intl_hpin = false;
+			npf_session_t *se;
+			int error = 0;
+
+			npf_cache_init(npc);
+			npf_cache_all(npc, burst[i], htons(v6 ?
+						RTE_ETHER_TYPE_IPV6 :
+						RTE_ETHER_TYPE_IPV4));
+
+			se = npf_session_inspect_or_create(
+				npc, burst[i], ifp, PFIL_IN, &npf_flags,
+				&error, &intl_hpin);
+
+			if (v6)
+				decision = npf_nat64_6to4_in(
+					&action, npf_config, &se, ifp, npc,
+					&burst[i], &npf_flags);
+			else
+				decision = npf_nat64_4to6_in(
+					&action, npf_config, &se, ifp, npc,
+					&burst[i], &npf_flags);
+
+			if (decision != NPF_DECISION_PASS)
+				break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		dp_test_fail_unless(i == N64_PERF_BURST,
+				    "%s translation failed",
+				    v6 ? "6-to-4" : "4-to-6");
+
+		usecs += timespec_diff_us(&start, &end);
+		pkts += N64_PERF_BURST;
+
+		for (i = 0; i < N64_PERF_BURST; i++)
+			rte_pktmbuf_free(burst[i]);
+	}
+
+	dpt_perf_report(v6 ? "NAT64 6-to-4" : "NAT64 4-to-6", pkts, usecs);
+}
+
+DP_DECL_TEST_CASE(npf_nat64_perf, nat64_throughput, NULL, NULL);
+
+/*
+ * TESTCASE: NAT64 throughput
+ *
+ * Measures the per-packet cost of translating an established flow in each
+ * direction.  Only the translation is timed, not building the packets.
+ */
+DP_START_TEST_DONT_RUN(nat64_throughput, established)
+{
+	n64_perf_setup();
+	n64_perf_establish();
+
+	n64_perf_run("dp1T0", true);
+	n64_perf_run("dp2T1", false);
+
+	n64_perf_teardown();
+
+} DP_END_TEST;
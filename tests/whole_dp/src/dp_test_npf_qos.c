@@ -9,13 +9,18 @@
  * @brief Dataplane unit-tests for npf QoS
  */
 
+#include <errno.h>
 #include <libmnl/libmnl.h>
+#include <rte_ether.h>
+#include <rte_lcore.h>
 
 #include "ip6_funcs.h"
 #include "ip_funcs.h"
 #include "in_cksum.h"
 #include "if_var.h"
 #include "main.h"
+#include "npf/rproc/npf_rproc.h"
+#include "util.h"
 
 #include "dp_test.h"
 #include "dp_test_str.h"
@@ -144,3 +149,203 @@ DP_START_TEST(qos_ipv4, test1)
 				  "aa:bb:cc:dd:2:b1");
 
 } DP_END_TEST;
+
+DP_DECL_TEST_CASE(npf_qos, qos_policer, NULL, NULL);
+
+/* 1MB/s with a 1s Tc, so one interval's credit is 1MB */
+#define POLICER_TEST_RATE	1000000
+#define POLICER_TEST_BURST	100000
+#define POLICER_TEST_PKT	1000
+
+static void *policer_test_create(const char *params)
+{
+	const npf_rproc_ops_t *ops;
+	void *handle = NULL;
+
+	ops = npf_find_rproc_by_id(NPF_RPROC_ID_POLICER);
+	dp_test_fail_unless(ops, "no policer rproc");
+	dp_test_fail_unless(ops->ro_ctor(NULL, params, &handle) == 0 &&
+			    handle, "failed to create policer(%s)", params);
+	return handle;
+}
+
+static void policer_test_destroy(void *handle)
+{
+	npf_find_rproc_by_id(NPF_RPROC_ID_POLICER)->ro_dtor(handle);
+}
+
+static uint32_t policer_test_slice(void *handle)
+{
+	uint32_t credit, held, slice;
+
+	npf_policer_credit_ut(handle, 0, &credit, &held, &slice);
+	return slice;
+}
+
+/* The cores the tests police on, at most 4 */
+static unsigned int policer_test_cores(void)
+{
+	return RTE_MIN(4u, get_lcore_max() + 1);
+}
+
+/*
+ * Offer packets round robin across the cores until each has had one
+ * refused, or max bytes have been offered.  Returns the bytes admitted.
+ */
+static uint64_t policer_test_offer(void *handle, unsigned int first,
+				   unsigned int ncores, uint64_t max)
+{
+	uint64_t offered, admitted = 0;
+	unsigned int refused = 0, core;
+
+	for (offered = 0; offered < max && refused < ncores;
+	     offered += POLICER_TEST_PKT) {
+		core = first + (offered / POLICER_TEST_PKT) % ncores;
+		if (npf_policer_conform_ut(handle, core, POLICER_TEST_PKT)) {
+			admitted += POLICER_TEST_PKT;
+			refused = 0;
+		} else
+			refused++;
+	}
+	return admitted;
+}
+
+/*
+ * TESTCASE: Policing across cores admits the configured rate
+ *
+ * Offer twice the rate, spread over several cores, for a number of
+ * intervals.  The policer never admits more than the rate plus burst
+ * allows, and the only credit not spent is what is left in the bucket
+ * and the slices at the end, less than a packet each.
+ */
+DP_START_TEST(qos_policer, accuracy)
+{
+	unsigned int ncores = policer_test_cores();
+	uint64_t admitted = 0, exp;
+	unsigned int i, intervals = 5;
+	uint32_t slice;
+	void *handle;
+
+	handle = policer_test_create("0,1000000,100000,drop,,0,1000");
+
+	/* A slice is big enough to stay off the shared bucket */
+	slice = policer_test_slice(handle);
+	dp_test_fail_unless(slice >= RTE_MIN(4 * RTE_ETHER_MAX_VLAN_FRAME_LEN,
+					     POLICER_TEST_RATE /
+					     rte_lcore_count()),
+			    "slice %u too small", slice);
+
+	for (i = 0; i < intervals; i++) {
+		if (i)
+			npf_policer_age_ut(handle, 1);
+		admitted += policer_test_offer(handle, 0, ncores,
+					       2 * POLICER_TEST_RATE);
+	}
+
+	exp = POLICER_TEST_BURST + (uint64_t)intervals * POLICER_TEST_RATE;
+	dp_test_fail_unless(admitted <= exp,
+			    "admitted %lu, more than %lu", admitted, exp);
+	dp_test_fail_unless(admitted + (ncores + 1) * POLICER_TEST_PKT >= exp,
+			    "admitted %lu, expected %lu on %u cores",
+			    admitted, exp, ncores);
+
+	policer_test_destroy(handle);
+} DP_END_TEST;
+
+/*
+ * TESTCASE: Credit held by an idle core is returned
+ *
+ * One core polices a single packet and goes idle, holding the rest of
+ * its slice.  Another core keeps the policer busy.  A slice can still be
+ * spent in the interval after it was claimed, so the credit is only
+ * returned at the refill after that, and is then admitted on the busy
+ * core.
+ */
+DP_START_TEST(qos_policer, reclaim)
+{
+	unsigned int busy = get_lcore_max();
+	uint32_t credit, held, slice;
+	uint64_t admitted;
+	void *handle;
+
+	dp_test_fail_unless(busy > 0, "need more than one lcore");
+	handle = policer_test_create("0,1000000,100000,drop,,0,1000");
+
+	dp_test_fail_unless(npf_policer_conform_ut(handle, 0,
+						   POLICER_TEST_PKT),
+			    "first packet refused");
+	npf_policer_credit_ut(handle, 0, &credit, &held, &slice);
+	dp_test_fail_unless(held == slice - POLICER_TEST_PKT,
+			    "idle core holds %u of slice %u", held, slice);
+	dp_test_fail_unless(slice > 3 * POLICER_TEST_PKT,
+			    "slice %u too small for the test", slice);
+
+	policer_test_offer(handle, busy, 1, 2 * POLICER_TEST_RATE);
+
+	/* Next interval, the idle core's slice is still its own */
+	npf_policer_age_ut(handle, 1);
+	admitted = policer_test_offer(handle, busy, 1, 2 * POLICER_TEST_RATE);
+	npf_policer_credit_ut(handle, 0, &credit, &held, &slice);
+	dp_test_fail_unless(held == slice - POLICER_TEST_PKT,
+			    "idle core holds %u, expected %u", held,
+			    slice - POLICER_TEST_PKT);
+	dp_test_fail_unless(admitted <= POLICER_TEST_RATE +
+			    2 * POLICER_TEST_PKT,
+			    "admitted %lu in interval 1", admitted);
+
+	/* The one after, it comes back */
+	npf_policer_age_ut(handle, 1);
+	admitted = policer_test_offer(handle, busy, 1, 2 * POLICER_TEST_RATE);
+	npf_policer_credit_ut(handle, 0, &credit, &held, &slice);
+	dp_test_fail_unless(held == 0, "idle core still holds %u", held);
+	dp_test_fail_unless(admitted + 2 * POLICER_TEST_PKT >=
+			    POLICER_TEST_RATE + slice - POLICER_TEST_PKT,
+			    "admitted %lu in interval 2, slice %u",
+			    admitted, slice);
+
+	policer_test_destroy(handle);
+} DP_END_TEST;
+
+/*
+ * TESTCASE: The optional 9th parameter sets the tolerance
+ *
+ * The tolerance is the percentage of rate plus burst the cores may
+ * claim at a time between them.  A larger one gives bigger slices, a
+ * small one still leaves a few packets' worth, and over 100% is
+ * rejected.
+ */
+DP_START_TEST(qos_policer, tolerance)
+{
+	const npf_rproc_ops_t *ops = npf_find_rproc_by_id(NPF_RPROC_ID_POLICER);
+	uint32_t def, big, small, exp;
+	void *handle = NULL;
+
+	handle = policer_test_create("0,1000000,100000,drop,,0,1000");
+	def = policer_test_slice(handle);
+	policer_test_destroy(handle);
+
+	handle = policer_test_create("0,1000000,100000,drop,,0,1000,,50");
+	big = policer_test_slice(handle);
+	policer_test_destroy(handle);
+
+	handle = policer_test_create("0,1000000,100000,drop,,0,1000,,0");
+	small = policer_test_slice(handle);
+	policer_test_destroy(handle);
+
+	exp = (POLICER_TEST_RATE + POLICER_TEST_BURST) / 2 / rte_lcore_count();
+	exp = RTE_MIN(exp, POLICER_TEST_RATE / rte_lcore_count());
+	dp_test_fail_unless(big == exp, "50%% slice %u, expected %u",
+			    big, exp);
+	dp_test_fail_unless(big > def, "50%% slice %u, default %u", big, def);
+
+	exp = RTE_MIN(4 * RTE_ETHER_MAX_VLAN_FRAME_LEN,
+		      POLICER_TEST_RATE / rte_lcore_count());
+	dp_test_fail_unless(small == exp, "0%% slice %u, expected %u",
+			    small, exp);
+
+	handle = NULL;
+	dp_test_fail_unless(ops->ro_ctor(NULL,
+					 "0,1000000,100000,drop,,0,1000,,101",
+					 &handle) == -EINVAL && !handle,
+			    "tolerance over 100%% accepted");
+} DP_END_TEST;
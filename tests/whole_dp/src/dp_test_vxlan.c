@@ -7,7 +7,21 @@
  *
  * dataplane UT VXLAN tests
  */
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#include "if/vxlan.h"
+#include "util.h"
+
+#include "dp_test.h"
+#include "dp_test_console.h"
+#include "dp_test_json_utils.h"
+#include "dp_test_lib_internal.h"
+#include "dp_test_lib_exp.h"
 #include "dp_test_lib_intf_internal.h"
+#include "dp_test_netlink_state_internal.h"
+#include "dp_test_pktmbuf_lib_internal.h"
+#include "dp_test/dp_test_cmd_check.h"
 #include "dp_test/dp_test_macros.h"
 
 DP_DECL_TEST_SUITE(vxlan_suite);
@@ -44,3 +58,410 @@ DP_START_TEST(vxlan_cfg_duplicate, vxlan_cfg_duplicate)
 	/* vxlan 71 should have failed to be created, so we dont delete it */
 #endif
 } DP_END_TEST;
+
+/*
+ * Decapsulation of a burst of vxlan packets.
+ *
+ * VNIs 10 to 14 are on dp2T1, each routed to a host on dp1T0, and there
+ * are two remote VTEPs.  Each VNI and VTEP pair is a group in the burst;
+ * the forwarding thread only tracks VXLAN_BURST_GROUPS (8) groups, and
+ * decapsulates packets in any further groups individually.
+ */
+#define VXLAN_BURST_VNI_BASE	10
+#define VXLAN_BURST_VNIS	5
+
+static const char * const vxlan_burst_vtep[] = {
+	"2.2.2.11",
+	"2.2.2.12",
+};
+static const char * const vxlan_burst_vtep_mac[] = {
+	"aa:bb:cc:dd:2:11",
+	"aa:bb:cc:dd:2:12",
+};
+
+/*
+ * The (vni, vtep) of each packet in a burst.  The first 8 distinct
+ * groups fill the group table, with one revisited; the last packet is in
+ * a ninth group.
+ */
+static const struct {
+	uint32_t vni;
+	unsigned int vtep;
+} vxlan_burst_pkt[DP_TEST_MAX_EXPECTED_PAKS] = {
+	{ 10, 0 }, { 11, 0 }, { 12, 0 }, { 10, 0 }, { 13, 0 },
+	{ 14, 0 }, { 10, 1 }, { 11, 1 }, { 12, 1 }, { 13, 1 },
+};
+
+static void vxlan_burst_setup(void)
+{
+	char ifname[IFNAMSIZ];
+	char addr[32];
+	unsigned int i;
+
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_netlink_add_neigh("dp1T0", "1.1.1.11", "aa:bb:cc:dd:1:11");
+	for (i = 0; i < ARRAY_SIZE(vxlan_burst_vtep); i++)
+		dp_test_netlink_add_neigh("dp2T1", vxlan_burst_vtep[i],
+					  vxlan_burst_vtep_mac[i]);
+
+	for (i = 0; i < VXLAN_BURST_VNIS; i++) {
+		uint32_t vni = VXLAN_BURST_VNI_BASE + i;
+
+		snprintf(ifname, sizeof(ifname), "vxl%u", vni);
+		snprintf(addr, sizeof(addr), "10.%u.0.1/24", vni);
+		dp_test_intf_vxlan_create(ifname, vni, "dp2T1");
+		dp_test_nl_add_ip_addr_and_connected(ifname, addr);
+	}
+}
+
+static void vxlan_burst_teardown(void)
+{
+	char ifname[IFNAMSIZ];
+	char addr[32];
+	unsigned int i;
+
+	for (i = 0; i < VXLAN_BURST_VNIS; i++) {
+		uint32_t vni = VXLAN_BURST_VNI_BASE + i;
+
+		snprintf(ifname, sizeof(ifname), "vxl%u", vni);
+		snprintf(addr, sizeof(addr), "10.%u.0.1/24", vni);
+		dp_test_nl_del_ip_addr_and_connected(ifname, addr);
+		dp_test_intf_vxlan_del(ifname, vni);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(vxlan_burst_vtep); i++)
+		dp_test_netlink_del_neigh("dp2T1", vxlan_burst_vtep[i],
+					  vxlan_burst_vtep_mac[i]);
+	dp_test_netlink_del_neigh("dp1T0", "1.1.1.11", "aa:bb:cc:dd:1:11");
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+}
+
+/* Inner source address and MAC of a host behind a vtep */
+static void vxlan_burst_host(uint32_t vni, unsigned int vtep,
+			     char *saddr, size_t saddr_len,
+			     char *smac, size_t smac_len)
+{
+	snprintf(saddr, saddr_len, "10.%u.0.%u", vni, 10 + vtep);
+	snprintf(smac, smac_len, "aa:bb:cc:dd:%x:%x", vni, 0x10 + vtep);
+}
+
+/*
+ * Send a burst, expecting the packets on any VNI in dropped_vni to be
+ * dropped, and the rest to be routed out of dp1T0 in the order sent.
+ */
+static void vxlan_burst_send(int dropped_vni)
+{
+	struct rte_mbuf *paks[DP_TEST_MAX_EXPECTED_PAKS];
+	struct dp_test_expected *exp;
+	char ifname[IFNAMSIZ];
+	char saddr[32];
+	char smac[32];
+	unsigned int i;
+	int len;
+
+	exp = dp_test_exp_create_m(NULL, DP_TEST_MAX_EXPECTED_PAKS);
+
+	for (i = 0; i < DP_TEST_MAX_EXPECTED_PAKS; i++) {
+		uint32_t vni = vxlan_burst_pkt[i].vni;
+		unsigned int vtep = vxlan_burst_pkt[i].vtep;
+		struct rte_mbuf *m;
+
+		vxlan_burst_host(vni, vtep, saddr, sizeof(saddr),
+				 smac, sizeof(smac));
+		snprintf(ifname, sizeof(ifname), "vxl%u", vni);
+
+		/* A different length for each, so they are told apart */
+		len = 20 + i;
+		m = dp_test_create_ipv4_pak(saddr, "1.1.1.11", 1, &len);
+		/* A deleted vxlan interface no longer has a mac */
+		dp_test_pktmbuf_eth_init(m, (int)vni == dropped_vni ?
+					 "aa:bb:cc:dd:0:1" :
+					 dp_test_intf_name2mac_str(ifname),
+					 smac, RTE_ETHER_TYPE_IPV4);
+
+		if ((int)vni == dropped_vni) {
+			dp_test_exp_set_pak_m(exp, i, dp_test_cp_pak(m));
+			dp_test_exp_set_fwd_status_m(exp, i,
+						     DP_TEST_FWD_DROPPED);
+		} else {
+			struct rte_mbuf *exp_pak = dp_test_cp_pak(m);
+
+			dp_test_pktmbuf_eth_init(
+				exp_pak, "aa:bb:cc:dd:1:11",
+				dp_test_intf_name2mac_str("dp1T0"),
+				RTE_ETHER_TYPE_IPV4);
+			dp_test_ipv4_decrement_ttl(exp_pak);
+			dp_test_exp_set_pak_m(exp, i, exp_pak);
+			dp_test_exp_set_oif_name_m(exp, i, "dp1T0");
+		}
+
+		dp_test_pktmbuf_vxlan_prepend(m, VXLAN_VALIDFLAG, vni);
+		dp_test_pktmbuf_udp_prepend_no_crc(m, 49152 + i, VXLAN_PORT,
+						   true);
+		dp_test_pktmbuf_ip_prepend(m, vxlan_burst_vtep[vtep],
+					   "2.2.2.2", IPPROTO_UDP);
+		dp_test_pktmbuf_eth_prepend(m,
+					    dp_test_intf_name2mac_str("dp2T1"),
+					    vxlan_burst_vtep_mac[vtep],
+					    RTE_ETHER_TYPE_IPV4);
+		paks[i] = m;
+	}
+
+	dp_test_pak_receive_n(paks, DP_TEST_MAX_EXPECTED_PAKS, "dp2T1", exp);
+}
+
+/* Each inner source is learnt against the vtep it came from */
+static void vxlan_burst_learnt_check(void)
+{
+	json_object *expected;
+	char saddr[32];
+	char smac[32];
+	unsigned int i;
+
+	for (i = 0; i < DP_TEST_MAX_EXPECTED_PAKS; i++) {
+		uint32_t vni = vxlan_burst_pkt[i].vni;
+		unsigned int vtep = vxlan_burst_pkt[i].vtep;
+
+		vxlan_burst_host(vni, vtep, saddr, sizeof(saddr),
+				 smac, sizeof(smac));
+		expected = dp_test_json_create(
+			"{\"mac_table\" : [{"
+			"\"intf\" : \"vxl%u\","
+			"\"entries\" : [{"
+			"\"mac\" : \"%s\","
+			"\"IPAddr\" : \"%s\","
+			"\"VNI\" : %u,"
+			"\"type\" : \"dynamic\""
+			"}]}]}",
+			vni, smac, vxlan_burst_vtep[vtep], vni);
+		dp_test_check_json_poll_state("vxlan macs show", expected,
+					      DP_TEST_JSON_CHECK_SUBSET,
+					      false, 10);
+		json_object_put(expected);
+	}
+}
+
+/*
+ * A burst with more groups than the forwarding thread tracks is
+ * delivered in order, and every inner source is learnt, including those
+ * in the group that overflowed the table.
+ */
+DP_DECL_TEST_CASE(vxlan_suite, vxlan_burst, vxlan_burst_setup,
+		  vxlan_burst_teardown);
+DP_START_TEST(vxlan_burst, groups)
+{
+	vxlan_burst_send(-1);
+	vxlan_burst_learnt_check();
+
+	dp_test_console_request_reply("vxlan macs clear", false);
+
+	/* And again, now that the VNIs are in the per-lcore cache */
+	vxlan_burst_send(-1);
+	vxlan_burst_learnt_check();
+
+	dp_test_console_request_reply("vxlan macs clear", false);
+} DP_END_TEST;
+
+/*
+ * Delete a VNI between bursts.  Its packets must be dropped rather than
+ * decapsulated on the deleted interface found in the per-lcore VNI
+ * cache, and once it is recreated they are delivered on the new one.
+ */
+DP_START_TEST(vxlan_burst, vni_delete)
+{
+	vxlan_burst_send(-1);
+
+	dp_test_nl_del_ip_addr_and_connected("vxl14", "10.14.0.1/24");
+	dp_test_intf_vxlan_del("vxl14", 14);
+
+	vxlan_burst_send(14);
+	vxlan_burst_send(14);
+
+	dp_test_intf_vxlan_create("vxl14", 14, "dp2T1");
+	dp_test_nl_add_ip_addr_and_connected("vxl14", "10.14.0.1/24");
+
+	vxlan_burst_send(-1);
+
+	dp_test_console_request_reply("vxlan macs clear", false);
+} DP_END_TEST;
+
+/*
+ * Encapsulation from the per-lcore outer header templates.
+ *
+ * Remote VTEP 3.3.3.3 is learnt on vxl10, and reached over dp2T1.  Each
+ * change that alters the outer header, or where it is sent, must be seen
+ * by the next packet, whether the template was in use or not.  The
+ * expected outer IPv4 header is built afresh with its own checksum, so
+ * a template checksum that is not fixed up correctly fails the compare.
+ */
+static void vxlan_tmpl_setup(void)
+{
+	struct dp_test_expected *exp;
+	struct rte_mbuf *m, *exp_pak;
+	int len = 32;
+
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_netlink_add_neigh("dp1T0", "1.1.1.11", "aa:bb:cc:dd:1:11");
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.11", "aa:bb:cc:dd:2:11");
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.12", "aa:bb:cc:dd:2:12");
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.13", "aa:bb:cc:dd:2:13");
+	dp_test_netlink_add_route("3.3.3.0/24 nh 2.2.2.11 int:dp2T1");
+
+	dp_test_intf_vxlan_create("vxl10", 10, "dp2T1");
+	dp_test_nl_add_ip_addr_and_connected("vxl10", "10.10.0.1/24");
+	dp_test_netlink_add_neigh("vxl10", "10.10.0.11", "aa:bb:cc:dd:a:11");
+
+	/* Learn the host's mac against the remote VTEP */
+	m = dp_test_create_ipv4_pak("10.10.0.11", "1.1.1.11", 1, &len);
+	dp_test_pktmbuf_eth_init(m, dp_test_intf_name2mac_str("vxl10"),
+				 "aa:bb:cc:dd:a:11", RTE_ETHER_TYPE_IPV4);
+	exp_pak = dp_test_cp_pak(m);
+	dp_test_pktmbuf_eth_init(exp_pak, "aa:bb:cc:dd:1:11",
+				 dp_test_intf_name2mac_str("dp1T0"),
+				 RTE_ETHER_TYPE_IPV4);
+	dp_test_ipv4_decrement_ttl(exp_pak);
+
+	dp_test_pktmbuf_vxlan_prepend(m, VXLAN_VALIDFLAG, 10);
+	dp_test_pktmbuf_udp_prepend_no_crc(m, 49152, VXLAN_PORT, true);
+	dp_test_pktmbuf_ip_prepend(m, "3.3.3.3", "2.2.2.2", IPPROTO_UDP);
+	dp_test_pktmbuf_eth_prepend(m, dp_test_intf_name2mac_str("dp2T1"),
+				    "aa:bb:cc:dd:2:11", RTE_ETHER_TYPE_IPV4);
+
+	exp = dp_test_exp_create_m(NULL, 1);
+	dp_test_exp_set_pak_m(exp, 0, exp_pak);
+	dp_test_exp_set_oif_name_m(exp, 0, "dp1T0");
+	dp_test_pak_receive(m, "dp2T1", exp);
+
+	/* Track the route to it now, rather than at the next vxlan_timer */
+	dp_test_fail_unless(vxlan_remotes_track_ut() == 1,
+			    "remote VTEP not tracked");
+}
+
+static void vxlan_tmpl_teardown(void)
+{
+	dp_test_console_request_reply("vxlan macs clear", false);
+	dp_test_netlink_del_neigh("vxl10", "10.10.0.11", "aa:bb:cc:dd:a:11");
+	dp_test_nl_del_ip_addr_and_connected("vxl10", "10.10.0.1/24");
+	dp_test_intf_vxlan_del("vxl10", 10);
+
+	dp_test_netlink_del_route("3.3.3.0/24 nh 2.2.2.11 int:dp2T1");
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.13", "aa:bb:cc:dd:2:13");
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.12", "aa:bb:cc:dd:2:12");
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.11", "aa:bb:cc:dd:2:11");
+	dp_test_netlink_del_neigh("dp1T0", "1.1.1.11", "aa:bb:cc:dd:1:11");
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+}
+
+/*
+ * Route a packet into vxl10, expecting it encapsulated from src to the
+ * remote VTEP, with the outer tos given, and sent to nh_mac; or to either
+ * ECMP nexthop if nh_mac is NULL.  Sent twice, so that the second is
+ * encapsulated from the template the first left, if it may be cached.
+ */
+static void vxlan_tmpl_send(const char *src, const char *nh_mac,
+			    uint8_t inner_tos, uint8_t outer_tos)
+{
+	struct dp_test_expected *exp;
+	struct rte_mbuf *m, *exp_pak;
+	struct iphdr *ip;
+	int len = 32;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		m = dp_test_create_ipv4_pak("1.1.1.11", "10.10.0.11", 1, &len);
+		dp_test_pktmbuf_eth_init(m, dp_test_intf_name2mac_str("dp1T0"),
+					 "aa:bb:cc:dd:1:11",
+					 RTE_ETHER_TYPE_IPV4);
+		dp_test_set_pak_ip_field(iphdr(m), DP_TEST_SET_TOS, inner_tos);
+
+		exp_pak = dp_test_cp_pak(m);
+		dp_test_pktmbuf_eth_init(exp_pak, "aa:bb:cc:dd:a:11",
+					 dp_test_intf_name2mac_str("vxl10"),
+					 RTE_ETHER_TYPE_IPV4);
+		dp_test_ipv4_decrement_ttl(exp_pak);
+
+		dp_test_pktmbuf_vxlan_prepend(exp_pak, VXLAN_VALIDFLAG, 10);
+		dp_test_pktmbuf_udp_prepend_no_crc(exp_pak, 0, VXLAN_PORT,
+						   true);
+		ip = dp_test_pktmbuf_ip_prepend(exp_pak, src, "3.3.3.3",
+						IPPROTO_UDP);
+		dp_test_set_pak_ip_field(ip, DP_TEST_SET_DF, 1);
+		dp_test_set_pak_ip_field(ip, DP_TEST_SET_TOS, outer_tos);
+		dp_test_pktmbuf_eth_prepend(exp_pak,
+					    nh_mac ? nh_mac : "0:0:0:0:0:0",
+					    dp_test_intf_name2mac_str("dp2T1"),
+					    RTE_ETHER_TYPE_IPV4);
+
+		exp = dp_test_exp_create_m(NULL, 1);
+		dp_test_exp_set_pak_m(exp, 0, exp_pak);
+		dp_test_exp_set_oif_name_m(exp, 0, "dp2T1");
+
+		/* The UDP source port is a hash of the inner frame */
+		dp_test_exp_set_dont_care(
+			exp, 0, rte_pktmbuf_mtod_offset(
+				exp_pak, uint8_t *,
+				RTE_ETHER_HDR_LEN + sizeof(struct iphdr)), 2);
+		if (!nh_mac)
+			dp_test_exp_set_dont_care(
+				exp, 0, rte_pktmbuf_mtod(exp_pak, uint8_t *),
+				RTE_ETHER_ADDR_LEN);
+
+		dp_test_pak_receive(m, "dp1T0", exp);
+	}
+}
+
+/*
+ * The route to the remote goes from a single path to ECMP, where no
+ * template may be used, and then back to a single, new, nexthop.
+ */
+DP_DECL_TEST_CASE(vxlan_suite, vxlan_tmpl, vxlan_tmpl_setup,
+		  vxlan_tmpl_teardown);
+DP_START_TEST(vxlan_tmpl, route_change)
+{
+	vxlan_tmpl_send("2.2.2.2", "aa:bb:cc:dd:2:11", 0, 0);
+
+	dp_test_netlink_replace_route("3.3.3.0/24 nh 2.2.2.11 int:dp2T1 "
+				      "nh 2.2.2.12 int:dp2T1");
+	vxlan_tmpl_send("2.2.2.2", NULL, 0, 0);
+
+	dp_test_netlink_replace_route("3.3.3.0/24 nh 2.2.2.13 int:dp2T1");
+	vxlan_tmpl_send("2.2.2.2", "aa:bb:cc:dd:2:13", 0, 0);
+
+	dp_test_netlink_replace_route("3.3.3.0/24 nh 2.2.2.11 int:dp2T1");
+	vxlan_tmpl_send("2.2.2.2", "aa:bb:cc:dd:2:11", 0, 0);
+} DP_END_TEST;
+
+/* The source address chosen for the remote changes */
+DP_START_TEST(vxlan_tmpl, source_change)
+{
+	vxlan_tmpl_send("2.2.2.2", "aa:bb:cc:dd:2:11", 0, 0);
+
+	dp_test_netlink_del_ip_address("dp2T1", "2.2.2.2/24");
+	dp_test_netlink_add_ip_address("dp2T1", "2.2.2.3/24");
+	vxlan_tmpl_send("2.2.2.3", "aa:bb:cc:dd:2:11", 0, 0);
+
+	dp_test_netlink_del_ip_address("dp2T1", "2.2.2.3/24");
+	dp_test_netlink_add_ip_address("dp2T1", "2.2.2.2/24");
+	vxlan_tmpl_send("2.2.2.2", "aa:bb:cc:dd:2:11", 0, 0);
+} DP_END_TEST;
+
+/*
+ * The configured tos replaces the inner one, and once removed the inner
+ * tos is inherited again, and folded into the template's checksum.
+ */
+DP_START_TEST(vxlan_tmpl, tos_change)
+{
+	vxlan_tmpl_send("2.2.2.2", "aa:bb:cc:dd:2:11", 0x10, 0x10);
+
+	dp_test_netlink_set_vxlan_tos("vxl10", 10, "dp2T1", 0x28);
+	vxlan_tmpl_send("2.2.2.2", "aa:bb:cc:dd:2:11", 0x10, 0x28);
+	vxlan_tmpl_send("2.2.2.2", "aa:bb:cc:dd:2:11", 0, 0x28);
+
+	dp_test_netlink_set_vxlan_tos("vxl10", 10, "dp2T1", 0);
+	vxlan_tmpl_send("2.2.2.2", "aa:bb:cc:dd:2:11", 0xb8, 0xb8);
+	vxlan_tmpl_send("2.2.2.2", "aa:bb:cc:dd:2:11", 0, 0);
+} DP_END_TEST;